@@ -0,0 +1,547 @@
+/*
+ * SOURCE FILE: accesslog.c - Implementation of functions declared in accesslog.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool access_log_init(const char *path, const bool binary);
+ * void access_log_session(const struct client *entry, const enum close_reason reason);
+ * uint64_t access_log_dropped(void);
+ * void access_log_stop(void);
+ * static struct access_ring *register_ring(void);
+ * static void fill_address(const int sock, uint8_t *family, uint16_t *port, uint8_t *addr);
+ * static void *writer_loop(void *unused);
+ * static bool drain_rings(void);
+ * static void append_record(const struct access_record *record);
+ * static size_t format_address(char *out, const size_t size, const uint8_t family, const uint16_t port, const uint8_t *addr);
+ * static void flush_buffer(void);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Every worker thread owns a single producer, single consumer ring, created the first time it closes a session.
+ * The worker only writes the tail and the writer thread only writes the head, so neither side ever locks or waits.
+ * When a ring is full the record is dropped and counted rather than stalling the data path.
+ * The writer thread batches records from every ring into one buffer and writes it out in large chunks.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "accesslog.h"
+#include "network.h"
+#include "macro.h"
+#include "main.h"
+
+//Head and tail are kept on separate cache lines so the worker and writer don't bounce each other's line
+struct access_ring {
+    _Alignas(64) _Atomic size_t head;
+    _Alignas(64) _Atomic size_t tail;
+    _Atomic uint64_t dropped;
+    struct access_record records[ACCESS_LOG_RING_SIZE];
+};
+
+static struct access_ring *register_ring(void);
+static void fill_address(const int sock, uint8_t *family, uint16_t *port, uint8_t *addr);
+static void *writer_loop(void *unused);
+static bool drain_rings(void);
+static void append_record(const struct access_record *record);
+static size_t format_address(char *out, const size_t size, const uint8_t family, const uint16_t port, const uint8_t *addr);
+static void flush_buffer(void);
+
+bool accessLogActive;
+
+static _Atomic(struct access_ring *) ringList[ACCESS_LOG_MAX_RINGS];
+static _Atomic size_t ringCount;
+static _Atomic uint64_t unregisteredDrops;
+static _Thread_local struct access_ring *localRing;
+
+static int logFD = -1;
+static bool binaryLog;
+static pthread_t writerThread;
+static atomic_bool writerRunning;
+
+//Only touched by the writer thread, or by access_log_stop after it has been joined
+static char *outBuffer;
+static size_t outSize;
+
+static const char *reasonNames[] = {
+    [CLOSE_NONE] = "none",
+    [CLOSE_EOF] = "eof",
+    [CLOSE_ERROR] = "error",
+    [CLOSE_HANGUP] = "hangup",
+    [CLOSE_NO_ROUTE] = "no_route",
+};
+
+/*
+ * FUNCTION: access_log_init
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool access_log_init(const char *path, const bool binary);
+ *
+ * PARAMETERS:
+ * const char *path - The file to append records to
+ * const bool binary - Whether to write raw access_record structs instead of JSON lines
+ *
+ * RETURNS:
+ * bool - Whether the log was opened and the writer thread started
+ *
+ * NOTES:
+ * A log that can't be opened is reported and forwarding continues without it.
+ */
+bool access_log_init(const char *path, const bool binary) {
+    if ((logFD = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+        perror("Unable to open access log");
+        return false;
+    }
+    binaryLog = binary;
+    outBuffer = checked_malloc(ACCESS_LOG_BUFFER_SIZE);
+    outSize = 0;
+
+    atomic_store(&writerRunning, true);
+    if (pthread_create(&writerThread, NULL, writer_loop, NULL) != 0) {
+        fprintf(stderr, "Unable to start access log writer\n");
+        close(logFD);
+        logFD = -1;
+        free(outBuffer);
+        outBuffer = NULL;
+        return false;
+    }
+    accessLogActive = true;
+    return true;
+}
+
+/*
+ * FUNCTION: access_log_session
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void access_log_session(const struct client *entry, const enum close_reason reason);
+ *
+ * PARAMETERS:
+ * const struct client *entry - The session being closed, its sockets must still be open
+ * const enum close_reason reason - Why the session is closing
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Only ever called by the thread that releases the session, so the record goes into that thread's own ring.
+ */
+void access_log_session(const struct client *entry, const enum close_reason reason) {
+    struct access_ring *ring = localRing;
+    if (unlikely(ring == NULL)) {
+        if ((ring = register_ring()) == NULL) {
+            atomic_fetch_add_explicit(&unregisteredDrops, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == ACCESS_LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct access_record *record = &ring->records[tail & (ACCESS_LOG_RING_SIZE - 1)];
+    memset(record, 0, sizeof(*record));
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    record->timestamp_ms = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    record->bytes_in = entry->bytes[DIR_LOCAL_TO_REMOTE];
+    record->bytes_out = entry->bytes[DIR_REMOTE_TO_LOCAL];
+    record->duration_ms = monotonic_ms() - entry->start_ms;
+    record->connect_us = entry->connect_us;
+    record->rule = entry->rule;
+    record->reason = reason;
+    fill_address(entry->local, &record->client_family, &record->client_port, record->client_addr);
+    if (entry->remote != -1) {
+        fill_address(entry->remote, &record->backend_family, &record->backend_port, record->backend_addr);
+    }
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/*
+ * FUNCTION: access_log_dropped
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * uint64_t access_log_dropped(void);
+ *
+ * RETURNS:
+ * uint64_t - How many records were lost to full rings or too many threads
+ */
+uint64_t access_log_dropped(void) {
+    uint64_t total = atomic_load_explicit(&unregisteredDrops, memory_order_relaxed);
+    const size_t count = atomic_load_explicit(&ringCount, memory_order_acquire);
+    for (size_t i = 0; i < count && i < ACCESS_LOG_MAX_RINGS; ++i) {
+        const struct access_ring *ring = atomic_load_explicit(&ringList[i], memory_order_acquire);
+        if (ring) {
+            total += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+/*
+ * FUNCTION: access_log_stop
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void access_log_stop(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Joins the writer, writes out whatever is left in the rings and closes the log.
+ * The rings themselves are left allocated, since worker threads may still be holding them.
+ */
+void access_log_stop(void) {
+    if (!accessLogActive) {
+        return;
+    }
+    accessLogActive = false;
+    atomic_store(&writerRunning, false);
+    pthread_join(writerThread, NULL);
+
+    while (drain_rings());
+    flush_buffer();
+
+    const uint64_t dropped = access_log_dropped();
+    if (dropped) {
+        fprintf(stderr, "Access log dropped %lu records\n", (unsigned long) dropped);
+    }
+
+    close(logFD);
+    logFD = -1;
+    free(outBuffer);
+    outBuffer = NULL;
+}
+
+/*
+ * FUNCTION: register_ring
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct access_ring *register_ring(void);
+ *
+ * RETURNS:
+ * struct access_ring * - The calling thread's new ring, or NULL if every slot is taken
+ */
+static struct access_ring *register_ring(void) {
+    const size_t slot = atomic_fetch_add(&ringCount, 1);
+    if (slot >= ACCESS_LOG_MAX_RINGS) {
+        return NULL;
+    }
+    struct access_ring *ring = checked_calloc(1, sizeof(struct access_ring));
+    atomic_store_explicit(&ringList[slot], ring, memory_order_release);
+    localRing = ring;
+    return ring;
+}
+
+/*
+ * FUNCTION: fill_address
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void fill_address(const int sock, uint8_t *family, uint16_t *port, uint8_t *addr);
+ *
+ * PARAMETERS:
+ * const int sock - The socket to get the peer of
+ * uint8_t *family - Filled with the peer's address family, left 0 if it is unknown
+ * uint16_t *port - Filled with the peer's port in network byte order
+ * uint8_t *addr - Filled with the peer's address, 16 bytes long
+ *
+ * RETURNS:
+ * void
+ */
+static void fill_address(const int sock, uint8_t *family, uint16_t *port, uint8_t *addr) {
+    struct sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(sock, (struct sockaddr *) &peer, &len) == -1) {
+        //Peer may already have reset the connection
+        return;
+    }
+    *family = peer.ss_family;
+    if (peer.ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *) &peer;
+        *port = in->sin_port;
+        memcpy(addr, &in->sin_addr, sizeof(in->sin_addr));
+    } else if (peer.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) &peer;
+        *port = in6->sin6_port;
+        memcpy(addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+}
+
+/*
+ * FUNCTION: writer_loop
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void *writer_loop(void *unused);
+ *
+ * PARAMETERS:
+ * void *unused - Required by pthread interface, ignored
+ *
+ * RETURNS:
+ * void * - Required by pthread interface, ignored
+ *
+ * NOTES:
+ * Only sleeps once every ring is empty, so a busy log is drained as fast as it can be written.
+ */
+static void *writer_loop(void *unused) {
+    (void) unused;
+    const struct timespec idle = {0, ACCESS_LOG_IDLE_NS};
+    while (atomic_load(&writerRunning)) {
+        if (!drain_rings()) {
+            flush_buffer();
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION: drain_rings
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool drain_rings(void);
+ *
+ * RETURNS:
+ * bool - Whether any records were taken from the rings
+ */
+static bool drain_rings(void) {
+    bool found = false;
+    const size_t count = atomic_load_explicit(&ringCount, memory_order_acquire);
+    for (size_t i = 0; i < count && i < ACCESS_LOG_MAX_RINGS; ++i) {
+        struct access_ring *ring = atomic_load_explicit(&ringList[i], memory_order_acquire);
+        if (ring == NULL) {
+            //Slot claimed but not published yet
+            continue;
+        }
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == tail) {
+            continue;
+        }
+        found = true;
+        for (; head != tail; ++head) {
+            append_record(&ring->records[head & (ACCESS_LOG_RING_SIZE - 1)]);
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    return found;
+}
+
+/*
+ * FUNCTION: append_record
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void append_record(const struct access_record *record);
+ *
+ * PARAMETERS:
+ * const struct access_record *record - The record to add to the output buffer
+ *
+ * RETURNS:
+ * void
+ */
+static void append_record(const struct access_record *record) {
+    //Longest JSON line is well under 512 bytes
+    if (ACCESS_LOG_BUFFER_SIZE - outSize < 512) {
+        flush_buffer();
+    }
+    if (binaryLog) {
+        memcpy(outBuffer + outSize, record, sizeof(*record));
+        outSize += sizeof(*record);
+        return;
+    }
+
+    char client[64];
+    char backend[64];
+    format_address(client, sizeof(client), record->client_family, record->client_port, record->client_addr);
+    format_address(backend, sizeof(backend), record->backend_family, record->backend_port, record->backend_addr);
+
+    const char *reason = (record->reason < sizeof(reasonNames) / sizeof(reasonNames[0])) ? reasonNames[record->reason] : "unknown";
+
+    outSize += snprintf(outBuffer + outSize, ACCESS_LOG_BUFFER_SIZE - outSize,
+            "{\"time\":%lu.%03lu,\"rule\":%u,\"listen\":\"%s\",\"client\":\"%s\",\"backend\":\"%s\","
+            "\"bytes_in\":%lu,\"bytes_out\":%lu,\"duration_ms\":%u,\"connect_us\":%u,\"close\":\"%s\"}\n",
+            (unsigned long) (record->timestamp_ms / 1000), (unsigned long) (record->timestamp_ms % 1000),
+            record->rule, (record->rule < ruleCount) ? lookupRule(record->rule)->listen_address : "",
+            client, backend, (unsigned long) record->bytes_in, (unsigned long) record->bytes_out,
+            record->duration_ms, record->connect_us, reason);
+}
+
+/*
+ * FUNCTION: format_address
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static size_t format_address(char *out, const size_t size, const uint8_t family, const uint16_t port, const uint8_t *addr);
+ *
+ * PARAMETERS:
+ * char *out - The buffer to write to
+ * const size_t size - The size of the buffer
+ * const uint8_t family - The address family
+ * const uint16_t port - The port in network byte order
+ * const uint8_t *addr - The raw address
+ *
+ * RETURNS:
+ * size_t - The length of the formatted address
+ */
+static size_t format_address(char *out, const size_t size, const uint8_t family, const uint16_t port, const uint8_t *addr) {
+    char ip[INET6_ADDRSTRLEN];
+    switch (family) {
+        case AF_INET:
+            inet_ntop(AF_INET, addr, ip, sizeof(ip));
+            return snprintf(out, size, "%s:%u", ip, ntohs(port));
+        case AF_INET6:
+            inet_ntop(AF_INET6, addr, ip, sizeof(ip));
+            return snprintf(out, size, "[%s]:%u", ip, ntohs(port));
+        case AF_UNIX:
+            return snprintf(out, size, "unix");
+        default:
+            out[0] = '\0';
+            return 0;
+    }
+}
+
+/*
+ * FUNCTION: flush_buffer
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void flush_buffer(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Write errors drop the buffered records, the log must never stop the writer from draining the rings.
+ */
+static void flush_buffer(void) {
+    size_t written = 0;
+    while (written < outSize) {
+        const ssize_t n = write(logFD, outBuffer + written, outSize - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Access log write");
+            break;
+        }
+        written += n;
+    }
+    outSize = 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * HEADER FILE: accesslog.h - Asynchronous per-session access log
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool access_log_init(const char *path, const bool binary);
+ * void access_log_session(const struct client *entry, const enum close_reason reason);
+ * uint64_t access_log_dropped(void);
+ * void access_log_stop(void);
+ *
+ * VARIABLES:
+ * extern bool accessLogActive - Whether the writer thread is running and sessions should be logged
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "network.h"
+
+//Records per worker ring, must be a power of two
+#define ACCESS_LOG_RING_SIZE 4096
+
+//Most worker threads that can log, sessions closed by any others are counted as dropped
+#define ACCESS_LOG_MAX_RINGS 256
+
+//Output buffer of the writer thread, flushed with a single write whenever it fills or the rings run dry
+#define ACCESS_LOG_BUFFER_SIZE 65536
+
+//How long the writer sleeps when every ring is empty
+#define ACCESS_LOG_IDLE_NS 5000000
+
+/*
+ * One closed session, also the on-disk layout of binary logs.
+ * Addresses are in network byte order, IPv4 addresses take the first 4 bytes.
+ * A family of 0 means there was no backend, AF_UNIX endpoints have no address.
+ */
+struct access_record {
+    uint64_t timestamp_ms;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t duration_ms;
+    uint32_t connect_us;
+    uint32_t rule;
+    uint8_t reason;
+    uint8_t client_family;
+    uint8_t backend_family;
+    uint8_t padding;
+    uint16_t client_port;
+    uint16_t backend_port;
+    uint8_t client_addr[16];
+    uint8_t backend_addr[16];
+};
+
+extern bool accessLogActive;
+
+bool access_log_init(const char *path, const bool binary);
+void access_log_session(const struct client *entry, const enum close_reason reason);
+uint64_t access_log_dropped(void);
+void access_log_stop(void);
+
+#endif
@@ -0,0 +1,584 @@
+/*
+ * SOURCE FILE: forward_bench.c - Microbenchmark of forward_traffic in isolation
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * int main(int argc, char **argv);
+ * static void run_case(const int transport, const size_t size, const int capacity, const size_t total);
+ * static void make_pair(const int transport, int pair[static 2]);
+ * static size_t fill(const int sock, const unsigned char *buffer, const size_t size);
+ * static size_t drain(const int sock, unsigned char *buffer, const size_t size);
+ * static bool open_counters(void);
+ * static void read_counters(uint64_t values[static COUNTER_COUNT]);
+ * static uint64_t now_ns(void);
+ * void *checked_calloc(const size_t nmemb, const size_t size);
+ * void *checked_realloc(void *ptr, const size_t size);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Built with make bench, and linked against socket.o and stats.o only, so what is measured is the real forward_traffic.
+ * Each case moves messages of one size from an input pair to an output pair through a pipe of one capacity,
+ * and only the forward_traffic calls are timed and counted, not the writes feeding it or the reads draining it.
+ * Hardware counters come from perf_event_open, and are left out when the kernel or container doesn't allow them.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include "socket.h"
+#include "stats.h"
+#include "macro.h"
+#include "main.h"
+
+#ifdef NO_STATS
+#error The benchmark counts syscalls with the stats counters, build it without NOSTATS
+#endif
+
+#define TRANSPORT_UNIX 0
+#define TRANSPORT_TCP 1
+
+//Hardware counters read around every forward_traffic call, as one group so they cover the same instructions
+#define COUNTER_CYCLES 0
+#define COUNTER_INSTRUCTIONS 1
+#define COUNTER_CACHE_MISSES 2
+#define COUNTER_COUNT 3
+
+//Bytes moved per case unless -b says otherwise, and the fewest and most messages a case is cut to
+#define BENCH_TOTAL_DEFAULT (64ul << 20)
+#define BENCH_MESSAGES_MIN 64
+#define BENCH_MESSAGES_MAX 200000
+
+static void run_case(const int transport, const size_t size, const int capacity, const size_t total);
+static void make_pair(const int transport, int pair[static 2]);
+static size_t fill(const int sock, const unsigned char *buffer, const size_t size);
+static size_t drain(const int sock, unsigned char *buffer, const size_t size);
+static bool open_counters(void);
+static void read_counters(uint64_t values[static COUNTER_COUNT]);
+static uint64_t now_ns(void);
+
+static const size_t sizeList[] = {64, 256, 1024, 4096, 16384, 65536, 262144, 1048576};
+static const int capacityList[] = {4096, 16384, 65536, 262144, 1048576};
+static const char *transportNames[] = {"unix", "tcp"};
+
+static int counterFds[COUNTER_COUNT] = {-1, -1, -1};
+static bool countersUserOnly;
+
+/*
+ * FUNCTION: main
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int main(int argc, char **argv);
+ *
+ * PARAMETERS:
+ * int argc - The number of arguments
+ * char **argv - -t unix|tcp, -m message size, -p pipe capacity and -b bytes per case, each narrowing the sweep
+ *
+ * RETURNS:
+ * int - The exit status
+ *
+ * NOTES:
+ * Runs every transport, message size and pipe capacity not ruled out by the arguments, one line per case.
+ */
+int main(int argc, char **argv) {
+    int transport = -1;
+    size_t size = 0;
+    int capacity = 0;
+    size_t total = BENCH_TOTAL_DEFAULT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:p:b:")) != -1) {
+        switch (opt) {
+            case 't':
+                transport = (strcmp(optarg, "tcp") == 0) ? TRANSPORT_TCP : TRANSPORT_UNIX;
+                break;
+            case 'm':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                capacity = strtol(optarg, NULL, 0);
+                break;
+            case 'b':
+                total = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t unix|tcp] [-m message size] [-p pipe capacity] [-b bytes per case]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    stats_init();
+    stats_register();
+    const bool counters = open_counters();
+    if (!counters) {
+        fprintf(stderr, "Hardware counters unavailable (%s), reporting time and syscalls only\n", strerror(errno));
+    }
+
+    printf("%-5s %8s %8s %8s %10s %9s %13s %11s %11s %11s\n", "pair", "pipe", "size", "msgs", "ns/op", "MB/s",
+            "syscalls/B", "cycles/op", "instr/op", countersUserOnly ? "miss/op(u)" : "miss/op");
+    for (int t = TRANSPORT_UNIX; t <= TRANSPORT_TCP; ++t) {
+        if (transport != -1 && t != transport) {
+            continue;
+        }
+        for (size_t c = 0; c < sizeof(capacityList) / sizeof(capacityList[0]); ++c) {
+            if (capacity && capacityList[c] != capacity) {
+                continue;
+            }
+            for (size_t s = 0; s < sizeof(sizeList) / sizeof(sizeList[0]); ++s) {
+                if (size && sizeList[s] != size) {
+                    continue;
+                }
+                run_case(t, sizeList[s], capacityList[c], total);
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * FUNCTION: run_case
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void run_case(const int transport, const size_t size, const int capacity, const size_t total);
+ *
+ * PARAMETERS:
+ * const int transport - TRANSPORT_UNIX for socketpairs, TRANSPORT_TCP for loopback connections
+ * const size_t size - Bytes per message
+ * const int capacity - The largest pipe the flow may grow to, and the one it starts with
+ * const size_t total - Roughly how many bytes to move
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * A message larger than the socket buffers is fed and drained in pieces, so one op can take several forward_traffic calls.
+ * Capacities from PIPE_SIZE_DEFAULT up are set as the pipe limit and seeded as the flow's size class,
+ * so forward_traffic grows its pipe on the first call and may shrink it again if the messages don't fill it.
+ * Smaller capacities are set on a pipe handed to the first call, which the thread's pipe cache gives back to every call after.
+ */
+static void run_case(const int transport, const size_t size, const int capacity, const size_t total) {
+    int input[2];
+    int output[2];
+    make_pair(transport, input);
+    make_pair(transport, output);
+
+    struct client client;
+    memset(&client, 0, sizeof(client));
+    client.pipes[0][0] = client.pipes[0][1] = client.pipes[1][0] = client.pipes[1][1] = -1;
+    setPipeLimits(capacity, PIPE_MEMORY_DEFAULT);
+    int sized = -1;
+    if (capacity >= PIPE_SIZE_DEFAULT) {
+        uint32_t size_class = 0;
+        while ((PIPE_SIZE_DEFAULT << (size_class + 1)) <= capacity) {
+            ++size_class;
+        }
+        atomic_store(&client.pending[DIR_LOCAL_TO_REMOTE], size_class << PENDING_CLASS_SHIFT);
+    } else {
+        if (pipe2(client.pipes[DIR_LOCAL_TO_REMOTE], O_NONBLOCK) == -1) {
+            fatal_error("pipe2");
+        }
+        if (fcntl(client.pipes[DIR_LOCAL_TO_REMOTE][1], F_SETPIPE_SZ, capacity) == -1) {
+            fatal_error("F_SETPIPE_SZ");
+        }
+        sized = client.pipes[DIR_LOCAL_TO_REMOTE][1];
+    }
+
+    unsigned char *buffer = checked_calloc(1, size);
+    size_t messages = total / size;
+    messages = (messages < BENCH_MESSAGES_MIN) ? BENCH_MESSAGES_MIN : (messages > BENCH_MESSAGES_MAX) ? BENCH_MESSAGES_MAX : messages;
+
+    uint64_t elapsed = 0;
+    uint64_t counted[COUNTER_COUNT] = {0};
+    const uint64_t splices = atomic_load(&localStats->splices);
+    for (size_t i = 0; i < messages; ++i) {
+        size_t sent = 0;
+        size_t received = 0;
+        while (received < size) {
+            sent += fill(input[1], buffer, size - sent);
+
+            uint64_t before[COUNTER_COUNT];
+            uint64_t after[COUNTER_COUNT];
+            read_counters(before);
+            const uint64_t start = now_ns();
+            const int result = forward_traffic(input[0], output[0], &client, DIR_LOCAL_TO_REMOTE, SIZE_MAX);
+            elapsed += now_ns() - start;
+            read_counters(after);
+            for (size_t j = 0; j < COUNTER_COUNT; ++j) {
+                counted[j] += after[j] - before[j];
+            }
+            if (result != FORWARD_OK) {
+                fprintf(stderr, "forward_traffic returned %d\n", result);
+                exit(EXIT_FAILURE);
+            }
+            received += drain(output[1], buffer, size - received);
+        }
+    }
+    const uint64_t calls = atomic_load(&localStats->splices) - splices;
+    const double bytes = (double) messages * size;
+
+    char columns[COUNTER_COUNT][16];
+    for (size_t j = 0; j < COUNTER_COUNT; ++j) {
+        if (counterFds[0] == -1) {
+            strcpy(columns[j], "-");
+        } else {
+            snprintf(columns[j], sizeof(columns[j]), "%.0f", (double) counted[j] / messages);
+        }
+    }
+    printf("%-5s %8d %8zu %8zu %10.0f %9.0f %13.3e %11s %11s %11s\n", transportNames[transport], capacity, size, messages,
+            (double) elapsed / messages, bytes * 1000.0 / elapsed, calls / bytes,
+            columns[COUNTER_CYCLES], columns[COUNTER_INSTRUCTIONS], columns[COUNTER_CACHE_MISSES]);
+
+    free(buffer);
+    releaseClientPipes(&client);
+    if (sized != -1) {
+        //The pipe went into the thread's cache, put it back to the default size before a later case draws it
+        fcntl(sized, F_SETPIPE_SZ, PIPE_SIZE_DEFAULT);
+    }
+    close(input[0]);
+    close(input[1]);
+    close(output[0]);
+    close(output[1]);
+}
+
+/*
+ * FUNCTION: make_pair
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void make_pair(const int transport, int pair[static 2]);
+ *
+ * PARAMETERS:
+ * const int transport - TRANSPORT_UNIX for a socketpair, TRANSPORT_TCP for a loopback connection
+ * int pair[static 2] - Filled with two connected non-blocking sockets
+ *
+ * RETURNS:
+ * void
+ */
+static void make_pair(const int transport, int pair[static 2]) {
+    if (transport == TRANSPORT_UNIX) {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == -1) {
+            fatal_error("socketpair");
+        }
+        return;
+    }
+
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addrLen = sizeof(addr);
+    if (listener == -1 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listener, 1) == -1
+            || getsockname(listener, (struct sockaddr *) &addr, &addrLen) == -1) {
+        fatal_error("listener");
+    }
+    pair[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (pair[0] == -1 || connect(pair[0], (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        fatal_error("connect");
+    }
+    if ((pair[1] = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) == -1) {
+        fatal_error("accept");
+    }
+    close(listener);
+    setNonBlocking(pair[0]);
+    setNoDelay(pair[0]);
+    setNoDelay(pair[1]);
+}
+
+/*
+ * FUNCTION: fill
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static size_t fill(const int sock, const unsigned char *buffer, const size_t size);
+ *
+ * PARAMETERS:
+ * const int sock - The far end of the input pair
+ * const unsigned char *buffer - The message
+ * const size_t size - How much of the message is left to send
+ *
+ * RETURNS:
+ * size_t - How much was sent before the socket filled
+ */
+static size_t fill(const int sock, const unsigned char *buffer, const size_t size) {
+    size_t sent = 0;
+    while (sent < size) {
+        const ssize_t n = send(sock, buffer + sent, size - sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            fatal_error("send");
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+/*
+ * FUNCTION: drain
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static size_t drain(const int sock, unsigned char *buffer, const size_t size);
+ *
+ * PARAMETERS:
+ * const int sock - The far end of the output pair
+ * unsigned char *buffer - Scratch space at least size long
+ * const size_t size - How much of the message is left to receive
+ *
+ * RETURNS:
+ * size_t - How much was received before the socket emptied
+ */
+static size_t drain(const int sock, unsigned char *buffer, const size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        const ssize_t n = recv(sock, buffer, size - received, 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            fatal_error("recv");
+        }
+        if (n == 0) {
+            break;
+        }
+        received += n;
+    }
+    return received;
+}
+
+/*
+ * FUNCTION: open_counters
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool open_counters(void);
+ *
+ * RETURNS:
+ * bool - Whether the counters were opened, errno says why not
+ *
+ * NOTES:
+ * Kernel time is counted where allowed, since splice does its work there.
+ * Where perf_event_paranoid only allows user space, the counters cover just the syscall entry and exit in forward_traffic.
+ */
+static bool open_counters(void) {
+    static const uint64_t configList[COUNTER_COUNT] = {
+        [COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+        [COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+        [COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    };
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        countersUserOnly = (attempt == 1);
+        for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configList[i];
+            attr.exclude_hv = 1;
+            attr.exclude_kernel = countersUserOnly;
+            counterFds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : counterFds[0], 0);
+            if (counterFds[i] == -1) {
+                const int error = errno;
+                for (size_t j = 0; j < i; ++j) {
+                    close(counterFds[j]);
+                    counterFds[j] = -1;
+                }
+                errno = error;
+                break;
+            }
+        }
+        if (counterFds[0] != -1) {
+            return true;
+        }
+    }
+    countersUserOnly = false;
+    return false;
+}
+
+/*
+ * FUNCTION: read_counters
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void read_counters(uint64_t values[static COUNTER_COUNT]);
+ *
+ * PARAMETERS:
+ * uint64_t values[static COUNTER_COUNT] - Filled with the current counts, or zeros if the counters aren't open
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The counters run the whole time and are read on either side of each call,
+ * so the reads themselves add a constant a few hundred instructions per call.
+ */
+static void read_counters(uint64_t values[static COUNTER_COUNT]) {
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        values[i] = 0;
+        if (counterFds[i] != -1 && read(counterFds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+            values[i] = 0;
+        }
+    }
+}
+
+/*
+ * FUNCTION: now_ns
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint64_t now_ns(void);
+ *
+ * RETURNS:
+ * uint64_t - The monotonic clock in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/*
+ * FUNCTION: checked_calloc
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void *checked_calloc(const size_t nmemb, const size_t size);
+ *
+ * PARAMETERS:
+ * const size_t nmemb - The number of elements
+ * const size_t size - The size of each element
+ *
+ * RETURNS:
+ * void * - The zeroed allocation
+ *
+ * NOTES:
+ * socket.o needs it, and main.o can't be linked in since it has its own main.
+ */
+void *checked_calloc(const size_t nmemb, const size_t size) {
+    void *rtn = calloc(nmemb, size);
+    if (rtn == NULL) {
+        fatal_error("calloc");
+    }
+    return rtn;
+}
+
+/*
+ * FUNCTION: checked_realloc
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void *checked_realloc(void *ptr, const size_t size);
+ *
+ * PARAMETERS:
+ * void *ptr - The allocation to resize
+ * const size_t size - The new size
+ *
+ * RETURNS:
+ * void * - The resized allocation
+ */
+void *checked_realloc(void *ptr, const size_t size) {
+    void *rtn = realloc(ptr, size);
+    if (rtn == NULL) {
+        fatal_error("realloc");
+    }
+    return rtn;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# latency.sh - Ping-pong latency through a loopback rule, blocking workers against busy polling ones
+#
+# Usage: bench/latency.sh <forwarder> <pingpong> [worker cpus] [client cpus]
+#
+# <pingpong> is pingpong-bench.elf from make bench, which runs the echo backend and the client in one process.
+# Runs it straight at the echo backend, then through a rule 7500 -> 127.0.0.1:7501 served by one worker
+# pinned to [worker cpus], by default, with busy_poll=200 and with busy_poll=2000.
+# The client and backend are pinned to [client cpus], which must not overlap the worker's for busy polling to pay off.
+# Defaults are the last CPU for the worker and every other CPU for the client.
+B=$(realpath "$1"); P=$(realpath "$2")
+LAST=$(($(nproc) - 1))
+WORKER=${3:-$LAST}
+CLIENT=${4:-0-$((LAST - 1))}
+if [ "$LAST" -lt 1 ]; then
+    echo "Only one CPU, so the worker shares it with the client and busy polling can only add latency"
+    CLIENT=0
+fi
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+
+echo "direct: $(taskset -c "$CLIENT" "$P" -c 7501 -e 7501)"
+for MODE in "" "busy_poll=200" "busy_poll=2000"; do
+    printf "workers=1\ncpus=%s\n%s\n7500,127.0.0.1,7501\n" "$WORKER" "$MODE" > forward.conf
+    "$B" > latency.log 2>&1 & FORWARDER=$!
+    sleep 0.5
+    echo "${MODE:-default}: $(taskset -c "$CLIENT" "$P" -c 7500 -e 7501)"
+    kill $FORWARDER
+    wait 2>/dev/null
+done
+cd / && rm -rf "$DIR"
@@ -0,0 +1,314 @@
+/*
+ * SOURCE FILE: pingpong.c - Round trip latency of small messages through a forwarder rule
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * int main(int argc, char **argv);
+ * static void *echo_server(void *arg);
+ * static int connect_port(const int port);
+ * static bool exchange(const int sock, unsigned char *buffer, const size_t size);
+ * static int compare_latency(const void *a, const void *b);
+ * static uint64_t now_ns(void);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Built with make bench, standalone, since it only talks to the forwarder over loopback.
+ * One connection sends a message, waits for all of it to come back, and times the round trip,
+ * so every sample pays the forwarder's wakeup and relay latency in both directions.
+ * With -e it also runs the echo backend the rule forwards to, on its own thread.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//Round trips thrown away before timing starts, so connection setup and cold caches stay out of the tail
+#define PINGPONG_WARMUP 1000
+#define PINGPONG_COUNT_DEFAULT 20000
+#define PINGPONG_SIZE_DEFAULT 32
+#define PINGPONG_SIZE_MAX 65536
+
+static void *echo_server(void *arg);
+static int connect_port(const int port);
+static bool exchange(const int sock, unsigned char *buffer, const size_t size);
+static int compare_latency(const void *a, const void *b);
+static uint64_t now_ns(void);
+
+/*
+ * FUNCTION: main
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int main(int argc, char **argv);
+ *
+ * PARAMETERS:
+ * int argc - The number of arguments
+ * char **argv - -c port to connect to, -e port to run the echo backend on, -n round trips and -m message size
+ *
+ * RETURNS:
+ * int - The exit status
+ *
+ * NOTES:
+ * Prints one line of percentiles, in microseconds.
+ */
+int main(int argc, char **argv) {
+    int port = 0;
+    int echo = 0;
+    size_t count = PINGPONG_COUNT_DEFAULT;
+    size_t size = PINGPONG_SIZE_DEFAULT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:e:n:m:")) != -1) {
+        switch (opt) {
+            case 'c':
+                port = strtol(optarg, NULL, 10);
+                break;
+            case 'e':
+                echo = strtol(optarg, NULL, 10);
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                size = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                port = 0;
+                break;
+        }
+    }
+    if (port == 0 || count == 0 || size == 0 || size > PINGPONG_SIZE_MAX) {
+        fprintf(stderr, "Usage: %s -c port [-e echo port] [-n round trips] [-m message size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (echo) {
+        const int listener = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(echo), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+        if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listener, SOMAXCONN) == -1) {
+            perror("echo listener");
+            return EXIT_FAILURE;
+        }
+        pthread_t thread;
+        pthread_create(&thread, NULL, echo_server, (void *) (intptr_t) listener);
+        pthread_detach(thread);
+    }
+
+    const int sock = connect_port(port);
+    if (sock == -1) {
+        return EXIT_FAILURE;
+    }
+    unsigned char *buffer = calloc(1, size);
+    uint64_t *latency = malloc(count * sizeof(uint64_t));
+    if (buffer == NULL || latency == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < PINGPONG_WARMUP + count; ++i) {
+        const uint64_t start = now_ns();
+        if (!exchange(sock, buffer, size)) {
+            return EXIT_FAILURE;
+        }
+        if (i >= PINGPONG_WARMUP) {
+            latency[i - PINGPONG_WARMUP] = now_ns() - start;
+        }
+    }
+    qsort(latency, count, sizeof(uint64_t), compare_latency);
+    printf("%zu round trips of %zu bytes: p50 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus\n", count, size,
+            latency[count / 2] / 1e3, latency[count * 99 / 100] / 1e3, latency[count * 999 / 1000] / 1e3, latency[count - 1] / 1e3);
+    close(sock);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * FUNCTION: echo_server
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void *echo_server(void *arg);
+ *
+ * PARAMETERS:
+ * void *arg - The listening socket
+ *
+ * RETURNS:
+ * void * - Never returns while the listener is open
+ *
+ * NOTES:
+ * Serves one connection at a time, which is all a ping-pong needs, and sets TCP_NODELAY so replies aren't held by Nagle.
+ */
+static void *echo_server(void *arg) {
+    const int listener = (intptr_t) arg;
+    unsigned char buffer[PINGPONG_SIZE_MAX];
+    for (;;) {
+        const int conn = accept(listener, NULL, NULL);
+        if (conn == -1) {
+            return NULL;
+        }
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+        ssize_t n;
+        while ((n = read(conn, buffer, sizeof(buffer))) > 0) {
+            if (write(conn, buffer, n) != n) {
+                break;
+            }
+        }
+        close(conn);
+    }
+}
+
+/*
+ * FUNCTION: connect_port
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int connect_port(const int port);
+ *
+ * PARAMETERS:
+ * const int port - The loopback port to connect to
+ *
+ * RETURNS:
+ * int - The connected socket with TCP_NODELAY set, or -1 on failure
+ */
+static int connect_port(const int port) {
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (sock == -1 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("connect");
+        return -1;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    return sock;
+}
+
+/*
+ * FUNCTION: exchange
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool exchange(const int sock, unsigned char *buffer, const size_t size);
+ *
+ * PARAMETERS:
+ * const int sock - The connection through the forwarder
+ * unsigned char *buffer - The message, overwritten by the reply
+ * const size_t size - Bytes per message
+ *
+ * RETURNS:
+ * bool - Whether the whole message came back
+ */
+static bool exchange(const int sock, unsigned char *buffer, const size_t size) {
+    if (write(sock, buffer, size) != (ssize_t) size) {
+        perror("write");
+        return false;
+    }
+    for (size_t got = 0; got < size;) {
+        const ssize_t n = read(sock, buffer + got, size - got);
+        if (n <= 0) {
+            fprintf(stderr, "read: %s\n", (n == 0) ? "connection closed" : strerror(errno));
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+/*
+ * FUNCTION: compare_latency
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int compare_latency(const void *a, const void *b);
+ *
+ * PARAMETERS:
+ * const void *a - A latency sample
+ * const void *b - Another latency sample
+ *
+ * RETURNS:
+ * int - Negative, zero or positive as a is shorter than, equal to or longer than b
+ */
+static int compare_latency(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * FUNCTION: now_ns
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint64_t now_ns(void);
+ *
+ * RETURNS:
+ * uint64_t - The monotonic clock in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,36 @@
+# slowdns.py - A DNS server on 127.0.0.1:53 that answers every A query with 127.0.0.1 after a fixed delay
+#
+# Usage: python3 bench/slowdns.py <delay in seconds>
+#
+# Queries are answered from their own threads, so the delay is latency and not a queue.
+# AAAA and other queries get an empty answer after the same delay, as a name with only an IPv4 address would.
+import socket
+import struct
+import sys
+import threading
+import time
+
+delay = float(sys.argv[1])
+server = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+server.bind(('127.0.0.1', 53))
+
+
+def answer(query, client):
+    time.sleep(delay)
+    end = 12
+    while query[end]:
+        end += query[end] + 1
+    qtype = struct.unpack('>H', query[end + 1:end + 3])[0]
+    question = query[12:end + 5]
+    header = query[:2] + b'\x81\x80'
+    if qtype == 1:
+        reply = header + struct.pack('>HHHH', 1, 1, 0, 0) + question
+        reply += b'\xc0\x0c' + struct.pack('>HHIH', 1, 1, 60, 4) + socket.inet_aton('127.0.0.1')
+    else:
+        reply = header + struct.pack('>HHHH', 1, 0, 0, 0) + question
+    server.sendto(reply, client)
+
+
+while True:
+    query, client = server.recvfrom(512)
+    threading.Thread(target=answer, args=(query, client), daemon=True).start()
@@ -0,0 +1,88 @@
+#!/bin/sh
+# soak.sh - Memory held per idle session
+#
+# Usage: bench/soak.sh <forwarder> <sessions>
+#
+# Starts the forwarder on a single rule, 7400 forwarding to 127.0.0.1:7401, where a holder accepts and keeps every connection.
+# The holder then opens <sessions> idle connections through the rule and holds them.
+# SIGUSR1 reports taken before and after give the forwarder's own line and the resident set each added session cost,
+# and /proc/meminfo gives how much the kernel's slab grew per session, which counts all four sockets of a loopback session.
+# Each session needs two descriptors in the forwarder and two in the holder, so the hard open file limit must allow for them.
+B=$(realpath "$1"); N=$2
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+
+printf "7400,127.0.0.1,7401\n" > forward.conf
+#Appended, so report can empty the log between reports
+stdbuf -oL "$B" >> soak.log 2>&1 & FORWARDER=$!
+sleep 0.5
+
+report() {
+    : > soak.log
+    kill -USR1 $FORWARDER
+    while ! grep -q "^Sessions:" soak.log; do
+        sleep 0.05
+    done
+    grep "^Sessions:" soak.log
+}
+rss() {
+    sed -n 's/.*RSS: \([0-9]*\) KiB.*/\1/p'
+}
+slab() {
+    sed -n 's/^Slab: *\([0-9]*\) kB/\1/p' /proc/meminfo
+}
+
+RSS_BEFORE=$(report | rss)
+SLAB_BEFORE=$(slab)
+
+python3 - "$N" > holder.log 2>&1 <<'EOF' & HOLDER=$!
+import resource, socket, sys, threading, time
+n = int(sys.argv[1])
+hard = resource.getrlimit(resource.RLIMIT_NOFILE)[1]
+resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+server = socket.socket()
+server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+server.bind(('127.0.0.1', 7401))
+server.listen(4096)
+accepted = []
+def accept():
+    while True:
+        accepted.append(server.accept()[0])
+threading.Thread(target=accept, daemon=True).start()
+clients = []
+deadline = time.monotonic() + 30
+#Paced, so the soak measures idle sessions rather than a storm of connects in flight
+while len(clients) < n and time.monotonic() < deadline:
+    if len(clients) - len(accepted) < 256:
+        clients.append(socket.create_connection(('127.0.0.1', 7400)))
+    else:
+        time.sleep(0.001)
+while len(accepted) < n and time.monotonic() < deadline:
+    time.sleep(0.05)
+if len(accepted) < n:
+    print('only %d of %d sessions reached the upstream' % (len(accepted), n), flush=True)
+    sys.exit(1)
+print('ready', flush=True)
+time.sleep(3600)
+EOF
+while ! grep -q ready holder.log; do
+    if ! kill -0 $HOLDER 2>/dev/null || ! kill -0 $FORWARDER 2>/dev/null; then
+        echo "could not open $N sessions"
+        tail -n 3 holder.log soak.log
+        kill $HOLDER $FORWARDER 2>/dev/null
+        wait 2>/dev/null
+        cd / && rm -rf "$DIR"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+AFTER=$(report)
+SLAB_AFTER=$(slab)
+echo "$AFTER"
+echo "$N idle sessions: $(( ($(echo "$AFTER" | rss) - RSS_BEFORE) * 1024 / N )) bytes of RSS per session in the forwarder"
+echo "Kernel slab: $(( (SLAB_AFTER - SLAB_BEFORE) * 1024 / N )) bytes per session, all four loopback sockets included"
+
+kill $HOLDER $FORWARDER
+wait 2>/dev/null
+cd / && rm -rf "$DIR"
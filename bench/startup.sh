@@ -0,0 +1,38 @@
+#!/bin/sh
+# startup.sh - Time until the last of a config's listeners accepts
+#
+# Usage: bench/startup.sh <forwarder> <rules> <output host> [dns latency in seconds]
+#
+# Writes a config of <rules> static rules on ports 20000 and up, all forwarding to <output host>:7301,
+# starts the forwarder on it and prints how long the last listener took to accept a connection,
+# then how long the forwarder took to resolve every output address, from its own log.
+# With a DNS latency, slowdns.py is started on 127.0.0.1:53 to answer every name with 127.0.0.1 after that delay,
+# so /etc/resolv.conf must point at 127.0.0.1, and binding port 53 needs root. Run it on a throwaway machine or namespace.
+B=$(realpath "$1"); N=$2; H=$3; DELAY=$4
+HERE=$(dirname "$(realpath "$0")")
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+
+if [ -n "$DELAY" ]; then
+    python3 "$HERE/slowdns.py" "$DELAY" & DNS=$!
+    sleep 0.3
+fi
+
+python3 -c "print('\n'.join('%d,$H,7301' % (20000 + i) for i in range($N)))" > forward.conf
+LAST=$((20000 + N - 1))
+START=$(date +%s%N)
+stdbuf -oL "$B" > startup.log 2>&1 & FORWARDER=$!
+while ! python3 -c "import socket; socket.create_connection(('127.0.0.1', $LAST), timeout=0.2)" 2>/dev/null; do
+    sleep 0.02
+done
+echo "$N rules ($H): last listener accepting after $(( ($(date +%s%N) - START) / 1000000 )) ms"
+
+while ! grep -q "^Resolved" startup.log; do
+    sleep 0.05
+done
+grep "^Resolved" startup.log
+
+kill $FORWARDER
+[ -n "$DNS" ] && kill $DNS
+wait 2>/dev/null
+cd / && rm -rf "$DIR"
@@ -0,0 +1,461 @@
+/*
+ * SOURCE FILE: cipher.c - Implementation of functions declared in cipher.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool cipher_init(const char *keyPath, const char *name);
+ * void cipher_cleanup(void);
+ * struct link_cipher *cipher_new(unsigned char salt[static CIPHER_SALT_SIZE]);
+ * bool cipher_start(struct link_cipher *cipher, const unsigned char *peerSalt, const bool edge);
+ * size_t cipher_seal(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out);
+ * ssize_t cipher_open(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out, size_t *used);
+ * void cipher_free(struct link_cipher *cipher);
+ * static bool read_key(const char *keyPath);
+ * static bool derive_key(EVP_CIPHER_CTX **ctx, unsigned char iv[static CIPHER_IV_SIZE], const unsigned char *salts, const char *label, const bool encrypt);
+ * static void make_nonce(unsigned char nonce[static CIPHER_IV_SIZE], const unsigned char iv[static CIPHER_IV_SIZE], const uint64_t count);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Both ends of a link share a pre-shared key, and each sends a random salt as the first bytes on the link.
+ * A key and IV for each direction are derived from the key and both salts with HKDF-SHA256,
+ * so no two links or directions ever share a key, and nonces are the IV combined with a per direction record count.
+ * The cipher runs through EVP, which picks AES-NI or the ChaCha20 vector code for the CPU on its own.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <endian.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include "cipher.h"
+#include "macro.h"
+#include "main.h"
+
+#define CIPHER_IV_SIZE 12
+
+struct link_cipher {
+    EVP_CIPHER_CTX *seal;
+    EVP_CIPHER_CTX *open;
+    uint64_t sealCount;
+    uint64_t openCount;
+    unsigned char sealIv[CIPHER_IV_SIZE];
+    unsigned char openIv[CIPHER_IV_SIZE];
+    unsigned char salt[CIPHER_SALT_SIZE];
+};
+
+static bool read_key(const char *keyPath);
+static bool derive_key(EVP_CIPHER_CTX **ctx, unsigned char iv[static CIPHER_IV_SIZE], const unsigned char *salts, const char *label, const bool encrypt);
+static void make_nonce(unsigned char nonce[static CIPHER_IV_SIZE], const unsigned char iv[static CIPHER_IV_SIZE], const uint64_t count);
+
+bool cipherActive;
+
+static const EVP_CIPHER *cipherType;
+static unsigned char sharedKey[CIPHER_KEY_SIZE];
+
+/*
+ * FUNCTION: cipher_init
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool cipher_init(const char *keyPath, const char *name);
+ *
+ * PARAMETERS:
+ * const char *keyPath - The file holding the pre-shared key
+ * const char *name - The EVP name of the AEAD cipher, or NULL for CIPHER_DEFAULT
+ *
+ * RETURNS:
+ * bool - Whether the key and cipher are usable
+ */
+bool cipher_init(const char *keyPath, const char *name) {
+    if (name == NULL) {
+        name = CIPHER_DEFAULT;
+    }
+    cipherType = EVP_get_cipherbyname(name);
+    if (cipherType == NULL || !(EVP_CIPHER_flags(cipherType) & EVP_CIPH_FLAG_AEAD_CIPHER)
+            || EVP_CIPHER_key_length(cipherType) != CIPHER_KEY_SIZE || EVP_CIPHER_iv_length(cipherType) != CIPHER_IV_SIZE) {
+        fprintf(stderr, "Tunnel cipher %s is not a supported AEAD cipher, use aes-256-gcm or chacha20-poly1305\n", name);
+        return false;
+    }
+    if (!read_key(keyPath)) {
+        return false;
+    }
+    printf("Tunnel links encrypted with %s\n", name);
+    cipherActive = true;
+    return true;
+}
+
+/*
+ * FUNCTION: cipher_cleanup
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void cipher_cleanup(void);
+ *
+ * RETURNS:
+ * void
+ */
+void cipher_cleanup(void) {
+    OPENSSL_cleanse(sharedKey, sizeof(sharedKey));
+    cipherActive = false;
+}
+
+/*
+ * FUNCTION: cipher_new
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct link_cipher *cipher_new(unsigned char salt[static CIPHER_SALT_SIZE]);
+ *
+ * PARAMETERS:
+ * unsigned char salt[static CIPHER_SALT_SIZE] - Filled with the salt to send to the other end
+ *
+ * RETURNS:
+ * struct link_cipher * - The state for a new link, unusable until cipher_start
+ */
+struct link_cipher *cipher_new(unsigned char salt[static CIPHER_SALT_SIZE]) {
+    struct link_cipher *cipher = checked_calloc(1, sizeof(struct link_cipher));
+    if (RAND_bytes(cipher->salt, CIPHER_SALT_SIZE) != 1) {
+        fatal_error("RAND_bytes");
+    }
+    memcpy(salt, cipher->salt, CIPHER_SALT_SIZE);
+    return cipher;
+}
+
+/*
+ * FUNCTION: cipher_start
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool cipher_start(struct link_cipher *cipher, const unsigned char *peerSalt, const bool edge);
+ *
+ * PARAMETERS:
+ * struct link_cipher *cipher - The link's cipher state
+ * const unsigned char *peerSalt - The CIPHER_SALT_SIZE bytes the other end sent
+ * const bool edge - Whether this end opened the link
+ *
+ * RETURNS:
+ * bool - Whether both directions were keyed
+ */
+bool cipher_start(struct link_cipher *cipher, const unsigned char *peerSalt, const bool edge) {
+    //Both ends need the salts in the same order, so the edge's always comes first
+    unsigned char salts[CIPHER_SALT_SIZE * 2];
+    memcpy(salts, edge ? cipher->salt : peerSalt, CIPHER_SALT_SIZE);
+    memcpy(salts + CIPHER_SALT_SIZE, edge ? peerSalt : cipher->salt, CIPHER_SALT_SIZE);
+
+    return derive_key(&cipher->seal, cipher->sealIv, salts, edge ? "edge to peer" : "peer to edge", true)
+        && derive_key(&cipher->open, cipher->openIv, salts, edge ? "peer to edge" : "edge to peer", false);
+}
+
+/*
+ * FUNCTION: cipher_seal
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t cipher_seal(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out);
+ *
+ * PARAMETERS:
+ * struct link_cipher *cipher - The link's cipher state
+ * const unsigned char *in - The plaintext
+ * const size_t size - The plaintext size, at most CIPHER_RECORD_MAX
+ * unsigned char *out - Where to write the record, with room for size + CIPHER_OVERHEAD bytes
+ *
+ * RETURNS:
+ * size_t - The record size
+ */
+size_t cipher_seal(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out) {
+    unsigned char nonce[CIPHER_IV_SIZE];
+    make_nonce(nonce, cipher->sealIv, cipher->sealCount++);
+
+    const uint32_t length = htobe32(size);
+    memcpy(out, &length, CIPHER_HEADER_SIZE);
+
+    int len;
+    if (EVP_EncryptInit_ex(cipher->seal, NULL, NULL, NULL, nonce) != 1
+            || EVP_EncryptUpdate(cipher->seal, NULL, &len, out, CIPHER_HEADER_SIZE) != 1
+            || EVP_EncryptUpdate(cipher->seal, out + CIPHER_HEADER_SIZE, &len, in, size) != 1
+            || EVP_EncryptFinal_ex(cipher->seal, out + CIPHER_HEADER_SIZE + len, &len) != 1
+            || EVP_CIPHER_CTX_ctrl(cipher->seal, EVP_CTRL_AEAD_GET_TAG, CIPHER_TAG_SIZE, out + CIPHER_HEADER_SIZE + size) != 1) {
+        fatal_error("EVP encrypt");
+    }
+    return size + CIPHER_OVERHEAD;
+}
+
+/*
+ * FUNCTION: cipher_open
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * ssize_t cipher_open(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out, size_t *used);
+ *
+ * PARAMETERS:
+ * struct link_cipher *cipher - The link's cipher state
+ * const unsigned char *in - Bytes read from the link
+ * const size_t size - How many bytes are available
+ * unsigned char *out - Where to write the plaintext, with room for CIPHER_RECORD_MAX bytes
+ * size_t *used - Set to how many bytes of in the record took up
+ *
+ * RETURNS:
+ * ssize_t - The plaintext size, 0 if in doesn't hold a whole record yet, or -1 if the record is forged or corrupt
+ */
+ssize_t cipher_open(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out, size_t *used) {
+    *used = 0;
+    if (size < CIPHER_HEADER_SIZE) {
+        return 0;
+    }
+    uint32_t length;
+    memcpy(&length, in, CIPHER_HEADER_SIZE);
+    length = be32toh(length);
+    if (length == 0 || length > CIPHER_RECORD_MAX) {
+        return -1;
+    }
+    if (size < length + CIPHER_OVERHEAD) {
+        return 0;
+    }
+
+    unsigned char nonce[CIPHER_IV_SIZE];
+    make_nonce(nonce, cipher->openIv, cipher->openCount);
+    unsigned char tag[CIPHER_TAG_SIZE];
+    memcpy(tag, in + CIPHER_HEADER_SIZE + length, CIPHER_TAG_SIZE);
+
+    int len;
+    if (EVP_DecryptInit_ex(cipher->open, NULL, NULL, NULL, nonce) != 1
+            || EVP_DecryptUpdate(cipher->open, NULL, &len, in, CIPHER_HEADER_SIZE) != 1
+            || EVP_DecryptUpdate(cipher->open, out, &len, in + CIPHER_HEADER_SIZE, length) != 1
+            || EVP_CIPHER_CTX_ctrl(cipher->open, EVP_CTRL_AEAD_SET_TAG, CIPHER_TAG_SIZE, tag) != 1
+            || EVP_DecryptFinal_ex(cipher->open, out + len, &len) != 1) {
+        return -1;
+    }
+    ++cipher->openCount;
+    *used = length + CIPHER_OVERHEAD;
+    return length;
+}
+
+/*
+ * FUNCTION: cipher_free
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void cipher_free(struct link_cipher *cipher);
+ *
+ * PARAMETERS:
+ * struct link_cipher *cipher - The cipher state to free, may be NULL
+ *
+ * RETURNS:
+ * void
+ */
+void cipher_free(struct link_cipher *cipher) {
+    if (cipher == NULL) {
+        return;
+    }
+    EVP_CIPHER_CTX_free(cipher->seal);
+    EVP_CIPHER_CTX_free(cipher->open);
+    OPENSSL_cleanse(cipher, sizeof(struct link_cipher));
+    free(cipher);
+}
+
+/*
+ * FUNCTION: read_key
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool read_key(const char *keyPath);
+ *
+ * PARAMETERS:
+ * const char *keyPath - The file holding the key as 64 hex digits
+ *
+ * RETURNS:
+ * bool - Whether a whole key was read
+ *
+ * NOTES:
+ * A key can be made with openssl rand -hex 32.
+ */
+static bool read_key(const char *keyPath) {
+    FILE *fp = fopen(keyPath, "r");
+    if (fp == NULL) {
+        perror(keyPath);
+        return false;
+    }
+    char hex[CIPHER_KEY_SIZE * 2 + 2];
+    const bool read = fgets(hex, sizeof(hex), fp) != NULL;
+    fclose(fp);
+
+    size_t len = read ? strlen(hex) : 0;
+    while (len && isspace((unsigned char) hex[len - 1])) {
+        hex[--len] = '\0';
+    }
+    if (len != CIPHER_KEY_SIZE * 2) {
+        fprintf(stderr, "Tunnel key in %s must be %d hex digits\n", keyPath, CIPHER_KEY_SIZE * 2);
+        return false;
+    }
+    for (size_t i = 0; i < CIPHER_KEY_SIZE; ++i) {
+        if (!isxdigit((unsigned char) hex[i * 2]) || !isxdigit((unsigned char) hex[i * 2 + 1])
+                || sscanf(hex + i * 2, "%2hhx", &sharedKey[i]) != 1) {
+            fprintf(stderr, "Tunnel key in %s must be %d hex digits\n", keyPath, CIPHER_KEY_SIZE * 2);
+            OPENSSL_cleanse(hex, sizeof(hex));
+            return false;
+        }
+    }
+    OPENSSL_cleanse(hex, sizeof(hex));
+    return true;
+}
+
+/*
+ * FUNCTION: derive_key
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool derive_key(EVP_CIPHER_CTX **ctx, unsigned char iv[static CIPHER_IV_SIZE], const unsigned char *salts, const char *label, const bool encrypt);
+ *
+ * PARAMETERS:
+ * EVP_CIPHER_CTX **ctx - Set to a context keyed for one direction
+ * unsigned char iv[static CIPHER_IV_SIZE] - Filled with that direction's IV
+ * const unsigned char *salts - Both ends' salts, edge first
+ * const char *label - Which direction is being keyed
+ * const bool encrypt - Whether this end encrypts or decrypts in that direction
+ *
+ * RETURNS:
+ * bool - Whether the context was created
+ */
+static bool derive_key(EVP_CIPHER_CTX **ctx, unsigned char iv[static CIPHER_IV_SIZE], const unsigned char *salts, const char *label, const bool encrypt) {
+    unsigned char material[CIPHER_KEY_SIZE + CIPHER_IV_SIZE];
+    size_t materialLen = sizeof(material);
+    bool derived = false;
+
+    EVP_PKEY_CTX *kdf = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if (kdf && EVP_PKEY_derive_init(kdf) == 1
+            && EVP_PKEY_CTX_set_hkdf_md(kdf, EVP_sha256()) == 1
+            && EVP_PKEY_CTX_set1_hkdf_salt(kdf, salts, CIPHER_SALT_SIZE * 2) == 1
+            && EVP_PKEY_CTX_set1_hkdf_key(kdf, sharedKey, CIPHER_KEY_SIZE) == 1
+            && EVP_PKEY_CTX_add1_hkdf_info(kdf, (const unsigned char *) label, strlen(label)) == 1
+            && EVP_PKEY_derive(kdf, material, &materialLen) == 1) {
+        derived = true;
+    }
+    EVP_PKEY_CTX_free(kdf);
+    if (!derived) {
+        return false;
+    }
+
+    memcpy(iv, material + CIPHER_KEY_SIZE, CIPHER_IV_SIZE);
+    if ((*ctx = EVP_CIPHER_CTX_new()) == NULL
+            || EVP_CipherInit_ex(*ctx, cipherType, NULL, material, NULL, encrypt) != 1) {
+        derived = false;
+    }
+    OPENSSL_cleanse(material, sizeof(material));
+    return derived;
+}
+
+/*
+ * FUNCTION: make_nonce
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void make_nonce(unsigned char nonce[static CIPHER_IV_SIZE], const unsigned char iv[static CIPHER_IV_SIZE], const uint64_t count);
+ *
+ * PARAMETERS:
+ * unsigned char nonce[static CIPHER_IV_SIZE] - Filled with the nonce for the record
+ * const unsigned char iv[static CIPHER_IV_SIZE] - The direction's IV
+ * const uint64_t count - How many records were sent before this one
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The count is XORed into the end of the IV, as TLS 1.3 does, so a nonce is never reused under one key.
+ */
+static void make_nonce(unsigned char nonce[static CIPHER_IV_SIZE], const unsigned char iv[static CIPHER_IV_SIZE], const uint64_t count) {
+    memcpy(nonce, iv, CIPHER_IV_SIZE);
+    for (size_t i = 0; i < sizeof(count); ++i) {
+        nonce[CIPHER_IV_SIZE - 1 - i] ^= (count >> (i * 8)) & 0xff;
+    }
+}
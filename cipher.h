@@ -0,0 +1,62 @@
+/*
+ * HEADER FILE: cipher.h - Authenticated encryption of tunnel links
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool cipher_init(const char *keyPath, const char *name);
+ * void cipher_cleanup(void);
+ * struct link_cipher *cipher_new(unsigned char salt[static CIPHER_SALT_SIZE]);
+ * bool cipher_start(struct link_cipher *cipher, const unsigned char *peerSalt, const bool edge);
+ * size_t cipher_seal(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out);
+ * ssize_t cipher_open(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out, size_t *used);
+ * void cipher_free(struct link_cipher *cipher);
+ *
+ * VARIABLES:
+ * extern bool cipherActive - Whether a tunnel key was loaded and links must be encrypted
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CIPHER_DEFAULT "aes-256-gcm"
+
+//Pre-shared keys are 32 bytes, written as 64 hex digits in the key file
+#define CIPHER_KEY_SIZE 32
+
+//Random bytes each end sends first on a new link, so every link gets its own keys
+#define CIPHER_SALT_SIZE 16
+
+/*
+ * Records are a 4 byte big endian payload length, the encrypted payload, then the tag.
+ * The length is authenticated along with the payload.
+ */
+#define CIPHER_HEADER_SIZE 4
+#define CIPHER_TAG_SIZE 16
+#define CIPHER_OVERHEAD (CIPHER_HEADER_SIZE + CIPHER_TAG_SIZE)
+
+//Largest payload sealed into one record, frames queued on a link are batched up to this
+#define CIPHER_RECORD_MAX 65536
+
+struct link_cipher;
+
+extern bool cipherActive;
+
+bool cipher_init(const char *keyPath, const char *name);
+void cipher_cleanup(void);
+struct link_cipher *cipher_new(unsigned char salt[static CIPHER_SALT_SIZE]);
+bool cipher_start(struct link_cipher *cipher, const unsigned char *peerSalt, const bool edge);
+size_t cipher_seal(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out);
+ssize_t cipher_open(struct link_cipher *cipher, const unsigned char *in, const size_t size, unsigned char *out, size_t *used);
+void cipher_free(struct link_cipher *cipher);
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * SOURCE FILE: control.c - Implementation of functions declared in control.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool control_start(const char *path);
+ * void control_stop(void);
+ * static void *control_loop(void *unused);
+ * static void serve_connection(const int conn);
+ * static void run_command(char *line, FILE *out);
+ * static void list_rules(FILE *out);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Commands are single lines, and every command is answered with its output followed by ok or error.
+ * add <rule> takes a rule line as written in forward.conf and prints the new rule's index.
+ * drain <listen> stops accepting on a rule and lets its sessions finish, remove <listen> also hides it.
+ * rules lists every rule that isn't removed, sessions <listen> lists a rule's sessions,
+ * and counters prints the same report as SIGUSR1.
+ * One connection is served at a time by a single thread, which is the only thread that changes rules once the workers start.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "control.h"
+#include "network.h"
+#include "resolve.h"
+#include "socket.h"
+#include "macro.h"
+#include "main.h"
+
+static void *control_loop(void *unused);
+static void serve_connection(const int conn);
+static void run_command(char *line, FILE *out);
+static void list_rules(FILE *out);
+
+static const char *modeNames[] = {"static", "redirect", "tproxy", "routed", "tunnel", "tunnel_peer", "proxy"};
+static const char *statusNames[] = {"active", "draining", "removed"};
+
+static int controlSock = -1;
+static char *controlPath;
+static pthread_t controlThread;
+static atomic_bool controlRunning;
+
+/*
+ * FUNCTION: control_start
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool control_start(const char *path);
+ *
+ * PARAMETERS:
+ * const char *path - Where to create the control socket
+ *
+ * RETURNS:
+ * bool - Whether the socket was opened and the control thread started
+ *
+ * NOTES:
+ * The socket is only accessible to its owner, since anyone who can connect can add forwards.
+ * A socket that can't be opened is reported and forwarding continues without it.
+ */
+bool control_start(const char *path) {
+    controlSock = createSocket(AF_UNIX, SOCK_STREAM, 0);
+    if (!bindUnixSocket(controlSock, path) || chmod(path, 0600) == -1 || listen(controlSock, SOMAXCONN) == -1) {
+        fprintf(stderr, "Unable to open control socket %s\n", path);
+        close(controlSock);
+        controlSock = -1;
+        return false;
+    }
+    controlPath = strdup(path);
+
+    atomic_store(&controlRunning, true);
+    if (pthread_create(&controlThread, NULL, control_loop, NULL) != 0) {
+        fprintf(stderr, "Unable to start control thread\n");
+        control_stop();
+        return false;
+    }
+    printf("Control socket listening on %s\n", path);
+    return true;
+}
+
+/*
+ * FUNCTION: control_stop
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void control_stop(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Must be called before the workers are stopped, since a rule change in progress waits on them.
+ */
+void control_stop(void) {
+    if (controlSock == -1) {
+        return;
+    }
+    if (atomic_exchange(&controlRunning, false)) {
+        pthread_join(controlThread, NULL);
+    }
+    close(controlSock);
+    controlSock = -1;
+    unlink(controlPath);
+    free(controlPath);
+    controlPath = NULL;
+}
+
+/*
+ * FUNCTION: control_loop
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void *control_loop(void *unused);
+ *
+ * PARAMETERS:
+ * void *unused - Required by pthread interface, ignored
+ *
+ * RETURNS:
+ * void * - Required by pthread interface, ignored
+ */
+static void *control_loop(void *unused) {
+    (void) unused;
+    while (atomic_load(&controlRunning)) {
+        struct pollfd pfd = {.fd = controlSock, .events = POLLIN};
+        if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0) {
+            continue;
+        }
+        const int conn = accept4(controlSock, NULL, NULL, SOCK_CLOEXEC);
+        if (conn == -1) {
+            continue;
+        }
+        serve_connection(conn);
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION: serve_connection
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void serve_connection(const int conn);
+ *
+ * PARAMETERS:
+ * const int conn - The accepted control connection, closed before returning
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Runs commands until the client closes its end, or sends a line longer than CONTROL_LINE_MAX.
+ */
+static void serve_connection(const int conn) {
+    FILE *out = fdopen(dup(conn), "w");
+    if (out == NULL) {
+        close(conn);
+        return;
+    }
+
+    char buffer[CONTROL_LINE_MAX + 1];
+    size_t size = 0;
+    while (atomic_load(&controlRunning)) {
+        struct pollfd pfd = {.fd = conn, .events = POLLIN};
+        if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0) {
+            continue;
+        }
+        const ssize_t n = recv(conn, buffer + size, CONTROL_LINE_MAX - size, 0);
+        if (n <= 0) {
+            break;
+        }
+        size += n;
+
+        char *line = buffer;
+        char *newline;
+        while ((newline = memchr(line, '\n', size - (line - buffer)))) {
+            *newline = '\0';
+            run_command(line, out);
+            line = newline + 1;
+        }
+        size -= line - buffer;
+        memmove(buffer, line, size);
+        if (size == CONTROL_LINE_MAX) {
+            fprintf(out, "error command too long\n");
+            break;
+        }
+    }
+    fclose(out);
+    close(conn);
+}
+
+/*
+ * FUNCTION: run_command
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void run_command(char *line, FILE *out);
+ *
+ * PARAMETERS:
+ * char *line - The command line without its newline, modified while parsing
+ * FILE *out - The control connection
+ *
+ * RETURNS:
+ * void
+ */
+static void run_command(char *line, FILE *out) {
+    line[strcspn(line, "\r")] = '\0';
+    char *arg = strchr(line, ' ');
+    if (arg) {
+        *arg++ = '\0';
+        arg += strspn(arg, " ");
+    }
+
+    if (strcmp(line, "add") == 0 && arg) {
+        const size_t index = parse_rule(arg, true);
+        if (index == CLIENT_NONE && ruleCount == RULE_MAX) {
+            //Removed rules keep their slots, so only a restart frees any
+            fprintf(out, "error rule table is full, all %lu slots have been used since startup\n", RULE_MAX);
+        } else if (index == CLIENT_NONE) {
+            fprintf(out, "error rule was not added\n");
+        } else {
+            //Resolve here, since workers refuse clients of a rule that isn't resolved yet
+            struct rule *rule = lookupRule(index);
+            if (rule->mode == RULE_STATIC && !isUnixAddress(rule->address) && resolve_rule_now(rule) == NULL) {
+                fprintf(out, "warning %s did not resolve\n", rule->address);
+            }
+            fprintf(out, "rule %zu\nok\n", index);
+        }
+    } else if ((strcmp(line, "drain") == 0 || strcmp(line, "remove") == 0) && arg) {
+        const size_t index = find_rule(arg);
+        if (index == CLIENT_NONE) {
+            fprintf(out, "error no rule on %s\n", arg);
+        } else if (!close_rule(index, (line[0] == 'd') ? RULE_DRAINING : RULE_REMOVED)) {
+            fprintf(out, "error rule on %s is already draining\n", arg);
+        } else {
+            printf("Rule on %s is now %s\n", arg, (line[0] == 'd') ? "draining" : "removed");
+            fprintf(out, "ok\n");
+        }
+    } else if (strcmp(line, "sessions") == 0 && arg) {
+        const size_t index = find_rule(arg);
+        if (index == CLIENT_NONE) {
+            fprintf(out, "error no rule on %s\n", arg);
+        } else {
+            list_rule_sessions(out, index);
+            fprintf(out, "ok\n");
+        }
+    } else if (strcmp(line, "rules") == 0) {
+        list_rules(out);
+        fprintf(out, "ok\n");
+    } else if (strcmp(line, "counters") == 0) {
+        report_memory_usage(out);
+        fprintf(out, "ok\n");
+    } else if (line[0]) {
+        fprintf(out, "error unknown command %s\n", line);
+    }
+    fflush(out);
+}
+
+/*
+ * FUNCTION: list_rules
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void list_rules(FILE *out);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the rules
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Prints one line per rule that isn't removed, with its active session count,
+ * then how many rule slots have been used, removed rules included, since only a restart frees them.
+ */
+static void list_rules(FILE *out) {
+    const size_t count = ruleCount;
+    uint32_t *sessions = checked_calloc(count ? count : 1, sizeof(uint32_t));
+    count_rule_sessions(sessions);
+
+    for (size_t i = 0; i < count; ++i) {
+        const struct rule *rule = lookupRule(i);
+        const uint32_t status = atomic_load(&rule->status);
+        if (status == RULE_REMOVED) {
+            continue;
+        }
+        //A mapped range only keeps its first output port
+        char port[16] = "";
+        if (rule->port_mapped) {
+            snprintf(port, sizeof(port), "%c%u", PORT_RANGE_SEPARATOR, (unsigned) (rule->output_port + rule->port_count - 1));
+        }
+        fprintf(out, "rule %zu listen=%s output=%s%s%s%s mode=%s status=%s weight=%u sessions=%u\n", i, rule->listen_address,
+                rule->address ? rule->address : "routed", (rule->port && *rule->port) ? ":" : "", rule->port ? rule->port : "", port,
+                modeNames[rule->mode], statusNames[status], rule->weight, sessions[i]);
+    }
+    fprintf(out, "slots used=%zu max=%lu\n", count, RULE_MAX);
+    free(sessions);
+}
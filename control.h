@@ -0,0 +1,30 @@
+/*
+ * HEADER FILE: control.h - Unix socket for changing rules while the forwarder runs
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool control_start(const char *path);
+ * void control_stop(void);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+
+//Longest command accepted, a rule line plus its command name
+#define CONTROL_LINE_MAX 1100
+
+//How often the control thread checks whether the forwarder is shutting down
+#define CONTROL_POLL_MS 250
+
+bool control_start(const char *path);
+void control_stop(void);
+
+#endif
@@ -8,7 +8,9 @@
  * FUNCTIONS:
  * int createEpollFd(void);
  * void addEpollSocket(const int epollfd, const int sock, struct epoll_event *ev);
- * int waitForEpollEvent(const int epollfd, struct epoll_event *events);
+ * int waitForEpollEvent(const int epollfd, struct epoll_event *events, const int timeout);
+ * int spinForEpollEvent(const int epollfd, struct epoll_event *events, const long budget, const int timeout);
+ * int pollEpollEvent(const int epollfd, struct epoll_event *events);
  * size_t singleEpollReadInstance(const int sock, unsigned char *buffer, const size_t bufSize);
  *
  * DESIGNER: John Agapeyev
@@ -20,10 +22,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include "epoll.h"
 #include "main.h"
 #include "macro.h"
 #include "socket.h"
+#include "stats.h"
 
 /*
  * FUNCTION: createEpollFd
@@ -93,24 +97,130 @@ void addEpollSocket(const int epollfd, const int sock, struct epoll_event *ev) {
  * John Agapeyev
  *
  * INTERFACE:
- * int waitForEpollEvent(const int epollfd, struct epoll_event *events);
+ * int waitForEpollEvent(const int epollfd, struct epoll_event *events, const int timeout);
  *
  * PARAMETERS:
  * const int epollfd - The epoll descriptor to wait on
  * struct epoll_event *events - The event list that epoll write too
+ * const int timeout - The longest to wait in milliseconds, or -1 to wait for an event
  *
  * RETURNS:
- * int - The number of events on the epoll descriptor
+ * int - The number of events on the epoll descriptor, 0 if the timeout passed first
  */
-int waitForEpollEvent(const int epollfd, struct epoll_event *events) {
+int waitForEpollEvent(const int epollfd, struct epoll_event *events, const int timeout) {
     int nevents;
-    if ((nevents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, -1)) == -1) {
+    nevents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, timeout);
+    STAT_ADD(waits, 1);
+    TRACE2(epoll_wait, nevents, timeout);
+    if (nevents == -1) {
         if (errno == EINTR) {
             //Interrupted by signal, ignore it
             return 0;
         }
         fatal_error("epoll_wait");
     }
+    if (nevents) {
+        STAT_ADD(wakeups, 1);
+        STAT_ADD(events, nevents);
+    }
     return nevents;
 }
 
+/*
+ * FUNCTION: spinForEpollEvent
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int spinForEpollEvent(const int epollfd, struct epoll_event *events, const long budget, const int timeout);
+ *
+ * PARAMETERS:
+ * const int epollfd - The epoll descriptor to poll
+ * struct epoll_event *events - The event list that epoll write too
+ * const long budget - How many microseconds to spin before blocking
+ * const int timeout - The longest the blocking wait may take in milliseconds, or -1 to wait for an event
+ *
+ * RETURNS:
+ * int - The number of events on the epoll descriptor
+ *
+ * NOTES:
+ * Polls with a zero timeout so the thread never sleeps or pays the wakeup latency while traffic is flowing.
+ * Once the budget passes with nothing ready, it falls back to a blocking wait so idle workers stop burning CPU.
+ * Only the poll that finds events, or the blocking fallback, counts as a wait; the empty polls before it count as spins.
+ */
+int spinForEpollEvent(const int epollfd, struct epoll_event *events, const long budget, const int timeout) {
+    struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        const int nevents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, 0);
+        TRACE2(epoll_wait, nevents, 0);
+        if (nevents == -1) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            fatal_error("epoll_wait");
+        }
+        if (nevents) {
+            STAT_ADD(waits, 1);
+            STAT_ADD(wakeups, 1);
+            STAT_ADD(events, nevents);
+            return nevents;
+        }
+        STAT_ADD(spins, 1);
+        if (unlikely(!isRunning)) {
+            return 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 >= budget) {
+            return waitForEpollEvent(epollfd, events, timeout);
+        }
+    }
+}
+
+/*
+ * FUNCTION: pollEpollEvent
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int pollEpollEvent(const int epollfd, struct epoll_event *events);
+ *
+ * PARAMETERS:
+ * const int epollfd - The epoll descriptor to poll
+ * struct epoll_event *events - The event list that epoll write too
+ *
+ * RETURNS:
+ * int - The number of events on the epoll descriptor, 0 if none are ready
+ */
+int pollEpollEvent(const int epollfd, struct epoll_event *events) {
+    int nevents;
+    nevents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, 0);
+    STAT_ADD(waits, 1);
+    TRACE2(epoll_wait, nevents, 0);
+    if (nevents == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fatal_error("epoll_wait");
+    }
+    if (nevents) {
+        STAT_ADD(wakeups, 1);
+        STAT_ADD(events, nevents);
+    }
+    return nevents;
+}
@@ -8,7 +8,9 @@
  * FUNCTIONS:
  * int createEpollFd(void);
  * void addEpollSocket(const int epollfd, const int sock, struct epoll_event *ev);
- * int waitForEpollEvent(const int epollfd, struct epoll_event *events);
+ * int waitForEpollEvent(const int epollfd, struct epoll_event *events, const int timeout);
+ * int spinForEpollEvent(const int epollfd, struct epoll_event *events, const long budget, const int timeout);
+ * int pollEpollEvent(const int epollfd, struct epoll_event *events);
  *
  * DESIGNER: John Agapeyev
  *
@@ -23,7 +25,9 @@
 
 int createEpollFd(void);
 void addEpollSocket(const int epollfd, const int sock, struct epoll_event *ev);
-int waitForEpollEvent(const int epollfd, struct epoll_event *events);
+int waitForEpollEvent(const int epollfd, struct epoll_event *events, const int timeout);
+int spinForEpollEvent(const int epollfd, struct epoll_event *events, const long budget, const int timeout);
+int pollEpollEvent(const int epollfd, struct epoll_event *events);
 
 #endif
 
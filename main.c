@@ -8,6 +8,10 @@
  * FUNCTIONS:
  * static void sighandler(int signo);
  * static void parse_config_file(void);
+ * size_t parse_rule(char *line, const bool runtime);
+ * static bool parse_setting(char *line);
+ * static bool parse_rule_option(char *field, struct rule_options *options);
+ * static void raise_file_limit(void);
  * void debug_print_buffer(const char *prompt, const unsigned char *buffer, const size_t size);
  * void *checked_malloc(const size_t size);
  * void *checked_calloc(const size_t nmemb, const size_t size);
@@ -34,9 +38,50 @@
 #include "macro.h"
 #include "socket.h"
 #include "network.h"
+#include "tunnel.h"
+#include "prefork.h"
+#include "stats.h"
+#include "proxy.h"
 
 static void sighandler(int signo);
 static void parse_config_file(void);
+static bool parse_setting(char *line);
+static bool parse_rule_option(char *field, struct rule_options *options);
+static void raise_file_limit(void);
+
+volatile sig_atomic_t isRunning;
+volatile sig_atomic_t dumpStats;
+
+struct settings settings = {.turn_budget = TURN_BUDGET_DEFAULT, .tunnel_links = TUNNEL_LINKS_DEFAULT,
+    .pipe_max = PIPE_MAX_DEFAULT, .pipe_memory = PIPE_MEMORY_DEFAULT, .worker_groups = 1};
+
+static const struct {
+    const char *name;
+    long *value;
+} settingList[] = {
+    {"sockmap", &settings.sockmap},
+    {"access_log_binary", &settings.access_log_binary},
+    {"busy_poll", &settings.busy_poll},
+    {"busy_poll_sockets", &settings.busy_poll_sockets},
+    {"turn_budget", &settings.turn_budget},
+    {"tunnel_links", &settings.tunnel_links},
+    {"processes", &settings.processes},
+    {"pipe_max", &settings.pipe_max},
+    {"pipe_memory", &settings.pipe_memory},
+    {"workers", &settings.workers},
+    {"worker_groups", &settings.worker_groups},
+};
+
+static const struct {
+    const char *name;
+    char **value;
+} stringSettingList[] = {
+    {"access_log", &settings.access_log},
+    {"tunnel_key", &settings.tunnel_key},
+    {"tunnel_cipher", &settings.tunnel_cipher},
+    {"control_socket", &settings.control_socket},
+    {"cpus", &settings.cpus},
+};
 
 /*
  * FUNCTION: main
@@ -67,11 +112,27 @@ int main(void) {
     sigaction(SIGHUP,&sigHandleList,0);
     sigaction(SIGQUIT,&sigHandleList,0);
     sigaction(SIGTERM,&sigHandleList,0);
+    sigaction(SIGUSR1,&sigHandleList,0);
+
+    //Peers closing mid-splice should return EPIPE, not kill the forwarder
+    struct sigaction ignoreList = {.sa_handler=SIG_IGN};
+    sigaction(SIGPIPE,&ignoreList,0);
 
+    raise_file_limit();
+    stats_init();
     network_init();
     parse_config_file();
-    startServer();
+    if (settings.processes > 1) {
+        prefork_run();
+    } else {
+        startServer();
+    }
     network_cleanup();
+    free(settings.access_log);
+    free(settings.tunnel_key);
+    free(settings.tunnel_cipher);
+    free(settings.control_socket);
+    free(settings.cpus);
 
     return EXIT_SUCCESS;
 }
@@ -99,44 +160,421 @@ int main(void) {
  * All rules are CSV, each line is new rule
  * Format is [input port],[output address],[output port]
  * The output port is optional, and will default to the input port when none is provided
+ * Lines starting with # are comments, and name=value lines set global settings
+ * Either the input port or output address may instead be unix:/path for a unix domain socket,
+ * in which case no output port is used for that side
+ * An output address of transparent or tproxy forwards to the client's original destination,
+ * and takes an optional spoof field in place of the output port
+ * An input of [input port]@[host] shares one listener between many rules, picking the rule by TLS SNI or HTTP Host,
+ * where the host may be *.domain for any subdomain or * for clients matching nothing else
+ * Any field of the form name=value after the input is a per-rule option rather than part of the rule
  */
 void parse_config_file(void) {
-    const char *delim = ",\n";
     FILE *fp = fopen("forward.conf", "r");
     if (fp == NULL) {
         fatal_error("forward.conf could not be located");
     }
 
     char buffer[1025];
-    char output_address[1025];
-    long listen_port;
-    char output_port[1025];
     while(fgets(buffer, 1024, fp)) {
-        char *contents = strtok(buffer, delim);
-        if (contents == NULL) {
+        if (buffer[0] == '#' || parse_setting(buffer)) {
             continue;
         }
-        listen_port = strtol(contents, NULL, 10);
-        if (errno == ERANGE) {
-            fatal_error("Invalid port in config file");
+        parse_rule(buffer, false);
+    }
+    fclose(fp);
+}
+
+/*
+ * FUNCTION: parse_rule
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t parse_rule(char *line, const bool runtime);
+ *
+ * PARAMETERS:
+ * char *line - A rule line in the forward.conf format, modified while parsing
+ * const bool runtime - Whether workers are already running, which rules out routed and tunnel rules
+ *
+ * RETURNS:
+ * size_t - The index of the rule that was added, or CLIENT_NONE if it was invalid or couldn't be opened
+ *
+ * NOTES:
+ * Shared by the config file and the control socket's add command.
+ * Routes and tunnel pools live in tables that are only grown before the workers start.
+ */
+size_t parse_rule(char *line, const bool runtime) {
+    const char *delim = ",\n";
+    char listen_addr[1025];
+    char route_host[1025];
+    char output_address[1025];
+    char output_port[1025];
+    char *fields[3];
+
+    struct rule_options options = {.weight = 1, .nodelay = true};
+    size_t fieldCount = 0;
+    bool valid = true;
+    for (char *field = strtok(line, delim); field; field = strtok(NULL, delim)) {
+        if (fieldCount && strchr(field, '=')) {
+            valid &= parse_rule_option(field, &options);
+        } else if (fieldCount < 3) {
+            fields[fieldCount++] = field;
+        } else {
+            fprintf(stderr, "Too many fields in rule, ignoring %s\n", field);
         }
-        contents = strtok(NULL, delim);
-        if (contents == NULL) {
-            fprintf(stderr, "Invalid rule format in config file\n");
-            continue;
+    }
+    if (fieldCount == 0) {
+        return CLIENT_NONE;
+    }
+    if (!valid) {
+        fprintf(stderr, "Invalid options for rule on %s\n", fields[0]);
+        return CLIENT_NONE;
+    }
+    char *contents = fields[0];
+    //[input port]@[host] routes on the TLS server name or HTTP Host of the client
+    char *at = strrchr(contents, '@');
+    if (at) {
+        *at = '\0';
+        strncpy(route_host, at + 1, 1025);
+    }
+    uint16_t first_port;
+    uint32_t port_count = 1;
+    if (isUnixAddress(contents) || strncmp(contents, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0) {
+        strncpy(listen_addr, contents, 1025);
+    } else if (strchr(contents, PORT_RANGE_SEPARATOR)) {
+        //[first port]-[last port] listens on every port in the range
+        if (!parse_port_range(contents, &first_port, &port_count)) {
+            fprintf(stderr, "Invalid listen port range %s in config file\n", contents);
+            return CLIENT_NONE;
+        }
+        sprintf(listen_addr, "%u%c%u", (unsigned) first_port, PORT_RANGE_SEPARATOR, (unsigned) (first_port + port_count - 1));
+    } else {
+        char *end;
+        const long listen_port = strtol(contents, &end, 10);
+        if (end == contents || listen_port < 0 || listen_port > 65535) {
+            fprintf(stderr, "Invalid listen port %s in config file\n", contents);
+            return CLIENT_NONE;
+        }
+        sprintf(listen_addr, "%ld", listen_port);
+    }
+    if (fieldCount < 2) {
+        fprintf(stderr, "Invalid rule format in config file\n");
+        return CLIENT_NONE;
+    }
+    strncpy(output_address, fields[1], 1025);
+    contents = (fieldCount > 2) ? fields[2] : NULL;
+    if (isUnixAddress(output_address) || strcmp(output_address, PROXY_ADDRESS) == 0) {
+        output_port[0] = '\0';
+    } else if (strcmp(output_address, TRANSPARENT_REDIRECT) == 0 || strcmp(output_address, TRANSPARENT_TPROXY) == 0) {
+        //Third field is an optional spoof flag rather than a port
+        strncpy(output_port, contents ? contents : "", 1025);
+    } else if (contents == NULL) {
+        if (isUnixAddress(listen_addr)) {
+            fprintf(stderr, "Output port is required when listening on a unix socket\n");
+            return CLIENT_NONE;
+        }
+        printf("Output port not specified, defaulting to listen port\n");
+        strncpy(output_port, listen_addr, 1025);
+    } else {
+        strncpy(output_port, contents, 1025);
+    }
+
+    if (port_count > 1 && (at || strncmp(output_address, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0)) {
+        fprintf(stderr, "Port ranges can't be used with routed or tunnel rules\n");
+        return CLIENT_NONE;
+    }
+    if ((strcmp(output_address, PROXY_ADDRESS) == 0) != (options.allow != NULL) || (options.user && !options.allow)) {
+        fprintf(stderr, "Proxy rules need an allow option, and allow and user only apply to proxy rules\n");
+        return CLIENT_NONE;
+    }
+    if (at && strcmp(output_address, PROXY_ADDRESS) == 0) {
+        fprintf(stderr, "Proxy rules can't be routed\n");
+        return CLIENT_NONE;
+    }
+    const bool tunnel = strncmp(listen_addr, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0 || strncmp(output_address, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0;
+    if ((options.defer_s || options.fastopen) && (tunnel || isUnixAddress(listen_addr))) {
+        fprintf(stderr, "Defer and fastopen only apply to TCP listeners of forwarding rules\n");
+        return CLIENT_NONE;
+    }
+    if (options.fastopen_connect && (at || tunnel || strcmp(output_address, PROXY_ADDRESS) == 0
+            || strcmp(output_address, TRANSPARENT_REDIRECT) == 0 || strcmp(output_address, TRANSPARENT_TPROXY) == 0)) {
+        fprintf(stderr, "Fastopen_connect only applies to rules with a fixed upstream\n");
+        return CLIENT_NONE;
+    }
+    if (options.group && tunnel) {
+        fprintf(stderr, "Tunnel rules always run in worker group 0\n");
+        return CLIENT_NONE;
+    }
+    if (runtime && options.group >= (uint32_t) settings.worker_groups) {
+        fprintf(stderr, "There is no worker group %u\n", options.group);
+        return CLIENT_NONE;
+    }
+    uint16_t output_first;
+    uint32_t output_count;
+    if (strchr(output_port, PORT_RANGE_SEPARATOR) && (!parse_port_range(output_port, &output_first, &output_count) || output_count != port_count)) {
+        fprintf(stderr, "Output port range %s must cover as many ports as %s\n", output_port, listen_addr);
+        return CLIENT_NONE;
+    }
+
+    if (runtime && find_rule(listen_addr) != CLIENT_NONE) {
+        fprintf(stderr, "%s already has a rule\n", listen_addr);
+        return CLIENT_NONE;
+    }
+    if (runtime && (at || strncmp(listen_addr, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0 || strncmp(output_address, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0)) {
+        fprintf(stderr, "Routed and tunnel rules can only be added in forward.conf\n");
+        return CLIENT_NONE;
+    }
+
+    if (at) {
+        printf("Adding route for %s on %s to %s%s%s\n", route_host, listen_addr, output_address, *output_port ? ":" : "", output_port);
+        return establish_routed_rule(listen_addr, route_host, output_address, output_port, &options);
+    }
+
+    printf("Adding forwarding on %s to %s%s%s\n", listen_addr, output_address, *output_port ? ":" : "", output_port);
+    return establish_forwarding_rule(listen_addr, output_address, output_port, &options);
+}
+
+/*
+ * FUNCTION: parse_setting
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool parse_setting(char *line);
+ *
+ * PARAMETERS:
+ * char *line - A line from the config file
+ *
+ * RETURNS:
+ * bool - Whether the line was a setting rather than a forwarding rule
+ *
+ * NOTES:
+ * Settings are name=value, where value is a number, on/off for flags, or a string such as a path.
+ * Rules always contain a comma, so any line with an = sign and no comma is treated as a setting.
+ */
+bool parse_setting(char *line) {
+    char *equals = strchr(line, '=');
+    if (equals == NULL || strchr(line, ',')) {
+        return false;
+    }
+    *equals = '\0';
+
+    char *name = line;
+    char *value = equals + 1;
+    while (isspace((unsigned char) *name)) {
+        ++name;
+    }
+    for (char *end = equals; end > name && isspace((unsigned char) end[-1]); *--end = '\0');
+    while (isspace((unsigned char) *value)) {
+        ++value;
+    }
+    for (char *end = value + strlen(value); end > value && isspace((unsigned char) end[-1]); *--end = '\0');
+
+    for (size_t i = 0; i < sizeof(stringSettingList) / sizeof(stringSettingList[0]); ++i) {
+        if (strcmp(stringSettingList[i].name, name) == 0) {
+            free(*stringSettingList[i].value);
+            *stringSettingList[i].value = checked_malloc(strlen(value) + 1);
+            strcpy(*stringSettingList[i].value, value);
+            printf("Setting %s to %s\n", name, value);
+            return true;
+        }
+    }
+    for (size_t i = 0; i < sizeof(settingList) / sizeof(settingList[0]); ++i) {
+        if (strcmp(settingList[i].name, name) == 0) {
+            if (strcmp(value, "on") == 0) {
+                *settingList[i].value = 1;
+            } else if (strcmp(value, "off") == 0) {
+                *settingList[i].value = 0;
+            } else {
+                *settingList[i].value = strtol(value, NULL, 0);
+            }
+            printf("Setting %s to %ld\n", name, *settingList[i].value);
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown setting %s in config file\n", name);
+    return true;
+}
+
+/*
+ * FUNCTION: parse_rule_option
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool parse_rule_option(char *field, struct rule_options *options);
+ *
+ * PARAMETERS:
+ * char *field - A name=value field from a rule line
+ * struct rule_options *options - The options to fill in
+ *
+ * RETURNS:
+ * bool - Whether the option was recognized and valid
+ *
+ * NOTES:
+ * Source, allow and user lists are kept as pointers into the rule line, so the options are only valid while the line is.
+ */
+bool parse_rule_option(char *field, struct rule_options *options) {
+    while (isspace((unsigned char) *field)) {
+        ++field;
+    }
+    char *value = strchr(field, '=');
+    *value++ = '\0';
+
+    if (strcmp(field, "weight") == 0) {
+        char *end;
+        const long weight = strtol(value, &end, 10);
+        if (end == value || weight < 1 || weight > 1024) {
+            fprintf(stderr, "Rule weight must be between 1 and 1024\n");
+            return false;
         }
-        strncpy(output_address, contents, 1025);
-        contents = strtok(NULL, delim);
-        if (contents == NULL) {
-            printf("Output port not specified, defaulting to listen port\n");
-            sprintf(output_port, "%ld", listen_port);
+        options->weight = weight;
+        return true;
+    }
+    if (strcmp(field, "source") == 0) {
+        //Built again when the rule is added, this only checks every address can be bound
+        struct source_pool *pool = createSourcePool(value, 0);
+        if (pool == NULL || pool->count == 0) {
+            fprintf(stderr, "Rule source must list local addresses separated by %s\n", SOURCE_SEPARATOR);
+            free(pool);
+            return false;
+        }
+        free(pool);
+        options->sources = value;
+        return true;
+    }
+    if (strcmp(field, "ports") == 0) {
+        char *end;
+        const long low = strtol(value, &end, 10);
+        const long high = (*end == '-') ? strtol(end + 1, &end, 10) : -1;
+        if (*end || low < 1 || high < low || high > 65535) {
+            fprintf(stderr, "Rule ports must be a range such as 20000-29999\n");
+            return false;
+        }
+        options->port_range = (uint32_t) low | ((uint32_t) high << 16);
+        return true;
+    }
+    if (strcmp(field, "wait") == 0) {
+        char *end;
+        const long wait = strtol(value, &end, 10);
+        if (end == value || *end || wait < 1 || wait > 600000) {
+            fprintf(stderr, "Rule wait must be between 1 and 600000 milliseconds\n");
+            return false;
+        }
+        options->wait_ms = wait;
+        return true;
+    }
+    if (strcmp(field, "defer") == 0 || strcmp(field, "fastopen") == 0) {
+        char *end;
+        const long limit = (field[0] == 'd') ? 3600 : 65535;
+        const long number = strtol(value, &end, 10);
+        if (end == value || *end || number < 1 || number > limit) {
+            fprintf(stderr, "Rule %s must be between 1 and %ld\n", field, limit);
+            return false;
+        }
+        if (field[0] == 'd') {
+            options->defer_s = number;
         } else {
-            strncpy(output_port, contents, 1025);
+            options->fastopen = number;
         }
+        return true;
+    }
+    if (strcmp(field, "group") == 0) {
+        char *end;
+        const long group = strtol(value, &end, 10);
+        if (end == value || *end || group < 0 || group >= WORKER_GROUP_MAX) {
+            fprintf(stderr, "Rule group must be between 0 and %d\n", WORKER_GROUP_MAX - 1);
+            return false;
+        }
+        options->group = group;
+        return true;
+    }
+    if (strcmp(field, "fastopen_connect") == 0 || strcmp(field, "nodelay") == 0 || strcmp(field, "quickack") == 0) {
+        if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+            fprintf(stderr, "Rule %s must be on or off\n", field);
+            return false;
+        }
+        bool *flag = (field[0] == 'f') ? &options->fastopen_connect : (field[0] == 'n') ? &options->nodelay : &options->quickack;
+        *flag = (strcmp(value, "on") == 0);
+        return true;
+    }
+    if (strcmp(field, "allow") == 0 || strcmp(field, "user") == 0) {
+        //Built again when the rule is added, this only checks the prefixes or credentials parse
+        struct proxy_rule *proxy = (field[0] == 'a') ? proxy_create(value, NULL) : proxy_create(NULL, value);
+        if (proxy == NULL) {
+            return false;
+        }
+        proxy_free(proxy);
+        if (field[0] == 'a') {
+            options->allow = value;
+        } else {
+            options->user = value;
+        }
+        return true;
+    }
+    fprintf(stderr, "Unknown rule option %s\n", field);
+    return false;
+}
 
-        printf("Adding forwarding on port %ld to %s:%s\n", listen_port, output_address, output_port);
-        establish_forwarding_rule(listen_port, output_address, output_port);
+/*
+ * FUNCTION: raise_file_limit
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void raise_file_limit(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Every session needs two sockets plus a pipe pair while data is in flight,
+ * so the soft descriptor limit is raised to the hard limit on startup.
+ */
+void raise_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("getrlimit");
+        return;
+    }
+    if (limit.rlim_cur == limit.rlim_max) {
+        return;
     }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("setrlimit");
+        return;
+    }
+    printf("Raised open file limit to %llu\n", (unsigned long long) limit.rlim_cur);
 }
 
 /*
@@ -163,9 +601,13 @@ void parse_config_file(void) {
  * NOTES:
  * Sets isRunning to 0 to terminate program gracefully in the event of SIGINT or other
  * user sent signals.
+ * SIGUSR1 instead requests a statistics report from the event loop.
  */
 void sighandler(int signo) {
-    (void)(signo);
+    if (signo == SIGUSR1) {
+        dumpStats = 1;
+        return;
+    }
     isRunning = 0;
 }
 
@@ -10,9 +10,12 @@
  * void *checked_malloc(const size_t size);
  * void *checked_calloc(const size_t nmemb, const size_t size);
  * void *checked_realloc(void *ptr, const size_t size);
+ * size_t parse_rule(char *line, const bool runtime);
  *
  * VARIABLES:
  * volatile sig_atomic_t isRunning - Whether the application is running
+ * volatile sig_atomic_t dumpStats - Set by SIGUSR1 to request a statistics report
+ * struct settings settings - Global settings read from name=value lines in forward.conf
  *
  * DESIGNER: John Agapeyev
  *
@@ -22,8 +25,32 @@
 #define MAIN_H
 
 #include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-volatile sig_atomic_t isRunning;
+extern volatile sig_atomic_t isRunning;
+extern volatile sig_atomic_t dumpStats;
+
+struct settings {
+    long sockmap;
+    char *access_log;
+    long access_log_binary;
+    long busy_poll;
+    long busy_poll_sockets;
+    long turn_budget;
+    long tunnel_links;
+    char *tunnel_key;
+    char *tunnel_cipher;
+    char *control_socket;
+    long processes;
+    long pipe_max;
+    long pipe_memory;
+    long workers;
+    long worker_groups;
+    char *cpus;
+};
+
+extern struct settings settings;
 
 void debug_print_buffer(const char *prompt, const unsigned char *buffer, const size_t size);
 
@@ -31,4 +58,6 @@ void *checked_malloc(const size_t size);
 void *checked_calloc(const size_t nmemb, const size_t size);
 void *checked_realloc(void *ptr, const size_t size);
 
+size_t parse_rule(char *line, const bool runtime);
+
 #endif
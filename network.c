@@ -7,11 +7,14 @@
 #include <stdatomic.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <unistd.h>
-#include <openssl/evp.h>
+#include <stdio.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
 #include "network.h"
@@ -19,16 +22,143 @@
 #include "socket.h"
 #include "macro.h"
 #include "main.h"
+#include "route.h"
+#include "sockmap.h"
+#include "accesslog.h"
+#include "tunnel.h"
+#include "resolve.h"
+#include "control.h"
+#include "stats.h"
+#include "sniff.h"
+#include "proxy.h"
+#include "topology.h"
+
+//Flag bits and close reason held in the low bits of a client's state, the upper bits hold the session generation
+#define STATE_RUNNING(dir) (1u << (dir))
+#define STATE_AGAIN(dir) (4u << (dir))
+#define STATE_CLOSING 16u
+#define STATE_DEAD 32u
+#define STATE_EOF(dir) (64u << (dir))
+#define STATE_REASON_SHIFT 8
+#define STATE_REASON_MASK 0xfu
+#define STATE_GEN_SHIFT 12
+#define STATE_GEN_MASK 0xfffffu
 
 struct client **clientList;
 size_t clientCount;
 size_t clientMax;
+struct rule **ruleList;
+size_t ruleCount;
 int efd;
 
-uint64_t epoll_mask = 0xffffff;
+//The rule listening on each TCP port and that port's listener, so ports find their rule without a search
+static uint32_t *portRules;
+static int *portListeners;
 
 pthread_mutex_t clientLock;
 
+static size_t clientUsed;
+static uint32_t clientFreeHead = CLIENT_NONE;
+
+//What a client without an upstream is waiting on, only allocated while its upstream is being connected
+struct client_connect {
+    struct connect_race race;
+    //A proxy client's destination lookup, set until it is done and the race is started
+    struct resolve_lookup *lookup;
+    //The epoll set the lookup's event is registered in
+    int epoll;
+    //What a proxy client asked for, to reply to once its connect is finished
+    struct proxy_request request;
+};
+
+//Pending connects beside the client entries, chunked the same way and only touched by whoever owns a client's inbound direction
+static struct client_connect **connectList[CLIENT_CHUNK_COUNT];
+
+//A session direction that used up its budget and still has input waiting
+struct run_entry {
+    uint32_t index;
+    uint32_t generation;
+    uint32_t direction;
+};
+
+/*
+ * Each worker bumps its phase to odd when it picks up a batch of events and back to even when it is done.
+ * The control thread waits for every odd phase to move on before reclaiming anything a worker may still be using.
+ * The run queue is locked so idle workers can steal from it, and its length is published for them to pick a victim.
+ * Each worker allocates its own state once it is pinned, so the memory sits on its NUMA node.
+ */
+struct worker_state {
+    _Alignas(64) _Atomic uint64_t phase;
+    _Atomic size_t queued;
+    _Atomic uint64_t stolen;
+    pthread_mutex_t queueLock;
+    struct run_entry *queue;
+    size_t queueMax;
+    uint32_t index;
+    uint32_t group;
+    int cpu;
+    int node;
+};
+
+/*
+ * Workers of a group wait on their own epoll set, and only steal from each other.
+ * Idle counts workers blocked or spinning in epoll, which a worker with a backlog wakes through stealFd.
+ */
+struct worker_group {
+    int epoll;
+    int stealFd;
+    _Atomic size_t idle;
+    atomic_bool wakePending;
+};
+
+//Published by each worker as it starts, NULL until then
+static struct worker_state *_Atomic *workerStates;
+static size_t workerMax;
+//The CPU each worker pins itself to, -1 for none
+static int *workerCpus;
+static _Thread_local struct worker_state *localWorker;
+
+static struct worker_group workerGroups[WORKER_GROUP_MAX];
+static size_t groupCount = 1;
+static _Thread_local struct worker_group *localGroup;
+
+static int connectUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const struct sockaddr_in *peer, const uint32_t offset);
+static int routeClient(struct client *entry, const uint32_t index, const uint32_t generation);
+static int proxyClient(struct client *entry, const uint32_t index, const uint32_t generation);
+static int proxyResolved(struct client *entry, const uint32_t index, const uint32_t generation);
+static int fastOpenClient(struct client *entry, const uint32_t index, const uint32_t generation);
+static int startUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const char *address, const struct addrinfo *upstream, const unsigned char *data, const size_t len);
+static int adoptUpstream(const uint32_t index, const uint32_t generation, const int sock);
+static int finishUpstream(struct client *entry, const uint32_t index, const uint32_t generation);
+static void cancelUpstream(const uint32_t index);
+static struct client_connect **lookupConnect(const uint32_t index);
+static void attachUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const int remote, const struct timespec *started);
+static bool startSniffTimer(struct client *entry, const uint32_t index, const uint32_t generation, const uint32_t wait_ms);
+static bool sniffTimerExpired(const struct client *entry);
+static void stopSniffTimer(struct client *entry);
+static size_t open_rule(const char *listen_addr, const enum rule_mode mode);
+static int open_listener(const char *listen_addr, const enum rule_mode mode);
+static bool set_listener_flag(const int sock, const int level, const int name, const char *label);
+static bool publish_rule(const size_t index);
+static int rule_epoll(const uint32_t index);
+static void tune_listeners(const size_t index);
+static int rule_listener(const uint32_t index, const uint32_t offset);
+static void close_listeners(const uint32_t index);
+static const struct addrinfo *shift_upstream(const struct addrinfo *upstream, const uint16_t port, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]);
+static struct source_pool *rule_sources(const struct rule_options *options);
+static void wait_for_workers(void);
+static void runDirection(struct client *entry, const uint32_t index, const uint32_t generation, const int direction, const enum close_reason reason);
+static void closeClient(struct client *entry, const enum close_reason reason);
+static uint32_t elapsed_us(const struct timespec *start);
+static void requeueDirection(const uint32_t index, const uint32_t generation, const int direction);
+static void runQueuedDirections(void);
+static size_t stealDirections(void);
+static void offerDirections(void);
+
+//The batch being run, swapped with the worker's queue so requeues during the batch don't move it
+static _Thread_local struct run_entry *runBatch;
+static _Thread_local size_t runBatchMax;
+
 /*
  * FUNCTION: network_init
  *
@@ -49,13 +179,25 @@ pthread_mutex_t clientLock;
  *
  * NOTES:
  * Initializes network state for the application
+ * Only the chunk table is allocated here, client chunks are allocated as sessions arrive.
+ * The rule table gets the same treatment, its chunks are allocated as rules are added and never move while workers read them.
+ * The port tables are too, at 256 KiB each, since every TCP port can have a listener.
  */
 void network_init(void) {
-    clientList = checked_calloc(100, sizeof(struct client *));
-    clientCount = 1;
-    clientMax = 100;
+    clientList = checked_calloc(CLIENT_CHUNK_COUNT, sizeof(struct client *));
+    clientCount = 0;
+    clientMax = 0;
+    ruleList = checked_calloc(RULE_CHUNK_COUNT, sizeof(struct rule *));
+    portRules = checked_malloc(sizeof(uint32_t) * (UINT16_MAX + 1));
+    portListeners = checked_malloc(sizeof(int) * (UINT16_MAX + 1));
+    memset(portRules, 0xff, sizeof(uint32_t) * (UINT16_MAX + 1));
+    memset(portListeners, 0xff, sizeof(int) * (UINT16_MAX + 1));
     pthread_mutex_init(&clientLock, NULL);
     efd = createEpollFd();
+    for (size_t i = 0; i < WORKER_GROUP_MAX; ++i) {
+        workerGroups[i].epoll = -1;
+        workerGroups[i].stealFd = -1;
+    }
 }
 
 /*
@@ -77,17 +219,69 @@ void network_init(void) {
  * void
  */
 void network_cleanup(void) {
-    for (size_t i = 0; i < clientMax; ++i) {
-        if (clientList[i]) {
-            pthread_mutex_destroy(clientList[i]->lock);
-            free(clientList[i]->lock);
-            close(clientList[i]->pipes[0]);
-            close(clientList[i]->pipes[1]);
-            free(clientList[i]);
+    for (size_t i = 0; i < clientUsed; ++i) {
+        struct client *entry = lookupClient(i);
+        if (!(atomic_load(&entry->state) & STATE_DEAD)) {
+            close(entry->local);
+            if (entry->remote != -1) {
+                close(entry->remote);
+            } else {
+                cancelUpstream(i);
+                if (lookupRule(entry->rule)->mode == RULE_ROUTED || lookupRule(entry->rule)->fastopen_connect) {
+                    stopSniffTimer(entry);
+                }
+            }
+            releaseClientPipes(entry);
+        }
+    }
+    for (size_t i = 0; i < CLIENT_CHUNK_COUNT; ++i) {
+        free(clientList[i]);
+        free(connectList[i]);
+    }
+    for (size_t i = 0; i < ruleCount; ++i) {
+        struct rule *rule = lookupRule(i);
+        if (atomic_load(&rule->enabled)) {
+            close_listeners(i);
         }
+        if (rule->upstream) {
+            freeaddrinfo(rule->upstream);
+        }
+        free(rule->listen_address);
+        free(rule->address);
+        free(rule->port);
+        free(rule->sources);
+        free(rule->sniff);
+        proxy_free(rule->proxy);
     }
+    tunnel_cleanup();
+    route_cleanup();
+    sockmap_cleanup();
     pthread_mutex_destroy(&clientLock);
     free(clientList);
+    for (size_t i = 0; i < RULE_CHUNK_COUNT; ++i) {
+        free(ruleList[i]);
+    }
+    free(ruleList);
+    free(portRules);
+    free(portListeners);
+    for (size_t i = 0; i < workerMax; ++i) {
+        struct worker_state *state = atomic_load(&workerStates[i]);
+        if (state) {
+            pthread_mutex_destroy(&state->queueLock);
+            free(state->queue);
+            free(state);
+        }
+    }
+    free(workerStates);
+    free(workerCpus);
+    for (size_t i = 0; i < WORKER_GROUP_MAX; ++i) {
+        if (workerGroups[i].stealFd != -1) {
+            close(workerGroups[i].stealFd);
+        }
+        if (i && workerGroups[i].epoll != -1) {
+            close(workerGroups[i].epoll);
+        }
+    }
     close(efd);
 }
 
@@ -104,48 +298,98 @@ void network_cleanup(void) {
  * John Agapeyev
  *
  * INTERFACE:
- * void establish_forwarding_rule(const long listen_port, const char *restrict addr, const char *restrict output_port);
+ * size_t establish_forwarding_rule(const char *restrict listen_addr, const char *restrict addr, const char *restrict output_port, const struct rule_options *options);
  *
  * PARAMETERS:
- * const long listen_port - The incoming port number to listen on
- * const char *restrict addr - A string of the outgoing address
- * const char *restrict output_port - A string of the outgoing port
+ * const char *restrict listen_addr - The incoming port number or unix:/path to listen on
+ * const char *restrict addr - A string of the outgoing address, or unix:/path
+ * const char *restrict output_port - A string of the outgoing port, ignored for unix addresses
+ * const struct rule_options *options - The per-rule options from the config line
  *
  * RETURNS:
- * void
+ * size_t - The index of the new rule, or CLIENT_NONE if it couldn't be opened
  *
  * NOTES:
  * The addr and output_port need to be strings based on the getaddrinfo interface, so they are not converted
  * to sockaddr and int repsectively for this call.
+ * Either side may be a unix domain stream socket, which splice handles the same as TCP.
+ * The upstream is resolved in the background once every rule is open, and a new upstream connection is made for every accepted client.
+ * An addr of transparent or tproxy forwards each client to its original destination instead,
+ * with an output_port of spoof connecting from the client's own address.
+ * An addr of tunnel:host carries every client over a pool of links to another forwarder,
+ * whose tunnel:port rule connects them to its own backend.
+ * A listen_addr of first-last listens on every port in the range, and an output_port range of the same length
+ * maps each of them to its own upstream port, where a single output port takes all of them.
+ * An addr of proxy connects each client to the destination it asks for over SOCKS5 or HTTP CONNECT,
+ * if the options allow it.
  */
-void establish_forwarding_rule(const long listen_port, const char *restrict addr, const char *restrict output_port) {
-    unsigned int sock = createSocket(AF_INET, SOCK_STREAM, 0);
-
-    setNonBlocking(sock);
-
-    bindSocket(sock, listen_port);
-    listen(sock, SOMAXCONN);
-
-    int remote = establishConnection(addr, output_port);
-
-    setNonBlocking(sock);
-
-    setNonBlocking(remote);
+size_t establish_forwarding_rule(const char *restrict listen_addr, const char *restrict addr, const char *restrict output_port, const struct rule_options *options) {
+    enum rule_mode mode = RULE_STATIC;
+    if (strcmp(addr, TRANSPARENT_REDIRECT) == 0) {
+        mode = RULE_REDIRECT;
+    } else if (strcmp(addr, TRANSPARENT_TPROXY) == 0) {
+        mode = RULE_TPROXY;
+    } else if (strncmp(addr, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0) {
+        mode = RULE_TUNNEL;
+    } else if (strncmp(listen_addr, TUNNEL_PREFIX, strlen(TUNNEL_PREFIX)) == 0) {
+        mode = RULE_TUNNEL_PEER;
+    } else if (strcmp(addr, PROXY_ADDRESS) == 0) {
+        mode = RULE_PROXY;
+    }
 
-    unsigned int index = addClient(remote);
+    //Built before the listener opens, so there is nothing to close if the options are invalid
+    struct proxy_rule *proxy = NULL;
+    if (mode == RULE_PROXY && (proxy = proxy_create(options->allow, options->user)) == NULL) {
+        return CLIENT_NONE;
+    }
+    const size_t index = open_rule(listen_addr, mode);
+    if (index == CLIENT_NONE) {
+        proxy_free(proxy);
+        return CLIENT_NONE;
+    }
+    struct rule *rule = lookupRule(index);
+    rule->proxy = proxy;
 
-    struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
-    ev.data.u64 = ((uint64_t) sock << 24ul) + ((uint64_t) index << 48ul);
+    rule->spoof = ((mode == RULE_REDIRECT || mode == RULE_TPROXY) && strcmp(output_port, TRANSPARENT_SPOOF) == 0);
+    rule->address = strdup(addr);
+    rule->weight = options->weight;
+    rule->sources = rule_sources(options);
+    rule->wait_ms = options->wait_ms;
+    rule->defer_s = options->defer_s;
+    rule->fastopen = options->fastopen;
+    rule->fastopen_connect = options->fastopen_connect;
+    rule->nodelay = options->nodelay;
+    rule->quickack = options->quickack;
+    rule->group = options->group;
 
-    addEpollSocket(efd, sock, &ev);
+    //A mapped range resolves its first output port, and each listener's clients connect that many ports further on
+    uint16_t first;
+    uint32_t count;
+    if (mode == RULE_STATIC && strchr(output_port, PORT_RANGE_SEPARATOR) && parse_port_range(output_port, &first, &count)) {
+        char text[8];
+        snprintf(text, sizeof(text), "%u", first);
+        rule->port = strdup(text);
+        rule->output_port = first;
+        rule->port_mapped = true;
+    } else {
+        rule->port = strdup(output_port);
+    }
+    if (mode == RULE_TUNNEL) {
+        tunnel_add_pool(index);
+    }
+    if (!publish_rule(index)) {
+        fprintf(stderr, "Unable to accept on %s, dropping rule\n", listen_addr);
+        close_rule(index, RULE_REMOVED);
+        return CLIENT_NONE;
+    }
+    return index;
 }
 
 /*
- * FUNCTION: startServer
+ * FUNCTION: establish_routed_rule
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -154,46 +398,70 @@ void establish_forwarding_rule(const long listen_port, const char *restrict addr
  * John Agapeyev
  *
  * INTERFACE:
- * void startServer(const int inputFD)
+ * size_t establish_routed_rule(const char *restrict listen_addr, const char *restrict host, const char *restrict addr, const char *restrict output_port, const struct rule_options *options);
  *
  * PARAMETERS:
- * const int inputFD - The file descriptor to read from in order to get packet data to send
+ * const char *restrict listen_addr - The incoming port number or unix:/path to listen on
+ * const char *restrict host - The TLS server name or HTTP host to match, *.domain, * for the default, or proto:name for a protocol
+ * const char *restrict addr - A string of the outgoing address, or unix:/path
+ * const char *restrict output_port - A string of the outgoing port, ignored for unix addresses
+ * const struct rule_options *options - The per-rule options from the config line
  *
  * RETURNS:
- * void
+ * size_t - The index of the shared rule, or CLIENT_NONE if it couldn't be opened
  *
  * NOTES:
- * Performs similar functions to startClient, except for the inital connection.
+ * All routes on the same listen address share a single listener.
+ * Options apply to the shared listener, so the last route line for a listener decides them.
+ * The worker group is the exception, the first route line picks it since the listener is published with it.
+ * The upstream is only chosen once the client's first bytes have been peeked at.
+ * A protocol route is stored under its name without the signature, so its key can't collide with a host name.
  */
-void startServer(void) {
-    const size_t core_count = sysconf(_SC_NPROCESSORS_ONLN);
-
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    cpu_set_t cpus;
-
-    pthread_t threads[core_count - 1];
-    for (size_t i = 0; i < core_count - 1; ++i) {
-        CPU_ZERO(&cpus);
-        CPU_SET(i % core_count, &cpus);
-        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
-        pthread_create(&threads[i], &attr, eventLoop, &efd);
+size_t establish_routed_rule(const char *restrict listen_addr, const char *restrict host, const char *restrict addr, const char *restrict output_port, const struct rule_options *options) {
+    const bool protocol = (strncmp(host, SNIFF_PREFIX, strlen(SNIFF_PREFIX)) == 0);
+    size_t index = find_rule(listen_addr);
+    const bool opened = (index == CLIENT_NONE || lookupRule(index)->mode != RULE_ROUTED);
+    if (protocol && !sniff_add((opened) ? NULL : &lookupRule(index)->sniff, host + strlen(SNIFF_PREFIX))) {
+        return CLIENT_NONE;
+    }
+    if (opened && (index = open_rule(listen_addr, RULE_ROUTED)) == CLIENT_NONE) {
+        return CLIENT_NONE;
+    }
+    if (protocol && opened) {
+        sniff_add(&lookupRule(index)->sniff, host + strlen(SNIFF_PREFIX));
     }
-    pthread_attr_destroy(&attr);
 
-    eventLoop(&efd);
+    struct rule *rule = lookupRule(index);
+    rule->weight = options->weight;
+    rule->wait_ms = options->wait_ms;
+    free(rule->sources);
+    rule->sources = rule_sources(options);
+    rule->defer_s = options->defer_s;
+    rule->fastopen = options->fastopen;
+    rule->nodelay = options->nodelay;
+    rule->quickack = options->quickack;
+    if (opened) {
+        rule->group = options->group;
+    }
 
-    for (size_t i = 0; i < core_count - 1; ++i) {
-        pthread_kill(threads[i], SIGKILL);
-        pthread_join(threads[i], NULL);
+    char key[ROUTE_HOST_SIZE];
+    snprintf(key, sizeof(key), "%.*s", (int) strcspn(host, "="), host);
+    route_add(index, protocol ? key : host, addr, output_port);
+    if (opened && !publish_rule(index)) {
+        fprintf(stderr, "Unable to accept on %s, dropping rule\n", listen_addr);
+        close_rule(index, RULE_REMOVED);
+        return CLIENT_NONE;
+    } else if (!opened) {
+        tune_listeners(index);
     }
+    return index;
 }
 
 /*
- * FUNCTION: eventLoop
+ * FUNCTION: open_rule
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -202,72 +470,75 @@ void startServer(void) {
  * John Agapeyev
  *
  * INTERFACE:
- * void *eventLoop(void *epollfd)
+ * static size_t open_rule(const char *listen_addr, const enum rule_mode mode);
  *
  * PARAMETERS:
- * void *epollfd - The address of an epoll descriptor
+ * const char *listen_addr - The incoming port number or unix:/path to listen on
+ * const enum rule_mode mode - How the rule picks its upstream
  *
  * RETURNS:
- * void * - Required by pthread interface, ignored.
+ * size_t - The index of the new rule, or CLIENT_NONE if there is no room for it or any of its listeners can't be bound
  *
  * NOTES:
- * Both client and server read threads run this function.
+ * Opens the listeners, the upstream fields are left for the caller to fill before it calls publish_rule.
+ * A port range opens one listener per port, all of them sharing the one rule.
  */
-void *eventLoop(void *epollfd) {
-    int efd = *((int *)epollfd);
-
-    struct epoll_event *eventList = checked_calloc(MAX_EPOLL_EVENTS, sizeof(struct epoll_event));
-
-    while (isRunning) {
-        int n = waitForEpollEvent(efd, eventList);
-        //n can't be -1 because the handling for that is done in waitForEpollEvent
-        assert(n != -1);
-        for (int i = 0; i < n; ++i) {
-            if (unlikely(eventList[i].events & EPOLLERR || eventList[i].events & EPOLLHUP)) {
-                if ((eventList[i].data.u64 & epoll_mask) != 0) {
-                    unsigned int listen_sock = (eventList[i].data.u64 >> 24) & epoll_mask;
-                    unsigned int index = eventList[i].data.u64 >> 48;
-                    fprintf(stderr, "Disconnection/error on listening socket %d\n", listen_sock);
+static size_t open_rule(const char *listen_addr, const enum rule_mode mode) {
+    if (ruleCount == RULE_MAX) {
+        fprintf(stderr, "All %lu rule slots are used, removed rules included, dropping rule for %s\n", RULE_MAX, listen_addr);
+        return CLIENT_NONE;
+    }
 
-                    pthread_mutex_lock(&clientLock);
-                    close(listen_sock);
-                    clientList[index]->enabled = false;
-                    pthread_mutex_unlock(&clientLock);
-                } else {
-                    struct client *client = (struct client *) (eventList[i].data.u64 - (eventList[i].data.u64 & 1));
-                    handleSocketError(client);
-                }
-            } else {
-                if (likely(eventList[i].events & EPOLLIN)) {
-                    if ((eventList[i].data.u64 & epoll_mask) != 0) {
-                        //Regular read connection
-                        struct client *client;
-                        if (eventList[i].data.u64 & 1) {
-                            client = (struct client *) (eventList[i].data.u64 - 1);
-                            forward_traffic(client->remote, client->local, client);
-                        } else {
-                            client = (struct client *) (eventList[i].data.u64);
-                            forward_traffic(client->local, client->remote, client);
-                        }
-                    } else {
-                        //Shift fd back, and zero the index portion
-                        unsigned int listen_sock = (eventList[i].data.u64 >> 24) & epoll_mask;
-                        unsigned int index = eventList[i].data.u64 >> 48;
-                        handleIncomingConnection(listen_sock, index);
-                    }
-                }
+    uint16_t first = 0;
+    uint32_t count = 1;
+    const bool numbered = parse_port_range(listen_addr, &first, &count);
+    int sock = -1;
+    for (uint32_t i = 0; i < count; ++i) {
+        char port[8];
+        snprintf(port, sizeof(port), "%u", first + i);
+        const int listener = open_listener(numbered ? port : listen_addr, mode);
+        if (listener == -1) {
+            fprintf(stderr, "Unable to listen on %s, dropping rule\n", numbered ? port : listen_addr);
+            for (uint32_t j = 0; j < i && count > 1; ++j) {
+                close(portListeners[first + j]);
+                portListeners[first + j] = -1;
             }
+            return CLIENT_NONE;
+        }
+        if (numbered) {
+            portListeners[first + i] = listener;
+        }
+        if (i == 0) {
+            sock = listener;
         }
     }
-    free(eventList);
-    return NULL;
+
+    //Slots are only ever claimed by the thread parsing rules, workers never see one or its chunk before it is published
+    const size_t index = ruleCount++;
+    if (ruleList[index >> RULE_CHUNK_SHIFT] == NULL) {
+        ruleList[index >> RULE_CHUNK_SHIFT] = checked_calloc(RULE_CHUNK_SIZE, sizeof(struct rule));
+    }
+    for (uint32_t i = 0; i < count && numbered; ++i) {
+        portRules[first + i] = index;
+    }
+
+    struct rule *rule = lookupRule(index);
+    rule->listen = sock;
+    rule->listen_port = first;
+    rule->port_count = count;
+    atomic_store(&rule->enabled, true);
+    atomic_store(&rule->status, RULE_ACTIVE);
+    rule->mode = mode;
+    rule->listen_address = strdup(listen_addr);
+
+    return index;
 }
 
 /*
- * FUNCTION: addClient
+ * FUNCTION: open_listener
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -276,54 +547,56 @@ void *eventLoop(void *epollfd) {
  * John Agapeyev
  *
  * INTERFACE:
- * size_t addClient(int sock)
+ * static int open_listener(const char *listen_addr, const enum rule_mode mode);
  *
  * PARAMETERS:
- * int sock - The new client's socket
+ * const char *listen_addr - The incoming port number or unix:/path to listen on
+ * const enum rule_mode mode - How the rule picks its upstream
  *
  * RETURNS:
- * size_t - The index of the newly created client entry
+ * int - The non-blocking listening socket, or -1 if it couldn't be created, configured or bound
+ *
+ * NOTES:
+ * Port listeners set SO_REUSEPORT in process mode, so each worker process can bind its own.
+ * Control socket adds come through here while the forwarder is running, so every failure closes the socket and returns,
+ * a tproxy rule without CAP_NET_ADMIN or running out of descriptors only drops the rule.
  */
-size_t addClient(int sock) {
-    pthread_mutex_lock(&clientLock);
-    bool foundEntry = false;
-    for (size_t i = 0; i < clientMax; ++i) {
-        if (clientList[i] && clientList[i]->enabled == false) {
-            initClientStruct(clientList[i], sock);
-            assert(clientList[i]->enabled);
-            foundEntry = true;
-            pthread_mutex_unlock(&clientLock);
-            return i;
-        }
-        if (clientList[i] == NULL) {
-            clientList[i] = checked_malloc(sizeof(struct client));
-            initClientStruct(clientList[i], sock);
-            assert(clientList[i]->enabled);
-            foundEntry = true;
-            ++clientCount;
-            pthread_mutex_unlock(&clientLock);
-            return i;
-        }
+static int open_listener(const char *listen_addr, const enum rule_mode mode) {
+    const bool unixSocket = isUnixAddress(listen_addr);
+    const int sock = socket((unixSocket) ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        perror("socket");
+        return -1;
     }
-    if (!foundEntry) {
-        clientList = checked_realloc(clientList, sizeof(struct client *) * clientMax * 2);
-        memset(clientList + clientMax, 0, sizeof(struct client *) * clientMax);
-        clientList[clientMax] = checked_malloc(sizeof(struct client));
-        initClientStruct(clientList[clientMax], sock);
-        clientMax *= 2;
+    bool bound;
+    if (unixSocket) {
+        bound = bindUnixSocket(sock, listen_addr + strlen(UNIX_PREFIX));
+    } else {
+        //Tunnel listeners are written tunnel:port
+        const size_t skip = (mode == RULE_TUNNEL_PEER) ? strlen(TUNNEL_PREFIX) : 0;
+        bound = set_listener_flag(sock, SOL_SOCKET, SO_REUSEADDR, "SO_REUSEADDR")
+                && (mode != RULE_TPROXY || set_listener_flag(sock, SOL_IP, IP_TRANSPARENT, "IP_TRANSPARENT"))
+                && (settings.processes <= 1 || set_listener_flag(sock, SOL_SOCKET, SO_REUSEPORT, "SO_REUSEPORT"))
+                && bindSocket(sock, strtol(listen_addr + skip, NULL, 10));
     }
-    ++clientCount;
-    size_t result = clientCount - 2;
-    pthread_mutex_unlock(&clientLock);
-    //Subtract 2: 1 for incremented client count, 1 for dummy value
-    return result;
+    if (!bound) {
+        close(sock);
+        return -1;
+    }
+    if (listen(sock, SOMAXCONN) == -1) {
+        perror("listen");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
 }
 
 /*
- * FUNCTION: initClientStruct
+ * FUNCTION: set_listener_flag
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -332,31 +605,62 @@ size_t addClient(int sock) {
  * John Agapeyev
  *
  * INTERFACE:
- * void initClientStruct(struct client *newClient, int sock)
+ * static bool set_listener_flag(const int sock, const int level, const int name, const char *label);
  *
  * PARAMETERS:
- * struct client *newClient - A pointer to the new client's struct
- * int sock - The new client's socket
+ * const int sock - The unbound listener
+ * const int level - The option level, SOL_SOCKET or SOL_IP
+ * const int name - The boolean option to turn on
+ * const char *label - The option's name for the error message
  *
  * RETURNS:
- * void
+ * bool - Whether the option was set
+ *
+ * NOTES:
+ * The socket.c setters exit on failure, which is right for startup but not for a rule added at runtime.
  */
-void initClientStruct(struct client *newClient, int sock) {
-    newClient->local = 0;
-    newClient->remote = sock;
-    newClient->lock = checked_malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(newClient->lock, NULL);
-    newClient->enabled = true;
-    if (pipe(newClient->pipes) < 0) {
-        fatal_error("pipe");
+static bool set_listener_flag(const int sock, const int level, const int name, const char *label) {
+    if (setsockopt(sock, level, name, &(int){1}, sizeof(int)) == -1) {
+        perror(label);
+        return false;
     }
+    return true;
 }
 
 /*
- * FUNCTION: handleIncomingConnection
+ * FUNCTION: open_rule_listener
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int open_rule_listener(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The port rule to open another listener for
+ *
+ * RETURNS:
+ * int - The new listening socket, or -1 if it couldn't be bound
+ *
+ * NOTES:
+ * Gives each worker process its own SO_REUSEPORT listener on the rule's port.
+ * Unix socket rules can't be bound twice, so their one listener is shared instead.
+ */
+int open_rule_listener(const uint32_t index) {
+    return open_listener(lookupRule(index)->listen_address, lookupRule(index)->mode);
+}
+
+/*
+ * FUNCTION: adopt_listeners
+ *
+ * DATE:
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -365,51 +669,147 @@ void initClientStruct(struct client *newClient, int sock) {
  * John Agapeyev
  *
  * INTERFACE:
- * void handleIncomingConnection(const int efd);
+ * void adopt_listeners(const int *listeners);
  *
  * PARAMETERS:
- * const int efd - The epoll descriptor that had the event
+ * const int *listeners - The listener for each rule, indexed like the rule table
  *
  * RETURNS:
  * void
  *
  * NOTES:
- * Adds an incoming connection to the client list, and initiates the handshake.
+ * Called by a forked worker process before it starts forwarding.
+ * The epoll set inherited from the supervisor is shared with every other process, so it is replaced with a private one.
  */
-void handleIncomingConnection(const int listen_sock, const int index) {
-    int local = accept(listen_sock, NULL, NULL);
-    if (local == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            //No incoming connections, ignore the error
-            return;
+void adopt_listeners(const int *listeners) {
+    close(efd);
+    efd = createEpollFd();
+    for (size_t i = 0; i < ruleCount; ++i) {
+        if (atomic_load(&lookupRule(i)->enabled)) {
+            lookupRule(i)->listen = listeners[i];
+            if (!publish_rule(i)) {
+                fprintf(stderr, "Unable to accept on %s in worker process %d\n", lookupRule(i)->listen_address, (int) getpid());
+            }
         }
-        fatal_error("accept");
     }
+}
 
-    setNonBlocking(local);
-
-    pthread_mutex_lock(&clientLock);
-    struct client *newClientEntry = clientList[index];
-    pthread_mutex_unlock(&clientLock);
-
-    newClientEntry->local = local;
+/*
+ * FUNCTION: publish_rule
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool publish_rule(const size_t index);
+ *
+ * PARAMETERS:
+ * const size_t index - The fully filled in rule to start accepting on
+ *
+ * RETURNS:
+ * bool - Whether every listener was added to epoll
+ *
+ * NOTES:
+ * Workers only learn a rule's index from its listener's epoll event, so registering it is what publishes the rule.
+ * Each listener of a range is tagged with its port's offset in the range, which is all a worker needs to find it.
+ * On failure some listeners may already be live, so the caller takes the rule down with close_rule.
+ */
+static bool publish_rule(const size_t index) {
+    tune_listeners(index);
 
+    const int epoll = rule_epoll(index);
+    if (epoll == -1) {
+        return false;
+    }
     struct epoll_event ev;
     ev.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
-    ev.data.u64 = ((uintptr_t) newClientEntry);
+    for (uint32_t i = 0; i < lookupRule(index)->port_count; ++i) {
+        ev.data.u64 = ((uint64_t) index << 32) + ((uint64_t) i << LISTENER_OFFSET_SHIFT) + EV_LISTENER_BIT;
 
-    addEpollSocket(efd, newClientEntry->local, &ev);
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, rule_listener(index, i), &ev) == -1) {
+            perror("epoll_ctl");
+            return false;
+        }
+    }
+    return true;
+}
 
-    ev.data.u64 = ((uintptr_t) newClientEntry) + 1;
+/*
+ * FUNCTION: rule_epoll
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int rule_epoll(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The rule whose listeners are being added or removed
+ *
+ * RETURNS:
+ * int - The epoll set of the rule's worker group, or -1 if it couldn't be created
+ *
+ * NOTES:
+ * Groups other than 0 get their epoll set the first time a rule uses them, since rules can come before the worker_groups setting.
+ * A forked worker process has a single worker, so every rule goes on its own epoll set.
+ */
+static int rule_epoll(const uint32_t index) {
+    const uint32_t group = lookupRule(index)->group;
+    if (group == 0 || settings.processes > 1) {
+        return efd;
+    }
+    if (workerGroups[group].epoll == -1 && (workerGroups[group].epoll = epoll_create1(0)) == -1) {
+        perror("epoll_create1");
+    }
+    return workerGroups[group].epoll;
+}
 
-    addEpollSocket(efd, newClientEntry->remote, &ev);
+/*
+ * FUNCTION: rule_listener
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int rule_listener(const uint32_t index, const uint32_t offset);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The rule the listener belongs to
+ * const uint32_t offset - Which port of the rule's range, 0 for a single port or unix socket rule
+ *
+ * RETURNS:
+ * int - The listening socket
+ *
+ * NOTES:
+ * The first listener is always the rule's own, which is the one a forked worker process replaces with its SO_REUSEPORT copy.
+ */
+static int rule_listener(const uint32_t index, const uint32_t offset) {
+    return (offset) ? portListeners[lookupRule(index)->listen_port + offset] : lookupRule(index)->listen;
 }
 
 /*
- * FUNCTION: handleSocketError
+ * FUNCTION: tune_listeners
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -418,24 +818,2122 @@ void handleIncomingConnection(const int listen_sock, const int index) {
  * John Agapeyev
  *
  * INTERFACE:
- * void handleSocketError(const int sock);
+ * static void tune_listeners(const size_t index);
  *
  * PARAMETERS:
- * const int sock - The socket that had the error
+ * const size_t index - The rule whose listeners to set the handshake options on
  *
  * RETURNS:
  * void
+ *
+ * NOTES:
+ * Called whenever a rule is published, so a forked worker process's own listeners get the options too.
  */
-void handleSocketError(struct client *entry) {
-    pthread_mutex_lock(&clientLock);
-    fprintf(stderr, "Disconnection/error on socket pair %d:%d\n", entry->local, entry->remote);
-
-    //Don't need to deregister socket from epoll
-    close(entry->local);
-    close(entry->remote);
+static void tune_listeners(const size_t index) {
+    const struct rule *rule = lookupRule(index);
+    if (rule->defer_s == 0 && rule->fastopen == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < rule->port_count; ++i) {
+        setListenerOptions(rule_listener(index, i), rule->defer_s, rule->fastopen);
+    }
+}
 
-    entry->enabled = false;
+/*
+ * FUNCTION: close_listeners
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void close_listeners(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The rule whose listeners to close
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Only called by whoever cleared the rule's enabled flag.
+ */
+static void close_listeners(const uint32_t index) {
+    for (uint32_t i = 0; i < lookupRule(index)->port_count; ++i) {
+        close(rule_listener(index, i));
+    }
+}
 
-    pthread_mutex_unlock(&clientLock);
+/*
+ * FUNCTION: rule_sources
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct source_pool *rule_sources(const struct rule_options *options);
+ *
+ * PARAMETERS:
+ * const struct rule_options *options - The per-rule options from the config line
+ *
+ * RETURNS:
+ * struct source_pool * - The rule's source pool, or NULL if it sets neither source addresses nor a port range
+ *
+ * NOTES:
+ * The options were already checked while parsing, so the pool can't fail to be built here.
+ */
+static struct source_pool *rule_sources(const struct rule_options *options) {
+    if (options->sources == NULL && options->port_range == 0) {
+        return NULL;
+    }
+    return createSourcePool(options->sources, options->port_range);
 }
 
+/*
+ * FUNCTION: find_rule
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t find_rule(const char *listen_addr);
+ *
+ * PARAMETERS:
+ * const char *listen_addr - The listen address as written in the rule
+ *
+ * RETURNS:
+ * size_t - The index of the rule that isn't removed listening there, or CLIENT_NONE
+ *
+ * NOTES:
+ * Ports are looked up directly, so a port inside a range rule finds that rule, and a range finds any rule overlapping it.
+ * Only unix socket and tunnel listeners are searched for.
+ */
+size_t find_rule(const char *listen_addr) {
+    uint16_t first;
+    uint32_t count;
+    if (parse_port_range(listen_addr, &first, &count)) {
+        for (uint32_t i = 0; i < count; ++i) {
+            if (portRules[first + i] != CLIENT_NONE) {
+                return portRules[first + i];
+            }
+        }
+        return CLIENT_NONE;
+    }
+    for (size_t i = 0; i < ruleCount; ++i) {
+        if (atomic_load(&lookupRule(i)->status) != RULE_REMOVED && strcmp(lookupRule(i)->listen_address, listen_addr) == 0) {
+            return i;
+        }
+    }
+    return CLIENT_NONE;
+}
+
+/*
+ * FUNCTION: parse_port_range
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool parse_port_range(const char *text, uint16_t *first, uint32_t *count);
+ *
+ * PARAMETERS:
+ * const char *text - A port number, or a range written first-last
+ * uint16_t *first - Filled with the first port
+ * uint32_t *count - Filled with the number of ports, 1 for a single port
+ *
+ * RETURNS:
+ * bool - Whether text was a valid port or range, false for anything else such as a unix socket path
+ */
+bool parse_port_range(const char *text, uint16_t *first, uint32_t *count) {
+    if (!isdigit((unsigned char) *text)) {
+        return false;
+    }
+    char *end;
+    const long low = strtol(text, &end, 10);
+    long high = low;
+    if (*end == PORT_RANGE_SEPARATOR) {
+        const char *last = end + 1;
+        if (!isdigit((unsigned char) *last)) {
+            return false;
+        }
+        high = strtol(last, &end, 10);
+    }
+    if (*end || low < 0 || high < low || high > UINT16_MAX || (high > low && low == 0)) {
+        return false;
+    }
+    *first = low;
+    *count = high - low + 1;
+    return true;
+}
+
+/*
+ * FUNCTION: close_rule
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool close_rule(const uint32_t index, const enum rule_status status);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The rule to stop accepting on
+ * const enum rule_status status - RULE_DRAINING or RULE_REMOVED
+ *
+ * RETURNS:
+ * bool - Whether the rule was changed, false if it was already at or past that status
+ *
+ * NOTES:
+ * Called from the control thread while workers are running, and takes no lock they take.
+ * The listener is taken out of epoll first, then closed once every worker has finished the batch it was in,
+ * so a worker still holding its event can't accept on a reused descriptor.
+ * Sessions already accepted carry on, and the rule slot and its strings stay allocated until shutdown for their sake.
+ * Slots are never reused, since stale listener events, access log records and background lookups may still name the index,
+ * so at most RULE_MAX rules can be added over the life of the process, and add reports it once they are used up.
+ * A removed rule gives up its ports, so a new rule can take them.
+ */
+bool close_rule(const uint32_t index, const enum rule_status status) {
+    struct rule *rule = lookupRule(index);
+    uint32_t current = atomic_load(&rule->status);
+    do {
+        if (current >= status) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&rule->status, &current, status));
+
+    if (atomic_exchange(&rule->enabled, false)) {
+        for (uint32_t i = 0; i < rule->port_count; ++i) {
+            epoll_ctl(rule_epoll(index), EPOLL_CTL_DEL, rule_listener(index, i), NULL);
+        }
+        wait_for_workers();
+        close_listeners(index);
+        if (isUnixAddress(rule->listen_address)) {
+            unlink(rule->listen_address + strlen(UNIX_PREFIX));
+        }
+    }
+    if (status == RULE_REMOVED && !isUnixAddress(rule->listen_address)) {
+        for (uint32_t i = 0; i < rule->port_count; ++i) {
+            if (portRules[rule->listen_port + i] == index) {
+                portRules[rule->listen_port + i] = CLIENT_NONE;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * FUNCTION: wait_for_workers
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void wait_for_workers(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Waits out one grace period, after which no worker can still be using anything unpublished before the call.
+ * Workers blocked in epoll are already quiescent, so this only waits on the ones partway through a batch.
+ */
+static void wait_for_workers(void) {
+    const struct timespec pause = {0, 100000};
+    for (size_t i = 0; i < workerMax; ++i) {
+        //A worker that hasn't started yet can't be holding anything
+        struct worker_state *state = atomic_load(&workerStates[i]);
+        const uint64_t phase = (state) ? atomic_load(&state->phase) : 0;
+        if (phase & 1) {
+            while (atomic_load(&state->phase) == phase && isRunning) {
+                nanosleep(&pause, NULL);
+            }
+        }
+    }
+}
+
+/*
+ * FUNCTION: startServer
+ *
+ * DATE:
+ * Dec. 2, 2017
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void startServer(const int inputFD)
+ *
+ * PARAMETERS:
+ * const int inputFD - The file descriptor to read from in order to get packet data to send
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Performs similar functions to startClient, except for the inital connection.
+ * Workers default to one per CPU of the cpus setting, and worker i is pinned to the i-th of those CPUs, wrapping around.
+ * The main thread runs worker 0, so no two workers share a CPU unless there are more workers than CPUs.
+ * Workers are split into worker_groups contiguous groups, and a rule whose group doesn't exist is removed.
+ */
+void startServer(void) {
+    //A forked worker process runs a single event loop, pinned by its supervisor
+    int cpus[CPU_SETSIZE];
+    size_t cpuCount = 0;
+    if (settings.processes <= 1 && (cpuCount = topology_cpus(settings.cpus, cpus, CPU_SETSIZE)) == 0) {
+        fprintf(stderr, "No usable CPUs in %s, using every allowed CPU\n", settings.cpus);
+        cpuCount = topology_cpus(NULL, cpus, CPU_SETSIZE);
+    }
+    if (settings.processes > 1) {
+        workerMax = 1;
+    } else if (settings.workers > 0) {
+        workerMax = settings.workers;
+    } else {
+        workerMax = (cpuCount) ? cpuCount : 1;
+    }
+    workerStates = checked_calloc(workerMax, sizeof(struct worker_state *));
+    workerCpus = checked_malloc(workerMax * sizeof(int));
+    for (size_t i = 0; i < workerMax; ++i) {
+        workerCpus[i] = (cpuCount) ? cpus[i % cpuCount] : -1;
+    }
+
+    groupCount = 1;
+    if (settings.processes <= 1) {
+        if (settings.worker_groups > 1) {
+            groupCount = (settings.worker_groups < WORKER_GROUP_MAX) ? settings.worker_groups : WORKER_GROUP_MAX;
+        }
+        if (groupCount > workerMax) {
+            fprintf(stderr, "Only %zu workers, using %zu worker groups\n", workerMax, workerMax);
+            groupCount = workerMax;
+        }
+        for (size_t i = 0; i < ruleCount; ++i) {
+            if (lookupRule(i)->group >= groupCount && close_rule(i, RULE_REMOVED)) {
+                fprintf(stderr, "Removing the rule on %s, there is no worker group %u\n", lookupRule(i)->listen_address, lookupRule(i)->group);
+            }
+        }
+    }
+    //Rules added through the control socket are checked against this
+    settings.worker_groups = groupCount;
+    workerGroups[0].epoll = efd;
+    for (size_t i = 0; i < groupCount; ++i) {
+        if (workerGroups[i].epoll == -1) {
+            workerGroups[i].epoll = createEpollFd();
+        }
+        //Worker w is in group w * groupCount / workerMax, so group i starts at the first w reaching i
+        const size_t first = (i * workerMax + groupCount - 1) / groupCount;
+        const size_t last = ((i + 1) * workerMax + groupCount - 1) / groupCount;
+        if (last - first > 1) {
+            //Edge triggered, so each write wakes a single idle worker
+            if ((workerGroups[i].stealFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+                fatal_error("eventfd");
+            }
+            struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.u64 = EV_STEAL_BIT};
+            addEpollSocket(workerGroups[i].epoll, workerGroups[i].stealFd, &ev);
+        }
+    }
+    if (settings.processes <= 1) {
+        printf("Starting %zu workers in %zu groups on %zu CPUs\n", workerMax, groupCount, cpuCount);
+    }
+
+    setPipeLimits(settings.pipe_max, settings.pipe_memory);
+    if (settings.sockmap) {
+        sockmap_init();
+    }
+    if (settings.access_log) {
+        access_log_init(settings.access_log, settings.access_log_binary);
+    }
+    tunnel_start();
+    resolve_start();
+    if (settings.control_socket) {
+        control_start(settings.control_socket);
+    }
+
+    //Helper threads were started above, before this one pins itself to worker 0's CPU
+    pthread_t threads[workerMax];
+    for (size_t i = 1; i < workerMax; ++i) {
+        pthread_create(&threads[i], NULL, eventLoop, (void *) (uintptr_t) i);
+    }
+
+    eventLoop((void *) (uintptr_t) 0);
+
+    //Flush before the workers are killed, since that takes the whole process with it
+    access_log_stop();
+    resolve_stop();
+    control_stop();
+
+    for (size_t i = 1; i < workerMax; ++i) {
+        pthread_kill(threads[i], SIGKILL);
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/*
+ * FUNCTION: eventLoop
+ *
+ * DATE:
+ * Dec. 2, 2017
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void *eventLoop(void *worker)
+ *
+ * PARAMETERS:
+ * void *worker - The worker's index, cast to a pointer
+ *
+ * RETURNS:
+ * void * - Required by pthread interface, ignored.
+ *
+ * NOTES:
+ * Both client and server read threads run this function.
+ * Sessions that used up their byte budget are run again after each batch of events,
+ * so a bulk transfer shares the worker with every other ready session instead of holding it until the socket drains.
+ * A worker with nothing queued steals half of the longest queue before it waits,
+ * and a worker with a backlog wakes an idle one to come and take part of it.
+ * Stealing and waking stay within the worker's group.
+ */
+void *eventLoop(void *worker) {
+    const size_t index = (uintptr_t) worker;
+    assert(index < workerMax);
+    if (workerCpus[index] != -1) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(workerCpus[index], &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+
+    //Allocated once pinned, so the first touch puts it on this worker's NUMA node
+    struct worker_state *state = aligned_alloc(_Alignof(struct worker_state), sizeof(struct worker_state));
+    if (state == NULL) {
+        fatal_error("aligned_alloc");
+    }
+    memset(state, 0, sizeof(struct worker_state));
+    pthread_mutex_init(&state->queueLock, NULL);
+    state->index = index;
+    state->cpu = workerCpus[index];
+    state->node = (state->cpu != -1) ? topology_node(state->cpu) : -1;
+    state->group = index * groupCount / workerMax;
+    localWorker = state;
+    localGroup = &workerGroups[state->group];
+    atomic_store(&workerStates[index], state);
+    stats_register();
+
+    const int efd = localGroup->epoll;
+    struct epoll_event *eventList = checked_calloc(MAX_EPOLL_EVENTS, sizeof(struct epoll_event));
+
+    while (isRunning) {
+        size_t queued = atomic_load_explicit(&localWorker->queued, memory_order_relaxed);
+        if (!queued && localGroup->stealFd != -1) {
+            queued = stealDirections();
+        }
+        //Also bounds the wait, so grown pipes no flow has used for a while are handed back on time
+        const int timeout = trimPipeCache();
+        int n;
+        if (queued) {
+            //Queued sessions still have data, so only pick up what is already ready
+            n = pollEpollEvent(efd, eventList);
+        } else {
+            atomic_fetch_add(&localGroup->idle, 1);
+            if (settings.busy_poll) {
+                n = spinForEpollEvent(efd, eventList, settings.busy_poll, timeout);
+            } else {
+                n = waitForEpollEvent(efd, eventList, timeout);
+            }
+            atomic_fetch_sub(&localGroup->idle, 1);
+        }
+        //n can't be -1 because the handling for that is done in waitForEpollEvent
+        assert(n != -1);
+        atomic_fetch_add(&localWorker->phase, 1);
+        if (unlikely(dumpStats)) {
+            dumpStats = 0;
+            report_memory_usage(stdout);
+        }
+        for (int i = 0; i < n; ++i) {
+            const uint64_t data = eventList[i].data.u64;
+            const uint32_t events = eventList[i].events;
+            if (unlikely(data & EV_LISTENER_BIT)) {
+                const uint32_t index = data >> 32;
+                const uint32_t offset = (data >> LISTENER_OFFSET_SHIFT) & UINT16_MAX;
+                const int listen_sock = rule_listener(index, offset);
+                if (unlikely(events & (EPOLLERR | EPOLLHUP))) {
+                    fprintf(stderr, "Disconnection/error on listening socket %d\n", listen_sock);
+
+                    if (atomic_exchange(&lookupRule(index)->enabled, false)) {
+                        close_listeners(index);
+                    }
+                } else if (likely(events & EPOLLIN)) {
+                    handleIncomingConnection(listen_sock, index, offset);
+                }
+                continue;
+            }
+            if (data & EV_TUNNEL_BIT) {
+                tunnel_event(data, events);
+                continue;
+            }
+            if (data & EV_STEAL_BIT) {
+                //The counter is never read, the next write is still a new edge
+                atomic_store(&localGroup->wakePending, false);
+                continue;
+            }
+            if (data & EV_CONNECT_BIT) {
+                //A client's wait ran out or its connect moved on, either is handled by whoever owns its inbound direction
+                const uint32_t index = data >> 32;
+                runDirection(lookupClient(index), index, (data >> STATE_GEN_SHIFT) & STATE_GEN_MASK, DIR_LOCAL_TO_REMOTE, CLOSE_NONE);
+                continue;
+            }
+
+            //Regular client socket, the direction bit says whether it is the remote end
+            const uint32_t index = data >> 32;
+            const uint32_t generation = (data >> STATE_GEN_SHIFT) & STATE_GEN_MASK;
+            const int inbound = (data & EV_DIRECTION_BIT) ? DIR_REMOTE_TO_LOCAL : DIR_LOCAL_TO_REMOTE;
+            const int outbound = !inbound;
+            struct client *client = lookupClient(index);
+
+            if (likely(events & EPOLLIN)) {
+                runDirection(client, index, generation, inbound, CLOSE_NONE);
+            }
+            if ((events & EPOLLOUT) && (atomic_load(&client->pending[outbound]) & PENDING_BYTES_MASK)) {
+                //Socket drained, flush data that was parked while it was full
+                runDirection(client, index, generation, outbound, CLOSE_NONE);
+            }
+            if (unlikely(events & EPOLLERR)) {
+                runDirection(client, index, generation, inbound, CLOSE_ERROR);
+            } else if (unlikely((events & (EPOLLHUP | EPOLLIN)) == EPOLLHUP)) {
+                //A hangup that comes with EPOLLIN is a finished half-close, whose end of stream the read above picks up
+                runDirection(client, index, generation, inbound, CLOSE_HANGUP);
+            }
+        }
+        if (atomic_load_explicit(&localWorker->queued, memory_order_relaxed)) {
+            runQueuedDirections();
+            offerDirections();
+        }
+        atomic_fetch_add(&localWorker->phase, 1);
+    }
+    free(eventList);
+    free(runBatch);
+    return NULL;
+}
+
+/*
+ * FUNCTION: runDirection
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void runDirection(struct client *entry, const uint32_t index, const uint32_t generation, const int direction, const enum close_reason reason);
+ *
+ * PARAMETERS:
+ * struct client *entry - The client the event belongs to
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation the event was registered with
+ * const int direction - Which direction to forward
+ * const enum close_reason reason - Why the session should be torn down, or CLOSE_NONE to just forward
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Each direction is owned by at most one thread at a time without taking a lock.
+ * A thread that finds the direction busy flags it to be run again by the owner instead of waiting.
+ * Events from an earlier session in the same entry are dropped by comparing the generation.
+ * The last thread to leave a closing session releases it.
+ * A direction that runs out of budget is released and put on this worker's run queue rather than looping.
+ * A direction that reaches end of stream shuts down writes on its output and stops forwarding,
+ * while the other direction carries on, so half-closed sessions deliver everything before they are released.
+ */
+static void runDirection(struct client *entry, const uint32_t index, const uint32_t generation, const int direction, const enum close_reason reason) {
+    const uint32_t running = STATE_RUNNING(direction);
+    const uint32_t again = STATE_AGAIN(direction);
+
+    uint32_t state = atomic_load(&entry->state);
+    uint32_t next;
+    do {
+        if ((state >> STATE_GEN_SHIFT) != generation || (state & STATE_DEAD)) {
+            return;
+        }
+        next = state | running | again;
+        if (reason != CLOSE_NONE) {
+            next |= STATE_CLOSING;
+            if (((state >> STATE_REASON_SHIFT) & STATE_REASON_MASK) == CLOSE_NONE) {
+                next |= (uint32_t) reason << STATE_REASON_SHIFT;
+            }
+        }
+    } while (!atomic_compare_exchange_weak(&entry->state, &state, next));
+
+    if (state & running) {
+        //Owner will see the again flag and loop
+        return;
+    }
+
+    bool requeue = false;
+    for (;;) {
+        state = atomic_fetch_and(&entry->state, ~again) & ~again;
+        int routed = 1;
+        if (!(state & STATE_CLOSING) && unlikely(entry->remote == -1)) {
+            //Routed, proxy and fast open clients have no upstream until enough of their first bytes have arrived, and none has until its connect finishes
+            const enum rule_mode mode = lookupRule(entry->rule)->mode;
+            routed = (mode == RULE_PROXY) ? proxyClient(entry, index, generation)
+                : (*lookupConnect(index)) ? finishUpstream(entry, index, generation)
+                : (mode == RULE_ROUTED) ? routeClient(entry, index, generation) : fastOpenClient(entry, index, generation);
+            if (routed == -1) {
+                closeClient(entry, CLOSE_NO_ROUTE);
+            }
+        }
+        if (!(state & (STATE_CLOSING | STATE_EOF(direction))) && routed == 1) {
+            const int in = (direction == DIR_LOCAL_TO_REMOTE) ? entry->local : entry->remote;
+            const int out = (direction == DIR_LOCAL_TO_REMOTE) ? entry->remote : entry->local;
+            const size_t budget = settings.turn_budget ? (size_t) settings.turn_budget * lookupRule(entry->rule)->weight : SIZE_MAX;
+            const int result = forward_traffic(in, out, entry, direction, budget);
+            if (lookupRule(entry->rule)->quickack) {
+                setQuickAck(in);
+            }
+            if (result == FORWARD_BUDGET) {
+                requeue = true;
+            } else if (result == FORWARD_EOF) {
+                //Everything read has been written, so pass the end of stream on and close once both directions have ended
+                shutdown(out, SHUT_WR);
+                if (atomic_fetch_or(&entry->state, STATE_EOF(direction)) & STATE_EOF(!direction)) {
+                    closeClient(entry, CLOSE_EOF);
+                }
+            } else if (result != FORWARD_OK) {
+                closeClient(entry, CLOSE_ERROR);
+            }
+        }
+
+        state = atomic_load(&entry->state);
+        for (;;) {
+            if (requeue && !(state & STATE_CLOSING)) {
+                //The queued run reads until EAGAIN, which covers any event that arrived meanwhile
+                if (atomic_compare_exchange_weak(&entry->state, &state, state & ~(running | again))) {
+                    requeueDirection(index, generation, direction);
+                    return;
+                }
+                continue;
+            }
+            if (state & again) {
+                break;
+            }
+            next = state & ~running;
+            if ((state & STATE_CLOSING) && !(state & STATE_RUNNING(!direction))) {
+                next |= STATE_DEAD;
+            }
+            if (atomic_compare_exchange_weak(&entry->state, &state, next)) {
+                if (next & STATE_DEAD) {
+                    handleSocketError(entry, index, (next >> STATE_REASON_SHIFT) & STATE_REASON_MASK);
+                }
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * FUNCTION: requeueDirection
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void requeueDirection(const uint32_t index, const uint32_t generation, const int direction);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation, so a reused entry is not run by mistake
+ * const int direction - Which direction still has input
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The lock is only contended while another worker is stealing from this queue.
+ */
+static void requeueDirection(const uint32_t index, const uint32_t generation, const int direction) {
+    struct worker_state *self = localWorker;
+    pthread_mutex_lock(&self->queueLock);
+    const size_t queued = atomic_load_explicit(&self->queued, memory_order_relaxed);
+    if (queued == self->queueMax) {
+        self->queueMax = (self->queueMax) ? self->queueMax * 2 : 64;
+        self->queue = checked_realloc(self->queue, sizeof(struct run_entry) * self->queueMax);
+    }
+    self->queue[queued] = (struct run_entry) {index, generation, direction};
+    atomic_store_explicit(&self->queued, queued + 1, memory_order_relaxed);
+    pthread_mutex_unlock(&self->queueLock);
+}
+
+/*
+ * FUNCTION: runQueuedDirections
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void runQueuedDirections(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Gives every queued direction one more turn.
+ * Directions that run out of budget again are queued behind this batch, so they wait for the next round of events.
+ * The whole queue is taken as the batch, so once it starts running none of it can be stolen.
+ */
+static void runQueuedDirections(void) {
+    struct worker_state *self = localWorker;
+    pthread_mutex_lock(&self->queueLock);
+    struct run_entry *batch = self->queue;
+    const size_t batchMax = self->queueMax;
+    const size_t count = atomic_load_explicit(&self->queued, memory_order_relaxed);
+    self->queue = runBatch;
+    self->queueMax = runBatchMax;
+    atomic_store_explicit(&self->queued, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&self->queueLock);
+    runBatch = batch;
+    runBatchMax = batchMax;
+
+    for (size_t i = 0; i < count; ++i) {
+        runDirection(lookupClient(batch[i].index), batch[i].index, batch[i].generation, batch[i].direction, CLOSE_NONE);
+    }
+}
+
+/*
+ * FUNCTION: stealDirections
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static size_t stealDirections(void);
+ *
+ * RETURNS:
+ * size_t - The number of directions moved onto this worker's queue
+ *
+ * NOTES:
+ * Takes the newest half of the longest queue in this worker's group, up to STEAL_MAX entries, and gives up rather than wait on a busy queue.
+ * Directions never leave their group, since their sockets are only in that group's epoll set.
+ * Queued directions aren't owned by any worker, so a stolen one is run like any other.
+ */
+static size_t stealDirections(void) {
+    struct worker_state *victim = NULL;
+    size_t longest = STEAL_MIN - 1;
+    for (size_t i = 0; i < workerMax; ++i) {
+        struct worker_state *state = atomic_load_explicit(&workerStates[i], memory_order_acquire);
+        if (state == NULL || state == localWorker || state->group != localWorker->group) {
+            continue;
+        }
+        const size_t queued = atomic_load_explicit(&state->queued, memory_order_relaxed);
+        if (queued > longest) {
+            longest = queued;
+            victim = state;
+        }
+    }
+    if (victim == NULL || pthread_mutex_trylock(&victim->queueLock) != 0) {
+        return 0;
+    }
+    struct run_entry taken[STEAL_MAX];
+    const size_t queued = atomic_load_explicit(&victim->queued, memory_order_relaxed);
+    size_t take = queued / 2;
+    if (take > STEAL_MAX) {
+        take = STEAL_MAX;
+    }
+    memcpy(taken, victim->queue + queued - take, sizeof(struct run_entry) * take);
+    atomic_store_explicit(&victim->queued, queued - take, memory_order_relaxed);
+    pthread_mutex_unlock(&victim->queueLock);
+
+    for (size_t i = 0; i < take; ++i) {
+        requeueDirection(taken[i].index, taken[i].generation, taken[i].direction);
+    }
+    atomic_store_explicit(&localWorker->stolen, atomic_load_explicit(&localWorker->stolen, memory_order_relaxed) + take, memory_order_relaxed);
+    TRACE2(steal, victim->index, take);
+    return take;
+}
+
+/*
+ * FUNCTION: offerDirections
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void offerDirections(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Wakes one idle worker when this one still has enough queued to share.
+ * Only one wakeup is outstanding at a time, so a worker that stays behind costs a write per woken worker, not per batch.
+ */
+static void offerDirections(void) {
+    struct worker_group *group = localGroup;
+    if (group->stealFd == -1 || atomic_load_explicit(&localWorker->queued, memory_order_relaxed) < STEAL_MIN
+            || !atomic_load_explicit(&group->idle, memory_order_relaxed) || atomic_load_explicit(&group->wakePending, memory_order_relaxed)
+            || atomic_exchange(&group->wakePending, true)) {
+        return;
+    }
+    const uint64_t wake = 1;
+    if (write(group->stealFd, &wake, sizeof(wake)) == -1) {
+        atomic_store(&group->wakePending, false);
+    }
+}
+
+/*
+ * FUNCTION: closeClient
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void closeClient(struct client *entry, const enum close_reason reason);
+ *
+ * PARAMETERS:
+ * struct client *entry - The client to mark as closing
+ * const enum close_reason reason - Why the client is closing
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Only called by the owner of a direction, the session is released by the last thread to leave it.
+ * Only the first reason is kept.
+ */
+static void closeClient(struct client *entry, const enum close_reason reason) {
+    uint32_t state = atomic_load(&entry->state);
+    uint32_t next;
+    do {
+        next = state | STATE_CLOSING;
+        if (((state >> STATE_REASON_SHIFT) & STATE_REASON_MASK) == CLOSE_NONE) {
+            next |= (uint32_t) reason << STATE_REASON_SHIFT;
+        }
+    } while (!atomic_compare_exchange_weak(&entry->state, &state, next));
+}
+
+/*
+ * FUNCTION: addClient
+ *
+ * DATE:
+ * Dec. 2, 2017
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t addClient(const int local, const int remote, const uint32_t rule);
+ *
+ * PARAMETERS:
+ * const int local - The accepted client socket
+ * const int remote - The upstream socket
+ * const uint32_t rule - The index of the rule the client was accepted on
+ *
+ * RETURNS:
+ * size_t - The index of the newly created client entry, or CLIENT_NONE if the table is full
+ *
+ * NOTES:
+ * Released entries are reused first, then a new chunk is allocated once the current ones are full.
+ */
+size_t addClient(const int local, const int remote, const uint32_t rule) {
+    pthread_mutex_lock(&clientLock);
+    uint32_t index = clientFreeHead;
+    if (index != CLIENT_NONE) {
+        clientFreeHead = lookupClient(index)->next_free;
+    } else {
+        if (clientUsed == clientMax) {
+            if (clientMax / CLIENT_CHUNK_SIZE == CLIENT_CHUNK_COUNT) {
+                pthread_mutex_unlock(&clientLock);
+                return CLIENT_NONE;
+            }
+            clientList[clientMax / CLIENT_CHUNK_SIZE] = checked_calloc(CLIENT_CHUNK_SIZE, sizeof(struct client));
+            connectList[clientMax / CLIENT_CHUNK_SIZE] = checked_calloc(CLIENT_CHUNK_SIZE, sizeof(struct client_connect *));
+            clientMax += CLIENT_CHUNK_SIZE;
+        }
+        index = clientUsed++;
+    }
+    initClientStruct(lookupClient(index), local, remote, rule);
+    ++clientCount;
+    pthread_mutex_unlock(&clientLock);
+    return index;
+}
+
+/*
+ * FUNCTION: initClientStruct
+ *
+ * DATE:
+ * Dec. 2, 2017
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void initClientStruct(struct client *newClient, const int local, const int remote, const uint32_t rule);
+ *
+ * PARAMETERS:
+ * struct client *newClient - A pointer to the new client's struct
+ * const int local - The accepted client socket
+ * const int remote - The upstream socket
+ * const uint32_t rule - The index of the rule the client was accepted on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * No pipes are allocated here, forward_traffic attaches them only while data is in flight.
+ * The generation is bumped so stale epoll events for the previous session are ignored.
+ */
+void initClientStruct(struct client *newClient, const int local, const int remote, const uint32_t rule) {
+    const uint32_t generation = ((atomic_load(&newClient->state) >> STATE_GEN_SHIFT) + 1) & STATE_GEN_MASK;
+
+    newClient->local = local;
+    newClient->remote = remote;
+    newClient->rule = rule;
+    newClient->connect_us = 0;
+    newClient->start_ms = monotonic_ms();
+    for (int i = 0; i < 2; ++i) {
+        newClient->pipes[i][0] = -1;
+        newClient->pipes[i][1] = -1;
+        newClient->bytes[i] = 0;
+        atomic_store(&newClient->pending[i], 0);
+    }
+    atomic_store(&newClient->state, generation << STATE_GEN_SHIFT);
+}
+
+/*
+ * FUNCTION: lookupClient
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct client *lookupClient(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of the client entry
+ *
+ * RETURNS:
+ * struct client * - The client entry at that index
+ */
+struct client *lookupClient(const uint32_t index) {
+    return &clientList[index >> CLIENT_CHUNK_SHIFT][index & (CLIENT_CHUNK_SIZE - 1)];
+}
+
+/*
+ * FUNCTION: lookupRule
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct rule *lookupRule(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of a rule slot below ruleCount
+ *
+ * RETURNS:
+ * struct rule * - The rule at that index
+ */
+struct rule *lookupRule(const uint32_t index) {
+    return &ruleList[index >> RULE_CHUNK_SHIFT][index & (RULE_CHUNK_SIZE - 1)];
+}
+
+/*
+ * FUNCTION: removeClient
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void removeClient(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of the client entry to release
+ *
+ * RETURNS:
+ * void
+ */
+void removeClient(const uint32_t index) {
+    pthread_mutex_lock(&clientLock);
+    lookupClient(index)->next_free = clientFreeHead;
+    clientFreeHead = index;
+    --clientCount;
+    pthread_mutex_unlock(&clientLock);
+}
+
+/*
+ * FUNCTION: handleIncomingConnection
+ *
+ * DATE:
+ * Dec. 2, 2017
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void handleIncomingConnection(const int listen_sock, const uint32_t index, const uint32_t offset);
+ *
+ * PARAMETERS:
+ * const int listen_sock - The listening socket that had the event
+ * const uint32_t index - The index of the rule the listening socket belongs to
+ * const uint32_t offset - Which port of the rule's range the listening socket is on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Accepts every pending connection, since the listener is edge triggered.
+ * Each accepted client gets its own client entry, and its upstream connect is only started here,
+ * so the client is added with no upstream and attached once the connect finishes from the event loop.
+ * Its sockets go on the accepting worker's group epoll set, which is the one the listener is on.
+ */
+void handleIncomingConnection(const int listen_sock, const uint32_t index, const uint32_t offset) {
+    const struct rule *rule = lookupRule(index);
+    for (;;) {
+        struct sockaddr_in peer;
+        socklen_t peerLen = sizeof(struct sockaddr_in);
+        int local = accept4(listen_sock, (struct sockaddr *) &peer, &peerLen, SOCK_NONBLOCK);
+        STAT_ADD(accepts, 1);
+        if (local == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                //No incoming connections, ignore the error
+                return;
+            }
+            if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            return;
+        }
+        TRACE2(accept, index, local);
+
+        //Tunnel sockets belong to their link rather than the client table
+        if (rule->mode == RULE_TUNNEL) {
+            tunnel_open_channel(local, index);
+            continue;
+        }
+        if (rule->mode == RULE_TUNNEL_PEER) {
+            tunnel_accept_link(local, index);
+            continue;
+        }
+
+        size_t client = addClient(local, -1, index);
+        if (client == CLIENT_NONE) {
+            fprintf(stderr, "Client table is full, dropping connection\n");
+            close(local);
+            continue;
+        }
+        struct client *entry = lookupClient(client);
+        const uint32_t generation = atomic_load(&entry->state) >> STATE_GEN_SHIFT;
+
+        //Routed and proxy clients get their upstream once the first bytes say where they want to go, fast open clients once there are bytes to send
+        if (rule->mode != RULE_ROUTED && rule->mode != RULE_PROXY && !rule->fastopen_connect
+                && connectUpstream(entry, client, generation, &peer, offset) == -1) {
+            //Never registered, so the entry can go straight back without a close reason
+            close(local);
+            atomic_fetch_or(&entry->state, STATE_DEAD);
+            removeClient(client);
+            continue;
+        }
+        STAT_ADD(sessions, 1);
+        TRACE2(session_open, client, index);
+
+        if (rule->nodelay) {
+            setNoDelay(local);
+        }
+        if (rule->quickack) {
+            setQuickAck(local);
+        }
+        if (settings.busy_poll_sockets) {
+            setBusyPoll(local, settings.busy_poll_sockets);
+        }
+        if ((rule->mode == RULE_ROUTED || rule->fastopen_connect) && rule->wait_ms
+                && !startSniffTimer(entry, client, generation, rule->wait_ms)) {
+            perror("timerfd");
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u64 = ((uint64_t) client << 32) + ((uint64_t) generation << STATE_GEN_SHIFT);
+
+        addEpollSocket(localGroup->epoll, local, &ev);
+    }
+}
+
+/*
+ * FUNCTION: connectUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int connectUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const struct sockaddr_in *peer, const uint32_t offset);
+ *
+ * PARAMETERS:
+ * struct client *entry - The newly accepted client
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to tag the connect's events with
+ * const struct sockaddr_in *peer - The address of the accepted client
+ * const uint32_t offset - Which port of the rule's range the client connected to
+ *
+ * RETURNS:
+ * int - 0 once the upstream connect is under way, -1 on failure
+ *
+ * NOTES:
+ * Transparent rules refuse connections made directly to the listener, since forwarding them would loop back.
+ */
+static int connectUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const struct sockaddr_in *peer, const uint32_t offset) {
+    struct rule *rule = lookupRule(entry->rule);
+    if (rule->mode != RULE_STATIC) {
+        struct sockaddr_in dst;
+        if (getOriginalDestination(entry->local, rule->mode == RULE_TPROXY, &dst) == -1) {
+            return -1;
+        }
+        struct sockaddr_in self;
+        socklen_t selfLen = sizeof(struct sockaddr_in);
+        if (rule->mode == RULE_REDIRECT && getsockname(entry->local, (struct sockaddr *) &self, &selfLen) == 0
+                && self.sin_addr.s_addr == dst.sin_addr.s_addr && self.sin_port == dst.sin_port) {
+            fprintf(stderr, "Connection was not redirected, refusing to forward to ourselves\n");
+            return -1;
+        }
+        return adoptUpstream(index, generation, establishTransparentConnection(&dst, (rule->spoof && peer->sin_family == AF_INET) ? peer : NULL));
+    }
+    const struct addrinfo *upstream = resolve_rule(rule);
+    struct addrinfo copies[CONNECT_MAX_ATTEMPTS];
+    struct sockaddr_storage addresses[CONNECT_MAX_ATTEMPTS];
+    if (rule->port_mapped && offset && upstream) {
+        upstream = shift_upstream(upstream, rule->output_port + offset, copies, addresses);
+    }
+    return startUpstream(entry, index, generation, rule->address, upstream, NULL, 0);
+}
+
+/*
+ * FUNCTION: shift_upstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static const struct addrinfo *shift_upstream(const struct addrinfo *upstream, const uint16_t port, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]);
+ *
+ * PARAMETERS:
+ * const struct addrinfo *upstream - The rule's resolved upstream, for its first output port
+ * const uint16_t port - The port to connect to instead
+ * struct addrinfo copies[static CONNECT_MAX_ATTEMPTS] - Filled with the copied list
+ * struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS] - Filled with the copied addresses
+ *
+ * RETURNS:
+ * const struct addrinfo * - The copied list with every address on port
+ *
+ * NOTES:
+ * The copy is on the caller's stack, so a range is resolved once however many ports it maps.
+ * Only as many addresses as a connect will try are copied.
+ */
+static const struct addrinfo *shift_upstream(const struct addrinfo *upstream, const uint16_t port, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]) {
+    size_t count = 0;
+    for (const struct addrinfo *address = upstream; address && count < CONNECT_MAX_ATTEMPTS; address = address->ai_next) {
+        if (address->ai_addrlen > sizeof(struct sockaddr_storage)) {
+            continue;
+        }
+        copies[count] = *address;
+        memcpy(&addresses[count], address->ai_addr, address->ai_addrlen);
+        if (address->ai_family == AF_INET) {
+            ((struct sockaddr_in *) &addresses[count])->sin_port = htons(port);
+        } else if (address->ai_family == AF_INET6) {
+            ((struct sockaddr_in6 *) &addresses[count])->sin6_port = htons(port);
+        }
+        copies[count].ai_addr = (struct sockaddr *) &addresses[count];
+        copies[count].ai_next = NULL;
+        if (count) {
+            copies[count - 1].ai_next = &copies[count];
+        }
+        ++count;
+    }
+    return (count) ? copies : NULL;
+}
+
+/*
+ * FUNCTION: routeClient
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int routeClient(struct client *entry, const uint32_t index, const uint32_t generation);
+ *
+ * PARAMETERS:
+ * struct client *entry - The routed client that has no upstream yet
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to register the upstream with
+ *
+ * RETURNS:
+ * int - 1 once the upstream is connected, 0 if more client data is needed or the connect is under way, -1 if the client can't be routed
+ *
+ * NOTES:
+ * The client's data is only peeked at, so the full stream is still spliced to the upstream afterwards.
+ * A protocol route takes precedence over host routes, which are only used when no protocol signature matches.
+ * Once the rule's wait runs out a client that sent nothing takes the silent route,
+ * and one that sent too little to route on takes the default route.
+ */
+static int routeClient(struct client *entry, const uint32_t index, const uint32_t generation) {
+    unsigned char buffer[ROUTE_PEEK_SIZE];
+    char host[ROUTE_HOST_SIZE];
+    int found = 0;
+
+    const ssize_t n = recv(entry->local, buffer, sizeof(buffer), MSG_PEEK);
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        if (!sniffTimerExpired(entry)) {
+            return 0;
+        }
+        snprintf(host, sizeof(host), "%s%s", SNIFF_PREFIX, SNIFF_SILENT);
+        found = 1;
+    } else if (n == 0) {
+        return -1;
+    } else {
+        const char *protocol;
+        const int sniffed = (lookupRule(entry->rule)->sniff) ? sniff_match(lookupRule(entry->rule)->sniff, buffer, n, &protocol) : -1;
+        if (sniffed == 1) {
+            snprintf(host, sizeof(host), "%s%s", SNIFF_PREFIX, protocol);
+            found = 1;
+        } else if (sniffed == -1) {
+            found = route_extract_host(buffer, n, host, sizeof(host));
+        }
+        if (found == 0 && !sniffTimerExpired(entry)) {
+            return 0;
+        }
+    }
+    stopSniffTimer(entry);
+
+    struct route *route = route_lookup(entry->rule, (found == 1) ? host : NULL);
+    if (route == NULL) {
+        fprintf(stderr, "No route for host %s\n", (found == 1) ? host : "(none)");
+        return -1;
+    }
+
+    if (startUpstream(entry, index, generation, route->address, resolve_upstream(&route->upstream, route->address, route->port, &route->retry_ms), NULL, 0) == -1) {
+        return -1;
+    }
+    return finishUpstream(entry, index, generation);
+}
+
+/*
+ * FUNCTION: proxyClient
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int proxyClient(struct client *entry, const uint32_t index, const uint32_t generation);
+ *
+ * PARAMETERS:
+ * struct client *entry - The proxy client that has no upstream yet
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to register the upstream with
+ *
+ * RETURNS:
+ * int - 1 once the destination is connected, 0 if more of the handshake is needed or the destination is pending, -1 if the client can't be connected
+ *
+ * NOTES:
+ * The destination is handed to the resolver threads, and its lookup's event goes on this worker's group epoll set with the client's connect tag,
+ * so the client waits in PROXY_RESOLVING and then PROXY_CONNECTING without any worker blocking on it.
+ * Anything the client sent after its request is left on the socket to be spliced to the destination.
+ */
+static int proxyClient(struct client *entry, const uint32_t index, const uint32_t generation) {
+    if (entry->proxy_stage == PROXY_RESOLVING) {
+        return proxyResolved(entry, index, generation);
+    }
+    if (entry->proxy_stage == PROXY_CONNECTING) {
+        return finishUpstream(entry, index, generation);
+    }
+    struct proxy_request request;
+    const int result = proxy_handshake(entry->local, &entry->proxy_stage, lookupRule(entry->rule)->proxy, &request);
+    if (result != 1) {
+        return result;
+    }
+
+    struct client_connect *pending = checked_malloc(sizeof(struct client_connect));
+    pending->request = request;
+    pending->epoll = localGroup->epoll;
+    if ((pending->lookup = resolve_lookup_start(request.host, request.port)) == NULL) {
+        free(pending);
+        proxy_reply(entry->local, &request, PROXY_UNREACHABLE, -1);
+        return -1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.u64 = ((uint64_t) index << 32) + ((uint64_t) generation << STATE_GEN_SHIFT) + EV_CONNECT_BIT};
+    if (epoll_ctl(pending->epoll, EPOLL_CTL_ADD, pending->lookup->event, &ev) == -1) {
+        perror("epoll_ctl");
+        resolve_lookup_release(pending->lookup);
+        free(pending);
+        proxy_reply(entry->local, &request, PROXY_FAILED, -1);
+        return -1;
+    }
+    *lookupConnect(index) = pending;
+    entry->proxy_stage = PROXY_RESOLVING;
+    return 0;
+}
+
+/*
+ * FUNCTION: proxyResolved
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int proxyResolved(struct client *entry, const uint32_t index, const uint32_t generation);
+ *
+ * PARAMETERS:
+ * struct client *entry - The proxy client waiting on its destination's lookup
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to tag the connect's events with
+ *
+ * RETURNS:
+ * int - 1 if the destination connected at once, 0 while the lookup or connect is pending, -1 if the client can't be connected
+ *
+ * NOTES:
+ * Only resolved addresses the rule allows are raced, and a client asking for none of them is told it isn't allowed.
+ */
+static int proxyResolved(struct client *entry, const uint32_t index, const uint32_t generation) {
+    const struct rule *rule = lookupRule(entry->rule);
+    struct client_connect **slot = lookupConnect(index);
+    struct client_connect *pending = *slot;
+    struct addrinfo *resolved;
+    if (!resolve_lookup_done(pending->lookup, &resolved)) {
+        return 0;
+    }
+    epoll_ctl(pending->epoll, EPOLL_CTL_DEL, pending->lookup->event, NULL);
+    resolve_lookup_release(pending->lookup);
+    pending->lookup = NULL;
+
+    struct addrinfo copies[CONNECT_MAX_ATTEMPTS];
+    struct sockaddr_storage addresses[CONNECT_MAX_ATTEMPTS];
+    const struct addrinfo *allowed = (resolved) ? proxy_filter(rule->proxy, resolved, copies, addresses) : NULL;
+    const uint64_t tag = ((uint64_t) index << 32) + ((uint64_t) generation << STATE_GEN_SHIFT) + EV_CONNECT_BIT;
+    if (allowed && startConnectRace(&pending->race, allowed, rule->sources, NULL, 0, localGroup->epoll, tag)) {
+        freeaddrinfo(resolved);
+        entry->proxy_stage = PROXY_CONNECTING;
+        return finishUpstream(entry, index, generation);
+    }
+
+    if (resolved && allowed == NULL) {
+        fprintf(stderr, "Proxy destination %s is not allowed on %s\n", pending->request.host, rule->listen_address);
+    }
+    proxy_reply(entry->local, &pending->request, (resolved == NULL) ? PROXY_UNREACHABLE : (allowed) ? PROXY_FAILED : PROXY_DENIED, -1);
+    if (resolved) {
+        freeaddrinfo(resolved);
+    }
+    *slot = NULL;
+    free(pending);
+    return -1;
+}
+
+/*
+ * FUNCTION: fastOpenClient
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int fastOpenClient(struct client *entry, const uint32_t index, const uint32_t generation);
+ *
+ * PARAMETERS:
+ * struct client *entry - The fast open client that has no upstream yet
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to register the upstream with
+ *
+ * RETURNS:
+ * int - 1 once the upstream is connected, 0 if the client hasn't sent anything yet or the connect is under way, -1 if the upstream can't be reached
+ *
+ * NOTES:
+ * The client's first bytes are peeked at and handed to the upstream's SYN with a non-blocking MSG_FASTOPEN sendto,
+ * and the connect is finished from epoll like any other. Only what the SYN carried is consumed once it wins,
+ * so whatever didn't fit is spliced as usual once the upstream is attached.
+ * Once the rule's wait runs out a client that sent nothing is connected without data, for protocols where the server speaks first.
+ */
+static int fastOpenClient(struct client *entry, const uint32_t index, const uint32_t generation) {
+    struct rule *rule = lookupRule(entry->rule);
+    unsigned char buffer[FASTOPEN_PEEK_SIZE];
+
+    const ssize_t n = recv(entry->local, buffer, sizeof(buffer), MSG_PEEK);
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        if (!sniffTimerExpired(entry)) {
+            return 0;
+        }
+    } else if (n == 0) {
+        return -1;
+    }
+    stopSniffTimer(entry);
+
+    const struct addrinfo *upstream = resolve_rule(rule);
+    struct addrinfo copies[CONNECT_MAX_ATTEMPTS];
+    struct sockaddr_storage addresses[CONNECT_MAX_ATTEMPTS];
+    struct sockaddr_in self;
+    socklen_t selfLen = sizeof(struct sockaddr_in);
+    if (rule->port_mapped && upstream && getsockname(entry->local, (struct sockaddr *) &self, &selfLen) == 0) {
+        upstream = shift_upstream(upstream, rule->output_port + (ntohs(self.sin_port) - rule->listen_port), copies, addresses);
+    }
+
+    if (startUpstream(entry, index, generation, rule->address, upstream, (n > 0) ? buffer : NULL, (n > 0) ? (size_t) n : 0) == -1) {
+        return -1;
+    }
+    return finishUpstream(entry, index, generation);
+}
+
+/*
+ * FUNCTION: startUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int startUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const char *address, const struct addrinfo *upstream, const unsigned char *data, const size_t len);
+ *
+ * PARAMETERS:
+ * struct client *entry - The client that has no upstream yet
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to tag the connect's events with
+ * const char *address - The upstream address string, checked for a unix:/path
+ * const struct addrinfo *upstream - The resolved upstream, NULL for unix sockets or if it couldn't be resolved
+ * const unsigned char *data - Bytes to send in the first attempt's SYN, or NULL
+ * const size_t len - How many bytes data holds
+ *
+ * RETURNS:
+ * int - 0 once the connect is under way, -1 if it couldn't be started
+ *
+ * NOTES:
+ * The attempts and their timer go on this worker's group epoll set with the client's connect tag,
+ * so the connect is finished by finishUpstream from whichever worker owns the client's inbound direction next.
+ * A unix socket has a single destination, so its connect is adopted by adoptUpstream instead.
+ */
+static int startUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const char *address, const struct addrinfo *upstream, const unsigned char *data, const size_t len) {
+    if (isUnixAddress(address)) {
+        return adoptUpstream(index, generation, startConnection(address, NULL, NULL));
+    }
+    struct client_connect *pending = checked_malloc(sizeof(struct client_connect));
+    pending->lookup = NULL;
+    const uint64_t tag = ((uint64_t) index << 32) + ((uint64_t) generation << STATE_GEN_SHIFT) + EV_CONNECT_BIT;
+    if (upstream == NULL || !startConnectRace(&pending->race, upstream, lookupRule(entry->rule)->sources, data, len, localGroup->epoll, tag)) {
+        free(pending);
+        return -1;
+    }
+    *lookupConnect(index) = pending;
+    return 0;
+}
+
+/*
+ * FUNCTION: adoptUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int adoptUpstream(const uint32_t index, const uint32_t generation, const int sock);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of a client that has no upstream yet
+ * const uint32_t generation - The session generation to tag the connect's events with
+ * const int sock - A non-blocking socket with its connect under way, or -1 if it couldn't be started
+ *
+ * RETURNS:
+ * int - 0 once the connect is being waited on, -1 if sock is -1 or couldn't be added to epoll
+ *
+ * NOTES:
+ * For upstreams with a single destination, unix sockets and transparent rules, which are finished by finishUpstream like a race.
+ */
+static int adoptUpstream(const uint32_t index, const uint32_t generation, const int sock) {
+    if (sock == -1) {
+        return -1;
+    }
+    struct client_connect *pending = checked_malloc(sizeof(struct client_connect));
+    pending->lookup = NULL;
+    const uint64_t tag = ((uint64_t) index << 32) + ((uint64_t) generation << STATE_GEN_SHIFT) + EV_CONNECT_BIT;
+    if (!adoptConnectRace(&pending->race, sock, localGroup->epoll, tag)) {
+        free(pending);
+        return -1;
+    }
+    *lookupConnect(index) = pending;
+    return 0;
+}
+
+/*
+ * FUNCTION: finishUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int finishUpstream(struct client *entry, const uint32_t index, const uint32_t generation);
+ *
+ * PARAMETERS:
+ * struct client *entry - The client whose connect is under way
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to register the upstream with
+ *
+ * RETURNS:
+ * int - 1 once the upstream is attached, 0 while the connect is still under way, -1 if it failed
+ *
+ * NOTES:
+ * Never blocks, so it is safe to call for every event the client gets until its connect is done.
+ */
+static int finishUpstream(struct client *entry, const uint32_t index, const uint32_t generation) {
+    struct client_connect **slot = lookupConnect(index);
+    struct client_connect *pending = *slot;
+    int result = stepConnectRace(&pending->race);
+    if (result == 0) {
+        return 0;
+    }
+    *slot = NULL;
+    //A fast open SYN's data is still queued on the client socket, and must not be spliced a second time
+    if (result == 1 && pending->race.sent) {
+        unsigned char buffer[FASTOPEN_PEEK_SIZE];
+        if (recv(entry->local, buffer, pending->race.sent, 0) != (ssize_t) pending->race.sent) {
+            close(pending->race.winner);
+            result = -1;
+        }
+    }
+    if (lookupRule(entry->rule)->mode == RULE_PROXY) {
+        proxy_reply(entry->local, &pending->request, (result == 1) ? PROXY_OK : PROXY_FAILED, (result == 1) ? pending->race.winner : -1);
+    }
+    if (result == 1) {
+        attachUpstream(entry, index, generation, pending->race.winner, &pending->race.begun);
+    }
+    free(pending);
+    return result;
+}
+
+/*
+ * FUNCTION: cancelUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void cancelUpstream(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of a client with no upstream
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Does nothing if the client has no connect under way.
+ */
+static void cancelUpstream(const uint32_t index) {
+    struct client_connect **slot = lookupConnect(index);
+    if (*slot && (*slot)->lookup) {
+        //The lookup may still be in flight, so its event is only closed once the resolver thread lets go of it too
+        epoll_ctl((*slot)->epoll, EPOLL_CTL_DEL, (*slot)->lookup->event, NULL);
+        resolve_lookup_release((*slot)->lookup);
+        free(*slot);
+        *slot = NULL;
+    } else if (*slot) {
+        cancelConnectRace(&(*slot)->race);
+        free(*slot);
+        *slot = NULL;
+    }
+}
+
+/*
+ * FUNCTION: lookupConnect
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct client_connect **lookupConnect(const uint32_t index);
+ *
+ * PARAMETERS:
+ * const uint32_t index - The index of the client entry
+ *
+ * RETURNS:
+ * struct client_connect ** - Where the client's pending connect is kept, holding NULL if there is none
+ */
+static struct client_connect **lookupConnect(const uint32_t index) {
+    return &connectList[index >> CLIENT_CHUNK_SHIFT][index & (CLIENT_CHUNK_SIZE - 1)];
+}
+
+/*
+ * FUNCTION: attachUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void attachUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const int remote, const struct timespec *started);
+ *
+ * PARAMETERS:
+ * struct client *entry - The client that had no upstream
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to register the upstream with
+ * const int remote - The newly connected upstream
+ * const struct timespec *started - When the connect began, for the access log
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Sets the upstream up as an accepted client's would have been, so it is forwarded like any other from here on.
+ */
+static void attachUpstream(struct client *entry, const uint32_t index, const uint32_t generation, const int remote, const struct timespec *started) {
+    setNonBlocking(remote);
+    entry->remote = remote;
+    entry->connect_us = elapsed_us(started);
+    TRACE2(session_connect, index, entry->connect_us);
+
+    if (lookupRule(entry->rule)->nodelay) {
+        setNoDelay(remote);
+    }
+    if (lookupRule(entry->rule)->quickack) {
+        setQuickAck(remote);
+    }
+    if (settings.busy_poll_sockets) {
+        setBusyPoll(remote, settings.busy_poll_sockets);
+    }
+
+    if (sockmapActive) {
+        sockmap_add_pair(entry->local, remote);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = ((uint64_t) index << 32) + ((uint64_t) generation << STATE_GEN_SHIFT) + EV_DIRECTION_BIT;
+
+    addEpollSocket(localGroup->epoll, remote, &ev);
+}
+
+/*
+ * FUNCTION: startSniffTimer
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool startSniffTimer(struct client *entry, const uint32_t index, const uint32_t generation, const uint32_t wait_ms);
+ *
+ * PARAMETERS:
+ * struct client *entry - The routed client that has no upstream yet
+ * const uint32_t index - The index of the client entry
+ * const uint32_t generation - The session generation to tag the timer's event with
+ * const uint32_t wait_ms - How long to wait for the client's first bytes
+ *
+ * RETURNS:
+ * bool - Whether the timer was started, a client without one waits for its bytes indefinitely
+ *
+ * NOTES:
+ * Must be called before the client socket is added to epoll, since routing it reads the timer.
+ * The timer is one shot, and wakes whichever worker gets its event to route the client.
+ */
+static bool startSniffTimer(struct client *entry, const uint32_t index, const uint32_t generation, const uint32_t wait_ms) {
+    const int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer == -1) {
+        return false;
+    }
+    const struct itimerspec wait = {.it_value = {wait_ms / 1000, (wait_ms % 1000) * 1000000l}};
+    if (timerfd_settime(timer, 0, &wait, NULL) == -1) {
+        close(timer);
+        return false;
+    }
+    entry->sniff_timer = timer + 1;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = ((uint64_t) index << 32) + ((uint64_t) generation << STATE_GEN_SHIFT) + EV_CONNECT_BIT;
+
+    addEpollSocket(localGroup->epoll, timer, &ev);
+    return true;
+}
+
+/*
+ * FUNCTION: sniffTimerExpired
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool sniffTimerExpired(const struct client *entry);
+ *
+ * PARAMETERS:
+ * const struct client *entry - The routed client that has no upstream yet
+ *
+ * RETURNS:
+ * bool - Whether the client's wait has run out, always false if its rule has no wait
+ *
+ * NOTES:
+ * Reading the timer resets it, so the caller must route the client once this returns true.
+ */
+static bool sniffTimerExpired(const struct client *entry) {
+    uint64_t expirations;
+    return entry->sniff_timer && read(entry->sniff_timer - 1, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+/*
+ * FUNCTION: stopSniffTimer
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void stopSniffTimer(struct client *entry);
+ *
+ * PARAMETERS:
+ * struct client *entry - The routed client that has no upstream yet
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Closing the timer removes it from epoll, and clears the field for connect_us which shares it.
+ */
+static void stopSniffTimer(struct client *entry) {
+    if (entry->sniff_timer) {
+        close(entry->sniff_timer - 1);
+        entry->sniff_timer = 0;
+    }
+}
+
+/*
+ * FUNCTION: handleSocketError
+ *
+ * DATE:
+ * Dec. 2, 2017
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void handleSocketError(struct client *entry, const uint32_t index, const enum close_reason reason);
+ *
+ * PARAMETERS:
+ * struct client *entry - The client that had the error
+ * const uint32_t index - The index of the client entry
+ * const enum close_reason reason - Why the client is being closed
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Must only be called once no thread is forwarding on the client.
+ * The access log record is handed to this thread's ring, so no lock is taken or write made here.
+ */
+void handleSocketError(struct client *entry, const uint32_t index, const enum close_reason reason) {
+    debug_print("Disconnection/error on socket pair %d:%d\n", entry->local, entry->remote);
+    TRACE4(session_close, index, reason, entry->bytes[DIR_LOCAL_TO_REMOTE], entry->bytes[DIR_REMOTE_TO_LOCAL]);
+
+    if (entry->remote == -1) {
+        cancelUpstream(index);
+    }
+    if (entry->remote == -1 && (lookupRule(entry->rule)->mode == RULE_ROUTED || lookupRule(entry->rule)->fastopen_connect)) {
+        stopSniffTimer(entry);
+    } else if (entry->remote == -1) {
+        //A proxy client that never finished its handshake still holds its stage here
+        entry->proxy_stage = 0;
+    }
+    if (accessLogActive) {
+        access_log_session(entry, reason);
+    }
+
+    //Don't need to deregister socket from epoll
+    close(entry->local);
+    if (entry->remote != -1) {
+        close(entry->remote);
+    }
+
+    releaseClientPipes(entry);
+
+    removeClient(index);
+}
+
+/*
+ * FUNCTION: monotonic_ms
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * uint32_t monotonic_ms(void);
+ *
+ * RETURNS:
+ * uint32_t - A coarse monotonic millisecond clock, wrapping every 49 days
+ *
+ * NOTES:
+ * Uses the coarse clock, which is read from the vDSO without a syscall.
+ */
+uint32_t monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/*
+ * FUNCTION: elapsed_us
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t elapsed_us(const struct timespec *start);
+ *
+ * PARAMETERS:
+ * const struct timespec *start - A CLOCK_MONOTONIC time
+ *
+ * RETURNS:
+ * uint32_t - Microseconds since start, saturated at UINT32_MAX
+ */
+static uint32_t elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const int64_t us = (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+    return (us > UINT32_MAX) ? UINT32_MAX : (uint32_t) us;
+}
+
+/*
+ * FUNCTION: report_memory_usage
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void report_memory_usage(FILE *out);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the report
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Triggered by SIGUSR1 or the control socket, prints the resident set size divided across the active sessions.
+ * Used to check the per-session memory budget during soak runs.
+ */
+void report_memory_usage(FILE *out) {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        perror("statm");
+        return;
+    }
+    unsigned long size;
+    unsigned long resident;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) {
+        fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    const size_t rss = resident * sysconf(_SC_PAGESIZE);
+    const size_t sessions = clientCount;
+    fprintf(out, "Sessions: %zu, entries: %zu, RSS: %zu KiB, RSS per session: %zu bytes\n",
+            sessions, clientMax, rss / 1024, sessions ? rss / sessions : 0);
+    fprintf(out, "Pipe memory grown past the default: %zu KiB\n", pipeGrownMemory() / 1024);
+    stats_report(out);
+    for (size_t i = 0; i < ruleCount; ++i) {
+        const struct rule *rule = lookupRule(i);
+        if (rule->sources && atomic_load(&rule->status) != RULE_REMOVED) {
+            reportSourcePool(out, rule->listen_address, rule->sources);
+        }
+        if (rule->sniff && atomic_load(&rule->status) != RULE_REMOVED) {
+            sniff_report(out, rule->listen_address, rule->sniff);
+        }
+    }
+    for (size_t i = 0; i < workerMax && workerMax > 1; ++i) {
+        struct worker_state *state = atomic_load(&workerStates[i]);
+        if (state) {
+            fprintf(out, "Worker %zu: group: %u, CPU: %d, node: %d, queued directions: %zu, stolen: %lu\n", i, state->group, state->cpu, state->node,
+                    atomic_load_explicit(&state->queued, memory_order_relaxed),
+                    (unsigned long) atomic_load_explicit(&state->stolen, memory_order_relaxed));
+        }
+    }
+    if (accessLogActive) {
+        fprintf(out, "Access log records dropped: %lu\n", (unsigned long) access_log_dropped());
+    }
+    fflush(out);
+}
+
+/*
+ * FUNCTION: count_rule_sessions
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void count_rule_sessions(uint32_t *counts);
+ *
+ * PARAMETERS:
+ * uint32_t *counts - Zeroed array of ruleCount entries, filled with each rule's active sessions
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Reads the client table without taking clientLock, so the counts are a snapshot that may be slightly stale.
+ */
+void count_rule_sessions(uint32_t *counts) {
+    const size_t used = clientUsed;
+    for (size_t i = 0; i < used; ++i) {
+        const struct client *entry = lookupClient(i);
+        if (!(atomic_load(&entry->state) & STATE_DEAD) && entry->rule < ruleCount) {
+            ++counts[entry->rule];
+        }
+    }
+}
+
+/*
+ * FUNCTION: list_rule_sessions
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void list_rule_sessions(FILE *out, const uint32_t rule);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the sessions
+ * const uint32_t rule - The rule whose sessions to list
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Prints one line per active session with its age and bytes forwarded each way, and which ends have closed their half.
+ * Like count_rule_sessions this is a lock free snapshot.
+ */
+void list_rule_sessions(FILE *out, const uint32_t rule) {
+    const size_t used = clientUsed;
+    const uint32_t now = monotonic_ms();
+    for (size_t i = 0; i < used; ++i) {
+        const struct client *entry = lookupClient(i);
+        const uint32_t state = atomic_load(&entry->state);
+        if (!(state & STATE_DEAD) && entry->rule == rule) {
+            fprintf(out, "session %zu age_ms=%u bytes_out=%lu bytes_in=%lu%s%s\n", i, now - entry->start_ms,
+                    (unsigned long) entry->bytes[DIR_LOCAL_TO_REMOTE], (unsigned long) entry->bytes[DIR_REMOTE_TO_LOCAL],
+                    (state & STATE_EOF(DIR_LOCAL_TO_REMOTE)) ? " client_eof" : "", (state & STATE_EOF(DIR_REMOTE_TO_LOCAL)) ? " backend_eof" : "");
+        }
+    }
+}
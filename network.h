@@ -10,18 +10,34 @@
  * void network_cleanup(void);
  * void process_packet(const unsigned char * const buffer, const size_t bufsize, struct client *src);
  * void startServer(void);
- * size_t addClient(int sock);
- * void initClientStruct(struct client *newClient, int sock);
- * void *eventLoop(void *epollfd);
- * void handleIncomingConnection(const int listen_sock, const int index);
- * void handleSocketError(struct client *entry);
+ * size_t addClient(const int local, const int remote, const uint32_t rule);
+ * void initClientStruct(struct client *newClient, const int local, const int remote, const uint32_t rule);
+ * struct client *lookupClient(const uint32_t index);
+ * struct rule *lookupRule(const uint32_t index);
+ * void removeClient(const uint32_t index);
+ * void *eventLoop(void *worker);
+ * void handleIncomingConnection(const int listen_sock, const uint32_t index, const uint32_t offset);
+ * void handleSocketError(struct client *entry, const uint32_t index, const enum close_reason reason);
  * void handleIncomingPacket(struct client *src);
- * void establish_forwarding_rule(const long listen_port, const char *addr, const char *output_port);
+ * size_t establish_forwarding_rule(const char *listen_addr, const char *addr, const char *output_port, const struct rule_options *options);
+ * size_t establish_routed_rule(const char *listen_addr, const char *host, const char *addr, const char *output_port, const struct rule_options *options);
+ * size_t find_rule(const char *listen_addr);
+ * bool parse_port_range(const char *text, uint16_t *first, uint32_t *count);
+ * bool close_rule(const uint32_t index, const enum rule_status status);
+ * int open_rule_listener(const uint32_t index);
+ * void adopt_listeners(const int *listeners);
+ * void count_rule_sessions(uint32_t *counts);
+ * void list_rule_sessions(FILE *out, const uint32_t rule);
+ * void report_memory_usage(FILE *out);
+ * uint32_t monotonic_ms(void);
  *
  * VARIABLES:
- * extern struct client **clientList - A list of all clients and connections
- * extern size_t clientCount - The current number of clients in the list
- * extern size_t clientCount - The current number of allocated client entries
+ * extern struct client **clientList - Chunk table of all client entries, CLIENT_CHUNK_SIZE per chunk
+ * extern size_t clientCount - The current number of active clients
+ * extern size_t clientMax - The current number of allocated client entries
+ * extern struct rule **ruleList - Chunk table of all configured forwarding rules, RULE_CHUNK_SIZE per chunk
+ * extern size_t ruleCount - The number of rule slots used, including removed rules
+ * extern int efd - The epoll descriptor shared by the workers of group 0, which also carries every tunnel
  *
  * DESIGNER: John Agapeyev
  *
@@ -30,33 +46,217 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#include <sys/socket.h>
 
+//Client entries are allocated in fixed chunks that never move, so pointers and indices stay valid
+#define CLIENT_CHUNK_SHIFT 12
+#define CLIENT_CHUNK_SIZE (1ul << CLIENT_CHUNK_SHIFT)
+#define CLIENT_CHUNK_COUNT 1024
+#define CLIENT_NONE UINT32_MAX
+
+//Epoll data tags, client entries are at least 4 byte aligned so the low bits are free
+#define EV_DIRECTION_BIT 1ul
+#define EV_LISTENER_BIT 2ul
+#define EV_TUNNEL_BIT 4ul
+#define EV_STEAL_BIT 8ul
+#define EV_CONNECT_BIT 16ul
+
+//Forwarding directions, local is the accepted socket and remote is the upstream
+#define DIR_LOCAL_TO_REMOTE 0
+#define DIR_REMOTE_TO_LOCAL 1
+
+//Why a session was torn down, kept in the session state and reported in the access log
+enum close_reason {
+    CLOSE_NONE,
+    CLOSE_EOF,
+    CLOSE_ERROR,
+    CLOSE_HANGUP,
+    CLOSE_NO_ROUTE
+};
+
+//Each direction's pending word holds the bytes parked in its pipe, and above them the pipe size class the flow has earned
+#define PENDING_BYTES_MASK 0xffffffu
+#define PENDING_CLASS_SHIFT 24
+
+/*
+ * Per-session record, kept to one cache line so that millions of mostly idle sessions fit in memory.
+ * Pipes are only attached while data is in flight in that direction, otherwise they are -1.
+ * State holds the per-direction ownership flags and close reason in the low bits and the session generation above them.
+ * Each direction's byte count is only written by the thread that owns that direction.
+ */
 struct client {
     int local;
     int remote;
-    bool enabled;
-    pthread_mutex_t *lock;
-    int pipes[2];
+    int pipes[2][2];
+    _Atomic uint32_t pending[2];
+    _Atomic uint32_t state;
+    uint32_t rule;
+    //A routed or fast open client's wait timer descriptor plus one, 0 for none, or a proxy client's handshake stage, until connect_us is set
+    union {
+        uint32_t next_free;
+        uint32_t connect_us;
+        uint32_t sniff_timer;
+        uint32_t proxy_stage;
+    };
+    uint32_t start_ms;
+    uint64_t bytes[2];
+};
+
+//Output address keywords for rules that forward to wherever the client originally connected
+#define TRANSPARENT_REDIRECT "transparent"
+#define TRANSPARENT_TPROXY "tproxy"
+#define TRANSPARENT_SPOOF "spoof"
+
+enum rule_mode {
+    RULE_STATIC,
+    RULE_REDIRECT,
+    RULE_TPROXY,
+    RULE_ROUTED,
+    RULE_TUNNEL,
+    RULE_TUNNEL_PEER,
+    RULE_PROXY
+};
+
+//Per-rule options, given as trailing name=value fields on a rule line
+struct rule_options {
+    uint32_t weight;
+    const char *sources;
+    uint32_t port_range;
+    uint32_t wait_ms;
+    const char *allow;
+    const char *user;
+    uint32_t defer_s;
+    uint32_t fastopen;
+    bool fastopen_connect;
+    bool nodelay;
+    bool quickack;
+    uint32_t group;
+};
+
+//A local address upstream connections are made from, and how often connecting from it found no free port
+struct source_address {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    _Atomic uint64_t connects;
+    _Atomic uint64_t exhausted;
+};
+
+//Source addresses a rule's upstream connections take in turn, and the ephemeral port range they use, 0 for the system's
+struct source_pool {
+    _Atomic uint32_t next;
+    uint32_t port_range;
+    size_t count;
+    struct source_address addresses[];
+};
+
+//Separates the addresses in a source option
+#define SOURCE_SEPARATOR "+"
+
+//Bytes a session may move in one direction before yielding its worker, scaled by its rule's weight
+#define TURN_BUDGET_DEFAULT 262144
+
+//Shortest run queue worth stealing from, and the most directions taken from it at once
+#define STEAL_MIN 2
+#define STEAL_MAX 64
+
+//Worker groups a rule can be given to, each with its own epoll set that only that group's workers wait on
+#define WORKER_GROUP_MAX 64
+
+//Rules are allocated in fixed chunks that never move, a port range rule takes one slot for all of its ports
+#define RULE_CHUNK_SHIFT 10
+#define RULE_CHUNK_SIZE (1ul << RULE_CHUNK_SHIFT)
+#define RULE_CHUNK_COUNT 4096
+#define RULE_MAX (RULE_CHUNK_SIZE * RULE_CHUNK_COUNT)
+
+//Listener epoll data keeps the rule index in its top 32 bits, and which port of its range above the tag bits
+#define LISTENER_OFFSET_SHIFT 8
+
+//Separates the first and last port of a range rule, as in 20000-29999
+#define PORT_RANGE_SEPARATOR '-'
+
+//Draining rules stop accepting but keep their sessions, removed rules are also hidden from the control socket
+enum rule_status {
+    RULE_ACTIVE,
+    RULE_DRAINING,
+    RULE_REMOVED
+};
+
+struct sniff_table;
+struct proxy_rule;
+
+/*
+ * Rules never move and their fields are not changed once the listener is published to epoll,
+ * so workers read them without locking.
+ * Whoever clears enabled owns closing the listener.
+ * A range rule listens on port_count ports from listen_port, and if port_mapped, the one at listen_port + n connects to output_port + n.
+ * A fastopen_connect rule connects upstream once the client's first bytes arrive, sending them with the SYN.
+ * Group picks which worker group accepts and serves the rule's sessions.
+ */
+struct rule {
+    char *listen_address;
+    int listen;
+    atomic_bool enabled;
+    _Atomic uint32_t status;
+    enum rule_mode mode;
+    bool spoof;
+    uint32_t weight;
+    uint32_t tunnel;
+    char *address;
+    char *port;
+    _Atomic uint32_t retry_ms;
+    struct addrinfo *_Atomic upstream;
+    struct source_pool *sources;
+    struct sniff_table *sniff;
+    struct proxy_rule *proxy;
+    uint32_t wait_ms;
+    uint16_t listen_port;
+    uint16_t output_port;
+    uint32_t port_count;
+    bool port_mapped;
+    uint32_t defer_s;
+    uint32_t fastopen;
+    bool fastopen_connect;
+    bool nodelay;
+    bool quickack;
+    uint32_t group;
 };
 
 extern struct client **clientList;
 extern size_t clientCount;
 extern size_t clientMax;
+extern struct rule **ruleList;
+extern size_t ruleCount;
+extern int efd;
 
 void network_init(void);
 void network_cleanup(void);
 void process_packet(const unsigned char * const buffer, const size_t bufsize, struct client *src);
 void startServer(void);
-size_t addClient(int sock);
-void initClientStruct(struct client *newClient, int sock);
-void *eventLoop(void *epollfd);
-void handleIncomingConnection(const int listen_sock, const int index);
-void handleSocketError(struct client *entry);
+size_t addClient(const int local, const int remote, const uint32_t rule);
+void initClientStruct(struct client *newClient, const int local, const int remote, const uint32_t rule);
+struct client *lookupClient(const uint32_t index);
+struct rule *lookupRule(const uint32_t index);
+void removeClient(const uint32_t index);
+void *eventLoop(void *worker);
+void handleIncomingConnection(const int listen_sock, const uint32_t index, const uint32_t offset);
+void handleSocketError(struct client *entry, const uint32_t index, const enum close_reason reason);
 void handleIncomingPacket(struct client *src);
-void establish_forwarding_rule(const long listen_port, const char *addr, const char *output_port);
+size_t establish_forwarding_rule(const char *listen_addr, const char *addr, const char *output_port, const struct rule_options *options);
+size_t establish_routed_rule(const char *listen_addr, const char *host, const char *addr, const char *output_port, const struct rule_options *options);
+size_t find_rule(const char *listen_addr);
+bool parse_port_range(const char *text, uint16_t *first, uint32_t *count);
+bool close_rule(const uint32_t index, const enum rule_status status);
+int open_rule_listener(const uint32_t index);
+void adopt_listeners(const int *listeners);
+void count_rule_sessions(uint32_t *counts);
+void list_rule_sessions(FILE *out, const uint32_t rule);
+void report_memory_usage(FILE *out);
+uint32_t monotonic_ms(void);
 
 #endif
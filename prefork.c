@@ -0,0 +1,385 @@
+/*
+ * SOURCE FILE: prefork.c - Implementation of functions declared in prefork.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void prefork_run(void);
+ * static bool spawn_process(const size_t slot);
+ * static void run_process(const size_t slot);
+ * static void reap_processes(void);
+ * static void report_processes(FILE *out);
+ * static void release_listeners(const bool child);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * With processes set, the rules are parsed and their listeners opened once, by the supervisor,
+ * which then forks that many worker processes that each forward on their own SO_REUSEPORT listeners.
+ * A worker that dies only takes its own sessions with it, and the supervisor keeps its listeners open
+ * so connections queued on them wait for its replacement instead of being reset.
+ * Counters live in memory shared with every worker, so SIGUSR1 to the supervisor reports totals for all of them.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "prefork.h"
+#include "network.h"
+#include "socket.h"
+#include "stats.h"
+#include "macro.h"
+#include "main.h"
+#include "topology.h"
+
+static bool spawn_process(const size_t slot);
+static void run_process(const size_t slot);
+static void reap_processes(void);
+static void report_processes(FILE *out);
+static void release_listeners(const bool child);
+
+//A worker process, and the listeners it gets for each rule
+struct process_slot {
+    pid_t pid;
+    int *listeners;
+    uint32_t started;
+    uint32_t restartAt;
+    uint32_t restarts;
+};
+
+static struct process_slot *processList;
+static size_t processCount;
+
+/*
+ * FUNCTION: prefork_run
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void prefork_run(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Returns in the supervisor once every worker has been stopped, and in a worker once it stops forwarding.
+ * Tunnel rules keep their links in the one process, so any tunnel rule falls back to running as threads.
+ * The control socket is left closed, since a rule added through it would only reach one process.
+ */
+void prefork_run(void) {
+    for (size_t i = 0; i < ruleCount; ++i) {
+        const enum rule_mode mode = lookupRule(i)->mode;
+        if (mode == RULE_TUNNEL || mode == RULE_TUNNEL_PEER) {
+            fprintf(stderr, "Tunnel rules need a single process, ignoring processes\n");
+            settings.processes = 0;
+            startServer();
+            return;
+        }
+    }
+    if (settings.control_socket) {
+        fprintf(stderr, "The control socket can't be used with processes, ignoring it\n");
+        free(settings.control_socket);
+        settings.control_socket = NULL;
+    }
+
+    processCount = settings.processes;
+    processList = checked_calloc(processCount, sizeof(struct process_slot));
+    for (size_t i = 0; i < processCount; ++i) {
+        processList[i].listeners = checked_malloc(sizeof(int) * (ruleCount ? ruleCount : 1));
+    }
+    for (size_t i = 0; i < ruleCount; ++i) {
+        struct rule *rule = lookupRule(i);
+        //Port ranges would need a listener per port per process, so like unix sockets every process shares them
+        if (!atomic_load(&rule->enabled) || isUnixAddress(rule->listen_address) || rule->port_count > 1) {
+            for (size_t j = 0; j < processCount; ++j) {
+                processList[j].listeners[i] = rule->listen;
+            }
+            continue;
+        }
+        //The listener opened while parsing may not have SO_REUSEPORT, so every process gets a new one
+        close(rule->listen);
+        for (size_t j = 0; j < processCount; ++j) {
+            if ((processList[j].listeners[i] = open_rule_listener(i)) == -1) {
+                fatal_error("SO_REUSEPORT listener");
+            }
+        }
+        rule->listen = processList[0].listeners[i];
+    }
+
+    for (size_t i = 0; i < processCount; ++i) {
+        if (spawn_process(i)) {
+            run_process(i);
+            return;
+        }
+    }
+    printf("Started %zu worker processes\n", processCount);
+
+    const struct timespec pause = {0, PREFORK_POLL_MS * 1000000l};
+    while (isRunning) {
+        nanosleep(&pause, NULL);
+        if (dumpStats) {
+            dumpStats = 0;
+            report_processes(stdout);
+        }
+        reap_processes();
+
+        const uint32_t now = monotonic_ms();
+        for (size_t i = 0; i < processCount && isRunning; ++i) {
+            if (processList[i].pid == 0 && (int32_t) (now - processList[i].restartAt) >= 0 && spawn_process(i)) {
+                run_process(i);
+                return;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < processCount; ++i) {
+        if (processList[i].pid > 0) {
+            kill(processList[i].pid, SIGTERM);
+        }
+    }
+    for (size_t i = 0; i < processCount; ++i) {
+        if (processList[i].pid > 0) {
+            waitpid(processList[i].pid, NULL, 0);
+        }
+    }
+    release_listeners(false);
+}
+
+/*
+ * FUNCTION: spawn_process
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool spawn_process(const size_t slot);
+ *
+ * PARAMETERS:
+ * const size_t slot - Which worker process to start
+ *
+ * RETURNS:
+ * bool - True in the new worker process, false in the supervisor
+ *
+ * NOTES:
+ * A failed fork is retried after PREFORK_RESTART_MS.
+ */
+static bool spawn_process(const size_t slot) {
+    //Anything still buffered would otherwise be printed by both processes
+    fflush(stdout);
+    fflush(stderr);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        return true;
+    }
+    if (pid == -1) {
+        perror("fork");
+        processList[slot].restartAt = monotonic_ms() + PREFORK_RESTART_MS;
+        return false;
+    }
+    processList[slot].pid = pid;
+    processList[slot].started = monotonic_ms();
+    return false;
+}
+
+/*
+ * FUNCTION: run_process
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void run_process(const size_t slot);
+ *
+ * PARAMETERS:
+ * const size_t slot - Which worker process this is
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Runs in the forked worker, which keeps only its own listeners and is pinned to a core like a worker thread would be.
+ * Its own reuseport listeners are marked with that core, so the kernel hands it the connections whose packets arrive there.
+ */
+static void run_process(const size_t slot) {
+    for (size_t i = 0; i < processCount; ++i) {
+        if (i == slot) {
+            continue;
+        }
+        for (size_t j = 0; j < ruleCount; ++j) {
+            if (processList[i].listeners[j] != processList[slot].listeners[j]) {
+                close(processList[i].listeners[j]);
+            }
+        }
+    }
+    adopt_listeners(processList[slot].listeners);
+    stats_set_base(slot);
+
+    int cpuList[CPU_SETSIZE];
+    size_t cpuCount = topology_cpus(settings.cpus, cpuList, CPU_SETSIZE);
+    if (cpuCount == 0) {
+        cpuCount = topology_cpus(NULL, cpuList, CPU_SETSIZE);
+    }
+    if (cpuCount) {
+        const int cpu = cpuList[slot % cpuCount];
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        sched_setaffinity(0, sizeof(cpu_set_t), &cpus);
+        for (size_t i = 0; i < ruleCount; ++i) {
+            const struct rule *rule = lookupRule(i);
+            if (atomic_load(&rule->enabled) && !isUnixAddress(rule->listen_address) && rule->port_count == 1) {
+                setIncomingCpu(processList[slot].listeners[i], cpu);
+            }
+        }
+    }
+
+    startServer();
+    release_listeners(true);
+}
+
+/*
+ * FUNCTION: reap_processes
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void reap_processes(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Schedules a restart for every worker that exited.
+ * One that dies straight after starting is held back, so a worker that can't start doesn't fork in a loop.
+ */
+static void reap_processes(void) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < processCount; ++i) {
+            if (processList[i].pid != pid) {
+                continue;
+            }
+            if (WIFSIGNALED(status)) {
+                fprintf(stderr, "Worker process %zu (pid %d) killed by signal %d, restarting\n", i, (int) pid, WTERMSIG(status));
+            } else {
+                fprintf(stderr, "Worker process %zu (pid %d) exited with status %d, restarting\n", i, (int) pid, WEXITSTATUS(status));
+            }
+            const uint32_t now = monotonic_ms();
+            processList[i].pid = 0;
+            processList[i].restartAt = (now - processList[i].started < PREFORK_RESTART_MS) ? now + PREFORK_RESTART_MS : now;
+            ++processList[i].restarts;
+            break;
+        }
+    }
+}
+
+/*
+ * FUNCTION: report_processes
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void report_processes(FILE *out);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the report
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Sessions and memory are per process, so only the shared counters are summed.
+ * Send SIGUSR1 to a worker for its own sessions and memory.
+ */
+static void report_processes(FILE *out) {
+    stats_report(out);
+    for (size_t i = 0; i < processCount; ++i) {
+        fprintf(out, "Worker process %zu: pid %d, restarts: %u\n", i, (int) processList[i].pid, processList[i].restarts);
+    }
+    fflush(out);
+}
+
+/*
+ * FUNCTION: release_listeners
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void release_listeners(const bool child);
+ *
+ * PARAMETERS:
+ * const bool child - Whether this is a worker, which already closed every listener but its own
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The listeners the rule table points at are left for network_cleanup to close.
+ */
+static void release_listeners(const bool child) {
+    for (size_t i = 0; i < processCount; ++i) {
+        for (size_t j = 0; j < ruleCount && !child; ++j) {
+            if (processList[i].listeners[j] != lookupRule(j)->listen) {
+                close(processList[i].listeners[j]);
+            }
+        }
+        free(processList[i].listeners);
+    }
+    free(processList);
+    processList = NULL;
+}
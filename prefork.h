@@ -0,0 +1,26 @@
+/*
+ * HEADER FILE: prefork.h - Supervisor for running the forwarder as several worker processes
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void prefork_run(void);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef PREFORK_H
+#define PREFORK_H
+
+//How often the supervisor checks for exited workers and stats requests
+#define PREFORK_POLL_MS 100
+
+//A worker that exits sooner than this after starting waits this long before it is restarted
+#define PREFORK_RESTART_MS 1000
+
+void prefork_run(void);
+
+#endif
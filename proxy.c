@@ -0,0 +1,838 @@
+/*
+ * SOURCE FILE: proxy.c - Implementation of functions declared in proxy.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * struct proxy_rule *proxy_create(const char *allow, const char *user);
+ * void proxy_free(struct proxy_rule *proxy);
+ * int proxy_handshake(const int sock, uint32_t *stage, const struct proxy_rule *proxy, struct proxy_request *request);
+ * void proxy_reply(const int sock, const struct proxy_request *request, const enum proxy_result result, const int remote);
+ * bool proxy_allowed(const struct proxy_rule *proxy, const struct sockaddr *addr);
+ * const struct addrinfo *proxy_filter(const struct proxy_rule *proxy, const struct addrinfo *list, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]);
+ * static bool add_prefix(struct proxy_rule *proxy, const char *text);
+ * static bool address_key(const struct sockaddr *addr, uint8_t key[static 16]);
+ * static ssize_t socks_greeting(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage);
+ * static ssize_t socks_auth(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage);
+ * static ssize_t socks_request(const int sock, const uint8_t *buffer, const size_t size, struct proxy_request *request, uint32_t *stage);
+ * static ssize_t http_request(const int sock, uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, struct proxy_request *request, uint32_t *stage);
+ * static void socks_reply(const int sock, const uint8_t code, const int remote);
+ * static void send_reply(const int sock, const void *reply, const size_t size);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Every message is peeked at until it has all arrived, then read off the socket exactly,
+ * so nothing the client sends after its request is lost and it is spliced to the destination like any other data.
+ * Requests are parsed in place in the peek buffer, nothing is allocated per client.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include "proxy.h"
+#include "socket.h"
+#include "macro.h"
+#include "main.h"
+
+#define SOCKS_VERSION 5
+#define SOCKS_AUTH_VERSION 1
+#define SOCKS_AUTH_NONE 0
+#define SOCKS_AUTH_PASSWORD 2
+#define SOCKS_AUTH_UNUSABLE 0xff
+#define SOCKS_CONNECT 1
+#define SOCKS_ATYP_IPV4 1
+#define SOCKS_ATYP_DOMAIN 3
+#define SOCKS_ATYP_IPV6 4
+
+//SOCKS5 reply codes from RFC 1928
+#define SOCKS_SUCCEEDED 0
+#define SOCKS_GENERAL_FAILURE 1
+#define SOCKS_NOT_ALLOWED 2
+#define SOCKS_HOST_UNREACHABLE 4
+#define SOCKS_COMMAND_UNSUPPORTED 7
+#define SOCKS_ADDRESS_UNSUPPORTED 8
+
+static bool add_prefix(struct proxy_rule *proxy, const char *text);
+static bool address_key(const struct sockaddr *addr, uint8_t key[static 16]);
+static ssize_t socks_greeting(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage);
+static ssize_t socks_auth(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage);
+static ssize_t socks_request(const int sock, const uint8_t *buffer, const size_t size, struct proxy_request *request, uint32_t *stage);
+static ssize_t http_request(const int sock, uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, struct proxy_request *request, uint32_t *stage);
+static void socks_reply(const int sock, const uint8_t code, const int remote);
+static void send_reply(const int sock, const void *reply, const size_t size);
+
+//SOCKS5 reply code and HTTP status line for each result
+static const struct {
+    uint8_t code;
+    const char *status;
+} resultList[] = {
+    [PROXY_OK] = {SOCKS_SUCCEEDED, "200 Connection established"},
+    [PROXY_DENIED] = {SOCKS_NOT_ALLOWED, "403 Forbidden"},
+    [PROXY_UNREACHABLE] = {SOCKS_HOST_UNREACHABLE, "502 Bad Gateway"},
+    [PROXY_FAILED] = {SOCKS_GENERAL_FAILURE, "502 Bad Gateway"},
+};
+
+/*
+ * FUNCTION: proxy_create
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct proxy_rule *proxy_create(const char *allow, const char *user);
+ *
+ * PARAMETERS:
+ * const char *allow - Address prefixes such as 10.0.0.0/8 separated by PROXY_ALLOW_SEPARATOR, or NULL to allow nothing
+ * const char *user - The name:password clients must give, or NULL to accept clients without one
+ *
+ * RETURNS:
+ * struct proxy_rule * - The new proxy settings, to be freed with proxy_free, or NULL if either option is invalid
+ *
+ * NOTES:
+ * An address without a prefix length allows only itself.
+ * IPv4 prefixes are stored as IPv4 mapped IPv6, so 0.0.0.0/0 allows every IPv4 destination and ::/0 every destination.
+ */
+struct proxy_rule *proxy_create(const char *allow, const char *user) {
+    struct proxy_rule *proxy = checked_calloc(1, sizeof(struct proxy_rule));
+    proxy->capacity = 64;
+    proxy->nodes = checked_calloc(proxy->capacity, sizeof(struct prefix_node));
+    proxy->count = 1;
+
+    if (allow) {
+        char *copy = strdup(allow);
+        char *save;
+        for (char *text = strtok_r(copy, PROXY_ALLOW_SEPARATOR, &save); text; text = strtok_r(NULL, PROXY_ALLOW_SEPARATOR, &save)) {
+            if (!add_prefix(proxy, text)) {
+                fprintf(stderr, "Invalid allowed prefix %s, expected an address with an optional /length\n", text);
+                free(copy);
+                proxy_free(proxy);
+                return NULL;
+            }
+        }
+        free(copy);
+    }
+
+    if (user) {
+        const char *colon = strchr(user, ':');
+        const size_t nameLength = colon ? (size_t) (colon - user) : 0;
+        const size_t passwordLength = colon ? strlen(colon + 1) : 0;
+        if (nameLength == 0 || nameLength >= PROXY_CREDENTIAL_SIZE || passwordLength == 0 || passwordLength >= PROXY_CREDENTIAL_SIZE) {
+            fprintf(stderr, "Proxy user must be name:password, each 1 to %d characters\n", PROXY_CREDENTIAL_SIZE - 1);
+            proxy_free(proxy);
+            return NULL;
+        }
+        memcpy(proxy->user, user, nameLength);
+        strcpy(proxy->password, colon + 1);
+        //HTTP clients send name:password in base64, so it is encoded once here rather than decoded per client
+        EVP_EncodeBlock((unsigned char *) proxy->basic, (const unsigned char *) user, nameLength + 1 + passwordLength);
+        proxy->authenticate = true;
+    }
+    return proxy;
+}
+
+/*
+ * FUNCTION: proxy_free
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void proxy_free(struct proxy_rule *proxy);
+ *
+ * PARAMETERS:
+ * struct proxy_rule *proxy - The proxy settings to free, or NULL
+ *
+ * RETURNS:
+ * void
+ */
+void proxy_free(struct proxy_rule *proxy) {
+    if (proxy) {
+        free(proxy->nodes);
+        free(proxy);
+    }
+}
+
+/*
+ * FUNCTION: add_prefix
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool add_prefix(struct proxy_rule *proxy, const char *text);
+ *
+ * PARAMETERS:
+ * struct proxy_rule *proxy - The proxy whose allow list the prefix is added to
+ * const char *text - An IPv4 or IPv6 address, with an optional /length
+ *
+ * RETURNS:
+ * bool - Whether the prefix was valid
+ *
+ * NOTES:
+ * A prefix covered by a shorter one already in the trie only adds nodes that are never reached.
+ */
+static bool add_prefix(struct proxy_rule *proxy, const char *text) {
+    char address[INET6_ADDRSTRLEN];
+    const char *slash = strchr(text, '/');
+    const size_t length = slash ? (size_t) (slash - text) : strlen(text);
+    if (length >= sizeof(address)) {
+        return false;
+    }
+    memcpy(address, text, length);
+    address[length] = '\0';
+
+    uint8_t key[16] = {0};
+    const bool v4 = (inet_pton(AF_INET, address, key + 12) == 1);
+    if (v4) {
+        key[10] = key[11] = 0xff;
+    } else if (inet_pton(AF_INET6, address, key) != 1) {
+        return false;
+    }
+    long bits = (v4) ? 32 : 128;
+    if (slash) {
+        char *end;
+        const long given = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end || given < 0 || given > bits) {
+            return false;
+        }
+        bits = given;
+    }
+    if (v4) {
+        //IPv4 lengths count from the start of the mapped address
+        bits += 96;
+    }
+
+    uint32_t node = 0;
+    for (long i = 0; i < bits; ++i) {
+        const int bit = (key[i / 8] >> (7 - i % 8)) & 1;
+        if (proxy->nodes[node].child[bit] == 0) {
+            if (proxy->count == proxy->capacity) {
+                proxy->capacity *= 2;
+                proxy->nodes = checked_realloc(proxy->nodes, proxy->capacity * sizeof(struct prefix_node));
+            }
+            memset(&proxy->nodes[proxy->count], 0, sizeof(struct prefix_node));
+            proxy->nodes[node].child[bit] = proxy->count++;
+        }
+        node = proxy->nodes[node].child[bit];
+    }
+    proxy->nodes[node].allowed = true;
+    return true;
+}
+
+/*
+ * FUNCTION: proxy_allowed
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool proxy_allowed(const struct proxy_rule *proxy, const struct sockaddr *addr);
+ *
+ * PARAMETERS:
+ * const struct proxy_rule *proxy - The proxy whose allow list is checked
+ * const struct sockaddr *addr - An IPv4 or IPv6 destination
+ *
+ * RETURNS:
+ * bool - Whether any allowed prefix covers addr
+ *
+ * NOTES:
+ * Walks at most one node per address bit, and stops at the first allowed prefix on the way.
+ */
+bool proxy_allowed(const struct proxy_rule *proxy, const struct sockaddr *addr) {
+    uint8_t key[16];
+    if (!address_key(addr, key)) {
+        return false;
+    }
+    uint32_t node = 0;
+    for (size_t i = 0; i < 128; ++i) {
+        if (proxy->nodes[node].allowed) {
+            return true;
+        }
+        if ((node = proxy->nodes[node].child[(key[i / 8] >> (7 - i % 8)) & 1]) == 0) {
+            return false;
+        }
+    }
+    return proxy->nodes[node].allowed;
+}
+
+/*
+ * FUNCTION: address_key
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool address_key(const struct sockaddr *addr, uint8_t key[static 16]);
+ *
+ * PARAMETERS:
+ * const struct sockaddr *addr - An IPv4 or IPv6 address
+ * uint8_t key[static 16] - Filled with the address as IPv6, IPv4 being mapped
+ *
+ * RETURNS:
+ * bool - Whether addr was IPv4 or IPv6
+ *
+ * NOTES:
+ * Mapping IPv4 means a client can't get around an IPv4 prefix by asking for the same address as ::ffff:a.b.c.d.
+ */
+static bool address_key(const struct sockaddr *addr, uint8_t key[static 16]) {
+    if (addr->sa_family == AF_INET) {
+        memset(key, 0, 10);
+        key[10] = key[11] = 0xff;
+        memcpy(key + 12, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+        return true;
+    }
+    if (addr->sa_family == AF_INET6) {
+        memcpy(key, &((const struct sockaddr_in6 *) addr)->sin6_addr, 16);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * FUNCTION: proxy_filter
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * const struct addrinfo *proxy_filter(const struct proxy_rule *proxy, const struct addrinfo *list, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]);
+ *
+ * PARAMETERS:
+ * const struct proxy_rule *proxy - The proxy whose allow list is checked
+ * const struct addrinfo *list - The destination's resolved addresses
+ * struct addrinfo copies[static CONNECT_MAX_ATTEMPTS] - Filled with the allowed entries
+ * struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS] - Filled with the allowed addresses
+ *
+ * RETURNS:
+ * const struct addrinfo * - The allowed addresses as a list on the caller's stack, or NULL if none are allowed
+ *
+ * NOTES:
+ * Names are checked after they resolve, so a name can't reach an address the list doesn't allow.
+ * Only as many addresses as a connect will try are kept.
+ */
+const struct addrinfo *proxy_filter(const struct proxy_rule *proxy, const struct addrinfo *list, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]) {
+    size_t count = 0;
+    for (const struct addrinfo *address = list; address && count < CONNECT_MAX_ATTEMPTS; address = address->ai_next) {
+        if (address->ai_addrlen > sizeof(struct sockaddr_storage) || !proxy_allowed(proxy, address->ai_addr)) {
+            continue;
+        }
+        copies[count] = *address;
+        memcpy(&addresses[count], address->ai_addr, address->ai_addrlen);
+        copies[count].ai_addr = (struct sockaddr *) &addresses[count];
+        copies[count].ai_next = NULL;
+        if (count) {
+            copies[count - 1].ai_next = &copies[count];
+        }
+        ++count;
+    }
+    return (count) ? copies : NULL;
+}
+
+/*
+ * FUNCTION: proxy_handshake
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int proxy_handshake(const int sock, uint32_t *stage, const struct proxy_rule *proxy, struct proxy_request *request);
+ *
+ * PARAMETERS:
+ * const int sock - The non-blocking client socket
+ * uint32_t *stage - The client's handshake stage, PROXY_GREETING for a new client, advanced as messages are read
+ * const struct proxy_rule *proxy - The rule's proxy settings
+ * struct proxy_request *request - Filled with the destination once the request has been read
+ *
+ * RETURNS:
+ * int - 1 once the request has been read, 0 if more client data is needed, -1 if the client failed the handshake
+ *
+ * NOTES:
+ * A client starting with the SOCKS5 version byte speaks SOCKS5, any other is read as an HTTP CONNECT request.
+ * Every complete message waiting is handled in one call, so a client that sends its greeting and request together isn't stalled.
+ * The reply for a failed handshake has already been sent when this returns -1,
+ * the reply to a complete request is left for proxy_reply once the destination is connected.
+ */
+int proxy_handshake(const int sock, uint32_t *stage, const struct proxy_rule *proxy, struct proxy_request *request) {
+    uint8_t buffer[PROXY_REQUEST_MAX];
+    while (*stage != PROXY_DONE) {
+        const ssize_t n = recv(sock, buffer, sizeof(buffer), MSG_PEEK);
+        if (n == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+
+        ssize_t used;
+        if (*stage == PROXY_GREETING && buffer[0] != SOCKS_VERSION) {
+            request->protocol = PROXY_HTTP;
+            used = http_request(sock, buffer, n, proxy, request, stage);
+        } else {
+            request->protocol = PROXY_SOCKS5;
+            if (*stage == PROXY_GREETING) {
+                used = socks_greeting(sock, buffer, n, proxy, stage);
+            } else if (*stage == PROXY_AUTH) {
+                used = socks_auth(sock, buffer, n, proxy, stage);
+            } else {
+                used = socks_request(sock, buffer, n, request, stage);
+            }
+        }
+        if (used <= 0) {
+            return (int) used;
+        }
+        if (recv(sock, buffer, used, 0) != used) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * FUNCTION: socks_greeting
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static ssize_t socks_greeting(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * const uint8_t *buffer - The data waiting on the socket
+ * const size_t size - How much data is waiting
+ * const struct proxy_rule *proxy - The rule's proxy settings
+ * uint32_t *stage - Advanced past the greeting once it is answered
+ *
+ * RETURNS:
+ * ssize_t - The length of the greeting, 0 if it hasn't all arrived, -1 if the client offered no method the rule accepts
+ *
+ * NOTES:
+ * A rule with a user only accepts username/password authentication, one without only accepts none.
+ */
+static ssize_t socks_greeting(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage) {
+    if (size < 2 || size < 2u + buffer[1]) {
+        return 0;
+    }
+    const uint8_t method = (proxy->authenticate) ? SOCKS_AUTH_PASSWORD : SOCKS_AUTH_NONE;
+    const bool offered = (memchr(buffer + 2, method, buffer[1]) != NULL);
+    const uint8_t reply[2] = {SOCKS_VERSION, (offered) ? method : SOCKS_AUTH_UNUSABLE};
+    send_reply(sock, reply, sizeof(reply));
+    if (!offered) {
+        return -1;
+    }
+    *stage = (proxy->authenticate) ? PROXY_AUTH : PROXY_REQUEST;
+    return 2 + buffer[1];
+}
+
+/*
+ * FUNCTION: socks_auth
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static ssize_t socks_auth(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * const uint8_t *buffer - The data waiting on the socket
+ * const size_t size - How much data is waiting
+ * const struct proxy_rule *proxy - The rule's proxy settings
+ * uint32_t *stage - Advanced to the request once the client has authenticated
+ *
+ * RETURNS:
+ * ssize_t - The length of the authentication message, 0 if it hasn't all arrived, -1 if the credentials are wrong
+ *
+ * NOTES:
+ * The username/password message is from RFC 1929.
+ * The password is compared in constant time so its length is the most a client can time.
+ */
+static ssize_t socks_auth(const int sock, const uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, uint32_t *stage) {
+    if (size < 2 || size < 3u + buffer[1] || size < 3u + buffer[1] + buffer[2 + buffer[1]]) {
+        return (size && buffer[0] != SOCKS_AUTH_VERSION) ? -1 : 0;
+    }
+    const size_t nameLength = buffer[1];
+    const size_t passwordLength = buffer[2 + nameLength];
+    const bool valid = buffer[0] == SOCKS_AUTH_VERSION
+            && nameLength == strlen(proxy->user) && memcmp(buffer + 2, proxy->user, nameLength) == 0
+            && passwordLength == strlen(proxy->password) && CRYPTO_memcmp(buffer + 3 + nameLength, proxy->password, passwordLength) == 0;
+    const uint8_t reply[2] = {SOCKS_AUTH_VERSION, (valid) ? 0 : 1};
+    send_reply(sock, reply, sizeof(reply));
+    if (!valid) {
+        return -1;
+    }
+    *stage = PROXY_REQUEST;
+    return 3 + nameLength + passwordLength;
+}
+
+/*
+ * FUNCTION: socks_request
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static ssize_t socks_request(const int sock, const uint8_t *buffer, const size_t size, struct proxy_request *request, uint32_t *stage);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * const uint8_t *buffer - The data waiting on the socket
+ * const size_t size - How much data is waiting
+ * struct proxy_request *request - Filled with the destination
+ * uint32_t *stage - Set to PROXY_DONE once the request is read
+ *
+ * RETURNS:
+ * ssize_t - The length of the request, 0 if it hasn't all arrived, -1 if it isn't a CONNECT the proxy can make
+ *
+ * NOTES:
+ * Only CONNECT is supported, BIND and UDP ASSOCIATE are refused with command not supported.
+ */
+static ssize_t socks_request(const int sock, const uint8_t *buffer, const size_t size, struct proxy_request *request, uint32_t *stage) {
+    if (size < 5) {
+        return 0;
+    }
+    if (buffer[0] != SOCKS_VERSION) {
+        return -1;
+    }
+    size_t addressLength;
+    if (buffer[3] == SOCKS_ATYP_IPV4) {
+        addressLength = 4;
+    } else if (buffer[3] == SOCKS_ATYP_IPV6) {
+        addressLength = 16;
+    } else if (buffer[3] == SOCKS_ATYP_DOMAIN) {
+        addressLength = 1 + buffer[4];
+    } else {
+        socks_reply(sock, SOCKS_ADDRESS_UNSUPPORTED, -1);
+        return -1;
+    }
+    const size_t length = 4 + addressLength + 2;
+    if (size < length) {
+        return 0;
+    }
+    if (buffer[1] != SOCKS_CONNECT) {
+        socks_reply(sock, SOCKS_COMMAND_UNSUPPORTED, -1);
+        return -1;
+    }
+
+    if (buffer[3] == SOCKS_ATYP_DOMAIN) {
+        if (buffer[4] == 0 || memchr(buffer + 5, '\0', buffer[4])) {
+            socks_reply(sock, SOCKS_HOST_UNREACHABLE, -1);
+            return -1;
+        }
+        memcpy(request->host, buffer + 5, buffer[4]);
+        request->host[buffer[4]] = '\0';
+    } else {
+        inet_ntop((buffer[3] == SOCKS_ATYP_IPV4) ? AF_INET : AF_INET6, buffer + 4, request->host, sizeof(request->host));
+    }
+    snprintf(request->port, sizeof(request->port), "%u", (unsigned) (buffer[length - 2] << 8 | buffer[length - 1]));
+    *stage = PROXY_DONE;
+    return length;
+}
+
+/*
+ * FUNCTION: http_request
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static ssize_t http_request(const int sock, uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, struct proxy_request *request, uint32_t *stage);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * uint8_t *buffer - The data waiting on the socket, modified while parsing
+ * const size_t size - How much data is waiting
+ * const struct proxy_rule *proxy - The rule's proxy settings
+ * struct proxy_request *request - Filled with the destination
+ * uint32_t *stage - Set to PROXY_DONE once the request is read
+ *
+ * RETURNS:
+ * ssize_t - The length of the request head, 0 if it hasn't all arrived, -1 if it isn't an acceptable CONNECT request
+ *
+ * NOTES:
+ * The request target is host:port, with an IPv6 host in brackets.
+ * A rule with a user requires a Proxy-Authorization header with Basic credentials,
+ * which are compared in their encoded form.
+ */
+static ssize_t http_request(const int sock, uint8_t *buffer, const size_t size, const struct proxy_rule *proxy, struct proxy_request *request, uint32_t *stage) {
+    static const char badRequest[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    static const char badMethod[] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: CONNECT\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    static const char needAuth[] = "HTTP/1.1 407 Proxy Authentication Required\r\nProxy-Authenticate: Basic realm=\"proxy\"\r\n"
+            "Content-Length: 0\r\nConnection: close\r\n\r\n";
+
+    uint8_t *end = memmem(buffer, size, "\r\n\r\n", 4);
+    if (end == NULL) {
+        if (size < PROXY_REQUEST_MAX) {
+            return 0;
+        }
+        send_reply(sock, badRequest, sizeof(badRequest) - 1);
+        return -1;
+    }
+    const size_t length = end - buffer + 4;
+    //Ending the head after its request line's CRLF lets the rest be parsed as strings
+    end[2] = '\0';
+
+    char *line = (char *) buffer;
+    char *next = strstr(line, "\r\n");
+    char *target = (next) ? strchr(line, ' ') : NULL;
+    if (target == NULL || target > next) {
+        send_reply(sock, badRequest, sizeof(badRequest) - 1);
+        return -1;
+    }
+    *next = '\0';
+    *target++ = '\0';
+    if (strcmp(line, "CONNECT") != 0) {
+        send_reply(sock, badMethod, sizeof(badMethod) - 1);
+        return -1;
+    }
+    char *version = strchr(target, ' ');
+    if (version == NULL || strncmp(version + 1, "HTTP/1.", 7) != 0) {
+        send_reply(sock, badRequest, sizeof(badRequest) - 1);
+        return -1;
+    }
+    *version = '\0';
+
+    char *host = target;
+    char *port = strrchr(target, ':');
+    if (*host == '[') {
+        char *close = strchr(++host, ']');
+        port = (close && close[1] == ':') ? close + 1 : NULL;
+        if (close) {
+            *close = '\0';
+        }
+    }
+    char *digits = NULL;
+    const long number = (port) ? strtol(port + 1, &digits, 10) : 0;
+    if (port == NULL || digits == port + 1 || *digits || number < 1 || number > 65535) {
+        send_reply(sock, badRequest, sizeof(badRequest) - 1);
+        return -1;
+    }
+    *port = '\0';
+    if (*host == '\0' || strlen(host) >= sizeof(request->host)) {
+        send_reply(sock, badRequest, sizeof(badRequest) - 1);
+        return -1;
+    }
+
+    if (proxy->authenticate) {
+        bool valid = false;
+        for (line = next + 2; *line && !valid; line = next + 2) {
+            //A header with a NUL in it ends the search, since the rest of the head can't be read as a string
+            if ((next = strstr(line, "\r\n")) == NULL) {
+                break;
+            }
+            *next = '\0';
+            if (strncasecmp(line, "Proxy-Authorization:", 20) != 0) {
+                continue;
+            }
+            line += 20 + strspn(line + 20, " \t");
+            if (strncasecmp(line, "Basic ", 6) == 0) {
+                line += 6 + strspn(line + 6, " ");
+                line[strcspn(line, " \t")] = '\0';
+                valid = strlen(line) == strlen(proxy->basic) && CRYPTO_memcmp(line, proxy->basic, strlen(line)) == 0;
+            }
+        }
+        if (!valid) {
+            send_reply(sock, needAuth, sizeof(needAuth) - 1);
+            return -1;
+        }
+    }
+
+    strcpy(request->host, host);
+    snprintf(request->port, sizeof(request->port), "%ld", number);
+    *stage = PROXY_DONE;
+    return length;
+}
+
+/*
+ * FUNCTION: proxy_reply
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void proxy_reply(const int sock, const struct proxy_request *request, const enum proxy_result result, const int remote);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * const struct proxy_request *request - The request being answered, for its protocol
+ * const enum proxy_result result - Whether the destination was connected, and why not
+ * const int remote - The connected destination, whose local address a SOCKS5 client is told, or -1
+ *
+ * RETURNS:
+ * void
+ */
+void proxy_reply(const int sock, const struct proxy_request *request, const enum proxy_result result, const int remote) {
+    if (request->protocol == PROXY_SOCKS5) {
+        socks_reply(sock, resultList[result].code, remote);
+        return;
+    }
+    char reply[128];
+    const int length = snprintf(reply, sizeof(reply), "HTTP/1.1 %s\r\n%s\r\n", resultList[result].status,
+            (result == PROXY_OK) ? "" : "Content-Length: 0\r\nConnection: close\r\n");
+    send_reply(sock, reply, length);
+}
+
+/*
+ * FUNCTION: socks_reply
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void socks_reply(const int sock, const uint8_t code, const int remote);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * const uint8_t code - The SOCKS5 reply code
+ * const int remote - The connected destination, or -1 to reply with an empty IPv4 address
+ *
+ * RETURNS:
+ * void
+ */
+static void socks_reply(const int sock, const uint8_t code, const int remote) {
+    uint8_t reply[22] = {SOCKS_VERSION, code, 0, SOCKS_ATYP_IPV4};
+    size_t length = 10;
+
+    struct sockaddr_storage bound;
+    socklen_t boundLen = sizeof(bound);
+    if (remote != -1 && getsockname(remote, (struct sockaddr *) &bound, &boundLen) == 0) {
+        if (bound.ss_family == AF_INET) {
+            const struct sockaddr_in *v4 = (const struct sockaddr_in *) &bound;
+            memcpy(reply + 4, &v4->sin_addr, 4);
+            memcpy(reply + 8, &v4->sin_port, 2);
+        } else if (bound.ss_family == AF_INET6) {
+            const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *) &bound;
+            reply[3] = SOCKS_ATYP_IPV6;
+            memcpy(reply + 4, &v6->sin6_addr, 16);
+            memcpy(reply + 20, &v6->sin6_port, 2);
+            length = 22;
+        }
+    }
+    send_reply(sock, reply, length);
+}
+
+/*
+ * FUNCTION: send_reply
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void send_reply(const int sock, const void *reply, const size_t size);
+ *
+ * PARAMETERS:
+ * const int sock - The client socket
+ * const void *reply - The reply to send
+ * const size_t size - The length of the reply
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Replies are far smaller than an empty socket buffer, so a short send means the client is gone and its next read will say so.
+ */
+static void send_reply(const int sock, const void *reply, const size_t size) {
+    if (send(sock, reply, size, MSG_NOSIGNAL) == -1) {
+        debug_print("Proxy reply failed: %s\n", strerror(errno));
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * HEADER FILE: proxy.h - SOCKS5 and HTTP CONNECT handshakes, and the destination allow list
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * struct proxy_rule *proxy_create(const char *allow, const char *user);
+ * void proxy_free(struct proxy_rule *proxy);
+ * int proxy_handshake(const int sock, uint32_t *stage, const struct proxy_rule *proxy, struct proxy_request *request);
+ * void proxy_reply(const int sock, const struct proxy_request *request, const enum proxy_result result, const int remote);
+ * bool proxy_allowed(const struct proxy_rule *proxy, const struct sockaddr *addr);
+ * const struct addrinfo *proxy_filter(const struct proxy_rule *proxy, const struct addrinfo *list, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "socket.h"
+
+//Output address keyword for rules that connect each client to the destination it asks for
+#define PROXY_ADDRESS "proxy"
+
+//Separates the prefixes in an allow option
+#define PROXY_ALLOW_SEPARATOR "+"
+
+//Largest SOCKS5 message or HTTP CONNECT request head accepted
+#define PROXY_REQUEST_MAX 8192
+
+//Longest user name and password, the most SOCKS5 can carry
+#define PROXY_CREDENTIAL_SIZE 256
+
+//Where a client is in its handshake, kept in its client entry until it is connected
+enum proxy_stage {
+    PROXY_GREETING,
+    PROXY_AUTH,
+    PROXY_REQUEST,
+    PROXY_DONE,
+    //Past the handshake, waiting on the resolver threads and then on the destination's connect
+    PROXY_RESOLVING,
+    PROXY_CONNECTING
+};
+
+enum proxy_protocol {
+    PROXY_SOCKS5,
+    PROXY_HTTP
+};
+
+enum proxy_result {
+    PROXY_OK,
+    PROXY_DENIED,
+    PROXY_UNREACHABLE,
+    PROXY_FAILED
+};
+
+//The destination a client asked for, filled in from its request without allocating
+struct proxy_request {
+    enum proxy_protocol protocol;
+    char host[256];
+    char port[6];
+};
+
+//One bit of an allowed prefix, node 0 is the root so a child of 0 means there is none
+struct prefix_node {
+    uint32_t child[2];
+    bool allowed;
+};
+
+//A proxy rule's allow list, as a binary trie over IPv6 addresses with IPv4 mapped into ::ffff:0:0/96
+struct proxy_rule {
+    char user[PROXY_CREDENTIAL_SIZE];
+    char password[PROXY_CREDENTIAL_SIZE];
+    char basic[(PROXY_CREDENTIAL_SIZE * 2 + 2) / 3 * 4 + 8];
+    bool authenticate;
+    size_t count;
+    size_t capacity;
+    struct prefix_node *nodes;
+};
+
+struct proxy_rule *proxy_create(const char *allow, const char *user);
+void proxy_free(struct proxy_rule *proxy);
+int proxy_handshake(const int sock, uint32_t *stage, const struct proxy_rule *proxy, struct proxy_request *request);
+void proxy_reply(const int sock, const struct proxy_request *request, const enum proxy_result result, const int remote);
+bool proxy_allowed(const struct proxy_rule *proxy, const struct sockaddr *addr);
+const struct addrinfo *proxy_filter(const struct proxy_rule *proxy, const struct addrinfo *list, struct addrinfo copies[static CONNECT_MAX_ATTEMPTS], struct sockaddr_storage addresses[static CONNECT_MAX_ATTEMPTS]);
+
+#endif
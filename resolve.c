@@ -0,0 +1,613 @@
+/*
+ * SOURCE FILE: resolve.c - Implementation of functions declared in resolve.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void resolve_start(void);
+ * void resolve_stop(void);
+ * const struct addrinfo *resolve_rule(struct rule *rule);
+ * const struct addrinfo *resolve_rule_now(struct rule *rule);
+ * const struct addrinfo *resolve_upstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port, _Atomic uint32_t *retry_ms);
+ * struct resolve_lookup *resolve_lookup_start(const char *host, const char *port);
+ * bool resolve_lookup_done(struct resolve_lookup *lookup, struct addrinfo **result);
+ * void resolve_lookup_release(struct resolve_lookup *lookup);
+ * static void *resolveThread(void *unused);
+ * static bool claimRetry(_Atomic uint32_t *retry_ms);
+ * static struct addrinfo *installUpstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port);
+ * static void queueLookup(struct resolve_lookup *lookup);
+ * static const char *ruleAddress(const struct rule *rule);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Rules are parsed and their listeners opened without waiting on DNS, so a large config is ready in the time it takes to bind.
+ * Output addresses are then resolved by a pool of threads while the workers are already accepting clients.
+ * Workers only ever read an upstream. A client that arrives before its rule is resolved, or after its lookup failed, is refused,
+ * and queues a lookup for the resolver threads so a later client finds the rule resolved.
+ * Failed lookups are queued at most once every RESOLVE_RETRY_MS, so a dead name can't flood the resolver threads.
+ * Whichever lookup finishes first is installed, and the rule keeps it for the life of the process.
+ *
+ * Once the startup targets are done the threads stay, and serve those lookups along with names that workers wait on,
+ * such as a proxy client's destination, so no worker ever waits on DNS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include "resolve.h"
+#include "network.h"
+#include "socket.h"
+#include "route.h"
+#include "tunnel.h"
+#include "macro.h"
+#include "main.h"
+
+static void *resolveThread(void *unused);
+static bool claimRetry(_Atomic uint32_t *retry_ms);
+static struct addrinfo *installUpstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port);
+static void queueLookup(struct resolve_lookup *lookup);
+static const char *ruleAddress(const struct rule *rule);
+
+static struct resolve_target *targetList;
+static size_t targetCount;
+static _Atomic size_t targetNext;
+static _Atomic size_t targetDone;
+static uint32_t resolveStarted;
+
+static pthread_t resolveThreads[RESOLVE_THREADS];
+static size_t resolveThreadCount;
+
+//Lookups waiting for a resolver thread, oldest first
+static struct resolve_lookup *queueHead;
+static struct resolve_lookup *queueTail;
+static bool queueStopped;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueReady = PTHREAD_COND_INITIALIZER;
+
+/*
+ * FUNCTION: resolve_start
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void resolve_start(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Must be called once every rule and route has been added, since targets point into their tables.
+ * The threads are started even with no targets, since they also serve lookups for workers.
+ */
+void resolve_start(void) {
+    targetCount = route_targets(NULL);
+    for (size_t i = 0; i < ruleCount; ++i) {
+        if (ruleAddress(lookupRule(i))) {
+            ++targetCount;
+        }
+    }
+
+    targetList = checked_calloc(targetCount + 1, sizeof(struct resolve_target));
+    size_t count = route_targets(targetList);
+    for (size_t i = 0; i < ruleCount; ++i) {
+        const char *address = ruleAddress(lookupRule(i));
+        if (address) {
+            targetList[count].upstream = &lookupRule(i)->upstream;
+            targetList[count].address = address;
+            targetList[count].port = lookupRule(i)->port;
+            targetList[count].retry_ms = &lookupRule(i)->retry_ms;
+            ++count;
+        }
+    }
+
+    resolveStarted = monotonic_ms();
+    queueStopped = false;
+    resolveThreadCount = RESOLVE_THREADS;
+    for (size_t i = 0; i < resolveThreadCount; ++i) {
+        pthread_create(&resolveThreads[i], NULL, resolveThread, NULL);
+    }
+}
+
+/*
+ * FUNCTION: resolve_stop
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void resolve_stop(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Threads stop taking new targets once the server is shutting down, so this waits for at most one lookup each.
+ * Lookups still queued are let go of, and are freed by whichever worker holds the other reference, if any is left.
+ */
+void resolve_stop(void) {
+    pthread_mutex_lock(&queueLock);
+    queueStopped = true;
+    pthread_cond_broadcast(&queueReady);
+    pthread_mutex_unlock(&queueLock);
+    for (size_t i = 0; i < resolveThreadCount; ++i) {
+        pthread_join(resolveThreads[i], NULL);
+    }
+    while (queueHead) {
+        struct resolve_lookup *lookup = queueHead;
+        queueHead = lookup->next;
+        resolve_lookup_release(lookup);
+    }
+    queueTail = NULL;
+    resolveThreadCount = 0;
+    free(targetList);
+    targetList = NULL;
+    targetCount = 0;
+}
+
+/*
+ * FUNCTION: resolve_rule
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * const struct addrinfo *resolve_rule(struct rule *rule);
+ *
+ * PARAMETERS:
+ * struct rule *rule - A rule with a fixed output address
+ *
+ * RETURNS:
+ * const struct addrinfo * - The rule's upstream, or NULL if it isn't resolved yet
+ *
+ * NOTES:
+ * Never blocks, so it is safe to call from a worker.
+ */
+const struct addrinfo *resolve_rule(struct rule *rule) {
+    const char *address = ruleAddress(rule);
+    if (address == NULL) {
+        return rule->upstream;
+    }
+    return resolve_upstream(&rule->upstream, address, rule->port, &rule->retry_ms);
+}
+
+/*
+ * FUNCTION: resolve_rule_now
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * const struct addrinfo *resolve_rule_now(struct rule *rule);
+ *
+ * PARAMETERS:
+ * struct rule *rule - A rule with a fixed output address
+ *
+ * RETURNS:
+ * const struct addrinfo * - The rule's upstream, or NULL if it can't be resolved
+ *
+ * NOTES:
+ * Blocks on DNS, so it is only for threads that may wait, such as the control thread adding a rule.
+ */
+const struct addrinfo *resolve_rule_now(struct rule *rule) {
+    const char *address = ruleAddress(rule);
+    struct addrinfo *list = atomic_load(&rule->upstream);
+    if (address == NULL || list) {
+        return list;
+    }
+    return installUpstream(&rule->upstream, address, rule->port);
+}
+
+/*
+ * FUNCTION: resolve_upstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * const struct addrinfo *resolve_upstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port, _Atomic uint32_t *retry_ms);
+ *
+ * PARAMETERS:
+ * struct addrinfo *_Atomic *upstream - Where the resolved list is kept
+ * const char *address - The output address
+ * const char *port - The output port
+ * _Atomic uint32_t *retry_ms - When the next lookup may be made, claimed by whoever makes it
+ *
+ * RETURNS:
+ * const struct addrinfo * - The resolved list, or NULL if it isn't resolved yet
+ *
+ * NOTES:
+ * Never blocks. Only the caller that claims the retry slot queues a lookup for the resolver threads,
+ * every other caller fails fast until it is installed.
+ */
+const struct addrinfo *resolve_upstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port, _Atomic uint32_t *retry_ms) {
+    struct addrinfo *list = atomic_load(upstream);
+    if (list || !claimRetry(retry_ms)) {
+        return list;
+    }
+    if (strlen(address) >= RESOLVE_HOST_SIZE || strlen(port) >= sizeof(((struct resolve_lookup *) NULL)->port)) {
+        fprintf(stderr, "Unable to resolve %s, the name is too long\n", address);
+        return NULL;
+    }
+    struct resolve_lookup *lookup = checked_calloc(1, sizeof(struct resolve_lookup));
+    strcpy(lookup->host, address);
+    strcpy(lookup->port, port);
+    lookup->upstream = upstream;
+    lookup->event = -1;
+    //Only the resolver thread holds an output address lookup
+    atomic_store(&lookup->refs, 1);
+    queueLookup(lookup);
+    return NULL;
+}
+
+/*
+ * FUNCTION: resolveThread
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void *resolveThread(void *unused);
+ *
+ * PARAMETERS:
+ * void *unused - Required by the pthread interface
+ *
+ * RETURNS:
+ * void * - Required by the pthread interface, always NULL
+ *
+ * NOTES:
+ * Startup targets come first, then the thread waits for lookups from workers until resolve_stop.
+ */
+static void *resolveThread(void *unused) {
+    (void) unused;
+    size_t i;
+    while (isRunning && (i = atomic_fetch_add(&targetNext, 1)) < targetCount) {
+        const struct resolve_target *target = &targetList[i];
+        //A client may have queued this one already, but the queue is only served once the startup targets are done
+        if (atomic_load(target->upstream) == NULL) {
+            atomic_store(target->retry_ms, monotonic_ms() + RESOLVE_RETRY_MS);
+            installUpstream(target->upstream, target->address, target->port);
+        }
+        if (atomic_fetch_add(&targetDone, 1) + 1 == targetCount) {
+            size_t resolved = 0;
+            for (size_t j = 0; j < targetCount; ++j) {
+                resolved += (atomic_load(targetList[j].upstream) != NULL);
+            }
+            printf("Resolved %zu of %zu output addresses in %u ms\n", resolved, targetCount, monotonic_ms() - resolveStarted);
+        }
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&queueLock);
+        while (queueHead == NULL && !queueStopped) {
+            pthread_cond_wait(&queueReady, &queueLock);
+        }
+        struct resolve_lookup *lookup = queueHead;
+        if (queueStopped) {
+            pthread_mutex_unlock(&queueLock);
+            return NULL;
+        }
+        if ((queueHead = lookup->next) == NULL) {
+            queueTail = NULL;
+        }
+        pthread_mutex_unlock(&queueLock);
+
+        if (lookup->upstream) {
+            if (atomic_load(lookup->upstream) == NULL) {
+                installUpstream(lookup->upstream, lookup->host, lookup->port);
+            }
+            resolve_lookup_release(lookup);
+            continue;
+        }
+        lookup->result = resolveAddress(lookup->host, lookup->port);
+        atomic_store_explicit(&lookup->done, true, memory_order_release);
+        if (eventfd_write(lookup->event, 1) == -1) {
+            perror("eventfd_write");
+        }
+        resolve_lookup_release(lookup);
+    }
+}
+
+/*
+ * FUNCTION: resolve_lookup_start
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct resolve_lookup *resolve_lookup_start(const char *host, const char *port);
+ *
+ * PARAMETERS:
+ * const char *host - The name or address to look up
+ * const char *port - The port to fill the results in with
+ *
+ * RETURNS:
+ * struct resolve_lookup * - The queued lookup, to be let go of with resolve_lookup_release, or NULL if it couldn't be queued
+ *
+ * NOTES:
+ * Never blocks on DNS, the caller waits for the lookup's event to become readable and then calls resolve_lookup_done.
+ */
+struct resolve_lookup *resolve_lookup_start(const char *host, const char *port) {
+    if (strlen(host) >= RESOLVE_HOST_SIZE || strlen(port) >= sizeof(((struct resolve_lookup *) NULL)->port)) {
+        return NULL;
+    }
+    struct resolve_lookup *lookup = checked_calloc(1, sizeof(struct resolve_lookup));
+    if ((lookup->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        free(lookup);
+        return NULL;
+    }
+    strcpy(lookup->host, host);
+    strcpy(lookup->port, port);
+    //One reference for the caller and one for the resolver thread
+    atomic_store(&lookup->refs, 2);
+    queueLookup(lookup);
+    return lookup;
+}
+
+/*
+ * FUNCTION: resolve_lookup_done
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool resolve_lookup_done(struct resolve_lookup *lookup, struct addrinfo **result);
+ *
+ * PARAMETERS:
+ * struct resolve_lookup *lookup - A lookup from resolve_lookup_start
+ * struct addrinfo **result - Set to the resolved list once the lookup is done, NULL if it failed
+ *
+ * RETURNS:
+ * bool - Whether the lookup is done
+ *
+ * NOTES:
+ * The list is handed over to the caller, who must free it with freeaddrinfo.
+ */
+bool resolve_lookup_done(struct resolve_lookup *lookup, struct addrinfo **result) {
+    if (!atomic_load_explicit(&lookup->done, memory_order_acquire)) {
+        return false;
+    }
+    *result = lookup->result;
+    lookup->result = NULL;
+    return true;
+}
+
+/*
+ * FUNCTION: resolve_lookup_release
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void resolve_lookup_release(struct resolve_lookup *lookup);
+ *
+ * PARAMETERS:
+ * struct resolve_lookup *lookup - A lookup to let go of
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * A worker may let go of a lookup that is still queued or in flight, and the last one to let go frees it,
+ * so the event is never closed while the resolver thread may still write to it.
+ * The caller must have taken the event out of its epoll set first.
+ */
+void resolve_lookup_release(struct resolve_lookup *lookup) {
+    if (atomic_fetch_sub(&lookup->refs, 1) != 1) {
+        return;
+    }
+    if (lookup->result) {
+        freeaddrinfo(lookup->result);
+    }
+    if (lookup->event != -1) {
+        close(lookup->event);
+    }
+    free(lookup);
+}
+
+/*
+ * FUNCTION: claimRetry
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool claimRetry(_Atomic uint32_t *retry_ms);
+ *
+ * PARAMETERS:
+ * _Atomic uint32_t *retry_ms - When the next lookup may be made
+ *
+ * RETURNS:
+ * bool - Whether the caller claimed the lookup, pushing the next one RESOLVE_RETRY_MS out
+ */
+static bool claimRetry(_Atomic uint32_t *retry_ms) {
+    const uint32_t now = monotonic_ms();
+    uint32_t retry = atomic_load(retry_ms);
+    return (int32_t) (now - retry) >= 0 && atomic_compare_exchange_strong(retry_ms, &retry, now + RESOLVE_RETRY_MS);
+}
+
+/*
+ * FUNCTION: installUpstream
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct addrinfo *installUpstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port);
+ *
+ * PARAMETERS:
+ * struct addrinfo *_Atomic *upstream - Where the resolved list is kept
+ * const char *address - The output address
+ * const char *port - The output port
+ *
+ * RETURNS:
+ * struct addrinfo * - The installed list, or NULL if the address didn't resolve
+ *
+ * NOTES:
+ * Blocks on DNS. If another lookup installed a list first, that one is kept.
+ */
+static struct addrinfo *installUpstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port) {
+    struct addrinfo *result = resolveAddress(address, port);
+    if (result == NULL) {
+        fprintf(stderr, "Unable to resolve %s, retrying in %d ms\n", address, RESOLVE_RETRY_MS);
+        return NULL;
+    }
+    struct addrinfo *list = NULL;
+    if (!atomic_compare_exchange_strong(upstream, &list, result)) {
+        freeaddrinfo(result);
+        return list;
+    }
+    return result;
+}
+
+/*
+ * FUNCTION: queueLookup
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void queueLookup(struct resolve_lookup *lookup);
+ *
+ * PARAMETERS:
+ * struct resolve_lookup *lookup - A lookup holding a reference for the resolver thread
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Once resolve_stop has run the lookup is let go of at once, so whoever waits on it never hears back, as with any lookup at shutdown.
+ */
+static void queueLookup(struct resolve_lookup *lookup) {
+    pthread_mutex_lock(&queueLock);
+    if (queueStopped) {
+        pthread_mutex_unlock(&queueLock);
+        resolve_lookup_release(lookup);
+        return;
+    }
+    if (queueTail) {
+        queueTail->next = lookup;
+    } else {
+        queueHead = lookup;
+    }
+    queueTail = lookup;
+    pthread_cond_signal(&queueReady);
+    pthread_mutex_unlock(&queueLock);
+}
+
+/*
+ * FUNCTION: ruleAddress
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static const char *ruleAddress(const struct rule *rule);
+ *
+ * PARAMETERS:
+ * const struct rule *rule - The rule to check
+ *
+ * RETURNS:
+ * const char * - The name to resolve for the rule, or NULL if it has no fixed network output address
+ */
+static const char *ruleAddress(const struct rule *rule) {
+    if (rule->address == NULL) {
+        return NULL;
+    }
+    if (rule->mode == RULE_TUNNEL) {
+        return rule->address + strlen(TUNNEL_PREFIX);
+    }
+    if ((rule->mode == RULE_STATIC || rule->mode == RULE_TUNNEL_PEER) && !isUnixAddress(rule->address)) {
+        return rule->address;
+    }
+    return NULL;
+}
@@ -0,0 +1,71 @@
+/*
+ * HEADER FILE: resolve.h - Background and on demand resolution of output addresses
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void resolve_start(void);
+ * void resolve_stop(void);
+ * const struct addrinfo *resolve_rule(struct rule *rule);
+ * const struct addrinfo *resolve_rule_now(struct rule *rule);
+ * const struct addrinfo *resolve_upstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port, _Atomic uint32_t *retry_ms);
+ * struct resolve_lookup *resolve_lookup_start(const char *host, const char *port);
+ * bool resolve_lookup_done(struct resolve_lookup *lookup, struct addrinfo **result);
+ * void resolve_lookup_release(struct resolve_lookup *lookup);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include "network.h"
+
+//Threads resolving output addresses in the background at startup
+#define RESOLVE_THREADS 16
+
+//How long a failed lookup is remembered before a client may queue another one
+#define RESOLVE_RETRY_MS 5000
+
+//An output address still waiting to be resolved, pointing into the rule or route that owns it
+struct resolve_target {
+    struct addrinfo *_Atomic *upstream;
+    const char *address;
+    const char *port;
+    _Atomic uint32_t *retry_ms;
+};
+
+//Longest host name a lookup takes, as much as a SOCKS5 request can carry
+#define RESOLVE_HOST_SIZE 256
+
+//A name looked up by the resolver threads for a worker, shared by both until each has let go of it
+struct resolve_lookup {
+    struct resolve_lookup *next;
+    char host[RESOLVE_HOST_SIZE];
+    char port[6];
+    //Where to install the result for an output address nobody waits on, NULL for a worker's lookup
+    struct addrinfo *_Atomic *upstream;
+    struct addrinfo *result;
+    atomic_bool done;
+    _Atomic int refs;
+    //Readable once the lookup is done, for the worker to wait on in its epoll set, -1 for an output address
+    int event;
+};
+
+void resolve_start(void);
+void resolve_stop(void);
+const struct addrinfo *resolve_rule(struct rule *rule);
+const struct addrinfo *resolve_rule_now(struct rule *rule);
+const struct addrinfo *resolve_upstream(struct addrinfo *_Atomic *upstream, const char *address, const char *port, _Atomic uint32_t *retry_ms);
+struct resolve_lookup *resolve_lookup_start(const char *host, const char *port);
+bool resolve_lookup_done(struct resolve_lookup *lookup, struct addrinfo **result);
+void resolve_lookup_release(struct resolve_lookup *lookup);
+
+#endif
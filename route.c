@@ -0,0 +1,514 @@
+/*
+ * SOURCE FILE: route.c - Implementation of functions declared in route.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void route_add(const uint32_t rule, const char *host, const char *address, const char *port);
+ * struct route *route_lookup(const uint32_t rule, const char *host);
+ * int route_extract_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ * void route_cleanup(void);
+ * static uint64_t hash_host(const uint32_t rule, const char *host);
+ * static struct route *find_route(const uint32_t rule, const char *host);
+ * static int parse_client_hello(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ * static int parse_http_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "route.h"
+#include "resolve.h"
+#include "socket.h"
+#include "main.h"
+#include "macro.h"
+
+static uint64_t hash_host(const uint32_t rule, const char *host);
+static struct route *find_route(const uint32_t rule, const char *host);
+static int parse_client_hello(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+static int parse_http_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+
+//Open addressed table, capacity is a power of two and kept at most half full
+static struct route *routeTable;
+static size_t routeCapacity;
+static size_t routeCount;
+
+/*
+ * FUNCTION: hash_host
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint64_t hash_host(const uint32_t rule, const char *host);
+ *
+ * PARAMETERS:
+ * const uint32_t rule - The rule the route belongs to
+ * const char *host - The lowercase host name
+ *
+ * RETURNS:
+ * uint64_t - FNV-1a hash of the rule index and host name
+ */
+static uint64_t hash_host(const uint32_t rule, const char *host) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (rule >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ull;
+    }
+    for (; *host; ++host) {
+        hash ^= (unsigned char) *host;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/*
+ * FUNCTION: route_add
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void route_add(const uint32_t rule, const char *host, const char *address, const char *port);
+ *
+ * PARAMETERS:
+ * const uint32_t rule - The routed rule the host is reached through
+ * const char *host - The host name, *.domain for any subdomain, or * for the default route
+ * const char *address - The upstream address string
+ * const char *port - The upstream port string
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * A later route for the same rule and host replaces the earlier one.
+ * The upstream is resolved later, either by resolve_start or by the resolver threads once the first client routed to it asks.
+ */
+void route_add(const uint32_t rule, const char *host, const char *address, const char *port) {
+    if ((routeCount + 1) * 2 > routeCapacity) {
+        const size_t oldCapacity = routeCapacity;
+        struct route *oldTable = routeTable;
+
+        routeCapacity = (routeCapacity) ? routeCapacity * 2 : 64;
+        routeTable = checked_calloc(routeCapacity, sizeof(struct route));
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            if (oldTable[i].host) {
+                size_t slot = oldTable[i].hash & (routeCapacity - 1);
+                while (routeTable[slot].host) {
+                    slot = (slot + 1) & (routeCapacity - 1);
+                }
+                routeTable[slot] = oldTable[i];
+            }
+        }
+        free(oldTable);
+    }
+
+    char *name = strdup(host);
+    for (char *c = name; *c; ++c) {
+        *c = tolower((unsigned char) *c);
+    }
+
+    const uint64_t hash = hash_host(rule, name);
+    size_t slot = hash & (routeCapacity - 1);
+    while (routeTable[slot].host) {
+        if (routeTable[slot].hash == hash && routeTable[slot].rule == rule && strcmp(routeTable[slot].host, name) == 0) {
+            free(routeTable[slot].host);
+            free(routeTable[slot].address);
+            free(routeTable[slot].port);
+            if (routeTable[slot].upstream) {
+                freeaddrinfo(routeTable[slot].upstream);
+            }
+            --routeCount;
+            break;
+        }
+        slot = (slot + 1) & (routeCapacity - 1);
+    }
+
+    routeTable[slot].hash = hash;
+    routeTable[slot].rule = rule;
+    routeTable[slot].host = name;
+    routeTable[slot].address = strdup(address);
+    routeTable[slot].port = strdup(port);
+    routeTable[slot].retry_ms = 0;
+    routeTable[slot].upstream = NULL;
+    ++routeCount;
+}
+
+/*
+ * FUNCTION: find_route
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct route *find_route(const uint32_t rule, const char *host);
+ *
+ * PARAMETERS:
+ * const uint32_t rule - The routed rule
+ * const char *host - The exact lowercase key to look for
+ *
+ * RETURNS:
+ * struct route * - The matching route, or NULL
+ */
+static struct route *find_route(const uint32_t rule, const char *host) {
+    if (routeCapacity == 0) {
+        return NULL;
+    }
+    const uint64_t hash = hash_host(rule, host);
+    for (size_t slot = hash & (routeCapacity - 1); routeTable[slot].host; slot = (slot + 1) & (routeCapacity - 1)) {
+        if (routeTable[slot].hash == hash && routeTable[slot].rule == rule && strcmp(routeTable[slot].host, host) == 0) {
+            return &routeTable[slot];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION: route_lookup
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct route *route_lookup(const uint32_t rule, const char *host);
+ *
+ * PARAMETERS:
+ * const uint32_t rule - The routed rule the client connected through
+ * const char *host - The lowercase host name the client asked for, or NULL if it sent none
+ *
+ * RETURNS:
+ * struct route * - The most specific matching route, or NULL
+ *
+ * NOTES:
+ * Tries the exact name, then *.parent for each parent domain, then the default route.
+ */
+struct route *route_lookup(const uint32_t rule, const char *host) {
+    if (host) {
+        struct route *match = find_route(rule, host);
+        if (match) {
+            return match;
+        }
+        char wildcard[ROUTE_HOST_SIZE + 1];
+        for (const char *dot = strchr(host, '.'); dot; dot = strchr(dot + 1, '.')) {
+            snprintf(wildcard, sizeof(wildcard), "*%s", dot);
+            if ((match = find_route(rule, wildcard))) {
+                return match;
+            }
+        }
+    }
+    return find_route(rule, ROUTE_DEFAULT_HOST);
+}
+
+/*
+ * FUNCTION: route_targets
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t route_targets(struct resolve_target *targets);
+ *
+ * PARAMETERS:
+ * struct resolve_target *targets - Filled with every route that needs resolving, or NULL to only count them
+ *
+ * RETURNS:
+ * size_t - The number of routes that need resolving
+ *
+ * NOTES:
+ * Targets point into the table, so no routes may be added while they are in use.
+ */
+size_t route_targets(struct resolve_target *targets) {
+    size_t count = 0;
+    for (size_t i = 0; i < routeCapacity; ++i) {
+        if (routeTable[i].host && !isUnixAddress(routeTable[i].address)) {
+            if (targets) {
+                targets[count].upstream = &routeTable[i].upstream;
+                targets[count].address = routeTable[i].address;
+                targets[count].port = routeTable[i].port;
+                targets[count].retry_ms = &routeTable[i].retry_ms;
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+/*
+ * FUNCTION: parse_client_hello
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int parse_client_hello(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ *
+ * PARAMETERS:
+ * const unsigned char *buffer - The peeked start of a TLS stream
+ * const size_t size - The number of bytes peeked
+ * char *host - Filled with the lowercase server name
+ * const size_t hostSize - The size of the host buffer
+ *
+ * RETURNS:
+ * int - 1 if a server name was found, 0 if more data is needed, -1 if there is no usable server name
+ *
+ * NOTES:
+ * Only looks inside the first record, a ClientHello split across records is treated as having no name.
+ */
+static int parse_client_hello(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize) {
+    if (size < 5) {
+        return 0;
+    }
+    const size_t recordLen = (buffer[3] << 8) | buffer[4];
+    if (size < 5 + recordLen) {
+        return (5 + recordLen <= ROUTE_PEEK_SIZE) ? 0 : -1;
+    }
+
+    const unsigned char *p = buffer + 5;
+    const unsigned char *end = p + recordLen;
+
+#define NEED(n) do { if ((size_t) (end - p) < (size_t) (n)) { return -1; } } while(0)
+
+    //Handshake type and length, client version, random
+    NEED(4 + 2 + 32);
+    if (p[0] != 0x01) {
+        return -1;
+    }
+    p += 4 + 2 + 32;
+
+    //Session id
+    NEED(1);
+    NEED(1 + p[0]);
+    p += 1 + p[0];
+
+    //Cipher suites
+    NEED(2);
+    NEED(2 + ((p[0] << 8) | p[1]));
+    p += 2 + ((p[0] << 8) | p[1]);
+
+    //Compression methods
+    NEED(1);
+    NEED(1 + p[0]);
+    p += 1 + p[0];
+
+    //Extensions
+    NEED(2);
+    const size_t extLen = (p[0] << 8) | p[1];
+    p += 2;
+    NEED(extLen);
+    end = p + extLen;
+
+    while (end - p >= 4) {
+        const unsigned int type = (p[0] << 8) | p[1];
+        const size_t len = (p[2] << 8) | p[3];
+        p += 4;
+        NEED(len);
+        if (type == 0) {
+            //server_name: list length, name type, name length, name
+            if (len < 5 || p[2] != 0) {
+                return -1;
+            }
+            const size_t nameLen = (p[3] << 8) | p[4];
+            if (nameLen == 0 || nameLen + 5 > len || nameLen >= hostSize) {
+                return -1;
+            }
+            for (size_t i = 0; i < nameLen; ++i) {
+                host[i] = tolower(p[5 + i]);
+            }
+            host[nameLen] = '\0';
+            return 1;
+        }
+        p += len;
+    }
+#undef NEED
+    return -1;
+}
+
+/*
+ * FUNCTION: parse_http_host
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int parse_http_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ *
+ * PARAMETERS:
+ * const unsigned char *buffer - The peeked start of an HTTP/1 request
+ * const size_t size - The number of bytes peeked
+ * char *host - Filled with the lowercase Host header value, without any port
+ * const size_t hostSize - The size of the host buffer
+ *
+ * RETURNS:
+ * int - 1 if a host was found, 0 if more data is needed, -1 if the request head has no usable host
+ */
+static int parse_http_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize) {
+    const unsigned char *end = buffer + size;
+    const unsigned char *line = buffer;
+    bool requestLine = true;
+
+    for (;;) {
+        const unsigned char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            return (size < ROUTE_PEEK_SIZE) ? 0 : -1;
+        }
+        size_t len = eol - line;
+        if (len > 0 && line[len - 1] == '\r') {
+            --len;
+        }
+        if (len == 0) {
+            //End of the request head without a host
+            return -1;
+        }
+        if (!requestLine && len > 5 && strncasecmp((const char *) line, "host:", 5) == 0) {
+            const unsigned char *value = line + 5;
+            const unsigned char *valueEnd = line + len;
+            while (value < valueEnd && (*value == ' ' || *value == '\t')) {
+                ++value;
+            }
+            while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+                --valueEnd;
+            }
+            //Strip the port, but leave bracketed IPv6 literals alone
+            const unsigned char *colon = valueEnd;
+            while (colon > value && colon[-1] != ':' && colon[-1] != ']') {
+                --colon;
+            }
+            if (colon > value && colon[-1] == ':') {
+                valueEnd = colon - 1;
+            }
+            const size_t hostLen = valueEnd - value;
+            if (hostLen == 0 || hostLen >= hostSize) {
+                return -1;
+            }
+            for (size_t i = 0; i < hostLen; ++i) {
+                host[i] = tolower(value[i]);
+            }
+            host[hostLen] = '\0';
+            return 1;
+        }
+        requestLine = false;
+        line = eol + 1;
+    }
+}
+
+/*
+ * FUNCTION: route_extract_host
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int route_extract_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ *
+ * PARAMETERS:
+ * const unsigned char *buffer - The bytes peeked from the client
+ * const size_t size - The number of bytes peeked
+ * char *host - Filled with the lowercase host name
+ * const size_t hostSize - The size of the host buffer
+ *
+ * RETURNS:
+ * int - 1 if a host was found, 0 if more data is needed, -1 if the client sent no usable host
+ *
+ * NOTES:
+ * A leading handshake record type means TLS and the SNI is used, anything else is treated as HTTP/1.
+ */
+int route_extract_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize) {
+    if (size == 0) {
+        return 0;
+    }
+    if (buffer[0] == 0x16) {
+        return parse_client_hello(buffer, size, host, hostSize);
+    }
+    return parse_http_host(buffer, size, host, hostSize);
+}
+
+/*
+ * FUNCTION: route_cleanup
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void route_cleanup(void);
+ *
+ * RETURNS:
+ * void
+ */
+void route_cleanup(void) {
+    for (size_t i = 0; i < routeCapacity; ++i) {
+        if (routeTable[i].host) {
+            free(routeTable[i].host);
+            free(routeTable[i].address);
+            free(routeTable[i].port);
+            if (routeTable[i].upstream) {
+                freeaddrinfo(routeTable[i].upstream);
+            }
+        }
+    }
+    free(routeTable);
+    routeTable = NULL;
+    routeCapacity = 0;
+    routeCount = 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * HEADER FILE: route.h - Name based routing of incoming connections
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void route_add(const uint32_t rule, const char *host, const char *address, const char *port);
+ * struct route *route_lookup(const uint32_t rule, const char *host);
+ * size_t route_targets(struct resolve_target *targets);
+ * int route_extract_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+ * void route_cleanup(void);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <netdb.h>
+
+//Largest client prefix peeked at, one full TLS record
+#define ROUTE_PEEK_SIZE 16389
+
+//Longest host name accepted, per RFC 1035
+#define ROUTE_HOST_SIZE 256
+
+//Matches any host that has no more specific route
+#define ROUTE_DEFAULT_HOST "*"
+
+struct route {
+    uint64_t hash;
+    uint32_t rule;
+    char *host;
+    char *address;
+    char *port;
+    _Atomic uint32_t retry_ms;
+    struct addrinfo *_Atomic upstream;
+};
+
+struct resolve_target;
+
+void route_add(const uint32_t rule, const char *host, const char *address, const char *port);
+struct route *route_lookup(const uint32_t rule, const char *host);
+size_t route_targets(struct resolve_target *targets);
+int route_extract_host(const unsigned char *buffer, const size_t size, char *host, const size_t hostSize);
+void route_cleanup(void);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * SOURCE FILE: sniff.c - Implementation of functions declared in sniff.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool sniff_add(struct sniff_table **table, const char *spec);
+ * int sniff_match(struct sniff_table *table, const unsigned char *buffer, const size_t size, const char **name);
+ * void sniff_report(FILE *out, const char *name, const struct sniff_table *table);
+ * static int parse_signature(const char *hex, uint8_t pattern[static SNIFF_SIGNATURE_SIZE], uint8_t mask[static SNIFF_SIGNATURE_SIZE]);
+ * static void compare_signatures(const struct sniff_table *table, const uint8_t data[static SNIFF_SIGNATURE_SIZE], uint32_t equal[static SNIFF_SIGNATURE_MAX]);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * A protocol route is proto:name for a built in protocol, or proto:name=hex for a custom one,
+ * where hex is the prefix the client sends first, with ?? for a byte that can be anything.
+ * Every signature is compared against the client's first 16 bytes at once,
+ * with SSE2 one signature per instruction, and with AVX2 two.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <ctype.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "sniff.h"
+#include "main.h"
+
+static int parse_signature(const char *hex, uint8_t pattern[static SNIFF_SIGNATURE_SIZE], uint8_t mask[static SNIFF_SIGNATURE_SIZE]);
+static void compare_signatures(const struct sniff_table *table, const uint8_t data[static SNIFF_SIGNATURE_SIZE], uint32_t equal[static SNIFF_SIGNATURE_MAX]);
+
+//Client first bytes of the built in protocols, a protocol with several signatures matches any of them
+static const struct {
+    const char *name;
+    const char *prefix;
+    size_t length;
+} builtinList[] = {
+    {"tls", "\x16\x03", 2},
+    {"ssh", "SSH-", 4},
+    {"http", "GET ", 4},
+    {"http", "HEAD ", 5},
+    {"http", "POST ", 5},
+    {"http", "PUT ", 4},
+    {"http", "DELETE ", 7},
+    {"http", "OPTIONS ", 8},
+    {"http", "PATCH ", 6},
+    {"http", "CONNECT ", 8},
+    {"http", "TRACE ", 6},
+    {"http", "PRI * HTTP/2.0", 14},
+};
+
+/*
+ * FUNCTION: sniff_add
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool sniff_add(struct sniff_table **table, const char *spec);
+ *
+ * PARAMETERS:
+ * struct sniff_table **table - The listener's table, allocated on its first signature, or NULL to only check spec
+ * const char *spec - The route host after SNIFF_PREFIX, a protocol name with an optional =hex signature
+ *
+ * RETURNS:
+ * bool - Whether spec was valid and its signatures fit in the table, which is left unchanged if not
+ *
+ * NOTES:
+ * Signatures already in the table for the same name are replaced, like a repeated route.
+ * The silent protocol has no signature, it is picked by the rule's wait instead.
+ */
+bool sniff_add(struct sniff_table **table, const char *spec) {
+    const char *equals = strchr(spec, '=');
+    const size_t nameLength = equals ? (size_t) (equals - spec) : strlen(spec);
+    char name[SNIFF_NAME_SIZE];
+    if (nameLength == 0 || nameLength >= sizeof(name)) {
+        fprintf(stderr, "Invalid protocol name %s\n", spec);
+        return false;
+    }
+    for (size_t i = 0; i < nameLength; ++i) {
+        if (!isalnum((unsigned char) spec[i]) && spec[i] != '-' && spec[i] != '_') {
+            fprintf(stderr, "Invalid protocol name %s\n", spec);
+            return false;
+        }
+        name[i] = tolower((unsigned char) spec[i]);
+    }
+    name[nameLength] = '\0';
+
+    uint8_t patterns[SNIFF_SIGNATURE_MAX][SNIFF_SIGNATURE_SIZE] = {{0}};
+    uint8_t masks[SNIFF_SIGNATURE_MAX][SNIFF_SIGNATURE_SIZE] = {{0}};
+    uint32_t lengths[SNIFF_SIGNATURE_MAX];
+    size_t added = 0;
+    if (equals) {
+        const int length = parse_signature(equals + 1, patterns[0], masks[0]);
+        if (length <= 0) {
+            fprintf(stderr, "Invalid signature for protocol %s, expected up to %d hex bytes or ??\n", name, SNIFF_SIGNATURE_SIZE);
+            return false;
+        }
+        lengths[added++] = length;
+    } else if (strcmp(name, SNIFF_SILENT) != 0) {
+        for (size_t i = 0; i < sizeof(builtinList) / sizeof(builtinList[0]); ++i) {
+            if (strcmp(builtinList[i].name, name) == 0) {
+                memcpy(patterns[added], builtinList[i].prefix, builtinList[i].length);
+                memset(masks[added], 0xff, builtinList[i].length);
+                lengths[added++] = builtinList[i].length;
+            }
+        }
+        if (added == 0) {
+            fprintf(stderr, "Unknown protocol %s, give its signature as %s%s=hex\n", name, SNIFF_PREFIX, name);
+            return false;
+        }
+    }
+
+    size_t kept = 0;
+    if (table && *table) {
+        for (size_t i = 0; i < (*table)->count; ++i) {
+            kept += (strcmp((*table)->names[i], name) != 0);
+        }
+    }
+    if (kept + added > SNIFF_SIGNATURE_MAX) {
+        fprintf(stderr, "Too many protocol signatures on one listener, dropping %s\n", name);
+        return false;
+    }
+    if (table == NULL || added == 0) {
+        return true;
+    }
+
+    if (*table == NULL) {
+        *table = checked_calloc(1, sizeof(struct sniff_table));
+    }
+    struct sniff_table *sniff = *table;
+    kept = 0;
+    for (size_t i = 0; i < sniff->count; ++i) {
+        if (strcmp(sniff->names[i], name) == 0) {
+            continue;
+        }
+        memmove(sniff->patterns[kept], sniff->patterns[i], SNIFF_SIGNATURE_SIZE);
+        memmove(sniff->masks[kept], sniff->masks[i], SNIFF_SIGNATURE_SIZE);
+        memmove(sniff->names[kept], sniff->names[i], SNIFF_NAME_SIZE);
+        sniff->lengths[kept] = sniff->lengths[i];
+        atomic_store(&sniff->matches[kept], atomic_load(&sniff->matches[i]));
+        ++kept;
+    }
+    for (size_t i = 0; i < added; ++i, ++kept) {
+        memcpy(sniff->patterns[kept], patterns[i], SNIFF_SIGNATURE_SIZE);
+        memcpy(sniff->masks[kept], masks[i], SNIFF_SIGNATURE_SIZE);
+        memcpy(sniff->names[kept], name, SNIFF_NAME_SIZE);
+        sniff->lengths[kept] = lengths[i];
+        atomic_store(&sniff->matches[kept], 0);
+    }
+    sniff->count = kept;
+    return true;
+}
+
+/*
+ * FUNCTION: parse_signature
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int parse_signature(const char *hex, uint8_t pattern[static SNIFF_SIGNATURE_SIZE], uint8_t mask[static SNIFF_SIGNATURE_SIZE]);
+ *
+ * PARAMETERS:
+ * const char *hex - Pairs of hex digits, or ?? for any byte
+ * uint8_t pattern[static SNIFF_SIGNATURE_SIZE] - Filled with the masked bytes to match
+ * uint8_t mask[static SNIFF_SIGNATURE_SIZE] - Filled with 0xff for each byte that must match and 0 for the rest
+ *
+ * RETURNS:
+ * int - The signature length in bytes, or -1 if it is malformed, too long, or only wildcards
+ */
+static int parse_signature(const char *hex, uint8_t pattern[static SNIFF_SIGNATURE_SIZE], uint8_t mask[static SNIFF_SIGNATURE_SIZE]) {
+    int length = 0;
+    bool fixed = false;
+    for (; hex[0]; hex += 2) {
+        if (!hex[1] || length == SNIFF_SIGNATURE_SIZE) {
+            return -1;
+        }
+        if (hex[0] == '?' && hex[1] == '?') {
+            pattern[length] = 0;
+            mask[length] = 0;
+        } else if (isxdigit((unsigned char) hex[0]) && isxdigit((unsigned char) hex[1])) {
+            const char digits[3] = {hex[0], hex[1], '\0'};
+            pattern[length] = strtoul(digits, NULL, 16);
+            mask[length] = 0xff;
+            fixed = true;
+        } else {
+            return -1;
+        }
+        ++length;
+    }
+    return fixed ? length : -1;
+}
+
+/*
+ * FUNCTION: compare_signatures
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void compare_signatures(const struct sniff_table *table, const uint8_t data[static SNIFF_SIGNATURE_SIZE], uint32_t equal[static SNIFF_SIGNATURE_MAX]);
+ *
+ * PARAMETERS:
+ * const struct sniff_table *table - The listener's signatures
+ * const uint8_t data[static SNIFF_SIGNATURE_SIZE] - The client's first bytes, zero padded
+ * uint32_t equal[static SNIFF_SIGNATURE_MAX] - Filled with a bit per byte position that matched, for each signature
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Which matcher is used is decided at compile time, release builds use -march=native and so get AVX2 where the build host has it.
+ */
+static void compare_signatures(const struct sniff_table *table, const uint8_t data[static SNIFF_SIGNATURE_SIZE], uint32_t equal[static SNIFF_SIGNATURE_MAX]) {
+#if defined(__AVX2__)
+    const __m256i input = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) data));
+    for (size_t i = 0; i < table->count; i += 2) {
+        const __m256i pattern = _mm256_loadu_si256((const __m256i *) table->patterns[i]);
+        const __m256i mask = _mm256_loadu_si256((const __m256i *) table->masks[i]);
+        const uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(input, mask), pattern));
+        equal[i] = bits & 0xffff;
+        equal[i + 1] = bits >> 16;
+    }
+#elif defined(__SSE2__)
+    const __m128i input = _mm_loadu_si128((const __m128i *) data);
+    for (size_t i = 0; i < table->count; ++i) {
+        const __m128i pattern = _mm_loadu_si128((const __m128i *) table->patterns[i]);
+        const __m128i mask = _mm_loadu_si128((const __m128i *) table->masks[i]);
+        equal[i] = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(input, mask), pattern));
+    }
+#else
+    for (size_t i = 0; i < table->count; ++i) {
+        equal[i] = 0;
+        for (size_t j = 0; j < SNIFF_SIGNATURE_SIZE; ++j) {
+            equal[i] |= (uint32_t) ((data[j] & table->masks[i][j]) == table->patterns[i][j]) << j;
+        }
+    }
+#endif
+}
+
+/*
+ * FUNCTION: sniff_match
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int sniff_match(struct sniff_table *table, const unsigned char *buffer, const size_t size, const char **name);
+ *
+ * PARAMETERS:
+ * struct sniff_table *table - The listener's signatures
+ * const unsigned char *buffer - The bytes peeked from the client
+ * const size_t size - The number of bytes peeked, at least one
+ * const char **name - Set to the matching protocol's name
+ *
+ * RETURNS:
+ * int - 1 if a protocol matched, 0 if more data is needed to tell, -1 if no signature can match
+ *
+ * NOTES:
+ * The first signature in route order wins, so a client that could still match an earlier, longer signature is waited on.
+ */
+int sniff_match(struct sniff_table *table, const unsigned char *buffer, const size_t size, const char **name) {
+    uint8_t data[SNIFF_SIGNATURE_SIZE] = {0};
+    uint32_t equal[SNIFF_SIGNATURE_MAX];
+    const size_t available = (size < SNIFF_SIGNATURE_SIZE) ? size : SNIFF_SIGNATURE_SIZE;
+    memcpy(data, buffer, available);
+    compare_signatures(table, data, equal);
+
+    int result = -1;
+    for (size_t i = 0; i < table->count; ++i) {
+        const uint32_t length = table->lengths[i];
+        const uint32_t wanted = (1u << ((length < available) ? length : available)) - 1;
+        if ((equal[i] & wanted) != wanted) {
+            continue;
+        }
+        if (available < length) {
+            result = 0;
+        } else if (result == -1) {
+            atomic_fetch_add_explicit(&table->matches[i], 1, memory_order_relaxed);
+            *name = table->names[i];
+            return 1;
+        }
+    }
+    return result;
+}
+
+/*
+ * FUNCTION: sniff_report
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void sniff_report(FILE *out, const char *name, const struct sniff_table *table);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the report
+ * const char *name - The listen address of the rule the table belongs to
+ * const struct sniff_table *table - The table to report on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Prints one line per protocol, with the clients matched by any of its signatures.
+ */
+void sniff_report(FILE *out, const char *name, const struct sniff_table *table) {
+    for (size_t i = 0; i < table->count; ++i) {
+        if (i && strcmp(table->names[i], table->names[i - 1]) == 0) {
+            continue;
+        }
+        uint64_t matches = 0;
+        for (size_t j = i; j < table->count && strcmp(table->names[j], table->names[i]) == 0; ++j) {
+            matches += atomic_load_explicit(&table->matches[j], memory_order_relaxed);
+        }
+        fprintf(out, "Rule %s protocol %s: clients: %lu\n", name, table->names[i], (unsigned long) matches);
+    }
+}
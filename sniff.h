@@ -0,0 +1,59 @@
+/*
+ * HEADER FILE: sniff.h - Protocol detection from a client's first bytes
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool sniff_add(struct sniff_table **table, const char *spec);
+ * int sniff_match(struct sniff_table *table, const unsigned char *buffer, const size_t size, const char **name);
+ * void sniff_report(FILE *out, const char *name, const struct sniff_table *table);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef SNIFF_H
+#define SNIFF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+//Route hosts starting with this name a protocol rather than a host, as in 443@proto:ssh
+#define SNIFF_PREFIX "proto:"
+
+//Pseudo protocol for clients that send nothing within their rule's wait, such as SMTP or FTP clients
+#define SNIFF_SILENT "silent"
+
+//Longest signature, one SSE2 register
+#define SNIFF_SIGNATURE_SIZE 16
+
+//Most signatures one listener matches against, kept even since the AVX2 matcher compares them in pairs
+#define SNIFF_SIGNATURE_MAX 32
+
+//Longest protocol name, including the terminator
+#define SNIFF_NAME_SIZE 32
+
+/*
+ * A listener's signatures, in the order their routes were added.
+ * Each pattern is pre-masked, so a signature matches when the masked client bytes equal it.
+ * Rows are contiguous so the matcher can load two patterns at once.
+ */
+struct sniff_table {
+    uint8_t patterns[SNIFF_SIGNATURE_MAX][SNIFF_SIGNATURE_SIZE];
+    uint8_t masks[SNIFF_SIGNATURE_MAX][SNIFF_SIGNATURE_SIZE];
+    uint32_t lengths[SNIFF_SIGNATURE_MAX];
+    char names[SNIFF_SIGNATURE_MAX][SNIFF_NAME_SIZE];
+    _Atomic uint64_t matches[SNIFF_SIGNATURE_MAX];
+    size_t count;
+};
+
+bool sniff_add(struct sniff_table **table, const char *spec);
+int sniff_match(struct sniff_table *table, const unsigned char *buffer, const size_t size, const char **name);
+void sniff_report(FILE *out, const char *name, const struct sniff_table *table);
+
+#endif
@@ -8,8 +8,47 @@
  * FUNCTIONS:
  * int createSocket(int domain, int type, int protocol);
  * void setNonBlocking(const int sock);
- * void bindSocket(const int sock, const unsigned short port);
- * int establishConnection(const char *address, const char *port);
+ * bool bindSocket(const int sock, const unsigned short port);
+ * struct addrinfo *resolveAddress(const char *address, const char *port);
+ * int startConnection(const char *address, const struct addrinfo *upstream, struct source_pool *sources);
+ * bool startConnectRace(struct connect_race *race, const struct addrinfo *list, struct source_pool *sources, const unsigned char *data, const size_t len, const int epoll, const uint64_t tag);
+ * bool adoptConnectRace(struct connect_race *race, const int sock, const int epoll, const uint64_t tag);
+ * int stepConnectRace(struct connect_race *race);
+ * void cancelConnectRace(struct connect_race *race);
+ * static void launchAttempt(struct connect_race *race, const unsigned char *data, const size_t len);
+ * static int checkAttempt(const int sock);
+ * static void armRace(struct connect_race *race);
+ * static size_t orderAddresses(const struct addrinfo *list, const struct addrinfo *order[static CONNECT_MAX_ATTEMPTS]);
+ * static int startAttempt(const struct addrinfo *address, struct source_pool *sources, const unsigned char *data, size_t *len);
+ * static bool bindSource(const int sock, const struct source_pool *sources, const struct source_address *source);
+ * struct source_pool *createSourcePool(const char *list, const uint32_t port_range);
+ * void reportSourcePool(FILE *out, const char *name, const struct source_pool *sources);
+ * static uint64_t addressHash(const struct addrinfo *address);
+ * static uint32_t lookupLatency(const struct addrinfo *address);
+ * static void rememberLatency(const struct addrinfo *address, const uint32_t us);
+ * static uint32_t elapsedMicros(const struct timespec *start);
+ * bool bindUnixSocket(const int sock, const char *path);
+ * bool isUnixAddress(const char *address);
+ * void setTransparent(const int sock);
+ * int getOriginalDestination(const int sock, const bool tproxy, struct sockaddr_in *dst);
+ * int establishTransparentConnection(const struct sockaddr_in *dst, const struct sockaddr_in *src);
+ * void setBusyPoll(const int sock, const int usecs);
+ * void setNoDelay(const int sock);
+ * void setQuickAck(const int sock);
+ * void setIncomingCpu(const int sock, const int cpu);
+ * void setListenerOptions(const int sock, const uint32_t defer_s, const uint32_t fastopen);
+ * void setReusePort(const int sock);
+ * void setPipeLimits(const long max, const long memory);
+ * size_t pipeGrownMemory(void);
+ * static uint32_t acquirePipe(int pipes[static 2], const uint32_t size_class);
+ * static void releasePipe(int pipes[static 2], const bool empty, const uint32_t size_class, const uint32_t keep);
+ * static bool cacheGrownPipe(int pipes[static 2], const uint32_t size_class);
+ * static uint32_t pipeClock(void);
+ * static uint32_t resizePipe(const int pipe, const uint32_t from, const uint32_t to);
+ * static uint32_t nextPipeClass(const int out, const uint32_t size_class, const size_t full, const size_t moved);
+ * void releaseClientPipes(struct client *const client);
+ * int trimPipeCache(void);
+ * int forward_traffic(const int in, const int out, struct client *const client, const int direction, const size_t budget);
  * size_t readNBytes(const int sock, unsigned char *buf, size_t bufsize);
  * void rawSend(const int sock, const unsigned char *buffer, size_t bufSize);
  *
@@ -20,8 +59,14 @@
 #define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <netinet/tcp.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netfilter_ipv4.h>
 #include <netdb.h>
 #include <string.h>
 #include <stdio.h>
@@ -30,9 +75,45 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 #include "socket.h"
+#include "stats.h"
 #include "network.h"
 #include "macro.h"
+#include "main.h"
+
+static size_t orderAddresses(const struct addrinfo *list, const struct addrinfo *order[static CONNECT_MAX_ATTEMPTS]);
+static int startAttempt(const struct addrinfo *address, struct source_pool *sources, const unsigned char *data, size_t *len);
+static void launchAttempt(struct connect_race *race, const unsigned char *data, const size_t len);
+static int checkAttempt(const int sock);
+static void armRace(struct connect_race *race);
+static bool bindSource(const int sock, const struct source_pool *sources, const struct source_address *source);
+static uint64_t addressHash(const struct addrinfo *address);
+static uint32_t lookupLatency(const struct addrinfo *address);
+static void rememberLatency(const struct addrinfo *address, const uint32_t us);
+static uint32_t elapsedMicros(const struct timespec *start);
+static uint32_t resizePipe(const int pipe, const uint32_t from, const uint32_t to);
+static uint32_t nextPipeClass(const int out, const uint32_t size_class, const size_t full, const size_t moved);
+static bool cacheGrownPipe(int pipes[static 2], const uint32_t size_class);
+static uint32_t pipeClock(void);
+
+static _Thread_local int pipeCache[PIPE_CACHE_SIZE][2];
+static _Thread_local size_t pipeCacheCount;
+
+//Drained grown pipes by size class less one, oldest first, so a bulk flow's next run doesn't resize a default pipe again
+static _Thread_local struct grown_pipe grownCache[PIPE_CLASS_MAX][PIPE_GROWN_CACHE_SIZE];
+static _Thread_local size_t grownCacheCount[PIPE_CLASS_MAX];
+static _Thread_local size_t grownCacheTotal;
+
+//Largest size class a flow's pipe may grow to, and the cap on pipe memory above PIPE_SIZE_DEFAULT across every flow
+static uint32_t pipeClassMax = 4;
+static size_t pipeMemoryMax = (size_t) PIPE_MEMORY_DEFAULT << 20;
+static _Atomic size_t pipeGrownBytes;
+
+//Smoothed connect time of recently tried upstream addresses, tagged with the top of the address hash
+static _Atomic uint64_t connectHistory[CONNECT_HISTORY_SIZE];
 
 /*
  * FUNCTION: createSocket
@@ -113,16 +194,16 @@ void setNonBlocking(const int sock) {
  * John Agapeyev
  *
  * INTERFACE:
- * void bindSocket(const int sock, const unsigned short port);
+ * bool bindSocket(const int sock, const unsigned short port);
  *
  * PARAMETERS:
  * const int sock - The socket to bind with
  * const unsigned short port - The port to bind
  *
  * RETURNS:
- * void
+ * bool - Whether the socket was bound
  */
-void bindSocket(const int sock, const unsigned short port) {
+bool bindSocket(const int sock, const unsigned short port) {
     struct sockaddr_in myAddr;
     memset(&myAddr, 0, sizeof(struct sockaddr_in));
     myAddr.sin_family = AF_INET;
@@ -130,15 +211,17 @@ void bindSocket(const int sock, const unsigned short port) {
     myAddr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(sock, (struct sockaddr *) &myAddr, sizeof(struct sockaddr_in)) == -1) {
-        fatal_error("bind");
+        perror("bind");
+        return false;
     }
+    return true;
 }
 
 /*
- * FUNCTION: establishConnection
+ * FUNCTION: resolveAddress
  *
  * DATE:
- * Dec. 2, 2017
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -147,19 +230,22 @@ void bindSocket(const int sock, const unsigned short port) {
  * John Agapeyev
  *
  * INTERFACE:
- * int establishConnection(const char *address, const char *port);
+ * struct addrinfo *resolveAddress(const char *address, const char *port);
  *
  * PARAMETERS:
  * const char *address - A string containing the domain name or ip address of the desired host
  * const char *port - A string containing the port number to connect to
  *
  * RETURNS:
- * int - The socket that is connected to the given address and port
+ * struct addrinfo * - The resolved address list, or NULL on failure
+ *
+ * NOTES:
+ * The list must be freed with freeaddrinfo.
  */
-int establishConnection(const char *address, const char *port) {
+struct addrinfo *resolveAddress(const char *address, const char *port) {
     struct addrinfo hints;
     memset(&hints, 0, sizeof (struct addrinfo));
-    hints.ai_family = AF_INET;     // Return IPv4 and IPv6 choices
+    hints.ai_family = AF_UNSPEC;     // Return IPv4 and IPv6 choices
     hints.ai_socktype = SOCK_STREAM; // We want a TCP socket
     hints.ai_flags = (AI_ADDRCONFIG | AI_V4MAPPED);
 
@@ -167,35 +253,496 @@ int establishConnection(const char *address, const char *port) {
     int e;
     if ((e = getaddrinfo(address, port, &hints, &result)) != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(e));
-        exit(EXIT_FAILURE);
+        return NULL;
     }
+    return result;
+}
 
-    struct addrinfo *rp;
-    int sock;
-    for (rp = result; rp; rp = rp->ai_next) {
-        if ((sock = createSocket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) == -1) {
+/*
+ * FUNCTION: orderAddresses
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static size_t orderAddresses(const struct addrinfo *list, const struct addrinfo *order[static CONNECT_MAX_ATTEMPTS]);
+ *
+ * PARAMETERS:
+ * const struct addrinfo *list - A resolved address list
+ * const struct addrinfo *order[static CONNECT_MAX_ATTEMPTS] - Filled with the addresses in the order to try them
+ *
+ * RETURNS:
+ * size_t - How many addresses were placed in order
+ *
+ * NOTES:
+ * Addresses that connected before come first, fastest first.
+ * Untried addresses follow in resolver order, alternating address families as RFC 8305 suggests,
+ * and addresses whose last attempt failed are tried last.
+ */
+static size_t orderAddresses(const struct addrinfo *list, const struct addrinfo *order[static CONNECT_MAX_ATTEMPTS]) {
+    const struct addrinfo *unknown[CONNECT_MAX_ATTEMPTS];
+    const struct addrinfo *failed[CONNECT_MAX_ATTEMPTS];
+    uint32_t latency[CONNECT_MAX_ATTEMPTS];
+    size_t known = 0;
+    size_t unknownCount = 0;
+    size_t failedCount = 0;
+
+    for (const struct addrinfo *rp = list; rp && known + unknownCount + failedCount < CONNECT_MAX_ATTEMPTS; rp = rp->ai_next) {
+        const uint32_t us = lookupLatency(rp);
+        if (us == 0) {
+            unknown[unknownCount++] = rp;
+        } else if (us == CONNECT_FAILED) {
+            failed[failedCount++] = rp;
+        } else {
+            //Insertion sort, the list is tiny
+            size_t i = known++;
+            for (; i > 0 && latency[i - 1] > us; --i) {
+                latency[i] = latency[i - 1];
+                order[i] = order[i - 1];
+            }
+            latency[i] = us;
+            order[i] = rp;
+        }
+    }
+
+    size_t count = known;
+    bool used[CONNECT_MAX_ATTEMPTS] = {false};
+    int family = (unknownCount) ? unknown[0]->ai_family : AF_UNSPEC;
+    for (size_t placed = 0; placed < unknownCount; ++placed) {
+        //Take the first unused address of the wanted family, or the first unused one if that family has run out
+        size_t pick = unknownCount;
+        for (size_t i = 0; i < unknownCount; ++i) {
+            if (!used[i] && (pick == unknownCount || unknown[i]->ai_family == family)) {
+                pick = i;
+                if (unknown[i]->ai_family == family) {
+                    break;
+                }
+            }
+        }
+        used[pick] = true;
+        order[count++] = unknown[pick];
+        family = (unknown[pick]->ai_family == AF_INET6) ? AF_INET : AF_INET6;
+    }
+
+    for (size_t i = 0; i < failedCount; ++i) {
+        order[count++] = failed[i];
+    }
+    return count;
+}
+
+/*
+ * FUNCTION: startAttempt
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int startAttempt(const struct addrinfo *address, struct source_pool *sources, const unsigned char *data, size_t *len);
+ *
+ * PARAMETERS:
+ * const struct addrinfo *address - The address to connect to
+ * struct source_pool *sources - The rule's source addresses, or NULL to let the kernel pick
+ * const unsigned char *data - Bytes to send with MSG_FASTOPEN, or NULL to connect
+ * size_t *len - How many bytes data holds, set to how many went out with the SYN, ignored without data
+ *
+ * RETURNS:
+ * int - A non-blocking socket with the connection under way, or -1 if it failed immediately
+ *
+ * NOTES:
+ * Unlike createSocket, a family the host doesn't support is just a failed attempt.
+ * Sources are taken in turn, skipping ones of the other family, and a source with no free port for this upstream
+ * moves the attempt on to the next one. Each EADDRNOTAVAIL is counted, since it means ports are running out.
+ * With client TFO disabled in net.ipv4.tcp_fastopen, MSG_FASTOPEN fails with EOPNOTSUPP and the attempt falls back to a plain connect.
+ */
+static int startAttempt(const struct addrinfo *address, struct source_pool *sources, const unsigned char *data, size_t *len) {
+    const size_t wanted = (data) ? *len : 0;
+    const size_t count = (sources) ? sources->count : 0;
+    const uint32_t first = (count) ? atomic_fetch_add_explicit(&sources->next, 1, memory_order_relaxed) : 0;
+    for (size_t i = 0; i < count || (i == 0 && count == 0); ++i) {
+        struct source_address *source = (count) ? &sources->addresses[(first + i) % count] : NULL;
+        if (source && source->addr.ss_family != address->ai_family) {
             continue;
         }
-        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
-            break;
+        const int sock = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+        if (sock == -1) {
+            return -1;
         }
-        close(sock);
+        if (sources && !bindSource(sock, sources, source)) {
+            close(sock);
+            continue;
+        }
+        int started = -1;
+        if (wanted) {
+            //Without a cookie the SYN goes out empty and this fails with EINPROGRESS, having sent nothing
+            const ssize_t n = sendto(sock, data, wanted, MSG_FASTOPEN | MSG_NOSIGNAL, address->ai_addr, address->ai_addrlen);
+            *len = (n > 0) ? (size_t) n : 0;
+            started = (n == -1) ? -1 : 0;
+        }
+        if (!wanted || (started == -1 && errno == EOPNOTSUPP)) {
+            started = connect(sock, address->ai_addr, address->ai_addrlen);
+        }
+        if (started == -1 && errno != EINPROGRESS && errno != EAGAIN) {
+            const int error = errno;
+            close(sock);
+            if (error != EADDRNOTAVAIL) {
+                return -1;
+            }
+            STAT_ADD(exhausted, 1);
+            if (source) {
+                atomic_fetch_add_explicit(&source->exhausted, 1, memory_order_relaxed);
+            }
+            continue;
+        }
+        if (source) {
+            atomic_fetch_add_explicit(&source->connects, 1, memory_order_relaxed);
+        }
+        return sock;
+    }
+    return -1;
+}
+
+/*
+ * FUNCTION: bindSource
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool bindSource(const int sock, const struct source_pool *sources, const struct source_address *source);
+ *
+ * PARAMETERS:
+ * const int sock - The unconnected upstream socket
+ * const struct source_pool *sources - The rule's source pool, for its port range
+ * const struct source_address *source - The address to bind to, or NULL to only set the port range
+ *
+ * RETURNS:
+ * bool - Whether the socket was bound
+ *
+ * NOTES:
+ * IP_BIND_ADDRESS_NO_PORT leaves picking the port to connect, so a port only has to be unique for the whole 4-tuple
+ * rather than for the source address, and one source can reuse each port for every upstream.
+ * Kernels without IP_LOCAL_PORT_RANGE ignore the rule's range and use the system wide one.
+ */
+static bool bindSource(const int sock, const struct source_pool *sources, const struct source_address *source) {
+    if (sources->port_range) {
+        setsockopt(sock, IPPROTO_IP, IP_LOCAL_PORT_RANGE, &sources->port_range, sizeof(uint32_t));
+    }
+    if (source == NULL) {
+        return true;
+    }
+    setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &(int){1}, sizeof(int));
+    return bind(sock, (const struct sockaddr *) &source->addr, source->len) == 0;
+}
+
+/*
+ * FUNCTION: createSourcePool
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * struct source_pool *createSourcePool(const char *list, const uint32_t port_range);
+ *
+ * PARAMETERS:
+ * const char *list - IPv4 or IPv6 addresses separated by SOURCE_SEPARATOR, or NULL for none
+ * const uint32_t port_range - The lowest port in the low 16 bits and the highest in the high 16, or 0 for the system's
+ *
+ * RETURNS:
+ * struct source_pool * - The new pool, to be freed by the caller, or NULL if an address is invalid or not local
+ *
+ * NOTES:
+ * Each address is test bound once, so a typo is reported at startup rather than failing every connect.
+ */
+struct source_pool *createSourcePool(const char *list, const uint32_t port_range) {
+    struct source_pool *pool = checked_calloc(1, sizeof(struct source_pool));
+    pool->port_range = port_range;
+    if (list == NULL) {
+        return pool;
+    }
+
+    char *copy = strdup(list);
+    char *save;
+    for (char *text = strtok_r(copy, SOURCE_SEPARATOR, &save); text; text = strtok_r(NULL, SOURCE_SEPARATOR, &save)) {
+        pool = checked_realloc(pool, sizeof(struct source_pool) + sizeof(struct source_address) * (pool->count + 1));
+        struct source_address *source = &pool->addresses[pool->count];
+        memset(source, 0, sizeof(struct source_address));
+
+        struct sockaddr_in *v4 = (struct sockaddr_in *) &source->addr;
+        struct sockaddr_in6 *v6 = (struct sockaddr_in6 *) &source->addr;
+        if (inet_pton(AF_INET, text, &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            source->len = sizeof(struct sockaddr_in);
+        } else if (inet_pton(AF_INET6, text, &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            source->len = sizeof(struct sockaddr_in6);
+        } else {
+            fprintf(stderr, "Invalid source address %s\n", text);
+            free(copy);
+            free(pool);
+            return NULL;
+        }
+
+        const int sock = socket(source->addr.ss_family, SOCK_STREAM, 0);
+        const bool bound = (sock != -1 && bindSource(sock, pool, source));
+        if (sock != -1) {
+            close(sock);
+        }
+        if (!bound) {
+            fprintf(stderr, "Unable to bind source address %s\n", text);
+            free(copy);
+            free(pool);
+            return NULL;
+        }
+        ++pool->count;
+    }
+    free(copy);
+    return pool;
+}
+
+/*
+ * FUNCTION: reportSourcePool
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void reportSourcePool(FILE *out, const char *name, const struct source_pool *sources);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the report
+ * const char *name - The listen address of the rule the pool belongs to
+ * const struct source_pool *sources - The pool to report on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Prints one line per source address with its connects and the ones that found no free port.
+ */
+void reportSourcePool(FILE *out, const char *name, const struct source_pool *sources) {
+    for (size_t i = 0; i < sources->count; ++i) {
+        const struct source_address *source = &sources->addresses[i];
+        char text[INET6_ADDRSTRLEN];
+        const void *addr = (source->addr.ss_family == AF_INET) ? (const void *) &((const struct sockaddr_in *) &source->addr)->sin_addr
+            : (const void *) &((const struct sockaddr_in6 *) &source->addr)->sin6_addr;
+        inet_ntop(source->addr.ss_family, addr, text, sizeof(text));
+        fprintf(out, "Rule %s source %s: connects: %lu, no free port: %lu\n", name, text,
+                (unsigned long) atomic_load_explicit(&source->connects, memory_order_relaxed),
+                (unsigned long) atomic_load_explicit(&source->exhausted, memory_order_relaxed));
+    }
+}
+
+/*
+ * FUNCTION: addressHash
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint64_t addressHash(const struct addrinfo *address);
+ *
+ * PARAMETERS:
+ * const struct addrinfo *address - The address to hash
+ *
+ * RETURNS:
+ * uint64_t - The FNV-1a hash of the socket address
+ */
+static uint64_t addressHash(const struct addrinfo *address) {
+    const unsigned char *bytes = (const unsigned char *) address->ai_addr;
+    uint64_t hash = 14695981039346656037ull;
+    for (socklen_t i = 0; i < address->ai_addrlen; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/*
+ * FUNCTION: lookupLatency
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t lookupLatency(const struct addrinfo *address);
+ *
+ * PARAMETERS:
+ * const struct addrinfo *address - The address to look up
+ *
+ * RETURNS:
+ * uint32_t - The smoothed connect time in microseconds, 0 if unknown, or CONNECT_FAILED
+ */
+static uint32_t lookupLatency(const struct addrinfo *address) {
+    const uint64_t hash = addressHash(address);
+    const uint64_t entry = atomic_load_explicit(&connectHistory[hash & (CONNECT_HISTORY_SIZE - 1)], memory_order_relaxed);
+    return ((entry >> 32) == (hash >> 32)) ? (uint32_t) entry : 0;
+}
+
+/*
+ * FUNCTION: rememberLatency
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void rememberLatency(const struct addrinfo *address, const uint32_t us);
+ *
+ * PARAMETERS:
+ * const struct addrinfo *address - The address that was tried
+ * const uint32_t us - How long it took to connect, or CONNECT_FAILED
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Entries are only hints, so a colliding address simply replaces the entry and racing updates may lose one.
+ */
+static void rememberLatency(const struct addrinfo *address, const uint32_t us) {
+    const uint64_t hash = addressHash(address);
+    const uint32_t previous = lookupLatency(address);
+    uint32_t smoothed = us;
+    if (us != CONNECT_FAILED && previous && previous != CONNECT_FAILED) {
+        smoothed = (previous * 3ull + us) / 4;
+    }
+    if (smoothed == 0) {
+        smoothed = 1;
+    }
+    atomic_store_explicit(&connectHistory[hash & (CONNECT_HISTORY_SIZE - 1)], (hash & 0xffffffff00000000ull) | smoothed, memory_order_relaxed);
+}
+
+/*
+ * FUNCTION: elapsedMicros
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t elapsedMicros(const struct timespec *start);
+ *
+ * PARAMETERS:
+ * const struct timespec *start - A CLOCK_MONOTONIC time
+ *
+ * RETURNS:
+ * uint32_t - Microseconds since start
+ */
+static uint32_t elapsedMicros(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * FUNCTION: startConnection
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int startConnection(const char *address, const struct addrinfo *upstream, struct source_pool *sources);
+ *
+ * PARAMETERS:
+ * const char *address - The upstream address string, checked for a unix:/path
+ * const struct addrinfo *upstream - The resolved upstream, NULL for unix sockets
+ * struct source_pool *sources - The rule's source addresses, or NULL to let the kernel pick
+ *
+ * RETURNS:
+ * int - A non-blocking socket with the connection under way, or -1 if it failed immediately
+ *
+ * NOTES:
+ * Only the address startConnectRace would try first is used, for callers such as tunnel channels that have no race to fall back through.
+ * The caller checks SO_ERROR once the socket becomes writable.
+ */
+int startConnection(const char *address, const struct addrinfo *upstream, struct source_pool *sources) {
+    if (!isUnixAddress(address)) {
+        const struct addrinfo *order[CONNECT_MAX_ATTEMPTS];
+        return (orderAddresses(upstream, order)) ? startAttempt(order[0], sources, NULL, NULL) : -1;
     }
 
-    if (!rp) {
-        fprintf(stderr, "Unable to connect\n");
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    if (strlen(address + strlen(UNIX_PREFIX)) >= sizeof(addr.sun_path)) {
         return -1;
     }
+    strcpy(addr.sun_path, address + strlen(UNIX_PREFIX));
 
-    freeaddrinfo(result);
+    //Running out of descriptors only fails this connection, unlike createSocket
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1 && errno != EINPROGRESS && errno != EAGAIN) {
+        close(sock);
+        return -1;
+    }
     return sock;
 }
 
 /*
- * FUNCTION: forward_traffic
+ * FUNCTION: startConnectRace
  *
  * DATE:
- * April 7 2018
+ * October 18 2026
  *
  * DESIGNER:
  * John Agapeyev
@@ -204,49 +751,1275 @@ int establishConnection(const char *address, const char *port) {
  * John Agapeyev
  *
  * INTERFACE:
- * void forward_traffic(const int in, const int out, const struct client *const client) {
+ * bool startConnectRace(struct connect_race *race, const struct addrinfo *list, struct source_pool *sources, const unsigned char *data, const size_t len, const int epoll, const uint64_t tag);
  *
  * PARAMETERS:
- * const int in - The input file descriptor
- * const int out - The output file descriptor
- * const struct client *const client - The client connection involved in the forwarding
+ * struct connect_race *race - Filled in with the race, owned by the caller
+ * const struct addrinfo *list - A resolved address list to race, copied so it may be freed once this returns
+ * struct source_pool *sources - The rule's source addresses, or NULL to let the kernel pick
+ * const unsigned char *data - The first bytes to send to the upstream with MSG_FASTOPEN, or NULL for a plain connect
+ * const size_t len - How many bytes data holds
+ * const int epoll - The epoll set the attempts and the race's timer are added to
+ * const uint64_t tag - The epoll data their events carry
  *
  * RETURNS:
- * void
+ * bool - Whether the race is under way, if not nothing is left open
+ *
+ * NOTES:
+ * Attempts are started CONNECT_ATTEMPT_DELAY_MS apart in the order picked by orderAddresses, without waiting for earlier ones to finish,
+ * as in RFC 8305, and an attempt that fails outright starts the next one immediately.
+ * Nothing here waits, so the caller drives the race with stepConnectRace whenever an event with its tag arrives.
+ * The kernel only puts data in the SYN when it holds a TFO cookie for the address, so the first connect to each upstream sends none.
+ * Only the first attempt carries data, but an abandoned first attempt may still have delivered it,
+ * which TFO's replay rules already demand that protocols tolerate.
  */
-void forward_traffic(const int in, const int out, const struct client *const client) {
-    for (;;) {
-        int n = splice(in, NULL, client->pipes[1], NULL, USHRT_MAX, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
-        if (n == -1) {
-            if (errno == EAGAIN) {
-                return;
-            } else {
-                fatal_error("splice1");
-            }
-        } else if (n == 0) {
-            return;
-        } else {
-            //Don't need non_blocking because the only blocking would be sending, which should be blocked on
-            int x;
-resend:
-            x = splice(client->pipes[0], NULL, out, NULL, USHRT_MAX, SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
-            if (x == -1) {
-                if (errno == EAGAIN) {
-                    return;
-                } else {
-                    fatal_error("splice2");
-                }
-            } else if (x == 0) {
-                //Input pipe is empty
-                continue;
-            } else if (x == n) {
-                //Sent all the data that was read
-                continue;
-            } else {
-                //x < n
-                n -= x;
-                goto resend;
-            }
+bool startConnectRace(struct connect_race *race, const struct addrinfo *list, struct source_pool *sources, const unsigned char *data, const size_t len, const int epoll, const uint64_t tag) {
+    const struct addrinfo *order[CONNECT_MAX_ATTEMPTS];
+    const size_t count = orderAddresses(list, order);
+
+    race->count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (order[i]->ai_addrlen > sizeof(race->attempts[0].addr)) {
+            continue;
         }
+        struct connect_attempt *attempt = &race->attempts[race->count++];
+        memcpy(&attempt->addr, order[i]->ai_addr, order[i]->ai_addrlen);
+        attempt->len = order[i]->ai_addrlen;
+        attempt->sock = -1;
+    }
+    race->next = 0;
+    race->active = 0;
+    race->carried = 0;
+    race->sources = sources;
+    race->epoll = epoll;
+    race->tag = tag;
+    race->winner = -1;
+    race->sent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &race->begun);
+    if ((race->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        return false;
+    }
+
+    while (race->next < race->count && race->active == 0) {
+        launchAttempt(race, (race->next == 0) ? data : NULL, len);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = tag;
+    if (race->active == 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, race->timer, &ev) == -1) {
+        if (race->active == 0) {
+            fprintf(stderr, "Unable to connect\n");
+        }
+        cancelConnectRace(race);
+        return false;
+    }
+    armRace(race);
+    return true;
+}
+
+/*
+ * FUNCTION: adoptConnectRace
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool adoptConnectRace(struct connect_race *race, const int sock, const int epoll, const uint64_t tag);
+ *
+ * PARAMETERS:
+ * struct connect_race *race - Filled in with the race, owned by the caller
+ * const int sock - A non-blocking socket with its connect already under way, closed if the race can't start
+ * const int epoll - The epoll set the socket and the race's timer are added to
+ * const uint64_t tag - The epoll data their events carry
+ *
+ * RETURNS:
+ * bool - Whether the race is under way, if not nothing is left open
+ *
+ * NOTES:
+ * For connects with a single destination, such as unix sockets and transparent rules, so they are finished from epoll
+ * and given up on after CONNECT_TIMEOUT_MS like any other. No latency is recorded for them.
+ */
+bool adoptConnectRace(struct connect_race *race, const int sock, const int epoll, const uint64_t tag) {
+    race->attempts[0].len = 0;
+    race->attempts[0].sock = sock;
+    race->count = 1;
+    race->next = 1;
+    race->active = 1;
+    race->carried = 0;
+    race->sources = NULL;
+    race->epoll = epoll;
+    race->tag = tag;
+    race->winner = -1;
+    race->sent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &race->begun);
+    race->attempts[0].started = race->begun;
+    race->latest = race->begun;
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.u64 = tag;
+    if ((race->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1
+            || epoll_ctl(epoll, EPOLL_CTL_ADD, sock, &ev) == -1) {
+        cancelConnectRace(race);
+        return false;
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, race->timer, &ev) == -1) {
+        cancelConnectRace(race);
+        return false;
+    }
+    armRace(race);
+    return true;
+}
+
+/*
+ * FUNCTION: stepConnectRace
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int stepConnectRace(struct connect_race *race);
+ *
+ * PARAMETERS:
+ * struct connect_race *race - A race that is under way
+ *
+ * RETURNS:
+ * int - 1 once an attempt has connected, 0 while attempts are still in flight, -1 once every address failed or the race timed out
+ *
+ * NOTES:
+ * Never blocks, so it may be called for any event with the race's tag, however stale.
+ * Once it returns 1 the connected socket is in winner, out of the race's epoll set and still non-blocking,
+ * and sent holds how many of the first attempt's bytes went out with its SYN.
+ * Once it returns anything but 0, every other attempt and the timer have been closed, so the race must not be stepped or cancelled again.
+ */
+int stepConnectRace(struct connect_race *race) {
+    uint64_t expirations;
+    if (read(race->timer, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("timerfd");
+    }
+
+    for (size_t i = 0; i < race->next; ++i) {
+        struct connect_attempt *attempt = &race->attempts[i];
+        if (attempt->sock == -1) {
+            continue;
+        }
+        const int result = checkAttempt(attempt->sock);
+        if (result == 0) {
+            continue;
+        }
+        struct addrinfo address = {.ai_addr = (struct sockaddr *) &attempt->addr, .ai_addrlen = attempt->len};
+        if (result == -1) {
+            if (attempt->len) {
+                rememberLatency(&address, CONNECT_FAILED);
+            }
+            close(attempt->sock);
+            attempt->sock = -1;
+            --race->active;
+            continue;
+        }
+        if (attempt->len) {
+            rememberLatency(&address, elapsedMicros(&attempt->started));
+        }
+        epoll_ctl(race->epoll, EPOLL_CTL_DEL, attempt->sock, NULL);
+        race->winner = attempt->sock;
+        race->sent = (i == 0) ? race->carried : 0;
+        attempt->sock = -1;
+        --race->active;
+        cancelConnectRace(race);
+        return 1;
+    }
+
+    //Give the latest attempt its head start before racing another one against it
+    while (race->next < race->count && (race->active == 0 || elapsedMicros(&race->latest) >= CONNECT_ATTEMPT_DELAY_MS * 1000u)) {
+        launchAttempt(race, NULL, 0);
+    }
+    if (race->active == 0 || elapsedMicros(&race->begun) >= CONNECT_TIMEOUT_MS * 1000u) {
+        fprintf(stderr, (race->active) ? "Connect timed out\n" : "Unable to connect\n");
+        cancelConnectRace(race);
+        return -1;
+    }
+    armRace(race);
+    return 0;
+}
+
+/*
+ * FUNCTION: cancelConnectRace
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void cancelConnectRace(struct connect_race *race);
+ *
+ * PARAMETERS:
+ * struct connect_race *race - A race that is under way
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Closes every attempt still in flight and the timer, which also takes them off the epoll set. The winner, if any, is left alone.
+ */
+void cancelConnectRace(struct connect_race *race) {
+    for (size_t i = 0; i < race->next; ++i) {
+        if (race->attempts[i].sock != -1) {
+            close(race->attempts[i].sock);
+            race->attempts[i].sock = -1;
+        }
+    }
+    race->active = 0;
+    if (race->timer != -1) {
+        close(race->timer);
+        race->timer = -1;
+    }
+}
+
+/*
+ * FUNCTION: launchAttempt
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void launchAttempt(struct connect_race *race, const unsigned char *data, const size_t len);
+ *
+ * PARAMETERS:
+ * struct connect_race *race - The race to start its next attempt on
+ * const unsigned char *data - Bytes to send with MSG_FASTOPEN, or NULL to connect
+ * const size_t len - How many bytes data holds
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * An attempt that fails to start, or can't be added to epoll, is remembered as failed and left closed.
+ */
+static void launchAttempt(struct connect_race *race, const unsigned char *data, const size_t len) {
+    struct connect_attempt *attempt = &race->attempts[race->next++];
+    struct addrinfo address = {.ai_family = ((struct sockaddr *) &attempt->addr)->sa_family, .ai_socktype = SOCK_STREAM,
+            .ai_addr = (struct sockaddr *) &attempt->addr, .ai_addrlen = attempt->len};
+    size_t carried = len;
+
+    clock_gettime(CLOCK_MONOTONIC, &attempt->started);
+    attempt->sock = startAttempt(&address, race->sources, data, &carried);
+    if (attempt->sock == -1) {
+        rememberLatency(&address, CONNECT_FAILED);
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.u64 = race->tag;
+    if (epoll_ctl(race->epoll, EPOLL_CTL_ADD, attempt->sock, &ev) == -1) {
+        close(attempt->sock);
+        attempt->sock = -1;
+        return;
+    }
+    if (data) {
+        race->carried = carried;
+    }
+    race->latest = attempt->started;
+    ++race->active;
+}
+
+/*
+ * FUNCTION: checkAttempt
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int checkAttempt(const int sock);
+ *
+ * PARAMETERS:
+ * const int sock - A socket with a non-blocking connect under way
+ *
+ * RETURNS:
+ * int - 1 if it has connected, 0 if it is still connecting, -1 if it failed
+ *
+ * NOTES:
+ * SO_ERROR alone can't tell a connect in progress from a finished one, but getpeername only succeeds once it has finished.
+ */
+static int checkAttempt(const int sock) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error) {
+        return -1;
+    }
+    struct sockaddr_storage peer;
+    socklen_t peerLen = sizeof(struct sockaddr_storage);
+    if (getpeername(sock, (struct sockaddr *) &peer, &peerLen) == 0) {
+        return 1;
+    }
+    return (errno == ENOTCONN) ? 0 : -1;
+}
+
+/*
+ * FUNCTION: armRace
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void armRace(struct connect_race *race);
+ *
+ * PARAMETERS:
+ * struct connect_race *race - A race with attempts in flight
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The timer fires when the next address is due to be raced, or when the whole race times out if every address has been tried.
+ */
+static void armRace(struct connect_race *race) {
+    uint32_t wait = CONNECT_TIMEOUT_MS * 1000u;
+    const uint32_t elapsed = elapsedMicros(&race->begun);
+    wait = (elapsed < wait) ? wait - elapsed : 1;
+    if (race->next < race->count) {
+        const uint32_t since = elapsedMicros(&race->latest);
+        const uint32_t delay = (since < CONNECT_ATTEMPT_DELAY_MS * 1000u) ? CONNECT_ATTEMPT_DELAY_MS * 1000u - since : 1;
+        wait = (delay < wait) ? delay : wait;
+    }
+    const struct itimerspec value = {.it_value = {wait / 1000000, (wait % 1000000) * 1000l}};
+    if (timerfd_settime(race->timer, 0, &value, NULL) == -1) {
+        perror("timerfd_settime");
+    }
+}
+
+/*
+ * FUNCTION: isUnixAddress
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool isUnixAddress(const char *address);
+ *
+ * PARAMETERS:
+ * const char *address - The address string from a forwarding rule
+ *
+ * RETURNS:
+ * bool - Whether the address names a unix domain socket path
+ *
+ * NOTES:
+ * Unix socket addresses are written as unix:/path/to/socket in the config file.
+ */
+bool isUnixAddress(const char *address) {
+    return strncmp(address, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0;
+}
+
+/*
+ * FUNCTION: bindUnixSocket
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool bindUnixSocket(const int sock, const char *path);
+ *
+ * PARAMETERS:
+ * const int sock - The AF_UNIX socket to bind with
+ * const char *path - The filesystem path to bind
+ *
+ * RETURNS:
+ * bool - Whether the socket was bound
+ *
+ * NOTES:
+ * Any stale socket file left behind by a previous run is removed before binding.
+ */
+bool bindUnixSocket(const int sock, const char *path) {
+    struct sockaddr_un myAddr;
+    memset(&myAddr, 0, sizeof(struct sockaddr_un));
+    myAddr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(myAddr.sun_path)) {
+        fprintf(stderr, "Unix socket path %s is too long\n", path);
+        return false;
+    }
+    strcpy(myAddr.sun_path, path);
+
+    if (unlink(path) == -1 && errno != ENOENT) {
+        perror("unlink");
+        return false;
+    }
+
+    if (bind(sock, (struct sockaddr *) &myAddr, sizeof(struct sockaddr_un)) == -1) {
+        perror("bind");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * FUNCTION: setTransparent
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setTransparent(const int sock);
+ *
+ * PARAMETERS:
+ * const int sock - The socket to set IP_TRANSPARENT on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Lets a listener accept TPROXY traffic for foreign addresses, and lets an upstream socket bind to the client's address.
+ * Requires CAP_NET_ADMIN.
+ */
+void setTransparent(const int sock) {
+    if (setsockopt(sock, SOL_IP, IP_TRANSPARENT, &(int){1}, sizeof(int)) == -1) {
+        fatal_error("IP_TRANSPARENT");
+    }
+}
+
+/*
+ * FUNCTION: getOriginalDestination
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int getOriginalDestination(const int sock, const bool tproxy, struct sockaddr_in *dst);
+ *
+ * PARAMETERS:
+ * const int sock - The accepted client socket
+ * const bool tproxy - Whether the connection was steered by TPROXY rather than REDIRECT/DNAT
+ * struct sockaddr_in *dst - Filled with the address the client originally connected to
+ *
+ * RETURNS:
+ * int - 0 on success, -1 if the destination is unknown
+ *
+ * NOTES:
+ * TPROXY keeps the original destination as the local address of the socket.
+ * REDIRECT and DNAT rewrite it, so it has to be read back out of conntrack with SO_ORIGINAL_DST.
+ */
+int getOriginalDestination(const int sock, const bool tproxy, struct sockaddr_in *dst) {
+    socklen_t len = sizeof(struct sockaddr_in);
+    if (tproxy) {
+        if (getsockname(sock, (struct sockaddr *) dst, &len) == -1) {
+            perror("getsockname");
+            return -1;
+        }
+    } else if (getsockopt(sock, SOL_IP, SO_ORIGINAL_DST, dst, &len) == -1) {
+        perror("SO_ORIGINAL_DST");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION: establishTransparentConnection
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int establishTransparentConnection(const struct sockaddr_in *dst, const struct sockaddr_in *src);
+ *
+ * PARAMETERS:
+ * const struct sockaddr_in *dst - The original destination to connect to
+ * const struct sockaddr_in *src - The client address to spoof as the source, or NULL to use our own
+ *
+ * RETURNS:
+ * int - A non-blocking socket with the connection under way, or -1 on failure
+ *
+ * NOTES:
+ * Only the client's IP is spoofed, the kernel picks the source port.
+ * Called from workers, so running out of descriptors fails this connection rather than exiting,
+ * and the caller finishes the connect from epoll.
+ */
+int establishTransparentConnection(const struct sockaddr_in *dst, const struct sockaddr_in *src) {
+    const int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    if (src) {
+        struct sockaddr_in bindAddr = *src;
+        bindAddr.sin_port = 0;
+
+        setTransparent(sock);
+        if (bind(sock, (const struct sockaddr *) &bindAddr, sizeof(struct sockaddr_in)) == -1) {
+            perror("bind");
+            close(sock);
+            return -1;
+        }
+    }
+
+    if (connect(sock, (const struct sockaddr *) dst, sizeof(struct sockaddr_in)) == -1 && errno != EINPROGRESS) {
+        perror("connect");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * FUNCTION: setBusyPoll
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setBusyPoll(const int sock, const int usecs);
+ *
+ * PARAMETERS:
+ * const int sock - The socket to busy poll
+ * const int usecs - How long a blocking read may spin on the device queue
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN, and unix sockets don't support it.
+ * Failures only cost latency, so permission errors are reported once and the rest are ignored.
+ */
+void setBusyPoll(const int sock, const int usecs) {
+    static atomic_bool reported;
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(int)) == -1
+            || setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &(int){1}, sizeof(int)) == -1) {
+        if (errno == EPERM && !atomic_exchange(&reported, true)) {
+            perror("SO_BUSY_POLL");
+        }
+    }
+}
+
+/*
+ * FUNCTION: setNoDelay
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setNoDelay(const int sock);
+ *
+ * PARAMETERS:
+ * const int sock - The socket to disable Nagle's algorithm on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The forwarder only ever writes what it just read, so Nagle can't coalesce anything useful.
+ * Left on, it holds each small write until the peer's delayed ack arrives, stalling request/response traffic.
+ * Unix sockets don't have the option, so failures are ignored.
+ */
+void setNoDelay(const int sock) {
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+}
+
+/*
+ * FUNCTION: setQuickAck
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setQuickAck(const int sock);
+ *
+ * PARAMETERS:
+ * const int sock - The socket to acknowledge data on immediately
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * TCP_QUICKACK isn't sticky, the kernel falls back to delayed acks on its own, so callers set it again after reading.
+ * Unix sockets don't have the option, so failures are ignored.
+ */
+void setQuickAck(const int sock) {
+    setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, &(int){1}, sizeof(int));
+}
+
+/*
+ * FUNCTION: setIncomingCpu
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setIncomingCpu(const int sock, const int cpu);
+ *
+ * PARAMETERS:
+ * const int sock - A SO_REUSEPORT listener
+ * const int cpu - The CPU its owner is pinned to
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The kernel prefers the reuseport listener whose incoming CPU is the one the SYN arrived on,
+ * so connections are accepted and served on the CPU that took the NIC's interrupt for them.
+ * Older kernels ignore it when picking a listener, which only loses the steering.
+ */
+void setIncomingCpu(const int sock, const int cpu) {
+    if (setsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+        perror("SO_INCOMING_CPU");
+    }
+}
+
+/*
+ * FUNCTION: setListenerOptions
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setListenerOptions(const int sock, const uint32_t defer_s, const uint32_t fastopen);
+ *
+ * PARAMETERS:
+ * const int sock - The TCP listener to set the options on
+ * const uint32_t defer_s - Seconds TCP_DEFER_ACCEPT holds a connection until its first data arrives, 0 to leave it unset
+ * const uint32_t fastopen - The TCP_FASTOPEN queue length for handshakes carrying data, 0 to leave it unset
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Both can be set on a listener that is already listening.
+ * Clients' SYN data is only accepted with server TFO enabled in net.ipv4.tcp_fastopen, which the option alone doesn't do.
+ */
+void setListenerOptions(const int sock, const uint32_t defer_s, const uint32_t fastopen) {
+    if (defer_s && setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &(int){defer_s}, sizeof(int)) == -1) {
+        perror("TCP_DEFER_ACCEPT");
+    }
+    if (fastopen && setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &(int){fastopen}, sizeof(int)) == -1) {
+        perror("TCP_FASTOPEN");
+    }
+}
+
+/*
+ * FUNCTION: setReusePort
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setReusePort(const int sock);
+ *
+ * PARAMETERS:
+ * const int sock - The unbound listener to set SO_REUSEPORT on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Every listener bound to the port must set it, and the kernel then spreads new connections across them by hash.
+ */
+void setReusePort(const int sock) {
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) == -1) {
+        fatal_error("SO_REUSEPORT");
+    }
+}
+
+/*
+ * FUNCTION: setPipeLimits
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void setPipeLimits(const long max, const long memory);
+ *
+ * PARAMETERS:
+ * const long max - The largest pipe, in bytes, a single flow may grow to
+ * const long memory - How many MiB of pipe memory above the default size every flow together may hold
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Must be called before any worker starts forwarding.
+ * The size is rounded down to a power of two multiple of PIPE_SIZE_DEFAULT.
+ */
+void setPipeLimits(const long max, const long memory) {
+    pipeClassMax = 0;
+    while (pipeClassMax < PIPE_CLASS_MAX && ((long) PIPE_SIZE_DEFAULT << (pipeClassMax + 1)) <= max) {
+        ++pipeClassMax;
+    }
+    pipeMemoryMax = (memory > 0) ? (size_t) memory << 20 : 0;
+}
+
+/*
+ * FUNCTION: pipeGrownMemory
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t pipeGrownMemory(void);
+ *
+ * RETURNS:
+ * size_t - The bytes of pipe memory currently held above PIPE_SIZE_DEFAULT by every flow
+ */
+size_t pipeGrownMemory(void) {
+    return atomic_load(&pipeGrownBytes);
+}
+
+/*
+ * FUNCTION: resizePipe
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t resizePipe(const int pipe, const uint32_t from, const uint32_t to);
+ *
+ * PARAMETERS:
+ * const int pipe - Either end of the pipe to resize
+ * const uint32_t from - The pipe's current size class
+ * const uint32_t to - The size class wanted
+ *
+ * RETURNS:
+ * uint32_t - The pipe's size class afterwards, from if it could not be resized
+ *
+ * NOTES:
+ * Growth is reserved against the global cap before the pipe is touched, so concurrent flows can't overshoot it.
+ * The kernel refuses pipes above pipe-max-size for unprivileged processes, which leaves the flow where it was.
+ * Shrinking fails if the pipe holds more than the new size.
+ */
+static uint32_t resizePipe(const int pipe, const uint32_t from, const uint32_t to) {
+    const size_t current = (size_t) PIPE_SIZE_DEFAULT << from;
+    const size_t target = (size_t) PIPE_SIZE_DEFAULT << to;
+
+    if (target > current && atomic_fetch_add(&pipeGrownBytes, target - current) + target - current > pipeMemoryMax) {
+        atomic_fetch_sub(&pipeGrownBytes, target - current);
+        return from;
+    }
+    if (fcntl(pipe, F_SETPIPE_SZ, (int) target) == -1) {
+        if (target > current) {
+            atomic_fetch_sub(&pipeGrownBytes, target - current);
+        }
+        return from;
+    }
+    if (target < current) {
+        atomic_fetch_sub(&pipeGrownBytes, current - target);
+    }
+    return to;
+}
+
+/*
+ * FUNCTION: nextPipeClass
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t nextPipeClass(const int out, const uint32_t size_class, const size_t full, const size_t moved);
+ *
+ * PARAMETERS:
+ * const int out - The socket the flow writes to
+ * const uint32_t size_class - The flow's current size class
+ * const size_t full - How many reads in the run that just ended filled at least half the pipe
+ * const size_t moved - How many bytes the run moved
+ *
+ * RETURNS:
+ * uint32_t - The size class the flow's next pipe should have
+ *
+ * NOTES:
+ * A flow that keeps filling its pipe doubles it, or jumps straight to one that holds the output's congestion window.
+ * A run that moved less than a fraction of the pipe steps it back down, so a flow that goes quiet drifts back to the default.
+ * When the class changes, TCP_NOTSENT_LOWAT on the output is set to twice the new pipe, so a grown pipe isn't
+ * mirrored by an unbounded backlog of unsent data in the socket. Unix sockets reject it, which is harmless.
+ * Back at class 0 it is set to 0, which hands the socket back to the net.ipv4.tcp_notsent_lowat default.
+ */
+static uint32_t nextPipeClass(const int out, const uint32_t size_class, const size_t full, const size_t moved) {
+    uint32_t next = size_class;
+
+    if (full >= PIPE_GROW_READS && size_class < pipeClassMax) {
+        ++next;
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        if (getsockopt(out, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && len == sizeof(info)) {
+            const size_t window = (size_t) info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+            while (next < pipeClassMax && ((size_t) PIPE_SIZE_DEFAULT << next) < window) {
+                ++next;
+            }
+        }
+    } else if (size_class > 0 && moved < ((size_t) PIPE_SIZE_DEFAULT << size_class) / PIPE_SHRINK_DIVISOR) {
+        --next;
+    }
+    if (next != size_class) {
+        const int lowat = (next) ? PIPE_SIZE_DEFAULT << (next + 1) : 0;
+        setsockopt(out, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    }
+    return next;
+}
+
+/*
+ * FUNCTION: acquirePipe
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t acquirePipe(int pipes[static 2], const uint32_t size_class);
+ *
+ * PARAMETERS:
+ * int pipes[static 2] - Filled with the read and write ends of an empty pipe
+ * const uint32_t size_class - The size class the flow has earned
+ *
+ * RETURNS:
+ * uint32_t - The size class of the pipe handed out, lower than asked for if it couldn't be grown
+ *
+ * NOTES:
+ * Empty pipes are kept in a small per-thread cache so idle sessions never hold one.
+ * A grown pipe of the right class is taken from the grown cache as is, only a default pipe has to be resized.
+ */
+static uint32_t acquirePipe(int pipes[static 2], const uint32_t size_class) {
+    if (size_class > 0 && grownCacheCount[size_class - 1] > 0) {
+        const struct grown_pipe *grown = &grownCache[size_class - 1][--grownCacheCount[size_class - 1]];
+        --grownCacheTotal;
+        pipes[0] = grown->pipes[0];
+        pipes[1] = grown->pipes[1];
+        return size_class;
+    }
+    if (pipeCacheCount > 0) {
+        --pipeCacheCount;
+        pipes[0] = pipeCache[pipeCacheCount][0];
+        pipes[1] = pipeCache[pipeCacheCount][1];
+    } else if (pipe2(pipes, O_NONBLOCK) < 0) {
+        fatal_error("pipe");
+    }
+    return (size_class > 0) ? resizePipe(pipes[1], 0, size_class) : 0;
+}
+
+/*
+ * FUNCTION: releasePipe
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void releasePipe(int pipes[static 2], const bool empty, const uint32_t size_class, const uint32_t keep);
+ *
+ * PARAMETERS:
+ * int pipes[static 2] - The pipe to release, reset to -1 afterwards
+ * const bool empty - Whether the pipe is empty and can be reused
+ * const uint32_t size_class - The size class the pipe was grown to, 0 if it was never grown
+ * const uint32_t keep - The size class the flow's next run wants, 0 once the flow is done
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * A pipe is only resized when its flow's class changes, so a bulk flow that stays in its class pays no F_SETPIPE_SZ per run.
+ * A grown pipe is cached under its class for the next run, or shrunk back to the default if that cache is full.
+ */
+static void releasePipe(int pipes[static 2], const bool empty, const uint32_t size_class, const uint32_t keep) {
+    if (pipes[0] == -1) {
+        return;
+    }
+    uint32_t current = size_class;
+    if (empty && keep != size_class) {
+        current = resizePipe(pipes[1], size_class, keep);
+    }
+    if (empty && current && cacheGrownPipe(pipes, current)) {
+        pipes[0] = -1;
+        pipes[1] = -1;
+        return;
+    }
+    if (current && (!empty || resizePipe(pipes[1], current, 0) != 0)) {
+        //Closing frees it whatever its size, so the memory is handed back either way
+        atomic_fetch_sub(&pipeGrownBytes, ((size_t) PIPE_SIZE_DEFAULT << current) - PIPE_SIZE_DEFAULT);
+        close(pipes[0]);
+        close(pipes[1]);
+    } else if (empty && pipeCacheCount < PIPE_CACHE_SIZE) {
+        pipeCache[pipeCacheCount][0] = pipes[0];
+        pipeCache[pipeCacheCount][1] = pipes[1];
+        ++pipeCacheCount;
+    } else {
+        close(pipes[0]);
+        close(pipes[1]);
+    }
+    pipes[0] = -1;
+    pipes[1] = -1;
+}
+
+/*
+ * FUNCTION: releaseClientPipes
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void releaseClientPipes(struct client *const client);
+ *
+ * PARAMETERS:
+ * struct client *const client - The client whose pipes are released
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Pipes that still hold undelivered data are closed rather than cached.
+ */
+void releaseClientPipes(struct client *const client) {
+    for (int i = 0; i < 2; ++i) {
+        const uint32_t pending = atomic_load(&client->pending[i]);
+        releasePipe(client->pipes[i], (pending & PENDING_BYTES_MASK) == 0, pending >> PENDING_CLASS_SHIFT, 0);
+        atomic_store(&client->pending[i], 0);
+    }
+}
+
+/*
+ * FUNCTION: cacheGrownPipe
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool cacheGrownPipe(int pipes[static 2], const uint32_t size_class);
+ *
+ * PARAMETERS:
+ * int pipes[static 2] - The empty grown pipe
+ * const uint32_t size_class - The size class it is grown to
+ *
+ * RETURNS:
+ * bool - Whether it was cached, false if that class's cache is full
+ *
+ * NOTES:
+ * A cached pipe still counts against pipe_memory, trimPipeCache hands it back once it has gone unused for PIPE_IDLE_MS.
+ */
+static bool cacheGrownPipe(int pipes[static 2], const uint32_t size_class) {
+    if (grownCacheCount[size_class - 1] == PIPE_GROWN_CACHE_SIZE) {
+        return false;
+    }
+    struct grown_pipe *grown = &grownCache[size_class - 1][grownCacheCount[size_class - 1]++];
+    grown->pipes[0] = pipes[0];
+    grown->pipes[1] = pipes[1];
+    grown->cached_ms = pipeClock();
+    ++grownCacheTotal;
+    return true;
+}
+
+/*
+ * FUNCTION: trimPipeCache
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int trimPipeCache(void);
+ *
+ * RETURNS:
+ * int - Milliseconds until the next cached grown pipe goes idle, or -1 if the thread holds none
+ *
+ * NOTES:
+ * Called by each worker before it waits, and the return value bounds the wait,
+ * so grown pipes left behind by a flow that went quiet are closed even if the worker sees no more events.
+ * Closing frees a pipe whatever its size, so the memory goes back to the pipe_memory budget at once.
+ */
+int trimPipeCache(void) {
+    if (grownCacheTotal == 0) {
+        return -1;
+    }
+    const uint32_t now = pipeClock();
+    uint32_t wait = PIPE_IDLE_MS;
+    for (uint32_t i = 0; i < PIPE_CLASS_MAX; ++i) {
+        size_t expired = 0;
+        while (expired < grownCacheCount[i] && now - grownCache[i][expired].cached_ms >= PIPE_IDLE_MS) {
+            close(grownCache[i][expired].pipes[0]);
+            close(grownCache[i][expired].pipes[1]);
+            atomic_fetch_sub(&pipeGrownBytes, ((size_t) PIPE_SIZE_DEFAULT << (i + 1)) - PIPE_SIZE_DEFAULT);
+            ++expired;
+        }
+        if (expired) {
+            grownCacheCount[i] -= expired;
+            grownCacheTotal -= expired;
+            memmove(grownCache[i], grownCache[i] + expired, grownCacheCount[i] * sizeof(struct grown_pipe));
+        }
+        if (grownCacheCount[i] && PIPE_IDLE_MS - (now - grownCache[i][0].cached_ms) < wait) {
+            wait = PIPE_IDLE_MS - (now - grownCache[i][0].cached_ms);
+        }
+    }
+    return (grownCacheTotal) ? (int) wait : -1;
+}
+
+/*
+ * FUNCTION: pipeClock
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static uint32_t pipeClock(void);
+ *
+ * RETURNS:
+ * uint32_t - A coarse monotonic millisecond clock, wrapping every 49 days
+ *
+ * NOTES:
+ * The same clock as monotonic_ms, kept here so the forward_traffic benchmark links without network.c.
+ */
+static uint32_t pipeClock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/*
+ * FUNCTION: forward_traffic
+ *
+ * DATE:
+ * April 7 2018
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int forward_traffic(const int in, const int out, struct client *const client, const int direction, const size_t budget);
+ *
+ * PARAMETERS:
+ * const int in - The input file descriptor
+ * const int out - The output file descriptor
+ * struct client *const client - The client connection involved in the forwarding
+ * const int direction - Which of the client's directions is being forwarded
+ * const size_t budget - How many bytes may be written before giving up the worker
+ *
+ * RETURNS:
+ * int - FORWARD_OK once the input is drained, FORWARD_BUDGET if the budget ran out first,
+ * FORWARD_EOF or FORWARD_ERROR if the session must be closed
+ *
+ * NOTES:
+ * Data left in the pipe when the output blocks is parked on the client until the output is writable again.
+ * The pipe is handed back to the thread cache as soon as it drains, a grown one to the cache for its size class.
+ * The flow's size class rides in the pending word between runs, so the next pipe it takes is grown to what it earned.
+ * On FORWARD_BUDGET the input has not been drained, so edge triggered epoll won't report it again and the caller must requeue it.
+ */
+int forward_traffic(const int in, const int out, struct client *const client, const int direction, const size_t budget) {
+    int *pipes = client->pipes[direction];
+    const uint32_t word = atomic_load(&client->pending[direction]);
+    uint32_t pending = word & PENDING_BYTES_MASK;
+    uint32_t size_class = word >> PENDING_CLASS_SHIFT;
+    int rtn = FORWARD_OK;
+    size_t moved = 0;
+    size_t full = 0;
+
+    if (pipes[0] == -1) {
+        size_class = acquirePipe(pipes, size_class);
+    }
+    const size_t capacity = (size_t) PIPE_SIZE_DEFAULT << size_class;
+
+    for (;;) {
+        if (moved >= budget) {
+            rtn = FORWARD_BUDGET;
+            break;
+        }
+        if (pending == 0) {
+            int n = splice(in, NULL, pipes[1], NULL, capacity, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            STAT_ADD(splices, 1);
+            TRACE4(splice_read, in, direction, n, (n == -1) ? errno : 0);
+            if (n == -1) {
+                if (errno != EAGAIN) {
+                    rtn = FORWARD_ERROR;
+                }
+                break;
+            } else if (n == 0) {
+                //Peer closed its end
+                rtn = FORWARD_EOF;
+                break;
+            }
+            //Socket data lands in partial pages, so a read that fills half the pipe counts as having filled it
+            if ((size_t) n >= capacity / 2) {
+                ++full;
+            }
+            pending = n;
+            atomic_store(&client->pending[direction], pending | size_class << PENDING_CLASS_SHIFT);
+        }
+        //No SPLICE_F_MORE, it corks small request/response traffic until the push timer fires
+        int x = splice(pipes[0], NULL, out, NULL, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        STAT_ADD(splices, 1);
+        TRACE4(splice_write, out, direction, x, (x == -1) ? errno : 0);
+        if (x == -1) {
+            if (errno != EAGAIN) {
+                rtn = FORWARD_ERROR;
+            }
+            break;
+        }
+        pending -= x;
+        moved += x;
+        client->bytes[direction] += x;
+        atomic_store(&client->pending[direction], pending | size_class << PENDING_CLASS_SHIFT);
+    }
+
+    if (pending == 0) {
+        const uint32_t next = nextPipeClass(out, size_class, full, moved);
+        releasePipe(pipes, true, size_class, next);
+        atomic_store(&client->pending[direction], next << PENDING_CLASS_SHIFT);
+    }
+    STAT_ADD(bytes, moved);
+    if (moved == 0 && rtn == FORWARD_OK) {
+        STAT_ADD(spurious, 1);
     }
+    return rtn;
 }
@@ -8,9 +8,31 @@
  * FUNCTIONS:
  * int createSocket(int domain, int type, int protocol);
  * void setNonBlocking(const int sock);
- * void bindSocket(const int sock, const unsigned short port);
- * int establishConnection(const char *address, const char *port);
- * void forward_traffic(const int in, const int out, const struct client *const client);
+ * bool bindSocket(const int sock, const unsigned short port);
+ * struct addrinfo *resolveAddress(const char *address, const char *port);
+ * int startConnection(const char *address, const struct addrinfo *upstream, struct source_pool *sources);
+ * bool startConnectRace(struct connect_race *race, const struct addrinfo *list, struct source_pool *sources, const unsigned char *data, const size_t len, const int epoll, const uint64_t tag);
+ * bool adoptConnectRace(struct connect_race *race, const int sock, const int epoll, const uint64_t tag);
+ * int stepConnectRace(struct connect_race *race);
+ * void cancelConnectRace(struct connect_race *race);
+ * struct source_pool *createSourcePool(const char *list, const uint32_t port_range);
+ * void reportSourcePool(FILE *out, const char *name, const struct source_pool *sources);
+ * bool bindUnixSocket(const int sock, const char *path);
+ * bool isUnixAddress(const char *address);
+ * void setTransparent(const int sock);
+ * int getOriginalDestination(const int sock, const bool tproxy, struct sockaddr_in *dst);
+ * int establishTransparentConnection(const struct sockaddr_in *dst, const struct sockaddr_in *src);
+ * void setBusyPoll(const int sock, const int usecs);
+ * void setNoDelay(const int sock);
+ * void setQuickAck(const int sock);
+ * void setIncomingCpu(const int sock, const int cpu);
+ * void setListenerOptions(const int sock, const uint32_t defer_s, const uint32_t fastopen);
+ * void setPipeLimits(const long max, const long memory);
+ * size_t pipeGrownMemory(void);
+ * void setReusePort(const int sock);
+ * void releaseClientPipes(struct client *const client);
+ * int trimPipeCache(void);
+ * int forward_traffic(const int in, const int out, struct client *const client, const int direction, const size_t budget);
  *
  * DESIGNER: John Agapeyev
  *
@@ -19,12 +41,116 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <stdbool.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <time.h>
 #include "network.h"
 
+#define UNIX_PREFIX "unix:"
+
+//Happy eyeballs connects, RFC 8305 recommends a 250ms delay between attempts
+#define CONNECT_ATTEMPT_DELAY_MS 250
+#define CONNECT_MAX_ATTEMPTS 16
+#define CONNECT_HISTORY_SIZE 4096
+#define CONNECT_FAILED UINT32_MAX
+
+//Longest a connect race may run before every attempt still in flight is given up on, well short of the kernel's SYN retries
+#define CONNECT_TIMEOUT_MS 10000
+
+//Most of a client's first bytes peeked at to send in the upstream's SYN, the kernel takes what fits in one segment
+#define FASTOPEN_PEEK_SIZE 16384
+
+//Per-socket ephemeral port range, added in Linux 6.3 and missing from older libc headers
+#ifndef IP_LOCAL_PORT_RANGE
+#define IP_LOCAL_PORT_RANGE 51
+#endif
+
+//Results of forward_traffic
+#define FORWARD_OK 0
+#define FORWARD_EOF 1
+#define FORWARD_ERROR -1
+#define FORWARD_BUDGET 2
+
+//Empty pipes kept per worker thread for reuse by whichever session has data in flight
+#define PIPE_CACHE_SIZE 64
+
+//Capacity of a new pipe, and the largest a busy flow's pipe may grow to as a power of two above it
+#define PIPE_SIZE_DEFAULT 65536
+#define PIPE_CLASS_MAX 7
+
+//Defaults for pipe_max, matching the default fs.pipe-max-size, and pipe_memory in MiB
+#define PIPE_MAX_DEFAULT 1048576
+#define PIPE_MEMORY_DEFAULT 256
+
+//Full pipe reads in one run that mark a flow as bulk, and the fraction of a pipe below which a run is light
+#define PIPE_GROW_READS 2
+#define PIPE_SHRINK_DIVISOR 8
+
+//Grown pipes kept per worker thread for each size class, and how long one may sit unused before it is handed back
+#define PIPE_GROWN_CACHE_SIZE 2
+#define PIPE_IDLE_MS 1000
+
+//A drained grown pipe waiting for the next run of a flow in its size class
+struct grown_pipe {
+    int pipes[2];
+    uint32_t cached_ms;
+};
+
+//One address of a connect race, with the attempt made to it once it is started
+struct connect_attempt {
+    union {
+        struct sockaddr_in v4;
+        struct sockaddr_in6 v6;
+    } addr;
+    socklen_t len;
+    int sock;
+    struct timespec started;
+};
+
+//A connect whose attempts and timer sit on a worker's epoll set, tagged so their events lead back to its owner
+struct connect_race {
+    struct connect_attempt attempts[CONNECT_MAX_ATTEMPTS];
+    size_t count;
+    size_t next;
+    size_t active;
+    size_t carried;
+    struct source_pool *sources;
+    struct timespec begun;
+    struct timespec latest;
+    int timer;
+    int epoll;
+    uint64_t tag;
+    int winner;
+    size_t sent;
+};
+
 int createSocket(int domain, int type, int protocol);
 void setNonBlocking(const int sock);
-void bindSocket(const int sock, const unsigned short port);
-int establishConnection(const char *address, const char *port);
-void forward_traffic(const int in, const int out, const struct client *const client);
+bool bindSocket(const int sock, const unsigned short port);
+struct addrinfo *resolveAddress(const char *address, const char *port);
+int startConnection(const char *address, const struct addrinfo *upstream, struct source_pool *sources);
+bool startConnectRace(struct connect_race *race, const struct addrinfo *list, struct source_pool *sources, const unsigned char *data, const size_t len, const int epoll, const uint64_t tag);
+bool adoptConnectRace(struct connect_race *race, const int sock, const int epoll, const uint64_t tag);
+int stepConnectRace(struct connect_race *race);
+void cancelConnectRace(struct connect_race *race);
+struct source_pool *createSourcePool(const char *list, const uint32_t port_range);
+void reportSourcePool(FILE *out, const char *name, const struct source_pool *sources);
+bool bindUnixSocket(const int sock, const char *path);
+bool isUnixAddress(const char *address);
+void setTransparent(const int sock);
+int getOriginalDestination(const int sock, const bool tproxy, struct sockaddr_in *dst);
+int establishTransparentConnection(const struct sockaddr_in *dst, const struct sockaddr_in *src);
+void setBusyPoll(const int sock, const int usecs);
+void setNoDelay(const int sock);
+void setQuickAck(const int sock);
+void setIncomingCpu(const int sock, const int cpu);
+void setListenerOptions(const int sock, const uint32_t defer_s, const uint32_t fastopen);
+void setPipeLimits(const long max, const long memory);
+size_t pipeGrownMemory(void);
+void setReusePort(const int sock);
+void releaseClientPipes(struct client *const client);
+int trimPipeCache(void);
+int forward_traffic(const int in, const int out, struct client *const client, const int direction, const size_t budget);
 
 #endif
@@ -0,0 +1,397 @@
+/*
+ * SOURCE FILE: sockmap.c - Implementation of functions declared in sockmap.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool sockmap_init(void);
+ * bool sockmap_add_pair(const int local, const int remote);
+ * void sockmap_cleanup(void);
+ * static int bpf(const int cmd, union bpf_attr *attr);
+ * static int create_sockhash(void);
+ * static int load_verdict_program(const int map);
+ * static bool socket_key(const int sock, struct sockmap_key *key);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Two sockhash maps are used. Every offloaded socket is stored in the peer map under the key of its partner,
+ * and in the enroll map under its own key. The stream verdict program is only attached to the enroll map,
+ * so a socket does not start redirecting until both halves of the pair are already in the peer map.
+ * The verdict builds the key of the socket the data arrived on and redirects the data to whatever the peer map holds for it,
+ * without it ever reaching userspace.
+ * The program is written directly as instructions so there is no dependency on libbpf or clang.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/bpf.h>
+#include "sockmap.h"
+#include "macro.h"
+
+//Matches the fields the verdict program copies out of struct __sk_buff
+struct sockmap_key {
+    uint32_t remote_ip4;
+    uint32_t local_ip4;
+    uint32_t remote_port;
+    uint32_t local_port;
+};
+
+static int bpf(const int cmd, union bpf_attr *attr);
+static int create_sockhash(void);
+static int load_verdict_program(const int map);
+static bool socket_key(const int sock, struct sockmap_key *key);
+
+bool sockmapActive;
+
+static int peerMap = -1;
+static int enrollMap = -1;
+static int verdictProg = -1;
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn) {.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+#define MOV64_REG(d, s) INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i) INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD64_IMM(d, i) INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define RSH32_IMM(d, i) INSN(BPF_ALU | BPF_RSH | BPF_K, d, 0, 0, i)
+#define LDX_W(d, s, o) INSN(BPF_LDX | BPF_MEM | BPF_W, d, s, o, 0)
+#define STX_W(d, s, o) INSN(BPF_STX | BPF_MEM | BPF_W, d, s, o, 0)
+#define LD_MAP_FD(d, fd) INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+#define CALL(f) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/*
+ * FUNCTION: bpf
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int bpf(const int cmd, union bpf_attr *attr);
+ *
+ * PARAMETERS:
+ * const int cmd - The bpf command to run
+ * union bpf_attr *attr - The command arguments
+ *
+ * RETURNS:
+ * int - The syscall result
+ */
+static int bpf(const int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+/*
+ * FUNCTION: create_sockhash
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int create_sockhash(void);
+ *
+ * RETURNS:
+ * int - The map descriptor, or -1 on failure
+ */
+static int create_sockhash(void) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_SOCKHASH;
+    attr.key_size = sizeof(struct sockmap_key);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = SOCKMAP_MAX_ENTRIES;
+    return bpf(BPF_MAP_CREATE, &attr);
+}
+
+/*
+ * FUNCTION: load_verdict_program
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static int load_verdict_program(const int map);
+ *
+ * PARAMETERS:
+ * const int map - The peer map to redirect through
+ *
+ * RETURNS:
+ * int - The program descriptor, or -1 on failure
+ *
+ * NOTES:
+ * The kernel hands remote_port over shifted into the upper half on little endian machines,
+ * so it is shifted back down to match the raw network order port stored by userspace.
+ */
+static int load_verdict_program(const int map) {
+    const struct bpf_insn insns[] = {
+        MOV64_REG(BPF_REG_6, BPF_REG_1),
+        LDX_W(BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, remote_ip4)),
+        STX_W(BPF_REG_10, BPF_REG_2, -16),
+        LDX_W(BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, local_ip4)),
+        STX_W(BPF_REG_10, BPF_REG_2, -12),
+        LDX_W(BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, remote_port)),
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+        RSH32_IMM(BPF_REG_2, 16),
+#endif
+        STX_W(BPF_REG_10, BPF_REG_2, -8),
+        LDX_W(BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, local_port)),
+        STX_W(BPF_REG_10, BPF_REG_2, -4),
+        MOV64_REG(BPF_REG_1, BPF_REG_6),
+        LD_MAP_FD(BPF_REG_2, map),
+        MOV64_REG(BPF_REG_3, BPF_REG_10),
+        ADD64_IMM(BPF_REG_3, -16),
+        MOV64_IMM(BPF_REG_4, 0),
+        CALL(BPF_FUNC_sk_redirect_hash),
+        EXIT(),
+    };
+
+    static char log[4096];
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+    attr.insns = (uintptr_t) insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t) "GPL";
+    if (DEBUG) {
+        //The kernel rejects a log buffer when logging is off
+        attr.log_buf = (uintptr_t) log;
+        attr.log_size = sizeof(log);
+        attr.log_level = 1;
+    }
+
+    int prog = bpf(BPF_PROG_LOAD, &attr);
+    if (prog == -1) {
+        debug_print("BPF verifier log:\n%s\n", log);
+    }
+    return prog;
+}
+
+/*
+ * FUNCTION: sockmap_init
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool sockmap_init(void);
+ *
+ * RETURNS:
+ * bool - Whether in-kernel forwarding is available
+ *
+ * NOTES:
+ * Failure is not fatal, usually it means the process lacks CAP_BPF/CAP_NET_ADMIN or the kernel is too old,
+ * and every session falls back to splice.
+ */
+bool sockmap_init(void) {
+    if ((peerMap = create_sockhash()) == -1 || (enrollMap = create_sockhash()) == -1) {
+        perror("sockmap map create");
+        goto fail;
+    }
+    if ((verdictProg = load_verdict_program(peerMap)) == -1) {
+        perror("sockmap program load");
+        goto fail;
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.target_fd = enrollMap;
+    attr.attach_bpf_fd = verdictProg;
+    attr.attach_type = BPF_SK_SKB_STREAM_VERDICT;
+    if (bpf(BPF_PROG_ATTACH, &attr) == -1) {
+        perror("sockmap program attach");
+        goto fail;
+    }
+
+    printf("In-kernel sockmap forwarding enabled\n");
+    sockmapActive = true;
+    return true;
+
+fail:
+    fprintf(stderr, "In-kernel sockmap forwarding unavailable, falling back to splice\n");
+    sockmap_cleanup();
+    return false;
+}
+
+/*
+ * FUNCTION: socket_key
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool socket_key(const int sock, struct sockmap_key *key);
+ *
+ * PARAMETERS:
+ * const int sock - The connected socket
+ * struct sockmap_key *key - Filled with the key the verdict program builds for data arriving on the socket
+ *
+ * RETURNS:
+ * bool - False if the socket is not IPv4 TCP and can't be offloaded
+ */
+static bool socket_key(const int sock, struct sockmap_key *key) {
+    struct sockaddr_in local;
+    struct sockaddr_in remote;
+    socklen_t localLen = sizeof(local);
+    socklen_t remoteLen = sizeof(remote);
+
+    if (getsockname(sock, (struct sockaddr *) &local, &localLen) == -1 || local.sin_family != AF_INET) {
+        return false;
+    }
+    if (getpeername(sock, (struct sockaddr *) &remote, &remoteLen) == -1 || remote.sin_family != AF_INET) {
+        return false;
+    }
+
+    key->remote_ip4 = remote.sin_addr.s_addr;
+    key->local_ip4 = local.sin_addr.s_addr;
+    key->remote_port = remote.sin_port;
+    key->local_port = ntohs(local.sin_port);
+    return true;
+}
+
+/*
+ * FUNCTION: sockmap_add_pair
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * bool sockmap_add_pair(const int local, const int remote);
+ *
+ * PARAMETERS:
+ * const int local - The accepted client socket
+ * const int remote - The connected upstream socket
+ *
+ * RETURNS:
+ * bool - Whether the pair is now forwarded in the kernel
+ *
+ * NOTES:
+ * Data already queued on either socket before this call is still read by userspace, so the caller keeps
+ * both sockets in epoll and splices whatever reaches it, which also picks up EOF.
+ * Closing either socket removes it from both maps.
+ */
+bool sockmap_add_pair(const int local, const int remote) {
+    struct sockmap_key localKey;
+    struct sockmap_key remoteKey;
+    if (!sockmapActive || !socket_key(local, &localKey) || !socket_key(remote, &remoteKey)) {
+        return false;
+    }
+
+    const struct {
+        int map;
+        const struct sockmap_key *key;
+        uint32_t sock;
+    } updates[] = {
+        {peerMap, &localKey, remote},
+        {peerMap, &remoteKey, local},
+        {enrollMap, &localKey, local},
+        {enrollMap, &remoteKey, remote},
+    };
+
+    union bpf_attr attr;
+    size_t i;
+    for (i = 0; i < sizeof(updates) / sizeof(updates[0]); ++i) {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = updates[i].map;
+        attr.key = (uintptr_t) updates[i].key;
+        attr.value = (uintptr_t) &updates[i].sock;
+        attr.flags = BPF_ANY;
+        if (bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+            debug_print("sockmap update failed: %s\n", strerror(errno));
+            break;
+        }
+    }
+    if (i == sizeof(updates) / sizeof(updates[0])) {
+        return true;
+    }
+
+    //Undo in reverse so no socket is left redirecting to a missing peer
+    while (i-- > 0) {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = updates[i].map;
+        attr.key = (uintptr_t) updates[i].key;
+        bpf(BPF_MAP_DELETE_ELEM, &attr);
+    }
+    return false;
+}
+
+/*
+ * FUNCTION: sockmap_cleanup
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void sockmap_cleanup(void);
+ *
+ * RETURNS:
+ * void
+ */
+void sockmap_cleanup(void) {
+    if (verdictProg != -1) {
+        close(verdictProg);
+    }
+    if (enrollMap != -1) {
+        close(enrollMap);
+    }
+    if (peerMap != -1) {
+        close(peerMap);
+    }
+    verdictProg = -1;
+    enrollMap = -1;
+    peerMap = -1;
+    sockmapActive = false;
+}
@@ -0,0 +1,34 @@
+/*
+ * HEADER FILE: sockmap.h - In-kernel forwarding of established pairs with a BPF sockhash
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * bool sockmap_init(void);
+ * bool sockmap_add_pair(const int local, const int remote);
+ * void sockmap_cleanup(void);
+ *
+ * VARIABLES:
+ * extern bool sockmapActive - Whether the verdict program is loaded and pairs can be offloaded
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef SOCKMAP_H
+#define SOCKMAP_H
+
+#include <stdbool.h>
+
+//Maximum number of offloaded sockets, two per session
+#define SOCKMAP_MAX_ENTRIES 262144
+
+extern bool sockmapActive;
+
+bool sockmap_init(void);
+bool sockmap_add_pair(const int local, const int remote);
+void sockmap_cleanup(void);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * SOURCE FILE: stats.c - Implementation of functions declared in stats.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void stats_init(void);
+ * void stats_set_base(const size_t base);
+ * void stats_register(void);
+ * void stats_report(FILE *out);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "stats.h"
+#include "macro.h"
+
+#ifndef NO_STATS
+
+//Threads that never register, such as the resolver, count here and are left out of reports
+static struct worker_stats unregisteredStats;
+
+_Thread_local struct worker_stats *localStats = &unregisteredStats;
+
+//Shared with forked worker processes, so the supervisor can sum their counters
+static struct worker_stats *statsList;
+static size_t statsBase;
+static _Atomic size_t statsCount;
+
+/*
+ * FUNCTION: stats_init
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void stats_init(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Must be called before any worker process is forked, since the counters are only shared with children forked after.
+ */
+void stats_init(void) {
+    statsList = mmap(NULL, sizeof(struct worker_stats) * STATS_MAX_THREADS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (statsList == MAP_FAILED) {
+        fatal_error("mmap");
+    }
+}
+
+/*
+ * FUNCTION: stats_set_base
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void stats_set_base(const size_t base);
+ *
+ * PARAMETERS:
+ * const size_t base - The first counter slot this process's workers register in
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Called by a forked worker process, so each process has its own slots.
+ * A restarted process takes over the slots of the one it replaces, so totals carry on from where they were.
+ */
+void stats_set_base(const size_t base) {
+    statsBase = base;
+}
+
+/*
+ * FUNCTION: stats_register
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void stats_register(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Called once by each worker as it starts, so its counters are included in reports.
+ * Threads past STATS_MAX_THREADS still count, they are just left out of the totals.
+ */
+void stats_register(void) {
+    const size_t slot = statsBase + atomic_fetch_add(&statsCount, 1);
+    if (slot < STATS_MAX_THREADS) {
+        localStats = &statsList[slot];
+    }
+}
+
+/*
+ * FUNCTION: stats_report
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void stats_report(FILE *out);
+ *
+ * PARAMETERS:
+ * FILE *out - Where to print the report
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Totals are summed from every worker without stopping them, so they are only consistent to within a batch.
+ * In process mode they include every worker process, and the ones that were restarted.
+ * Syscalls counted are the ones made per event: epoll_wait, accept and splice.
+ * Connects that fail with EADDRNOTAVAIL have run out of ephemeral ports for their upstream.
+ * A spurious wakeup is a forwarding run that found nothing to read and nothing left to write.
+ * Busy poll spins that found nothing are counted apart, so spinning doesn't inflate the waits or syscalls per MiB.
+ */
+void stats_report(FILE *out) {
+    struct {
+        uint64_t waits;
+        uint64_t wakeups;
+        uint64_t events;
+        uint64_t accepts;
+        uint64_t splices;
+        uint64_t bytes;
+        uint64_t spurious;
+        uint64_t sessions;
+        uint64_t exhausted;
+        uint64_t spins;
+    } total = {0};
+
+    //Unused slots are zero, so every slot can be summed without knowing which processes registered
+    for (size_t i = 0; i < STATS_MAX_THREADS; ++i) {
+        struct worker_stats *stats = &statsList[i];
+        total.waits += atomic_load_explicit(&stats->waits, memory_order_relaxed);
+        total.wakeups += atomic_load_explicit(&stats->wakeups, memory_order_relaxed);
+        total.events += atomic_load_explicit(&stats->events, memory_order_relaxed);
+        total.accepts += atomic_load_explicit(&stats->accepts, memory_order_relaxed);
+        total.splices += atomic_load_explicit(&stats->splices, memory_order_relaxed);
+        total.bytes += atomic_load_explicit(&stats->bytes, memory_order_relaxed);
+        total.spurious += atomic_load_explicit(&stats->spurious, memory_order_relaxed);
+        total.sessions += atomic_load_explicit(&stats->sessions, memory_order_relaxed);
+        total.exhausted += atomic_load_explicit(&stats->exhausted, memory_order_relaxed);
+        total.spins += atomic_load_explicit(&stats->spins, memory_order_relaxed);
+    }
+
+    const uint64_t syscalls = total.waits + total.accepts + total.splices;
+    fprintf(out, "Sessions opened: %lu, bytes forwarded: %lu\n", (unsigned long) total.sessions, (unsigned long) total.bytes);
+    fprintf(out, "Syscalls: %lu (epoll_wait %lu, accept %lu, splice %lu), per MiB forwarded: %.1f\n",
+            (unsigned long) syscalls, (unsigned long) total.waits, (unsigned long) total.accepts, (unsigned long) total.splices,
+            total.bytes ? syscalls * 1048576.0 / total.bytes : 0.0);
+    fprintf(out, "Wakeups: %lu, empty waits: %lu, events per wakeup: %.2f, spurious wakeups: %lu\n",
+            (unsigned long) total.wakeups, (unsigned long) (total.waits - total.wakeups),
+            total.wakeups ? (double) total.events / total.wakeups : 0.0, (unsigned long) total.spurious);
+    if (total.spins) {
+        fprintf(out, "Busy poll spins that found nothing: %lu\n", (unsigned long) total.spins);
+    }
+    fprintf(out, "Upstream connects with no free source port (EADDRNOTAVAIL): %lu\n", (unsigned long) total.exhausted);
+}
+
+#else
+
+//Keeps the translation unit from being empty when stats are compiled out
+typedef int stats_disabled;
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * HEADER FILE: stats.h - Per-worker data path counters and USDT probes
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void stats_init(void);
+ * void stats_set_base(const size_t base);
+ * void stats_register(void);
+ * void stats_report(FILE *out);
+ *
+ * VARIABLES:
+ * extern _Thread_local struct worker_stats *localStats - The calling thread's counters
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Building with NO_STATS defined, or make NOSTATS=1, compiles out both the counters and the probes.
+ * Probes are only emitted when <sys/sdt.h> is available, and are listed with perf list sdt_forwarder:*
+ * or bpftrace -l 'usdt:./8005-ass3.elf:*'.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+//Most threads whose counters are summed into a report, across every worker process
+#define STATS_MAX_THREADS 256
+
+#ifndef NO_STATS
+
+/*
+ * Only the owning thread writes its counters, so increments are a plain load and store rather than a locked add.
+ * They are still atomic so a report can read them from another thread, or from the supervisor in process mode.
+ */
+struct worker_stats {
+    _Alignas(64) _Atomic uint64_t waits;
+    _Atomic uint64_t wakeups;
+    _Atomic uint64_t events;
+    _Atomic uint64_t accepts;
+    _Atomic uint64_t splices;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t spurious;
+    _Atomic uint64_t sessions;
+    _Atomic uint64_t exhausted;
+    _Atomic uint64_t spins;
+};
+
+extern _Thread_local struct worker_stats *localStats;
+
+#define STAT_ADD(field, n) \
+    atomic_store_explicit(&localStats->field, atomic_load_explicit(&localStats->field, memory_order_relaxed) + (n), memory_order_relaxed)
+
+void stats_init(void);
+void stats_set_base(const size_t base);
+void stats_register(void);
+void stats_report(FILE *out);
+
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE1(name, a) DTRACE_PROBE1(forwarder, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(forwarder, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(forwarder, name, a, b, c)
+#define TRACE4(name, a, b, c, d) DTRACE_PROBE4(forwarder, name, a, b, c, d)
+#endif
+
+#else
+
+#define STAT_ADD(field, n) ((void) 0)
+#define stats_init() ((void) 0)
+#define stats_set_base(base) ((void) (base))
+#define stats_register() ((void) 0)
+#define stats_report(out) ((void) (out))
+
+#endif
+
+#ifndef TRACE1
+#define TRACE1(name, a) ((void) 0)
+#define TRACE2(name, a, b) ((void) 0)
+#define TRACE3(name, a, b, c) ((void) 0)
+#define TRACE4(name, a, b, c, d) ((void) 0)
+#endif
+
+#endif
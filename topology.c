@@ -0,0 +1,336 @@
+/*
+ * SOURCE FILE: topology.c - Implementation of functions declared in topology.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * size_t topology_cpus(const char *spec, int *cpus, const size_t max);
+ * int topology_node(const int cpu);
+ * static bool parseCpuList(const char *list, cpu_set_t *set);
+ * static bool readCpuList(const char *path, cpu_set_t *set);
+ * static bool nicCpus(const char *nic, cpu_set_t *set);
+ * static bool irqCpus(const char *path, cpu_set_t *set);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * Everything is read from procfs and sysfs, so there is no libnuma dependency.
+ * CPUs outside the process's affinity mask are always dropped, so a cpuset or taskset still has the last word.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include "topology.h"
+
+static bool parseCpuList(const char *list, cpu_set_t *set);
+static bool readCpuList(const char *path, cpu_set_t *set);
+static bool nicCpus(const char *nic, cpu_set_t *set);
+static bool irqCpus(const char *path, cpu_set_t *set);
+
+/*
+ * FUNCTION: topology_cpus
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * size_t topology_cpus(const char *spec, int *cpus, const size_t max);
+ *
+ * PARAMETERS:
+ * const char *spec - A CPU list such as 0-3,8-11, nic:eth0 for the CPUs servicing a NIC, or NULL for every allowed CPU
+ * int *cpus - Filled with the chosen CPU numbers in ascending order
+ * const size_t max - How many CPU numbers cpus can hold
+ *
+ * RETURNS:
+ * size_t - How many CPUs were chosen, 0 if spec is invalid or names no CPU the process may run on
+ *
+ * NOTES:
+ * A NIC's CPUs are the ones its interrupts are affine to, or if none can be found, the CPUs of the NUMA node it sits on.
+ */
+size_t topology_cpus(const char *spec, int *cpus, const size_t max) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("sched_getaffinity");
+        return 0;
+    }
+    cpu_set_t chosen;
+    if (spec == NULL || *spec == '\0') {
+        chosen = allowed;
+    } else if (strncmp(spec, TOPOLOGY_NIC_PREFIX, strlen(TOPOLOGY_NIC_PREFIX)) == 0) {
+        if (!nicCpus(spec + strlen(TOPOLOGY_NIC_PREFIX), &chosen)) {
+            fprintf(stderr, "Unable to find the CPUs servicing %s\n", spec + strlen(TOPOLOGY_NIC_PREFIX));
+            return 0;
+        }
+    } else if (!parseCpuList(spec, &chosen)) {
+        fprintf(stderr, "Invalid CPU list %s\n", spec);
+        return 0;
+    }
+    CPU_AND(&chosen, &chosen, &allowed);
+
+    size_t count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max; ++cpu) {
+        if (CPU_ISSET(cpu, &chosen)) {
+            cpus[count++] = cpu;
+        }
+    }
+    return count;
+}
+
+/*
+ * FUNCTION: topology_node
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * int topology_node(const int cpu);
+ *
+ * PARAMETERS:
+ * const int cpu - The CPU to look up
+ *
+ * RETURNS:
+ * int - The NUMA node the CPU belongs to, or -1 if the kernel doesn't say
+ *
+ * NOTES:
+ * The CPU's sysfs directory links to its node as nodeN.
+ */
+int topology_node(const int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    int node = -1;
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char) entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/*
+ * FUNCTION: parseCpuList
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool parseCpuList(const char *list, cpu_set_t *set);
+ *
+ * PARAMETERS:
+ * const char *list - Comma separated CPU numbers and first-last ranges, the format sysfs uses
+ * cpu_set_t *set - Filled with the listed CPUs
+ *
+ * RETURNS:
+ * bool - Whether the list was valid and named at least one CPU
+ */
+static bool parseCpuList(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    bool valid = false;
+    for (const char *text = list;;) {
+        char *end;
+        const long first = strtol(text, &end, 10);
+        long last = first;
+        if (end != text && *end == '-') {
+            text = end + 1;
+            last = strtol(text, &end, 10);
+        }
+        if (end == text || first < 0 || last < first || last >= CPU_SETSIZE) {
+            break;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+        if (*end == ',') {
+            text = end + 1;
+            continue;
+        }
+        valid = (*end == '\0' || *end == '\n');
+        break;
+    }
+    return valid && CPU_COUNT(set) > 0;
+}
+
+/*
+ * FUNCTION: readCpuList
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool readCpuList(const char *path, cpu_set_t *set);
+ *
+ * PARAMETERS:
+ * const char *path - A procfs or sysfs file holding a CPU list
+ * cpu_set_t *set - Filled with the listed CPUs
+ *
+ * RETURNS:
+ * bool - Whether the file could be read and listed at least one CPU
+ */
+static bool readCpuList(const char *path, cpu_set_t *set) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    char line[TOPOLOGY_LINE_SIZE];
+    const bool found = fgets(line, sizeof(line), fp) && parseCpuList(line, set);
+    fclose(fp);
+    return found;
+}
+
+/*
+ * FUNCTION: nicCpus
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool nicCpus(const char *nic, cpu_set_t *set);
+ *
+ * PARAMETERS:
+ * const char *nic - The interface name, such as eth0
+ * cpu_set_t *set - Filled with the CPUs servicing the interface
+ *
+ * RETURNS:
+ * bool - Whether any CPU was found
+ *
+ * NOTES:
+ * MSI interrupts are listed under the PCI device, which for virtio NICs is the parent of the device link.
+ * Interfaces without MSI are matched by name in /proc/interrupts, which is how most drivers name their queue interrupts.
+ * When no interrupt turns up, the NIC's NUMA node is used instead, which is still the memory its DMA lands in.
+ */
+static bool nicCpus(const char *nic, cpu_set_t *set) {
+    CPU_ZERO(set);
+    if (strchr(nic, '/') || *nic == '\0') {
+        return false;
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", nic);
+    if (!irqCpus(path, set)) {
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/../msi_irqs", nic);
+        irqCpus(path, set);
+    }
+
+    FILE *fp = (CPU_COUNT(set) == 0) ? fopen("/proc/interrupts", "r") : NULL;
+    if (fp) {
+        char line[TOPOLOGY_LINE_SIZE];
+        while (fgets(line, sizeof(line), fp)) {
+            char *end;
+            const long irq = strtol(line, &end, 10);
+            if (end == line || *end != ':' || strstr(end, nic) == NULL) {
+                continue;
+            }
+            cpu_set_t cpus;
+            snprintf(path, sizeof(path), "/proc/irq/%ld/smp_affinity_list", irq);
+            if (readCpuList(path, &cpus)) {
+                CPU_OR(set, set, &cpus);
+            }
+        }
+        fclose(fp);
+    }
+    if (CPU_COUNT(set) > 0) {
+        return true;
+    }
+
+    for (int level = 0; level < 2; ++level) {
+        snprintf(path, sizeof(path), (level) ? "/sys/class/net/%s/device/../numa_node" : "/sys/class/net/%s/device/numa_node", nic);
+        if ((fp = fopen(path, "r")) == NULL) {
+            continue;
+        }
+        int node = -1;
+        const bool read = fscanf(fp, "%d", &node) == 1;
+        fclose(fp);
+        if (read && node >= 0) {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            return readCpuList(path, set);
+        }
+    }
+    return false;
+}
+
+/*
+ * FUNCTION: irqCpus
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool irqCpus(const char *path, cpu_set_t *set);
+ *
+ * PARAMETERS:
+ * const char *path - A device's msi_irqs directory, with one entry per interrupt number
+ * cpu_set_t *set - Has the CPUs each interrupt is affine to added to it
+ *
+ * RETURNS:
+ * bool - Whether the directory exists and listed any interrupt
+ */
+static bool irqCpus(const char *path, cpu_set_t *set) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return false;
+    }
+    bool found = false;
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+        if (!isdigit((unsigned char) entry->d_name[0])) {
+            continue;
+        }
+        char affinity[128];
+        cpu_set_t cpus;
+        snprintf(affinity, sizeof(affinity), "/proc/irq/%.32s/smp_affinity_list", entry->d_name);
+        if (readCpuList(affinity, &cpus)) {
+            CPU_OR(set, set, &cpus);
+            found = true;
+        }
+    }
+    closedir(dir);
+    return found;
+}
@@ -0,0 +1,30 @@
+/*
+ * HEADER FILE: topology.h - Picking the CPUs workers are pinned to
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * size_t topology_cpus(const char *spec, int *cpus, const size_t max);
+ * int topology_node(const int cpu);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+
+//A cpus setting of nic:eth0 pins workers to the CPUs that service eth0's interrupts
+#define TOPOLOGY_NIC_PREFIX "nic:"
+
+//Longest line read from /proc/interrupts and the sysfs files describing CPUs
+#define TOPOLOGY_LINE_SIZE 4096
+
+size_t topology_cpus(const char *spec, int *cpus, const size_t max);
+int topology_node(const int cpu);
+
+#endif
@@ -0,0 +1,1507 @@
+/*
+ * SOURCE FILE: tunnel.c - Implementation of functions declared in tunnel.h
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void tunnel_add_pool(const uint32_t rule);
+ * void tunnel_start(void);
+ * void tunnel_open_channel(const int sock, const uint32_t rule);
+ * void tunnel_accept_link(const int sock, const uint32_t rule);
+ * void tunnel_event(const uint64_t data, const uint32_t events);
+ * void tunnel_cleanup(void);
+ * static struct tunnel_link *new_link(const uint32_t rule, const bool edge);
+ * static bool connect_link(struct tunnel_link *link);
+ * static void finish_link(struct tunnel_link *link);
+ * static void register_link(struct tunnel_link *link);
+ * static void link_down(struct tunnel_link *link);
+ * static void read_link(struct tunnel_link *link);
+ * static bool open_records(struct tunnel_link *link);
+ * static bool parse_frames(struct tunnel_link *link);
+ * static void flush_link(struct tunnel_link *link);
+ * static void seal_output(struct tunnel_link *link);
+ * static void handle_frame(struct tunnel_link *link, const unsigned char *frame, const uint32_t slot, const unsigned int type, const size_t size);
+ * static void send_frame(struct tunnel_link *link, const uint32_t slot, const unsigned int type, const void *payload, const size_t size);
+ * static unsigned char *reserve_buffer(unsigned char **buffer, size_t *max, const size_t used, const size_t size);
+ * static struct tunnel_channel *claim_slot(struct tunnel_link *link, const uint32_t slot);
+ * static void register_channel(struct tunnel_link *link, const uint32_t slot, const uint32_t events);
+ * static void pump_channel(struct tunnel_link *link, const uint32_t slot);
+ * static void deliver_channel(struct tunnel_link *link, const uint32_t slot, const unsigned char *data, const size_t size);
+ * static void drain_channel(struct tunnel_link *link, const uint32_t slot);
+ * static void grant_window(struct tunnel_link *link, const uint32_t slot, const size_t delivered);
+ * static void close_channel(struct tunnel_link *link, const uint32_t slot);
+ * static void release_slot(struct tunnel_link *link, const uint32_t slot);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ *
+ * NOTES:
+ * The edge end of a tunnel holds a small pool of long-lived connections, called links, to a peer forwarder.
+ * Every client accepted by an edge rule becomes a channel on one of the rule's links,
+ * and the peer opens a connection to its own backend for every channel it is told about.
+ * Data is carried in frames with an 8 byte header of channel, type, flags and payload length.
+ *
+ * Each end may only send TUNNEL_WINDOW bytes on a channel before the other grants it more,
+ * and grants are only made once data has been written to the channel's socket.
+ * Data for a slow channel is therefore bounded and parked on that channel, and never stops the link from being read.
+ *
+ * A channel is torn down by each end sending a close frame once it is done, and its slot is only reused
+ * once both ends have sent one, so late frames can never reach a new channel.
+ *
+ * With a tunnel_key set, each link starts with both ends sending a salt, and everything after that is sealed records.
+ * Frames queued on a link are sealed together when it is flushed, so a busy link pays for one record per batch rather than per frame.
+ *
+ * Edge links connect without blocking, and clients that arrive while their link is connecting are queued on it as channels,
+ * with their open frames waiting in the link's output until it is up.
+ *
+ * Every link and its channels are guarded by the link's lock, so events on a link are handled by one worker at a time.
+ * Channel events carry their slot's generation, so an event for a channel that has since closed is ignored.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "tunnel.h"
+#include "cipher.h"
+#include "network.h"
+#include "resolve.h"
+#include "socket.h"
+#include "epoll.h"
+#include "macro.h"
+#include "main.h"
+
+//Channel flags
+#define CHANNEL_ACTIVE 1u
+#define CHANNEL_CONNECTING 2u
+#define CHANNEL_READABLE 4u
+#define CHANNEL_SENT_CLOSE 8u
+#define CHANNEL_GOT_CLOSE 16u
+
+struct tunnel_channel {
+    int sock;
+    uint32_t generation;
+    uint32_t flags;
+    uint32_t credit;
+    uint32_t delivered;
+    uint32_t pendingSize;
+    unsigned char *pending;
+    uint32_t next_free;
+};
+
+struct tunnel_link {
+    pthread_mutex_t lock;
+    int sock;
+    //Set while an edge link is connecting, with sock still -1
+    struct connect_race *race;
+    uint32_t index;
+    uint32_t rule;
+    bool edge;
+    bool congested;
+    unsigned char *in;
+    size_t inSize;
+    unsigned char *out;
+    size_t outSize;
+    size_t outMax;
+    struct link_cipher *cipher;
+    bool keyed;
+    unsigned char *raw;
+    size_t rawSize;
+    unsigned char *wire;
+    size_t wireSize;
+    size_t wireMax;
+    struct tunnel_channel *channels;
+    uint32_t channelMax;
+    uint32_t channelUsed;
+    uint32_t freeHead;
+    uint32_t next_free;
+};
+
+struct tunnel_pool {
+    uint32_t rule;
+    uint32_t links[TUNNEL_POOL_MAX];
+    size_t count;
+    _Atomic size_t next;
+};
+
+static struct tunnel_link *new_link(const uint32_t rule, const bool edge);
+static bool connect_link(struct tunnel_link *link);
+static void finish_link(struct tunnel_link *link);
+static void register_link(struct tunnel_link *link);
+static void link_down(struct tunnel_link *link);
+static void read_link(struct tunnel_link *link);
+static bool open_records(struct tunnel_link *link);
+static bool parse_frames(struct tunnel_link *link);
+static void flush_link(struct tunnel_link *link);
+static void seal_output(struct tunnel_link *link);
+static void handle_frame(struct tunnel_link *link, const unsigned char *frame, const uint32_t slot, const unsigned int type, const size_t size);
+static void send_frame(struct tunnel_link *link, const uint32_t slot, const unsigned int type, const void *payload, const size_t size);
+static unsigned char *reserve_buffer(unsigned char **buffer, size_t *max, const size_t used, const size_t size);
+static struct tunnel_channel *claim_slot(struct tunnel_link *link, const uint32_t slot);
+static void register_channel(struct tunnel_link *link, const uint32_t slot, const uint32_t events);
+static void pump_channel(struct tunnel_link *link, const uint32_t slot);
+static void deliver_channel(struct tunnel_link *link, const uint32_t slot, const unsigned char *data, const size_t size);
+static void drain_channel(struct tunnel_link *link, const uint32_t slot);
+static void grant_window(struct tunnel_link *link, const uint32_t slot, const size_t delivered);
+static void close_channel(struct tunnel_link *link, const uint32_t slot);
+static void release_slot(struct tunnel_link *link, const uint32_t slot);
+
+//Links are never freed while running, so epoll events can always find theirs
+static struct tunnel_link *linkList[TUNNEL_MAX_LINKS];
+static size_t linkCount;
+static uint32_t linkFreeHead = CLIENT_NONE;
+static pthread_mutex_t linkListLock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct tunnel_pool *poolList;
+static size_t poolCount;
+
+/*
+ * FUNCTION: tunnel_add_pool
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void tunnel_add_pool(const uint32_t rule);
+ *
+ * PARAMETERS:
+ * const uint32_t rule - The edge rule whose clients are carried over the pool
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Only records the pool, the links are opened by tunnel_start once every setting has been read.
+ */
+void tunnel_add_pool(const uint32_t rule) {
+    poolList = checked_realloc(poolList, sizeof(struct tunnel_pool) * (poolCount + 1));
+    memset(&poolList[poolCount], 0, sizeof(struct tunnel_pool));
+    poolList[poolCount].rule = rule;
+    lookupRule(rule)->tunnel = poolCount++;
+}
+
+/*
+ * FUNCTION: tunnel_start
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void tunnel_start(void);
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Runs before the workers start, so the peer's name is resolved here and the links' connects are finished by the workers.
+ * Links that can't connect yet are retried when a client next needs them.
+ */
+void tunnel_start(void) {
+    if (settings.tunnel_key && !cipher_init(settings.tunnel_key, settings.tunnel_cipher)) {
+        //Never fall back to sending in the clear when encryption was asked for
+        exit(EXIT_FAILURE);
+    }
+
+    size_t links = (settings.tunnel_links > 0) ? (size_t) settings.tunnel_links : 1;
+    if (links > TUNNEL_POOL_MAX) {
+        links = TUNNEL_POOL_MAX;
+    }
+    for (size_t i = 0; i < poolCount; ++i) {
+        struct tunnel_pool *pool = &poolList[i];
+        const bool resolved = resolve_rule_now(lookupRule(pool->rule)) != NULL;
+        for (size_t j = 0; j < links; ++j) {
+            struct tunnel_link *link = new_link(pool->rule, true);
+            if (link == NULL) {
+                break;
+            }
+            pool->links[pool->count++] = link->index;
+            pthread_mutex_lock(&link->lock);
+            if (resolved && !connect_link(link)) {
+                fprintf(stderr, "Tunnel peer %s:%s is not reachable yet\n", lookupRule(pool->rule)->address + strlen(TUNNEL_PREFIX), lookupRule(pool->rule)->port);
+            }
+            pthread_mutex_unlock(&link->lock);
+        }
+    }
+}
+
+/*
+ * FUNCTION: tunnel_open_channel
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void tunnel_open_channel(const int sock, const uint32_t rule);
+ *
+ * PARAMETERS:
+ * const int sock - The accepted client socket
+ * const uint32_t rule - The edge rule the client was accepted on
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Clients are spread over the pool round robin, skipping links that are down and can't be reconnected.
+ * A link that is still connecting takes the client too, and sends its open frame once it is up.
+ */
+void tunnel_open_channel(const int sock, const uint32_t rule) {
+    struct tunnel_pool *pool = &poolList[lookupRule(rule)->tunnel];
+    for (size_t tries = 0; tries < pool->count; ++tries) {
+        struct tunnel_link *link = linkList[pool->links[atomic_fetch_add(&pool->next, 1) % pool->count]];
+        pthread_mutex_lock(&link->lock);
+        if (link->sock == -1 && link->race == NULL && !connect_link(link)) {
+            pthread_mutex_unlock(&link->lock);
+            continue;
+        }
+        uint32_t slot = link->freeHead;
+        if (slot == CLIENT_NONE) {
+            if (link->channelUsed == TUNNEL_MAX_CHANNELS) {
+                pthread_mutex_unlock(&link->lock);
+                continue;
+            }
+            slot = link->channelUsed;
+        }
+        struct tunnel_channel *channel = claim_slot(link, slot);
+        channel->sock = sock;
+        setNoDelay(sock);
+        send_frame(link, slot, TUNNEL_OPEN, NULL, 0);
+        register_channel(link, slot, EPOLLIN | EPOLLOUT | EPOLLET);
+        if (link->sock != -1) {
+            flush_link(link);
+        }
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
+    fprintf(stderr, "No tunnel link is up, dropping connection\n");
+    close(sock);
+}
+
+/*
+ * FUNCTION: tunnel_accept_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void tunnel_accept_link(const int sock, const uint32_t rule);
+ *
+ * PARAMETERS:
+ * const int sock - The accepted link from an edge forwarder
+ * const uint32_t rule - The tunnel listener rule it arrived on
+ *
+ * RETURNS:
+ * void
+ */
+void tunnel_accept_link(const int sock, const uint32_t rule) {
+    struct tunnel_link *link = new_link(rule, false);
+    if (link == NULL) {
+        fprintf(stderr, "Too many tunnel links, dropping connection\n");
+        close(sock);
+        return;
+    }
+    pthread_mutex_lock(&link->lock);
+    link->sock = sock;
+    setNoDelay(sock);
+    register_link(link);
+    pthread_mutex_unlock(&link->lock);
+}
+
+/*
+ * FUNCTION: tunnel_event
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void tunnel_event(const uint64_t data, const uint32_t events);
+ *
+ * PARAMETERS:
+ * const uint64_t data - The epoll data of a tunnel socket
+ * const uint32_t events - The events that fired
+ *
+ * RETURNS:
+ * void
+ */
+void tunnel_event(const uint64_t data, const uint32_t events) {
+    struct tunnel_link *link = linkList[(data >> TUNNEL_LINK_SHIFT) & TUNNEL_LINK_MASK];
+    pthread_mutex_lock(&link->lock);
+    if (data & EV_CONNECT_BIT) {
+        //Events from a race that already finished find no race, or only step the next one
+        if (link->race) {
+            finish_link(link);
+        }
+    } else if (data & EV_DIRECTION_BIT) {
+        //Stale events for a link that has since been replaced only cost a read that returns EAGAIN
+        if (link->sock != -1 && (events & EPOLLOUT)) {
+            flush_link(link);
+        }
+        if (link->sock != -1 && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+            read_link(link);
+            //Frames handled above may have queued grants, closes or newly unblocked data
+            if (link->sock != -1) {
+                flush_link(link);
+            }
+        }
+    } else {
+        const uint32_t slot = (data >> TUNNEL_SLOT_SHIFT) & TUNNEL_SLOT_MASK;
+        const uint32_t generation = (data >> TUNNEL_GEN_SHIFT) & TUNNEL_GEN_MASK;
+        if (slot < link->channelUsed && (link->channels[slot].generation & TUNNEL_GEN_MASK) == generation && link->channels[slot].sock != -1) {
+            if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                drain_channel(link, slot);
+            }
+            if (link->channels[slot].sock != -1 && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                pump_channel(link, slot);
+            }
+            if (link->sock != -1) {
+                flush_link(link);
+            }
+        }
+    }
+    pthread_mutex_unlock(&link->lock);
+}
+
+/*
+ * FUNCTION: tunnel_cleanup
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * void tunnel_cleanup(void);
+ *
+ * RETURNS:
+ * void
+ */
+void tunnel_cleanup(void) {
+    for (size_t i = 0; i < linkCount; ++i) {
+        struct tunnel_link *link = linkList[i];
+        if (link->race) {
+            //Channels queued on a link that never came up are closed with it
+            cancelConnectRace(link->race);
+            free(link->race);
+            link->race = NULL;
+            link_down(link);
+        } else if (link->sock != -1) {
+            link_down(link);
+        }
+        free(link->in);
+        free(link->out);
+        free(link->raw);
+        free(link->wire);
+        free(link->channels);
+        pthread_mutex_destroy(&link->lock);
+        free(link);
+    }
+    free(poolList);
+    cipher_cleanup();
+}
+
+/*
+ * FUNCTION: new_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct tunnel_link *new_link(const uint32_t rule, const bool edge);
+ *
+ * PARAMETERS:
+ * const uint32_t rule - The rule the link belongs to
+ * const bool edge - Whether this end opens channels, rather than accepting them
+ *
+ * RETURNS:
+ * struct tunnel_link * - The link, or NULL if the table is full
+ *
+ * NOTES:
+ * Reuses links that went down on the peer side, keeping their channel table and slot generations.
+ */
+static struct tunnel_link *new_link(const uint32_t rule, const bool edge) {
+    struct tunnel_link *link;
+    pthread_mutex_lock(&linkListLock);
+    if (linkFreeHead != CLIENT_NONE) {
+        link = linkList[linkFreeHead];
+        linkFreeHead = link->next_free;
+    } else if (linkCount < TUNNEL_MAX_LINKS) {
+        link = checked_calloc(1, sizeof(struct tunnel_link));
+        pthread_mutex_init(&link->lock, NULL);
+        link->index = linkCount;
+        link->freeHead = CLIENT_NONE;
+        linkList[linkCount++] = link;
+    } else {
+        pthread_mutex_unlock(&linkListLock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&linkListLock);
+
+    link->sock = -1;
+    link->rule = rule;
+    link->edge = edge;
+    link->next_free = CLIENT_NONE;
+    return link;
+}
+
+/*
+ * FUNCTION: connect_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool connect_link(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The edge link to connect, with its lock held
+ *
+ * RETURNS:
+ * bool - Whether the link's connect is now under way
+ *
+ * NOTES:
+ * The attempts go on the shared epoll set with the link's connect tag, and are finished by finish_link.
+ */
+static bool connect_link(struct tunnel_link *link) {
+    const struct addrinfo *upstream = resolve_rule(lookupRule(link->rule));
+    if (upstream == NULL) {
+        return false;
+    }
+    link->race = checked_malloc(sizeof(struct connect_race));
+    const uint64_t tag = ((uint64_t) link->index << TUNNEL_LINK_SHIFT) + EV_TUNNEL_BIT + EV_CONNECT_BIT;
+    if (!startConnectRace(link->race, upstream, lookupRule(link->rule)->sources, NULL, 0, efd, tag)) {
+        free(link->race);
+        link->race = NULL;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * FUNCTION: finish_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void finish_link(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The edge link whose connect had an event, with its lock held
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * A link that fails to connect goes down like any other, closing the channels queued on it.
+ */
+static void finish_link(struct tunnel_link *link) {
+    const int result = stepConnectRace(link->race);
+    if (result == 0) {
+        return;
+    }
+    const int sock = link->race->winner;
+    free(link->race);
+    link->race = NULL;
+    if (result == -1) {
+        link_down(link);
+        return;
+    }
+    setNoDelay(sock);
+    link->sock = sock;
+    register_link(link);
+}
+
+/*
+ * FUNCTION: register_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void register_link(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link whose socket was just connected, with its lock held
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Frames queued while the link was connecting are kept, and go out on the writable event that registering it brings.
+ */
+static void register_link(struct tunnel_link *link) {
+    if (link->in == NULL) {
+        link->in = checked_malloc(TUNNEL_IN_SIZE);
+    }
+    link->inSize = 0;
+
+    if (cipherActive) {
+        if (link->raw == NULL) {
+            link->raw = checked_malloc(TUNNEL_IN_SIZE);
+        }
+        link->rawSize = 0;
+        link->wireSize = 0;
+        link->keyed = false;
+        //The salt goes out ahead of any frame, everything after it waits for the other end's salt
+        unsigned char salt[CIPHER_SALT_SIZE];
+        link->cipher = cipher_new(salt);
+        memcpy(reserve_buffer(&link->wire, &link->wireMax, 0, CIPHER_SALT_SIZE), salt, CIPHER_SALT_SIZE);
+        link->wireSize = CIPHER_SALT_SIZE;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = ((uint64_t) link->index << TUNNEL_LINK_SHIFT) + EV_TUNNEL_BIT + EV_DIRECTION_BIT;
+    addEpollSocket(efd, link->sock, &ev);
+}
+
+/*
+ * FUNCTION: link_down
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void link_down(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link that failed, with its lock held
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Every channel on the link is closed, since their data can't be recovered.
+ * Edge links stay in their pool and are reconnected on demand, peer links go back to the free list.
+ * Also used for an edge link that failed to connect, which has no socket yet.
+ */
+static void link_down(struct tunnel_link *link) {
+    debug_print("Tunnel link %u went down\n", link->index);
+    if (link->sock != -1) {
+        close(link->sock);
+        link->sock = -1;
+    }
+
+    for (uint32_t slot = 0; slot < link->channelUsed; ++slot) {
+        struct tunnel_channel *channel = &link->channels[slot];
+        if (channel->flags & CHANNEL_ACTIVE) {
+            channel->flags |= CHANNEL_SENT_CLOSE | CHANNEL_GOT_CLOSE;
+            close_channel(link, slot);
+        }
+    }
+    link->inSize = 0;
+    link->outSize = 0;
+    link->congested = false;
+    link->rawSize = 0;
+    link->wireSize = 0;
+    cipher_free(link->cipher);
+    link->cipher = NULL;
+
+    if (!link->edge) {
+        pthread_mutex_lock(&linkListLock);
+        link->next_free = linkFreeHead;
+        linkFreeHead = link->index;
+        pthread_mutex_unlock(&linkListLock);
+    }
+}
+
+/*
+ * FUNCTION: read_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void read_link(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link to read frames from, with its lock held
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Reads until the socket is drained, handling every complete frame and keeping any partial one for next time.
+ * Encrypted links are read into the raw buffer and only reach the frame buffer once a record is authenticated.
+ */
+static void read_link(struct tunnel_link *link) {
+    for (;;) {
+        unsigned char *buffer = (link->cipher) ? link->raw : link->in;
+        size_t *filled = (link->cipher) ? &link->rawSize : &link->inSize;
+        const ssize_t n = read(link->sock, buffer + *filled, TUNNEL_IN_SIZE - *filled);
+        if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+            link_down(link);
+            return;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        *filled += n;
+
+        if (!((link->cipher) ? open_records(link) : parse_frames(link))) {
+            return;
+        }
+    }
+}
+
+/*
+ * FUNCTION: open_records
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool open_records(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The encrypted link that was just read from, with its lock held
+ *
+ * RETURNS:
+ * bool - Whether the link is still up
+ *
+ * NOTES:
+ * The first bytes on a link are the other end's salt, which keys both directions.
+ * Frames queued before then were held back by flush_link, and go out sealed on the next flush.
+ * A record larger than what is left of the frame buffer can't arrive, since parsing leaves at most one partial frame behind.
+ */
+static bool open_records(struct tunnel_link *link) {
+    size_t offset = 0;
+    if (!link->keyed) {
+        if (link->rawSize < CIPHER_SALT_SIZE) {
+            return true;
+        }
+        if (!cipher_start(link->cipher, link->raw, link->edge)) {
+            fprintf(stderr, "Unable to key tunnel link, dropping link\n");
+            link_down(link);
+            return false;
+        }
+        link->keyed = true;
+        offset = CIPHER_SALT_SIZE;
+    }
+    for (;;) {
+        size_t used;
+        const ssize_t size = cipher_open(link->cipher, link->raw + offset, link->rawSize - offset, link->in + link->inSize, &used);
+        if (size == -1) {
+            fprintf(stderr, "Tunnel record failed authentication, check tunnel_key and tunnel_cipher match on both ends\n");
+            link_down(link);
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+        offset += used;
+        link->inSize += size;
+        if (!parse_frames(link)) {
+            return false;
+        }
+    }
+    memmove(link->raw, link->raw + offset, link->rawSize - offset);
+    link->rawSize -= offset;
+    return true;
+}
+
+/*
+ * FUNCTION: parse_frames
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static bool parse_frames(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link whose frame buffer was just filled, with its lock held
+ *
+ * RETURNS:
+ * bool - Whether the link is still up
+ */
+static bool parse_frames(struct tunnel_link *link) {
+    size_t offset = 0;
+    while (link->inSize - offset >= TUNNEL_HEADER_SIZE) {
+        const unsigned char *frame = link->in + offset;
+        uint32_t slot;
+        uint16_t size;
+        memcpy(&slot, frame, sizeof(slot));
+        memcpy(&size, frame + 6, sizeof(size));
+        slot = be32toh(slot);
+        size = be16toh(size);
+        if (size > TUNNEL_FRAME_MAX || slot >= TUNNEL_MAX_CHANNELS) {
+            fprintf(stderr, "Malformed tunnel frame, dropping link\n");
+            link_down(link);
+            return false;
+        }
+        if (link->inSize - offset < TUNNEL_HEADER_SIZE + size) {
+            break;
+        }
+        handle_frame(link, frame + TUNNEL_HEADER_SIZE, slot, frame[4], size);
+        if (link->sock == -1) {
+            return false;
+        }
+        offset += TUNNEL_HEADER_SIZE + size;
+    }
+    memmove(link->in, link->in + offset, link->inSize - offset);
+    link->inSize -= offset;
+    return true;
+}
+
+/*
+ * FUNCTION: flush_link
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void flush_link(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link to write queued frames to, with its lock held
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Once a congested link drains below the low mark, every channel that stopped reading because of it is pumped again.
+ * Encrypted links seal whatever is queued here, so frames from one batch of events share records.
+ */
+static void flush_link(struct tunnel_link *link) {
+    for (;;) {
+        if (link->keyed) {
+            seal_output(link);
+        }
+        //Encrypted links only ever write sealed records, and nothing but the salt until the link is keyed
+        unsigned char *buffer = (link->cipher) ? link->wire : link->out;
+        size_t *queued = (link->cipher) ? &link->wireSize : &link->outSize;
+
+        bool blocked = false;
+        size_t written = 0;
+        while (written < *queued) {
+            const ssize_t n = write(link->sock, buffer + written, *queued - written);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN) {
+                    link_down(link);
+                    return;
+                }
+                blocked = true;
+                break;
+            }
+            written += n;
+        }
+        memmove(buffer, buffer + written, *queued - written);
+        *queued -= written;
+
+        if (!link->congested || link->outSize + link->wireSize >= TUNNEL_OUT_LOW) {
+            return;
+        }
+        link->congested = false;
+        for (uint32_t slot = 0; slot < link->channelUsed && !link->congested; ++slot) {
+            if (link->channels[slot].flags & CHANNEL_READABLE) {
+                pump_channel(link, slot);
+            }
+        }
+        //Without an EAGAIN there won't be another writable event, so whatever was just pumped is sent now
+        if (blocked || link->outSize == 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * FUNCTION: seal_output
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void seal_output(struct tunnel_link *link);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The keyed link to flush, with its lock held
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Moves every queued frame into sealed records, each holding as many frames as fit in CIPHER_RECORD_MAX.
+ */
+static void seal_output(struct tunnel_link *link) {
+    size_t offset = 0;
+    while (offset < link->outSize) {
+        const size_t size = (link->outSize - offset < CIPHER_RECORD_MAX) ? link->outSize - offset : CIPHER_RECORD_MAX;
+        unsigned char *record = reserve_buffer(&link->wire, &link->wireMax, link->wireSize, size + CIPHER_OVERHEAD);
+        link->wireSize += cipher_seal(link->cipher, link->out + offset, size, record);
+        offset += size;
+    }
+    link->outSize = 0;
+}
+
+/*
+ * FUNCTION: handle_frame
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void handle_frame(struct tunnel_link *link, const unsigned char *frame, const uint32_t slot, const unsigned int type, const size_t size);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the frame arrived on, with its lock held
+ * const unsigned char *frame - The frame payload
+ * const uint32_t slot - The channel the frame is for
+ * const unsigned int type - The frame type
+ * const size_t size - The payload size
+ *
+ * RETURNS:
+ * void
+ */
+static void handle_frame(struct tunnel_link *link, const unsigned char *frame, const uint32_t slot, const unsigned int type, const size_t size) {
+    if (type == TUNNEL_OPEN) {
+        if (link->edge || (slot < link->channelUsed && (link->channels[slot].flags & CHANNEL_ACTIVE))) {
+            fprintf(stderr, "Unexpected tunnel open, dropping link\n");
+            link_down(link);
+            return;
+        }
+        struct tunnel_channel *channel = claim_slot(link, slot);
+        struct rule *rule = lookupRule(link->rule);
+        if ((channel->sock = startConnection(rule->address, resolve_rule(rule), rule->sources)) == -1) {
+            channel->flags |= CHANNEL_SENT_CLOSE;
+            send_frame(link, slot, TUNNEL_CLOSE, NULL, 0);
+            return;
+        }
+        channel->flags |= CHANNEL_CONNECTING;
+        setNoDelay(channel->sock);
+        register_channel(link, slot, EPOLLIN | EPOLLOUT | EPOLLET);
+        return;
+    }
+
+    if (slot >= link->channelUsed || !(link->channels[slot].flags & CHANNEL_ACTIVE)) {
+        //Frames for a channel both ends have closed can't be sent, anything else is a broken peer
+        fprintf(stderr, "Tunnel frame for unknown channel %u, dropping link\n", slot);
+        link_down(link);
+        return;
+    }
+    struct tunnel_channel *channel = &link->channels[slot];
+
+    switch (type) {
+        case TUNNEL_DATA:
+            if (channel->pendingSize + size > TUNNEL_WINDOW) {
+                fprintf(stderr, "Tunnel peer overran its window, dropping link\n");
+                link_down(link);
+                return;
+            }
+            deliver_channel(link, slot, frame, size);
+            break;
+        case TUNNEL_WINDOW_UPDATE:
+            if (size == sizeof(uint32_t)) {
+                uint32_t grant;
+                memcpy(&grant, frame, sizeof(grant));
+                channel->credit += be32toh(grant);
+                if ((channel->flags & CHANNEL_READABLE) && !link->congested) {
+                    pump_channel(link, slot);
+                }
+            }
+            break;
+        case TUNNEL_CLOSE:
+            channel->flags |= CHANNEL_GOT_CLOSE;
+            if (channel->pendingSize == 0 || channel->sock == -1) {
+                close_channel(link, slot);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * FUNCTION: send_frame
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void send_frame(struct tunnel_link *link, const uint32_t slot, const unsigned int type, const void *payload, const size_t size);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link to queue the frame on, with its lock held
+ * const uint32_t slot - The channel the frame is for
+ * const unsigned int type - The frame type
+ * const void *payload - The frame payload, may be NULL if size is 0
+ * const size_t size - The payload size
+ *
+ * RETURNS:
+ * void
+ */
+static void send_frame(struct tunnel_link *link, const uint32_t slot, const unsigned int type, const void *payload, const size_t size) {
+    unsigned char *frame = reserve_buffer(&link->out, &link->outMax, link->outSize, TUNNEL_HEADER_SIZE + size);
+    const uint32_t id = htobe32(slot);
+    const uint16_t length = htobe16(size);
+    memcpy(frame, &id, sizeof(id));
+    frame[4] = type;
+    frame[5] = 0;
+    memcpy(frame + 6, &length, sizeof(length));
+    if (size) {
+        memcpy(frame + TUNNEL_HEADER_SIZE, payload, size);
+    }
+    link->outSize += TUNNEL_HEADER_SIZE + size;
+}
+
+/*
+ * FUNCTION: reserve_buffer
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static unsigned char *reserve_buffer(unsigned char **buffer, size_t *max, const size_t used, const size_t size);
+ *
+ * PARAMETERS:
+ * unsigned char **buffer - One of a link's output buffers
+ * size_t *max - The buffer's allocated size
+ * const size_t used - How much of the buffer is already queued
+ * const size_t size - How many bytes are about to be queued
+ *
+ * RETURNS:
+ * unsigned char * - Where the bytes should be written, the caller adds them to its size
+ */
+static unsigned char *reserve_buffer(unsigned char **buffer, size_t *max, const size_t used, const size_t size) {
+    if (*max - used < size) {
+        while (*max - used < size) {
+            *max = (*max) ? *max * 2 : TUNNEL_OUT_LOW;
+        }
+        *buffer = checked_realloc(*buffer, *max);
+    }
+    return *buffer + used;
+}
+
+/*
+ * FUNCTION: claim_slot
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static struct tunnel_channel *claim_slot(struct tunnel_link *link, const uint32_t slot);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link to open the channel on, with its lock held
+ * const uint32_t slot - The free slot to use, either the free list head or the first unused slot on the edge
+ *
+ * RETURNS:
+ * struct tunnel_channel * - The channel, with no socket yet
+ *
+ * NOTES:
+ * The peer uses whichever slot the edge picked, so it unlinks that slot from wherever it is in its own free list.
+ */
+static struct tunnel_channel *claim_slot(struct tunnel_link *link, const uint32_t slot) {
+    if (slot >= link->channelMax) {
+        uint32_t size = (link->channelMax) ? link->channelMax : 64;
+        while (size <= slot) {
+            size *= 2;
+        }
+        link->channels = checked_realloc(link->channels, sizeof(struct tunnel_channel) * size);
+        memset(link->channels + link->channelMax, 0, sizeof(struct tunnel_channel) * (size - link->channelMax));
+        link->channelMax = size;
+    }
+    while (link->channelUsed <= slot) {
+        //Unused slots in between go on the free list so the edge can reuse them later
+        struct tunnel_channel *unused = &link->channels[link->channelUsed];
+        unused->sock = -1;
+        unused->next_free = link->freeHead;
+        link->freeHead = link->channelUsed++;
+    }
+
+    if (link->freeHead == slot) {
+        link->freeHead = link->channels[slot].next_free;
+    } else {
+        for (uint32_t prev = link->freeHead; prev != CLIENT_NONE; prev = link->channels[prev].next_free) {
+            if (link->channels[prev].next_free == slot) {
+                link->channels[prev].next_free = link->channels[slot].next_free;
+                break;
+            }
+        }
+    }
+
+    struct tunnel_channel *channel = &link->channels[slot];
+    channel->sock = -1;
+    channel->flags = CHANNEL_ACTIVE;
+    channel->credit = TUNNEL_WINDOW;
+    channel->delivered = 0;
+    channel->pendingSize = 0;
+    channel->next_free = CLIENT_NONE;
+    return channel;
+}
+
+/*
+ * FUNCTION: register_channel
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void register_channel(struct tunnel_link *link, const uint32_t slot, const uint32_t events);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the channel is on, with its lock held
+ * const uint32_t slot - The channel whose socket should be added to epoll
+ * const uint32_t events - The events to wait for
+ *
+ * RETURNS:
+ * void
+ */
+static void register_channel(struct tunnel_link *link, const uint32_t slot, const uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t) (link->channels[slot].generation & TUNNEL_GEN_MASK) << TUNNEL_GEN_SHIFT) + ((uint64_t) slot << TUNNEL_SLOT_SHIFT)
+        + ((uint64_t) link->index << TUNNEL_LINK_SHIFT) + EV_TUNNEL_BIT;
+    addEpollSocket(efd, link->channels[slot].sock, &ev);
+}
+
+/*
+ * FUNCTION: pump_channel
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void pump_channel(struct tunnel_link *link, const uint32_t slot);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the channel is on, with its lock held
+ * const uint32_t slot - The channel to read from
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Reads straight into the link's output buffer behind a frame header, so data is only copied out of the kernel once.
+ * Stops early when the channel is out of credit or the link is congested, and remembers the channel still has input,
+ * since edge triggered epoll won't report it again.
+ */
+static void pump_channel(struct tunnel_link *link, const uint32_t slot) {
+    struct tunnel_channel *channel = &link->channels[slot];
+    if (channel->sock == -1 || (channel->flags & (CHANNEL_CONNECTING | CHANNEL_SENT_CLOSE))) {
+        return;
+    }
+    channel->flags &= ~CHANNEL_READABLE;
+    for (;;) {
+        if (channel->credit == 0 || link->congested) {
+            channel->flags |= CHANNEL_READABLE;
+            return;
+        }
+        const size_t want = (channel->credit < TUNNEL_FRAME_MAX) ? channel->credit : TUNNEL_FRAME_MAX;
+        unsigned char *frame = reserve_buffer(&link->out, &link->outMax, link->outSize, TUNNEL_HEADER_SIZE + want);
+        const ssize_t n = read(channel->sock, frame + TUNNEL_HEADER_SIZE, want);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                close_channel(link, slot);
+            }
+            return;
+        }
+        if (n == 0) {
+            close_channel(link, slot);
+            return;
+        }
+        const uint32_t id = htobe32(slot);
+        const uint16_t length = htobe16(n);
+        memcpy(frame, &id, sizeof(id));
+        frame[4] = TUNNEL_DATA;
+        frame[5] = 0;
+        memcpy(frame + 6, &length, sizeof(length));
+        link->outSize += TUNNEL_HEADER_SIZE + n;
+        channel->credit -= n;
+        if (link->outSize + link->wireSize >= TUNNEL_OUT_HIGH) {
+            link->congested = true;
+        }
+    }
+}
+
+/*
+ * FUNCTION: deliver_channel
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void deliver_channel(struct tunnel_link *link, const uint32_t slot, const unsigned char *data, const size_t size);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the data arrived on, with its lock held
+ * const uint32_t slot - The channel the data is for
+ * const unsigned char *data - The frame payload
+ * const size_t size - The payload size
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Whatever the socket won't take right now is parked on the channel, which the window keeps bounded.
+ */
+static void deliver_channel(struct tunnel_link *link, const uint32_t slot, const unsigned char *data, const size_t size) {
+    struct tunnel_channel *channel = &link->channels[slot];
+    if (channel->sock == -1) {
+        //Channel already closed on this end, its close frame is on the way
+        return;
+    }
+    size_t written = 0;
+    if (channel->pendingSize == 0 && !(channel->flags & CHANNEL_CONNECTING)) {
+        while (written < size) {
+            const ssize_t n = write(channel->sock, data + written, size - written);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN) {
+                    close_channel(link, slot);
+                    return;
+                }
+                break;
+            }
+            written += n;
+        }
+        grant_window(link, slot, written);
+    }
+    if (written < size) {
+        if (channel->pending == NULL) {
+            channel->pending = checked_malloc(TUNNEL_WINDOW);
+        }
+        memcpy(channel->pending + channel->pendingSize, data + written, size - written);
+        channel->pendingSize += size - written;
+    }
+}
+
+/*
+ * FUNCTION: drain_channel
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void drain_channel(struct tunnel_link *link, const uint32_t slot);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the channel is on, with its lock held
+ * const uint32_t slot - The channel whose socket became writable
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * The first writable event on the peer end also completes the connection to the backend.
+ */
+static void drain_channel(struct tunnel_link *link, const uint32_t slot) {
+    struct tunnel_channel *channel = &link->channels[slot];
+    if (channel->flags & CHANNEL_CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(channel->sock, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error) {
+            debug_print("Tunnel backend connect failed: %s\n", strerror(error));
+            close_channel(link, slot);
+            return;
+        }
+        channel->flags &= ~CHANNEL_CONNECTING;
+        //Client data may have arrived while connecting
+        pump_channel(link, slot);
+        if (channel->sock == -1) {
+            return;
+        }
+    }
+
+    size_t written = 0;
+    while (written < channel->pendingSize) {
+        const ssize_t n = write(channel->sock, channel->pending + written, channel->pendingSize - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                close_channel(link, slot);
+                return;
+            }
+            break;
+        }
+        written += n;
+    }
+    if (written) {
+        memmove(channel->pending, channel->pending + written, channel->pendingSize - written);
+        channel->pendingSize -= written;
+        grant_window(link, slot, written);
+    }
+    if (channel->pendingSize == 0) {
+        free(channel->pending);
+        channel->pending = NULL;
+        if (channel->flags & CHANNEL_GOT_CLOSE) {
+            close_channel(link, slot);
+        }
+    }
+}
+
+/*
+ * FUNCTION: grant_window
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void grant_window(struct tunnel_link *link, const uint32_t slot, const size_t delivered);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the channel is on, with its lock held
+ * const uint32_t slot - The channel that delivered data
+ * const size_t delivered - How many bytes were just written to the channel's socket
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Grants are batched to a quarter of the window so small writes don't each cost a frame.
+ */
+static void grant_window(struct tunnel_link *link, const uint32_t slot, const size_t delivered) {
+    struct tunnel_channel *channel = &link->channels[slot];
+    channel->delivered += delivered;
+    if (channel->delivered >= TUNNEL_WINDOW / 4 && !(channel->flags & CHANNEL_GOT_CLOSE)) {
+        const uint32_t grant = htobe32(channel->delivered);
+        send_frame(link, slot, TUNNEL_WINDOW_UPDATE, &grant, sizeof(grant));
+        channel->delivered = 0;
+    }
+}
+
+/*
+ * FUNCTION: close_channel
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void close_channel(struct tunnel_link *link, const uint32_t slot);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the channel is on, with its lock held
+ * const uint32_t slot - The channel that is done on this end
+ *
+ * RETURNS:
+ * void
+ *
+ * NOTES:
+ * Closes this end's socket and tells the other end, the slot is released once both ends have done so.
+ */
+static void close_channel(struct tunnel_link *link, const uint32_t slot) {
+    struct tunnel_channel *channel = &link->channels[slot];
+    if (channel->sock != -1) {
+        close(channel->sock);
+        channel->sock = -1;
+    }
+    free(channel->pending);
+    channel->pending = NULL;
+    channel->pendingSize = 0;
+    channel->flags &= ~(CHANNEL_READABLE | CHANNEL_CONNECTING);
+
+    if (!(channel->flags & CHANNEL_SENT_CLOSE)) {
+        channel->flags |= CHANNEL_SENT_CLOSE;
+        send_frame(link, slot, TUNNEL_CLOSE, NULL, 0);
+    }
+    if (channel->flags & CHANNEL_GOT_CLOSE) {
+        release_slot(link, slot);
+    }
+}
+
+/*
+ * FUNCTION: release_slot
+ *
+ * DATE:
+ * October 18 2026
+ *
+ * DESIGNER:
+ * John Agapeyev
+ *
+ * PROGRAMMER:
+ * John Agapeyev
+ *
+ * INTERFACE:
+ * static void release_slot(struct tunnel_link *link, const uint32_t slot);
+ *
+ * PARAMETERS:
+ * struct tunnel_link *link - The link the channel is on, with its lock held
+ * const uint32_t slot - The channel both ends have closed
+ *
+ * RETURNS:
+ * void
+ */
+static void release_slot(struct tunnel_link *link, const uint32_t slot) {
+    struct tunnel_channel *channel = &link->channels[slot];
+    channel->flags = 0;
+    ++channel->generation;
+    channel->next_free = link->freeHead;
+    link->freeHead = slot;
+}
@@ -0,0 +1,72 @@
+/*
+ * HEADER FILE: tunnel.h - Multiplexed tunnel links between forwarder instances
+ *
+ * PROGRAM: 8005-ass3
+ *
+ * DATE: October 18 2026
+ *
+ * FUNCTIONS:
+ * void tunnel_add_pool(const uint32_t rule);
+ * void tunnel_start(void);
+ * void tunnel_open_channel(const int sock, const uint32_t rule);
+ * void tunnel_accept_link(const int sock, const uint32_t rule);
+ * void tunnel_event(const uint64_t data, const uint32_t events);
+ * void tunnel_cleanup(void);
+ *
+ * DESIGNER: John Agapeyev
+ *
+ * PROGRAMMER: John Agapeyev
+ */
+#ifndef TUNNEL_H
+#define TUNNEL_H
+
+#include <stdint.h>
+
+//Prefix for a tunnel output address on the edge, and for a tunnel listener on the peer
+#define TUNNEL_PREFIX "tunnel:"
+
+//Links opened to the peer for every edge rule, unless overridden by the tunnel_links setting
+#define TUNNEL_LINKS_DEFAULT 4
+#define TUNNEL_POOL_MAX 64
+
+#define TUNNEL_MAX_LINKS 4096
+#define TUNNEL_MAX_CHANNELS 65536
+
+//Bytes either end may send on a channel before the other grants more, so one stalled channel can't block its link
+#define TUNNEL_WINDOW 262144
+
+//Largest payload carried by a single frame
+#define TUNNEL_FRAME_MAX 16384
+#define TUNNEL_HEADER_SIZE 8u
+
+//Channels stop reading once this much is queued for a link, and resume once it falls below the low mark
+#define TUNNEL_OUT_HIGH (1ul << 20)
+#define TUNNEL_OUT_LOW (1ul << 18)
+
+#define TUNNEL_IN_SIZE (1ul << 18)
+
+//Frame types
+#define TUNNEL_OPEN 1
+#define TUNNEL_DATA 2
+#define TUNNEL_WINDOW_UPDATE 3
+#define TUNNEL_CLOSE 4
+
+/*
+ * Epoll data layout for tunnel sockets, tagged with EV_TUNNEL_BIT.
+ * The direction bit marks the link socket itself, otherwise the event belongs to a channel's socket.
+ */
+#define TUNNEL_LINK_SHIFT 8
+#define TUNNEL_LINK_MASK 0xfffu
+#define TUNNEL_SLOT_SHIFT 20
+#define TUNNEL_SLOT_MASK 0xffffu
+#define TUNNEL_GEN_SHIFT 36
+#define TUNNEL_GEN_MASK 0xfffffffu
+
+void tunnel_add_pool(const uint32_t rule);
+void tunnel_start(void);
+void tunnel_open_channel(const int sock, const uint32_t rule);
+void tunnel_accept_link(const int sock, const uint32_t rule);
+void tunnel_event(const uint64_t data, const uint32_t events);
+void tunnel_cleanup(void);
+
+#endif